@@ -0,0 +1,284 @@
+//
+//  dns_txt.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  This module queries DNS TXT records with a single UDP request, e.g. to
+//  learn about new firmware versions without opening a TLS connection.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "esp_system.h"
+#include "esp_log.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "lwip/sockets.h"
+#include "lwip/dns.h"
+
+#include "dns_txt.h"
+
+
+#define TAG "dns_txt"
+
+#define DNS_TXT_SERVER_PORT 53
+#define DNS_TXT_HEADER_LEN  12
+#define DNS_TXT_MAX_LABEL_LEN 63
+
+#define DNS_TXT_TYPE_TXT    16
+#define DNS_TXT_CLASS_IN    1
+
+// Flags in the message header.
+#define DNS_TXT_FLAG_QR     0x8000 // response
+#define DNS_TXT_FLAG_TC     0x0200 // truncated
+#define DNS_TXT_FLAG_RD     0x0100 // recursion desired
+#define DNS_TXT_RCODE_MASK  0x000f
+
+
+static int dns_txt_build_query(uint8_t *msg, uint16_t id, const char *name);
+static int dns_txt_parse_response(const uint8_t *msg, int len, char *txt, size_t txtLen);
+static int dns_txt_skip_name(const uint8_t *msg, int len, int pos);
+static uint16_t dns_txt_get_u16(const uint8_t *bytes);
+
+
+int dns_txt_query(const char *name, const char *serverAddress, char *txt, size_t txtLen, uint32_t timeoutMs)
+{
+    struct sockaddr_in serverAddr;
+    memset(&serverAddr, 0, sizeof(serverAddr));
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(DNS_TXT_SERVER_PORT);
+    
+    if (serverAddress) {
+        serverAddr.sin_addr.s_addr = inet_addr(serverAddress);
+    } else {
+        ip_addr_t dnsServer = dns_getserver(0);
+        serverAddr.sin_addr.s_addr = ip4_addr_get_u32(ip_2_ip4(&dnsServer));
+    }
+    if (serverAddr.sin_addr.s_addr == 0 || serverAddr.sin_addr.s_addr == INADDR_NONE) {
+        ESP_LOGE(TAG, "dns_txt_query: no DNS server");
+        return -1;
+    }
+    
+    uint8_t *msg = malloc(DNS_TXT_MAX_MESSAGE_LEN);
+    if (!msg) {
+        ESP_LOGE(TAG, "dns_txt_query: out of memory");
+        return -1;
+    }
+    
+    uint16_t id = esp_random() & 0xffff;
+    int queryLen = dns_txt_build_query(msg, id, name);
+    if (queryLen < 0) {
+        ESP_LOGE(TAG, "dns_txt_query: invalid name '%s'", name);
+        free(msg);
+        return -1;
+    }
+    
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "dns_txt_query: failed to create socket (%d)", errno);
+        free(msg);
+        return -1;
+    }
+    
+    int result = -1;
+    if (sendto(fd, msg, queryLen, 0, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) != queryLen) {
+        ESP_LOGE(TAG, "dns_txt_query: failed to send the query (%d)", errno);
+        
+    } else {
+        TickType_t startTicks = xTaskGetTickCount();
+        while (1) {
+            uint32_t elapsedMillisec = (xTaskGetTickCount() - startTicks) * portTICK_PERIOD_MS;
+            if (elapsedMillisec >= timeoutMs) {
+                ESP_LOGW(TAG, "dns_txt_query: no answer within %d ms", timeoutMs);
+                break;
+            }
+            
+            uint32_t remainingMillisec = timeoutMs - elapsedMillisec;
+            fd_set readFds;
+            FD_ZERO(&readFds);
+            FD_SET(fd, &readFds);
+            struct timeval timeout;
+            timeout.tv_sec = remainingMillisec / 1000;
+            timeout.tv_usec = (remainingMillisec % 1000) * 1000;
+            
+            int ret = select(fd + 1, &readFds, NULL, NULL, &timeout);
+            if (ret < 0) {
+                ESP_LOGE(TAG, "dns_txt_query: select failed (%d)", errno);
+                break;
+            }
+            if (ret == 0) {
+                continue;
+            }
+            
+            struct sockaddr_in fromAddr;
+            socklen_t fromAddrLen = sizeof(fromAddr);
+            int len = recvfrom(fd, msg, DNS_TXT_MAX_MESSAGE_LEN, 0, (struct sockaddr *)&fromAddr, &fromAddrLen);
+            
+            // Ignore stray datagrams: only the server can answer, with the ID of our query.
+            if (len < DNS_TXT_HEADER_LEN || dns_txt_get_u16(msg) != id
+                || fromAddr.sin_addr.s_addr != serverAddr.sin_addr.s_addr || fromAddr.sin_port != serverAddr.sin_port)
+            {
+                ESP_LOGD(TAG, "dns_txt_query: ignoring unexpected datagram");
+                continue;
+            }
+            
+            result = dns_txt_parse_response(msg, len, txt, txtLen);
+            break;
+        }
+    }
+    
+    close(fd);
+    free(msg);
+    
+    if (result >= 0) {
+        ESP_LOGD(TAG, "dns_txt_query: %s TXT '%s'", name, txt);
+    }
+    return result;
+}
+
+static int dns_txt_build_query(uint8_t *msg, uint16_t id, const char *name)
+{
+    // Header: ID, flags, one question, no other records.
+    memset(msg, 0, DNS_TXT_HEADER_LEN);
+    msg[0] = id >> 8;
+    msg[1] = id & 0xff;
+    msg[2] = DNS_TXT_FLAG_RD >> 8;
+    msg[5] = 1;
+    
+    // Question: the name as a sequence of labels, each with a length byte.
+    int pos = DNS_TXT_HEADER_LEN;
+    const char *label = name;
+    while (*label) {
+        size_t labelLen = strcspn(label, ".");
+        if (labelLen == 0 || labelLen > DNS_TXT_MAX_LABEL_LEN || pos + 1 + labelLen + 5 > DNS_TXT_MAX_MESSAGE_LEN) {
+            return -1;
+        }
+        msg[pos++] = labelLen;
+        memcpy(&msg[pos], label, labelLen);
+        pos += labelLen;
+        label += labelLen;
+        if (*label == '.') {
+            label++;
+        }
+    }
+    if (pos == DNS_TXT_HEADER_LEN) {
+        return -1;
+    }
+    
+    msg[pos++] = 0;
+    msg[pos++] = 0;
+    msg[pos++] = DNS_TXT_TYPE_TXT;
+    msg[pos++] = 0;
+    msg[pos++] = DNS_TXT_CLASS_IN;
+    
+    return pos;
+}
+
+static int dns_txt_parse_response(const uint8_t *msg, int len, char *txt, size_t txtLen)
+{
+    uint16_t flags = dns_txt_get_u16(&msg[2]);
+    if (!(flags & DNS_TXT_FLAG_QR) || (flags & DNS_TXT_FLAG_TC) || (flags & DNS_TXT_RCODE_MASK)) {
+        ESP_LOGW(TAG, "dns_txt_parse_response: no answer (flags 0x%04x)", flags);
+        return -1;
+    }
+    
+    int nofQuestions = dns_txt_get_u16(&msg[4]);
+    int nofAnswers = dns_txt_get_u16(&msg[6]);
+    int pos = DNS_TXT_HEADER_LEN;
+    
+    for (int i = 0; i < nofQuestions; i++) {
+        pos = dns_txt_skip_name(msg, len, pos);
+        if (pos < 0 || pos + 4 > len) {
+            return -1;
+        }
+        pos += 4;
+    }
+    
+    // Resource records: name, type, class, TTL, data length and data.
+    // The TXT record may be preceded by CNAME records.
+    for (int i = 0; i < nofAnswers; i++) {
+        pos = dns_txt_skip_name(msg, len, pos);
+        if (pos < 0 || pos + 10 > len) {
+            return -1;
+        }
+        uint16_t type = dns_txt_get_u16(&msg[pos]);
+        uint16_t class = dns_txt_get_u16(&msg[pos + 2]);
+        int dataLen = dns_txt_get_u16(&msg[pos + 8]);
+        pos += 10;
+        if (pos + dataLen > len) {
+            return -1;
+        }
+        
+        if (type == DNS_TXT_TYPE_TXT && class == DNS_TXT_CLASS_IN) {
+            // The data consists of character strings, each with a length byte.
+            int end = pos + dataLen;
+            size_t txtCount = 0;
+            while (pos < end) {
+                int strLen = msg[pos++];
+                if (pos + strLen > end || txtCount + strLen >= txtLen) {
+                    ESP_LOGW(TAG, "dns_txt_parse_response: invalid or too long TXT record");
+                    return -1;
+                }
+                memcpy(&txt[txtCount], &msg[pos], strLen);
+                txtCount += strLen;
+                pos += strLen;
+            }
+            txt[txtCount] = 0x00;
+            return txtCount;
+        }
+        
+        pos += dataLen;
+    }
+    
+    ESP_LOGW(TAG, "dns_txt_parse_response: no TXT record in the answer");
+    return -1;
+}
+
+// Returns the position after the name, or -1 if the name is invalid.
+static int dns_txt_skip_name(const uint8_t *msg, int len, int pos)
+{
+    while (pos < len) {
+        uint8_t labelLen = msg[pos];
+        if (labelLen == 0) {
+            return pos + 1;
+        }
+        // A compression pointer (two bytes) ends the name.
+        if ((labelLen & 0xc0) == 0xc0) {
+            return pos + 2 <= len ? pos + 2 : -1;
+        }
+        if (labelLen > DNS_TXT_MAX_LABEL_LEN) {
+            return -1;
+        }
+        pos += 1 + labelLen;
+    }
+    return -1;
+}
+
+static uint16_t dns_txt_get_u16(const uint8_t *bytes)
+{
+    return (bytes[0] << 8) | bytes[1];
+}
@@ -0,0 +1,49 @@
+//
+//  dns_txt.h
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  This module queries DNS TXT records with a single UDP request, e.g. to
+//  learn about new firmware versions without opening a TLS connection.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __DNS_TXT__
+#define __DNS_TXT__ 1
+
+
+// Maximum size of a DNS message over UDP (without EDNS).
+#define DNS_TXT_MAX_MESSAGE_LEN 512
+
+
+// Query the TXT record of 'name' (e.g. "_ota.example.com") from the DNS server
+// with the specified IPv4 address (e.g. "192.168.1.1"), or from the DNS server
+// configured by DHCP if NULL.
+// The character strings of the first TXT record in the answer are concatenated
+// and copied to 'txt', which has a size of 'txtLen' (zero-terminated).
+// Returns the length of the text, or -1 if there's no valid answer within 'timeoutMs'.
+// Records which don't fit are treated as invalid.
+int dns_txt_query(const char *name, const char *serverAddress, char *txt, size_t txtLen, uint32_t timeoutMs);
+
+
+#endif // __DNS_TXT__
@@ -5,7 +5,7 @@
 //  Updating the firmware over the air.
 //
 //  This module provides functions to execute HTTPS requests on an
-//  existing TLS TCP connection.
+//  existing connection, provided through the https_transport interface.
 //
 //  Created by Andreas Schweizer on 19.01.2017.
 //  Copyright © 2017 Classy Code GmbH
@@ -31,14 +31,32 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
 #include "esp_log.h"
 
-#include "wifi_tls.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "https_transport.h"
 #include "https_client.h"
 
 
 #define TAG "httpscl"
 
+// Maximum time to wait for more data from the server.
+#define HTTPS_READ_TIMEOUT_MS 30000
+
+// While waiting for data, the cancellation flag of the request is checked this often.
+#define HTTPS_CANCEL_CHECK_MS 100
+
+// With a rate limit, up to this fraction of a second's worth of data is read at once.
+#define HTTPS_THROTTLE_BURST_DIVIDER 4
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
 
 // This object lives on the heap and is passed around in callbacks etc.
 // It contains the state for a single HTTP request.
@@ -57,119 +75,219 @@ typedef struct http_request_context_ {
     size_t content_length;
     int is_processing_headers;
     
+    // Set after the message body has been received completely.
+    int is_body_complete;
+    
+    // The server announced that it closes the connection after the response.
+    int is_connection_close;
+    
     char *tls_request_buffer;
     size_t tls_request_buffer_size;
     
-    char *tls_response_buffer;
-    size_t tls_response_buffer_size;
-    
+    // Token bucket of the rate limit: number of bytes which may be read,
+    // last updated at throttle_ticks.
+    uint32_t throttle_tokens;
+    TickType_t throttle_ticks;
+
 } http_request_context_t;
 
 
-static const char *http_get_request_format_string = "GET %s HTTP/1.1\r\nHost: %s\r\n\r\n";
+static const char *http_get_request_format_string = "GET %s HTTP/1.1\r\nHost: %s\r\n%s\r\n";
 static uint32_t request_nr;
 
 
-static int https_tls_callback(struct wifi_tls_context_ *context, struct wifi_tls_request_ *request, int index, size_t len);
+static int https_tls_callback(http_request_context_t *httpContext, int index, size_t len);
+static int https_write_request(struct https_transport_ *transport, http_request_context_t *httpContext);
+static http_err_t https_connection_lost(http_request_context_t *httpContext, int callbackIndex);
+static const char *https_find_header(const char *headers, const char *name);
+static int https_parse_max_age(const char *cacheControl);
+static size_t https_throttle(http_request_context_t *httpContext, size_t len);
 
 static http_err_t https_validate_request(http_request_t *httpRequest);
 static http_err_t https_create_context_for_request(http_request_context_t **httpContext, http_request_t *httpRequest);
 static void https_destroy_context(http_request_context_t *httpContext);
 
 
-// Send the specified HTTP request on the (connected and verified) tlsContext.
-http_err_t https_send_request(struct wifi_tls_context_ *tlsContext, http_request_t *httpRequest)
+// Send the specified HTTP request on the (connected and verified) transport.
+http_err_t https_send_request(struct https_transport_ *transport, http_request_t *httpRequest)
 {
     // Validate the input.
     
-    if (!tlsContext) {
-        ESP_LOGE(TAG, "https_send_request: tlsContext missing");
+    if (!transport || !transport->write || !transport->read || !transport->close) {
+        ESP_LOGE(TAG, "https_send_request: transport missing");
         return HTTP_ERR_INVALID_ARGS;
     }
     
     http_err_t result = https_validate_request(httpRequest);
     if (result != HTTP_SUCCESS) {
+        transport->close(transport->context);
+        httpRequest->keep_alive = 0;
         return result;
     }
 
 
     // Create the HTTP context.
-
+    
     // This object lives on the heap and is passed around in callbacks etc.
     // It contains the state for a single HTTP request.
-
+    
     http_request_context_t *httpContext;
     result = https_create_context_for_request(&httpContext, httpRequest);
     if (result != HTTP_SUCCESS) {
+        transport->close(transport->context);
+        httpRequest->keep_alive = 0;
         return result;
     }
 
 
-    // Create the TLS context.
-    
-    wifi_tls_request_t tlsRequest;
+    // Submit the request.
     
-    tlsRequest.custom_data = httpContext;
+    if (https_write_request(transport, httpContext)) {
+        ESP_LOGE(TAG, "https_send_request: failed to send HTTP request %d", httpContext->request_id);
+        transport->close(transport->context);
+        httpRequest->keep_alive = 0;
+        https_destroy_context(httpContext);
+        return HTTP_ERR_CONNECTION_CLOSED;
+    }
 
-    tlsRequest.request_len = httpContext->tls_request_buffer_size;
-    tlsRequest.request_buffer = httpContext->tls_request_buffer;
-    
-    tlsRequest.response_buffer_size = httpContext->tls_response_buffer_size;
-    tlsRequest.response_buffer = httpContext->tls_response_buffer;
-    
-    tlsRequest.response_callback = &https_tls_callback;
 
+    // Read the response and pass it on until the parser doesn't want any more data.
+    // The data is read directly into the response buffer, behind the data which hasn't
+    // been processed yet. One byte is reserved for the terminating zero.
     
-    // Submit the TLS request.
+    httpContext->is_processing_headers = 1;
+    httpRequest->response_buffer[0] = 0x00;
+    httpRequest->retry_after_s = -1;
+    httpRequest->max_age_s = -1;
     
-    int tlsResult = wifi_tls_send_request(tlsContext, &tlsRequest);
+    int callbackIndex = 0;
+    while (1) {
+        
+        size_t spaceRemaining = httpRequest->response_buffer_len - httpContext->response_buffer_count - 1;
+        if (spaceRemaining == 0) {
+            ESP_LOGE(TAG, "https_send_request: response buffer overflow (%d bytes)", httpRequest->response_buffer_len);
+            httpRequest->error_callback(httpRequest, HTTP_ERR_BUFFER_TOO_SMALL, 0);
+            result = HTTP_ERR_BUFFER_TOO_SMALL;
+            break;
+        }
+        
+        if (transport->wait_readable) {
+            uint32_t timeoutMillisec = httpRequest->read_timeout_ms ? httpRequest->read_timeout_ms : HTTPS_READ_TIMEOUT_MS;
+            int ready = 0;
+            for (uint32_t waitedMillisec = 0; waitedMillisec < timeoutMillisec && !httpRequest->is_cancelled; ) {
+                uint32_t sliceMillisec = MIN(timeoutMillisec - waitedMillisec, HTTPS_CANCEL_CHECK_MS);
+                ready = transport->wait_readable(transport->context, sliceMillisec);
+                if (ready != 0) {
+                    break;
+                }
+                waitedMillisec += sliceMillisec;
+            }
+            if (httpRequest->is_cancelled) {
+                ESP_LOGD(TAG, "https_send_request: request cancelled");
+                result = HTTP_ERR_CANCELLED;
+                break;
+            }
+            if (ready == 0) {
+                ESP_LOGE(TAG, "https_send_request: no data received within %d ms", timeoutMillisec);
+                httpRequest->error_callback(httpRequest, HTTP_ERR_READ_TIMEOUT, 0);
+                result = HTTP_ERR_READ_TIMEOUT;
+                break;
+            }
+            if (ready < 0) {
+                result = https_connection_lost(httpContext, callbackIndex);
+                break;
+            }
+        }
+        
+        char *readBuffer = &httpRequest->response_buffer[httpContext->response_buffer_count];
+        int ret = transport->read(transport->context, readBuffer, https_throttle(httpContext, spaceRemaining));
+        if (ret <= 0) {
+            ESP_LOGD(TAG, "https_send_request: %s", ret == 0 ? "EOF" : "read failed");
+            result = https_connection_lost(httpContext, callbackIndex);
+            break;
+        }
+        
+        ESP_LOGD(TAG, "https_send_request: partial read: %d bytes read", ret);
+        httpContext->throttle_tokens -= MIN((uint32_t)ret, httpContext->throttle_tokens);
+        if (!https_tls_callback(httpContext, callbackIndex, ret)) {
+            break;
+        }
+        callbackIndex++;
+    }
 
 
     // Cleanup.
-
-    if (tlsResult == 0) {
+    
+    // The connection can only be re-used if nothing of this response is left unread.
+    if (!httpRequest->keep_alive || result != HTTP_SUCCESS
+        || !httpContext->is_body_complete || httpContext->is_connection_close)
+    {
+        transport->close(transport->context);
+        httpRequest->keep_alive = 0;
+    }
+    
+    if (result == HTTP_SUCCESS) {
         ESP_LOGD(TAG, "https_send_request: successfully completed HTTP request %d to the server: %s",
-                 httpContext->request_id, tlsRequest.request_buffer);
-
-        https_destroy_context(httpContext);
-        return HTTP_SUCCESS;
+                 httpContext->request_id, httpContext->tls_request_buffer);
+    } else {
+        ESP_LOGE(TAG, "https_send_request: failed to complete HTTP request %d (%d)",
+                 httpContext->request_id, result);
     }
     
-    ESP_LOGE(TAG, "https_send_request: failed to complete HTTP request %d (wifi_tls_send_request returned %d)",
-             httpContext->request_id, tlsResult);
-
     https_destroy_context(httpContext);
-    return HTTP_ERR_SEND_FAILED;
+    return result;
 }
 
-static int https_tls_callback(struct wifi_tls_context_ *context, struct wifi_tls_request_ *request, int index, size_t len)
+// The connection was closed or failed while waiting for the response. Before
+// any data, the request can be repeated (e.g. on a new connection); after
+// that, the response is incomplete, which is reported to the application.
+static http_err_t https_connection_lost(http_request_context_t *httpContext, int callbackIndex)
 {
-    http_request_context_t *httpContext = (http_request_context_t*)request->custom_data;
-    ESP_LOGD(TAG, "https_tls_callback: request_id = %d", httpContext->request_id);
-
-    http_request_t *httpRequest = httpContext->request;
-
-    // First packet resets the state
-    if (index == 0) {
-        httpContext->response_buffer_count = 0;
-        httpContext->response_body_total_count = 0;
-        httpContext->content_length = 0;
-        httpContext->is_processing_headers = 1;
-        bzero(httpRequest->response_buffer, httpRequest->response_buffer_len);
+    if (callbackIndex == 0) {
+        return HTTP_ERR_CONNECTION_CLOSED;
+    }
+    
+    // While waiting for the complete body, the received part is still in the buffer.
+    size_t bodyCount = 0;
+    if (!httpContext->is_processing_headers) {
+        bodyCount = httpContext->request->response_mode == HTTP_WAIT_FOR_COMPLETE_BODY
+            ? httpContext->response_buffer_count : httpContext->response_body_total_count;
     }
     
-    // If the received data would overflow our buffer, we simply stop processing the packet and drop it.
-    if (httpContext->response_buffer_count + len > httpRequest->response_buffer_len) {
-        ESP_LOGE(TAG, "https_tls_callback: packet buffer overflow (%d bytes), dropping the packet.", httpRequest->response_buffer_len + len);
-        httpRequest->error_callback(httpRequest, HTTP_ERR_BUFFER_TOO_SMALL, 0);
-        return 0; // Stop processing the packet.
+    ESP_LOGE(TAG, "https_connection_lost: response truncated after %d body bytes (Content-Length %d)",
+             bodyCount, httpContext->content_length);
+    httpContext->request->error_callback(httpContext->request, HTTP_ERR_RESPONSE_TRUNCATED, bodyCount);
+    return HTTP_ERR_RESPONSE_TRUNCATED;
+}
+
+static int https_write_request(struct https_transport_ *transport, http_request_context_t *httpContext)
+{
+    size_t lenRemaining = httpContext->tls_request_buffer_size;
+    const char *p = httpContext->tls_request_buffer;
+    
+    while (lenRemaining > 0) {
+        int ret = transport->write(transport->context, p, lenRemaining);
+        if (ret <= 0) {
+            return -1;
+        }
+        lenRemaining -= ret;
+        p += ret;
     }
     
-    // Accumulate the received data from the TLS buffer in the HTTP buffer.
-    memcpy(&httpRequest->response_buffer[httpContext->response_buffer_count], request->response_buffer, len);
+    return 0;
+}
+
+static int https_tls_callback(http_request_context_t *httpContext, int index, size_t len)
+{
+    ESP_LOGD(TAG, "https_tls_callback: request_id = %d", httpContext->request_id);
+    
+    http_request_t *httpRequest = httpContext->request;
+    
+    // The received data has been read directly into the response buffer (behind the
+    // data which is already there). Keep the buffer zero-terminated for the parsers.
+    size_t previousCount = httpContext->response_buffer_count;
     httpContext->response_buffer_count += len;
-    httpContext->response_body_total_count += len;
-    //httpRequest->response_buffer[httpContext->response_buffer_count] = 0x00;
+    httpRequest->response_buffer[httpContext->response_buffer_count] = 0x00;
     ESP_LOGD(TAG, "https_tls_callback: packet index=%d length=%d inHeaders=%d",
              index, httpContext->response_buffer_count, httpContext->is_processing_headers);
     
@@ -178,7 +296,9 @@ static int https_tls_callback(struct wifi_tls_context_ *context, struct wifi_tls
     if (httpContext->is_processing_headers) {
         
         // Wait with processing until all headers have been completely received.
-        char *endOfHeader = strstr(httpRequest->response_buffer, "\r\n\r\n");
+        // Only scan the new data (and the last 3 bytes before it, the end marker may be split).
+        size_t scanStart = previousCount > 3 ? previousCount - 3 : 0;
+        char *endOfHeader = strstr(&httpRequest->response_buffer[scanStart], "\r\n\r\n");
         if (!endOfHeader) {
             ESP_LOGD(TAG, "https_tls_callback: headers not yet complete, waiting for remaining header data.");
             return 1;
@@ -186,8 +306,6 @@ static int https_tls_callback(struct wifi_tls_context_ *context, struct wifi_tls
         
         // --- All headers received. ---
         
-        // TODO: use the headers callback!!!! handle missing Content-Length!!!
-        
         // The last received packet may contain data that belongs to the message body.
         // Make sure we don't process the message body data as part of the headers processing.
         uint32_t nofHeaderBytes = endOfHeader - &httpRequest->response_buffer[0] + 4;
@@ -200,7 +318,9 @@ static int https_tls_callback(struct wifi_tls_context_ *context, struct wifi_tls
         int httpVersionMajor = 0;
         int httpVersionMinor = 0;
         int httpStatusCode = 0;
-        if (3 != sscanf(httpRequest->response_buffer, "HTTP/%d.%d %d ", &httpVersionMajor, &httpVersionMinor, &httpStatusCode)) {
+        if (3 != sscanf(httpRequest->response_buffer, "HTTP/%d.%d %d ", &httpVersionMajor, &httpVersionMinor, &httpStatusCode)
+            || httpStatusCode < 100 || httpStatusCode > 599)
+        {
             ESP_LOGE(TAG, "https_tls_callback: invalid HTTP status line, dropping packet. '%s'", httpRequest->response_buffer);
             httpRequest->error_callback(httpRequest, HTTP_ERR_INVALID_STATUS_LINE, 0);
             return 0;
@@ -211,87 +331,201 @@ static int https_tls_callback(struct wifi_tls_context_ *context, struct wifi_tls
             httpRequest->error_callback(httpRequest, HTTP_ERR_VERSION_NOT_SUPPORTED, 0);
             return 0;
         }
-        if (httpStatusCode != 200) {
+        // Pacing requested by the server, also (and mainly) with error status codes.
+        const char *retryAfterValue = https_find_header(httpRequest->response_buffer, "Retry-After");
+        if (retryAfterValue && http_parse_int(retryAfterValue, &httpRequest->retry_after_s)) {
+            httpRequest->retry_after_s = -1;
+        }
+        const char *cacheControlValue = https_find_header(httpRequest->response_buffer, "Cache-Control");
+        if (cacheControlValue) {
+            httpRequest->max_age_s = https_parse_max_age(cacheControlValue);
+        }
+        
+        const char *connectionValue = https_find_header(httpRequest->response_buffer, "Connection");
+        if (connectionValue && !strncasecmp(connectionValue, "close", 5)) {
+            httpContext->is_connection_close = 1;
+        }
+        
+        // 206 (Partial Content) is the response to a Range request.
+        if (httpStatusCode != 200 && httpStatusCode != 206) {
+            // A 204 (No Content) response ends with the headers, so the connection can be re-used.
+            if (httpStatusCode == 204) {
+                ESP_LOGD(TAG, "https_tls_callback: HTTP status code 204 (No Content) received");
+                httpContext->is_body_complete = 1;
+                httpRequest->error_callback(httpRequest, HTTP_ERR_NON_200_STATUS_CODE, httpStatusCode);
+                return 0;
+            }
             ESP_LOGE(TAG, "https_tls_callback: non-200 HTTP status code received, dropping packet. '%s'", httpRequest->response_buffer);
             httpRequest->error_callback(httpRequest, HTTP_ERR_NON_200_STATUS_CODE, httpStatusCode);
             return 0;
         }
         
         // We're mainly interested in the content length.
-        // The server should either send the Content-Length header or should close the connection at the end.
+        // We need the Content-Length header to know where the message body ends.
         int contentLength = 0;
-        if (!http_parse_key_value_int(httpRequest->response_buffer, "Content-Length:", &contentLength)) {
+        const char *contentLengthValue = https_find_header(httpRequest->response_buffer, "Content-Length");
+        if (contentLengthValue && !http_parse_int(contentLengthValue, &contentLength) && contentLength >= 0) {
             ESP_LOGD(TAG, "Content-Length: %d", contentLength);
             httpContext->content_length = contentLength;
         } else {
-            ESP_LOGW(TAG, "Content length header missing, dropping the packet. '%s'", httpRequest->response_buffer);
-            // TODO error callback??
+            ESP_LOGW(TAG, "Content length header missing or invalid, dropping the packet. '%s'", httpRequest->response_buffer);
+            httpRequest->error_callback(httpRequest, HTTP_ERR_INVALID_CONTENT_LENGTH, 0);
+            return 0;
+        }
+        
+        // Let the application prepare for the message body (e.g. allocate buffers).
+        if (httpRequest->headers_callback
+            && httpRequest->headers_callback(httpRequest, httpStatusCode, contentLength) != HTTP_CONTINUE_RECEIVING)
+        {
             return 0;
         }
         
         // -----------------------------------------
         
-        // If the last received packet also contains message body data, we copy it to the beginning of the buffer.
+        // If the last received packet also contains message body data, we move it to the beginning of the buffer.
         httpContext->response_buffer_count -= nofHeaderBytes;
-        httpContext->response_body_total_count = httpContext->response_buffer_count; // Start counting bytes in the message body.
         if (httpContext->response_buffer_count > 0) {
-            ESP_LOGD(TAG, "https_tls_callback: last packet contains data of the message body; copying to the beginning, new length = %d", httpContext->response_buffer_count);
-            memcpy(httpRequest->response_buffer, &request->response_buffer[nofHeaderBytes], httpContext->response_buffer_count);
+            ESP_LOGD(TAG, "https_tls_callback: last packet contains data of the message body; moving to the beginning, new length = %d", httpContext->response_buffer_count);
+            memmove(httpRequest->response_buffer, &httpRequest->response_buffer[nofHeaderBytes], httpContext->response_buffer_count);
         }
         httpRequest->response_buffer[httpContext->response_buffer_count] = 0x00;
+        httpContext->response_body_total_count = 0; // Start counting bytes in the message body.
         
         // Continue with message body processing.
         httpContext->is_processing_headers = 0;
     }
     
-    if (httpContext->is_processing_headers) {
-        return 1;
-    }
-    
     // ---------- Message body processing ----------
     
-    if (httpRequest->response_mode == HTTP_WAIT_FOR_COMPLETE_BODY) {
+    // Ignore anything the server sends after the end of the message body.
+    size_t bodyRemaining = httpContext->content_length - httpContext->response_body_total_count;
+    if (httpContext->response_buffer_count > bodyRemaining) {
+        httpContext->response_buffer_count = bodyRemaining;
+        httpRequest->response_buffer[httpContext->response_buffer_count] = 0x00;
+    }
     
+    if (httpRequest->response_mode == HTTP_WAIT_FOR_COMPLETE_BODY) {
+        
         // Wait with processing until the message body has been completely received.
         if (httpContext->response_buffer_count < httpContext->content_length) {
             ESP_LOGD(TAG, "https_tls_callback: message body is not yet complete, waiting for remaining data (total = %d, received = %d).",
                      httpContext->content_length, httpContext->response_buffer_count);
             return 1;
         }
-    
+        
         ESP_LOGD(TAG, "https_tls_callback: message body has been completely received, starting processing");
+        httpContext->is_body_complete = 1;
         httpRequest->body_callback(httpRequest, httpContext->response_buffer_count);
-
+        
         return 0;
     }
     
     // Provide partial message body fragments to the callback function.
     
     if (httpContext->response_buffer_count > 0) {
+        httpContext->response_body_total_count += httpContext->response_buffer_count;
+        
         ESP_LOGD(TAG, "https_tls_callback: message body fragment received (%d bytes, total %d of %d bytes), forwarding to callback",
                  httpContext->response_buffer_count, httpContext->response_body_total_count, httpContext->content_length);
         
         http_continue_receiving_t cr = httpRequest->body_callback(httpRequest, httpContext->response_buffer_count);
-    
+        
         // The callback handler doesn't want to receive more packets.
         if (cr != HTTP_CONTINUE_RECEIVING) {
             return 0;
         }
         
-        // Don't read after the end.
-        if (httpContext->response_body_total_count >= httpContext->content_length) {
-            // Invoke the callback with length 0 to indicate that all data has been received.
-            httpRequest->body_callback(httpRequest, 0);
-            return 0;
-        }
-    
         // The next fragment should start at the beginning of the packet.
         httpContext->response_buffer_count = 0;
     }
     
+    // Don't read after the end.
+    if (httpContext->response_body_total_count >= httpContext->content_length) {
+        // Invoke the callback with length 0 to indicate that all data has been received.
+        httpContext->is_body_complete = 1;
+        httpRequest->body_callback(httpRequest, 0);
+        return 0;
+    }
+    
     return 1;
 }
 
+// Waits until the rate limit permits reading and returns the number of bytes
+// to read (at most 'len'). The caller consumes the tokens of the bytes actually read.
+static size_t https_throttle(http_request_context_t *httpContext, size_t len)
+{
+    while (1) {
+        uint32_t bytesPerSec = httpContext->request->max_bytes_per_s;
+        if (bytesPerSec == 0) {
+            return len;
+        }
+        
+        // Refill the bucket, up to the maximum burst size.
+        uint32_t burst = MAX(bytesPerSec / HTTPS_THROTTLE_BURST_DIVIDER, 1);
+        TickType_t now = xTaskGetTickCount();
+        uint64_t refill = (uint64_t)(now - httpContext->throttle_ticks) * bytesPerSec / configTICK_RATE_HZ;
+        if (httpContext->throttle_tokens + refill >= burst) {
+            httpContext->throttle_tokens = burst;
+            httpContext->throttle_ticks = now;
+        } else if (refill > 0) {
+            // Keep the fraction of a token which hasn't been added yet.
+            httpContext->throttle_tokens += refill;
+            httpContext->throttle_ticks += (TickType_t)(refill * configTICK_RATE_HZ / bytesPerSec);
+        }
+        
+        if (httpContext->throttle_tokens > 0) {
+            return MIN(len, httpContext->throttle_tokens);
+        }
+        
+        // Sleep until the next token is due (at least one tick).
+        vTaskDelay(MAX(configTICK_RATE_HZ / bytesPerSec, 1));
+    }
+}
+
+// Returns the value of the max-age directive, e.g. "public, max-age=300", or -1.
+static int https_parse_max_age(const char *cacheControl)
+{
+    // The header value ends at the end of the line.
+    const char *end = cacheControl + strcspn(cacheControl, "\r\n");
+    
+    for (const char *directive = cacheControl; directive + 8 <= end; directive++) {
+        if (!strncasecmp(directive, "max-age=", 8)) {
+            char *valueEnd;
+            errno = 0;
+            long v = strtol(directive + 8, &valueEnd, 10);
+            if (valueEnd == directive + 8 || errno == ERANGE || v < 0 || v > INT_MAX) {
+                return -1;
+            }
+            return (int)v;
+        }
+    }
+    
+    return -1;
+}
+
+int http_parse_int(const char *str, int *value)
+{
+    char *end;
+    errno = 0;
+    long v = strtol(str, &end, 10);
+    
+    // There needs to be at least one digit, and the value needs to fit.
+    if (end == str || errno == ERANGE || v < INT_MIN || v > INT_MAX) {
+        return -1;
+    }
+    
+    // Only trailing whitespace is allowed after the number.
+    while (*end == ' ' || *end == '\t') {
+        end++;
+    }
+    if (*end != 0x00 && *end != '\r' && *end != '\n') {
+        return -1;
+    }
+    
+    *value = (int)v;
+    return 0;
+}
+
 int http_parse_key_value_int(const char *buffer, const char *key, int *value)
 {
     const char *locKey = strstr(buffer, key);
@@ -300,12 +534,15 @@ int http_parse_key_value_int(const char *buffer, const char *key, int *value)
         return -1;
     }
     
-    *value = atoi(&locKey[strlen(key)]);
-    return 0;
+    return http_parse_int(&locKey[strlen(key)], value);
 }
 
 int http_parse_key_value_string(const char *buffer, const char *key, char *str, int strLen)
 {
+    if (strLen < 1) {
+        return -1;
+    }
+    
     const char *locKey = strstr(buffer, key);
     
     if (!locKey) {
@@ -326,6 +563,28 @@ int http_parse_key_value_string(const char *buffer, const char *key, char *str,
     return 0;
 }
 
+static const char *https_find_header(const char *headers, const char *name)
+{
+    // Header names are case-insensitive and start at the beginning of a line
+    // (the first line is the status line).
+    size_t nameLen = strlen(name);
+    const char *line = strstr(headers, "\r\n");
+    
+    while (line) {
+        line += 2;
+        if (!strncasecmp(line, name, nameLen) && line[nameLen] == ':') {
+            const char *value = &line[nameLen + 1];
+            while (*value == ' ' || *value == '\t') {
+                value++;
+            }
+            return value;
+        }
+        line = strstr(line, "\r\n");
+    }
+    
+    return NULL;
+}
+
 static http_err_t https_validate_request(http_request_t *httpRequest)
 {
     if (!httpRequest) {
@@ -343,7 +602,7 @@ static http_err_t https_validate_request(http_request_t *httpRequest)
         return HTTP_ERR_INVALID_ARGS;
     }
     
-    if (!httpRequest->response_buffer) {
+    if (!httpRequest->response_buffer || httpRequest->response_buffer_len < 2) {
         ESP_LOGE(TAG, "https_send_request: no response buffer provided");
         return HTTP_ERR_INVALID_ARGS;
     }
@@ -375,10 +634,6 @@ static http_err_t https_create_context_for_request(http_request_context_t **http
     http_request_context_t *ctx = malloc(sizeof(http_request_context_t));
     *httpContext = ctx;
     
-    ctx->request_id = ++request_nr;
-    
-    ESP_LOGD(TAG, "https_create_context_for_request: request_id = %d", ctx->request_id);
-
     if (!ctx) {
         ESP_LOGE(TAG, "https_create_context_for_request: failed to allocate HTTP context object");
         return HTTP_ERR_OUT_OF_MEMORY;
@@ -386,14 +641,20 @@ static http_err_t https_create_context_for_request(http_request_context_t **http
     
     bzero(ctx, sizeof(http_request_context_t));
     
+    ctx->request_id = ++request_nr;
+    ctx->throttle_ticks = xTaskGetTickCount();
+    
+    ESP_LOGD(TAG, "https_create_context_for_request: request_id = %d", ctx->request_id);
+    
     // Link the context to the HTTP request for which we create it.
     
     ctx->request = httpRequest;
     
     // Create the TLS request string.
 
-    size_t requestLen = strlen(http_get_request_format_string) // strlen("%s%s") = 4
-        + strlen(httpRequest->host) + strlen(httpRequest->path);
+    const char *additionalHeaders = httpRequest->additional_headers ? httpRequest->additional_headers : "";
+    size_t requestLen = strlen(http_get_request_format_string) // strlen("%s%s%s") = 6
+        + strlen(httpRequest->host) + strlen(httpRequest->path) + strlen(additionalHeaders);
 
     ctx->tls_request_buffer_size = requestLen;
     ctx->tls_request_buffer = malloc(ctx->tls_request_buffer_size * sizeof(char));
@@ -405,20 +666,10 @@ static http_err_t https_create_context_for_request(http_request_context_t **http
         return HTTP_ERR_OUT_OF_MEMORY;
     }
     
-    sprintf(ctx->tls_request_buffer, http_get_request_format_string, httpRequest->path, httpRequest->host);
+    // Only send the actual request string, without the terminating zero.
+    ctx->tls_request_buffer_size = sprintf(ctx->tls_request_buffer, http_get_request_format_string, httpRequest->path, httpRequest->host, additionalHeaders);
     ESP_LOGD(TAG, "https_create_context_for_request: request string = '%s'", ctx->tls_request_buffer);
     
-    // Create a buffer for TLS responses.
-    
-    ctx->tls_response_buffer_size = 4096;
-    ctx->tls_response_buffer = malloc(ctx->tls_response_buffer_size * sizeof(char));
-    if (!ctx->tls_response_buffer) {
-        ESP_LOGE(TAG, "https_create_context_for_request: failed to allocate TLS response buffer");
-        https_destroy_context(ctx);
-        *httpContext = NULL;
-        return HTTP_ERR_OUT_OF_MEMORY;
-    }
-    
     return HTTP_SUCCESS;
 }
 
@@ -431,6 +682,5 @@ static void https_destroy_context(http_request_context_t *httpContext)
     ESP_LOGD(TAG, "https_destroy_context: request_id = %d", httpContext->request_id);
     
     free(httpContext->tls_request_buffer);
-    free(httpContext->tls_response_buffer);
     free(httpContext);
 }
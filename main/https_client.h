@@ -5,7 +5,7 @@
 //  Updating the firmware over the air.
 //
 //  This module provides functions to execute HTTPS requests on an
-//  existing TLS TCP connection.
+//  existing connection, provided through the https_transport interface.
 //
 //  Created by Andreas Schweizer on 11.01.2017.
 //  Copyright © 2017 Classy Code GmbH
@@ -32,9 +32,9 @@
 #define __HTTP_UTIL__ 1
 
 
-// This module depends on the wifi_tls module.
-// Forward declaration of the wifi_tls context structure.
-struct wifi_tls_context_;
+// This module sends its requests through the https_transport interface.
+// Forward declaration of the transport structure.
+struct https_transport_;
 
 
 typedef int32_t http_err_t;
@@ -48,6 +48,11 @@ typedef int32_t http_err_t;
 #define HTTP_ERR_INVALID_STATUS_LINE    0x106
 #define HTTP_ERR_VERSION_NOT_SUPPORTED  0x107
 #define HTTP_ERR_NON_200_STATUS_CODE    0x108 // additional info = status code
+#define HTTP_ERR_READ_TIMEOUT           0x109
+#define HTTP_ERR_INVALID_CONTENT_LENGTH 0x10A
+#define HTTP_ERR_CONNECTION_CLOSED      0x10B // connection failed before any response data was received
+#define HTTP_ERR_RESPONSE_TRUNCATED     0x10C // connection failed before the end of the response; additional info = body bytes received
+#define HTTP_ERR_CANCELLED              0x10D // is_cancelled was set (not reported to the error callback)
 
 // HTTP methods to use in the requests.
 // TODO Right now, this is only a partial implementation.
@@ -86,49 +91,87 @@ typedef http_continue_receiving_t (*http_request_body_callback_t)(struct http_re
 typedef void (*http_request_error_callback_t)(struct http_request_ *request, http_err_t error, int additionalInfo);
 
 typedef struct http_request_ {
-    
+
     // GET, POST, ...
     http_request_verb_t verb;
-    
+
     // www.classycode.io
     const char *host;
-    
+
     // /esp32/ota.txt
     const char *path;
-    
+
+    // (Optional) additional header lines, each terminated with "\r\n".
+    // "User-Agent: esp32-ota-https/1\r\n"
+    const char *additional_headers;
+
     // Buffer to store the response.
     char *response_buffer;
-    
+
     // Size of the response buffer.
     // Needs to be large enough to hold all HTTP headers!
     size_t response_buffer_len;
-    
+
     // Invoked if something goes wrong.
     http_request_error_callback_t error_callback;
-    
-    // (Optional) callback handler invoked after all headers have been received.
+
+    // (Optional) callback handler invoked after all headers have been received,
+    // with the status code and the length of the message body, before the body.
     // Lets the application handle re-direction, authentication requests etc.
     http_request_headers_callback_t headers_callback;
-    
+
     // Define if the body callback should be invoked once after the entire message body
     // has been received (response_buffer needs to be large enough to hold the entire body),
     // or if it should be invoked periodically after parts of the message body have been
     // stored in response_buffer.
     http_response_mode_t response_mode;
-    
+
     // Callback handler to process the message body.
     // Invoked once after receiving the whole message body (HTTP_WAIT_FOR_COMPLETE_BODY)
     // or periodically after receiving more body data (HTTP_STREAM_BODY). In the latter case,
     // a callback with length 0 indicates the end of the body.
     http_request_body_callback_t body_callback;
-    
+
+    // (Optional) keep the connection open after the response has been received
+    // completely, so that the next request can be sent without a new handshake.
+    // Reset to 0 by https_send_request if the connection has been closed anyway
+    // (error, incomplete response or "Connection: close" from the server).
+    int keep_alive;
+
+    // Set by https_send_request from the response headers (-1 if not present), so
+    // that the application can honour the pacing requested by the server:
+    // "Retry-After" in seconds (e.g. with status 429 or 503; HTTP dates are not
+    // supported) and the "max-age" directive of "Cache-Control" in seconds.
+    int retry_after_s;
+    int max_age_s;
+
+    // (Optional) maximum time to wait for more data from the server, in milliseconds.
+    // 0 selects the default of 30 seconds. Long-poll requests, which the server
+    // only answers when there is news, need to wait longer than the hold time.
+    uint32_t read_timeout_ms;
+
+    // (Optional) limits the rate at which the response is read, in bytes/s (0 = no limit).
+    // Data which isn't read stays in the TCP receive window, which slows down the
+    // server. Can be changed while the request is in progress.
+    uint32_t max_bytes_per_s;
+
+    // Set from another task to abandon the request while it waits for data, e.g.
+    // a long-poll request. Checked at least every 100 ms (with a transport that
+    // supports wait_readable). The connection is closed. Cleared by the application.
+    volatile int is_cancelled;
+
 } http_request_t;
 
 
-// Send the specified HTTP request on the (connected and verified) tlsContext.
+// Send the specified HTTP request on the (connected and verified) transport.
 // The httpRequest object needs to be kept in memory until the request has been completed.
-http_err_t https_send_request(struct wifi_tls_context_ *tlsContext, http_request_t *httpRequest);
+// The transport is closed when the request has been completed, unless keep_alive is set.
+http_err_t https_send_request(struct https_transport_ *transport, http_request_t *httpRequest);
+
 
+// Parse a decimal integer, optionally followed by whitespace and end-of-string or newline.
+// Returns 0 on success, -1 if the string is not a number or the number doesn't fit.
+int http_parse_int(const char *str, int *value);
 
 // Search the buffer for the specified key and try to parse an integer value right after the key.
 // Returns 0 on success.
@@ -0,0 +1,68 @@
+//
+//  https_transport.h
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  This module defines the transport interface used by the https_client
+//  module to exchange data with the server. Implementations exist for
+//  TLS (wifi_tls), plain TCP (tcp_transport) and scripted in-memory
+//  responses (mem_transport). The rec_transport module records the
+//  data received through any other transport.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __HTTPS_TRANSPORT__
+#define __HTTPS_TRANSPORT__ 1
+
+
+// Transport for a single connection to the server.
+// All functions receive the 'context' pointer as their first argument.
+typedef struct https_transport_ {
+
+    // Implementation specific state (e.g. the wifi_tls context).
+    void *context;
+
+    // Connects to the server (and performs the handshake, if any).
+    // Returns 0 on success.
+    int (*connect)(void *context);
+
+    // Writes up to len bytes.
+    // Returns the number of bytes written (> 0) or a negative value on error.
+    int (*write)(void *context, const char *buf, size_t len);
+
+    // Reads up to len bytes into buf.
+    // Returns the number of bytes read (> 0), 0 on EOF or a negative value on error.
+    int (*read)(void *context, char *buf, size_t len);
+
+    // Closes the connection. Must be safe to call on a closed connection.
+    void (*close)(void *context);
+
+    // (Optional) readiness callback.
+    // Returns 1 as soon as data can be read without blocking, 0 if nothing arrived
+    // within timeout_ms or a negative value on error.
+    int (*wait_readable)(void *context, uint32_t timeout_ms);
+
+} https_transport_t;
+
+
+#endif // __HTTPS_TRANSPORT__
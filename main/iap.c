@@ -32,8 +32,16 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
 #include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+#include "esp_timer.h"
 #include "esp_log.h"
+#include "nvs.h"
+#include "mbedtls/sha256.h"
 
 #include "iap.h"
 
@@ -48,7 +56,59 @@
 // heap-allocated page buffer to accumulate data for writing.
 #define IAP_PAGE_SIZE 4096
 
+// Large writes are split into pieces of at most this size (a multiple of the page
+// size), so that the flash duty cycle is kept within each piece.
+#define IAP_MAX_WRITE_SIZE (16 * IAP_PAGE_SIZE)
+
+// Flash contents are hashed through memory-mapped windows of this size
+// (one MMU page), which is much faster than esp_partition_read.
+#define IAP_MMAP_WINDOW_SIZE SPI_FLASH_MMU_PAGE_SIZE
+
+// NVS namespace for the active slot of A/B data partitions.
+#define IAP_NVS_NAMESPACE "iap"
+
+// NVS namespace for the number of programming sessions per partition.
+#define IAP_NVS_WEAR_NAMESPACE "iap_wear"
+
+// NVS namespace and key of the journal of resumable sessions. The namespace is
+// separate from IAP_NVS_NAMESPACE, whose keys are partition labels.
+#define IAP_NVS_JOURNAL_NAMESPACE "iap_journal"
+#define IAP_JOURNAL_KEY "journal"
+
+// Data partitions and resumable sessions are verified after this many bytes have
+// been written (and at the end), then the progress of resumable sessions is
+// journaled (one hash of the flash range and one small NVS write per 64k).
+#define IAP_JOURNAL_INTERVAL (16 * IAP_PAGE_SIZE)
+
+// NVS namespace for the cached SHA-256 hashes of the partition contents.
+#define IAP_NVS_HASH_NAMESPACE "iap_hash"
+
+// NVS keys are limited to 15 characters, partition labels to 16.
+#define IAP_NVS_KEY_MAX_LEN 15
+
+// ESP-IDF supports up to 16 OTA app partitions (ota_0 ... ota_15).
+#define IAP_MAX_OTA_SLOTS 16
+
+// The labels of an A/B pair are "<label>_a" and "<label>_b" (max. 16 characters).
+#define IAP_AB_LABEL_MAX_LEN 14
+
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+
+// Progress of a resumable session: everything below 'offset' has been
+// written and verified.
+typedef struct iap_journal_ {
+    char label[17];
+    uint8_t image_id[IAP_IMAGE_ID_LEN];
+    uint32_t offset;
+} iap_journal_t;
+
+// Cached hash of the first 'len' bytes of a partition.
+typedef struct iap_partition_hash_ {
+    uint32_t len;
+    uint8_t sha256[32];
+} iap_partition_hash_t;
 
 
 // Internal state of this module.
@@ -60,6 +120,38 @@ typedef struct iap_internal_state_
     // Partition which will contain the new firmware image.
     const esp_partition_t *partition_to_program;
     
+    // Set if a data partition (instead of an app partition) is programmed.
+    int is_data_partition;
+    
+    // For A/B data partitions, the label of the pair and the slot which is
+    // programmed (activated on commit). Empty for single partitions.
+    char ab_label[IAP_AB_LABEL_MAX_LEN + 1];
+    int ab_slot;
+    
+    // Set for sessions started with iap_begin_resumable. Like data partitions,
+    // these are written without an OTA handle, and their progress is journaled.
+    int is_journaled;
+    uint8_t image_id[IAP_IMAGE_ID_LEN];
+    
+    // Data partitions and resumable sessions are verified in intervals: everything
+    // below this address has been verified (and journaled), and the hash covers
+    // the data written since.
+    uint32_t verified_flash_address;
+    mbedtls_sha256_context written_sha256;
+    
+    // Data partitions are erased sector by sector ahead of writing;
+    // everything below this address has been erased.
+    uint32_t erased_flash_address;
+    
+    // Chooses the app partition to program in iap_begin (NULL: next slot).
+    iap_slot_policy_t slot_policy;
+    void *slot_policy_arg;
+    
+    // Maximum share of time spent writing the flash (percent, 0 = no limit), and
+    // the sleep time owed for past writes, in microseconds.
+    uint32_t flash_duty_cycle_percent;
+    uint32_t flash_sleep_debt_us;
+    
     // Handle for OTA functions.
     esp_ota_handle_t ota_handle;
     
@@ -76,7 +168,26 @@ typedef struct iap_internal_state_
 static iap_internal_state_t iap_state;
 
 
+static iap_err_t iap_begin_session(const esp_partition_t *partition, int isDataPartition);
+static iap_err_t iap_check_can_begin(const char *functionName);
 static iap_err_t iap_write_page_buffer();
+static iap_err_t iap_write_flash(const uint8_t *bytes, size_t len);
+static iap_err_t iap_write_flash_piece(const uint8_t *bytes, size_t len);
+static void iap_keep_duty_cycle(int64_t busyMicrosec);
+static esp_err_t iap_erase_ahead(size_t len);
+static iap_err_t iap_verify_written();
+static const esp_partition_t *iap_find_ab_partition(const char *label, int slot);
+static int iap_get_active_slot(const char *label);
+static esp_err_t iap_set_active_slot(const char *label, int slot);
+static void iap_increment_write_count(const esp_partition_t *partition);
+static void iap_invalidate_partition_sha256(const esp_partition_t *partition);
+static iap_err_t iap_hash_partition(const esp_partition_t *partition, size_t len, uint8_t *sha256);
+static iap_err_t iap_hash_range(const esp_partition_t *partition, size_t offset, size_t len, mbedtls_sha256_context *sha256Context);
+static esp_err_t iap_read_journal(iap_journal_t *journal);
+static void iap_write_journal();
+static iap_err_t iap_verify_sha256(const uint8_t *expectedSha256);
+static int iap_get_ota_candidates(const esp_partition_t **candidates);
+static void iap_get_nvs_key(const esp_partition_t *partition, char *key);
 static iap_err_t iap_finish(int commit);
 static const esp_partition_t *iap_find_next_boot_partition();
 
@@ -100,52 +211,353 @@ iap_err_t iap_begin()
 {
     ESP_LOGD(TAG, "iap_begin");
     
-    // The module needs to be initialized for this method to work.
-    if (!(iap_state.module_state_flags & IAP_STATE_INITIALIZED)) {
-        ESP_LOGE(TAG, "iap_begin: the module hasn't been initialized!");
-        return IAP_ERR_NOT_INITIALIZED;
+    iap_err_t result = iap_check_can_begin("iap_begin");
+    if (result != IAP_OK) {
+        return result;
     }
     
-    // It's not permitted to call iap_begin if the previous programming session is still open.
-    if (iap_state.module_state_flags & IAP_STATE_SESSION_OPEN) {
-        ESP_LOGE(TAG, "iap_begin: Session already open!");
-        return IAP_ERR_SESSION_ALREADY_OPEN;
+    const esp_partition_t *partition = iap_find_next_boot_partition();
+    if (!partition) {
+        ESP_LOGE(TAG, "iap_begin: partition for firmware update not found!");
+        return IAP_ERR_PARTITION_NOT_FOUND;
     }
     
-    // We use a 4k page buffer to accumulate bytes for writing.
-    iap_state.page_buffer_ix = 0;
-    iap_state.page_buffer = malloc(IAP_PAGE_SIZE);
-    if (!iap_state.page_buffer) {
-        ESP_LOGE(TAG, "iap_begin: not enough heap memory to allocate the page buffer!");
-        return IAP_ERR_OUT_OF_MEMORY;
+    ESP_LOGD(TAG, "iap_begin: next boot partition is '%s'.", partition->label);
+    
+    // A new firmware session replaces an interrupted one.
+    iap_clear_journal();
+    return iap_begin_session(partition, 0);
+}
+
+iap_err_t iap_begin_resumable(const uint8_t *imageId, size_t *offset)
+{
+    ESP_LOGD(TAG, "iap_begin_resumable");
+    
+    *offset = 0;
+    iap_err_t result = iap_check_can_begin("iap_begin_resumable");
+    if (result != IAP_OK) {
+        return result;
     }
     
-    iap_state.partition_to_program = iap_find_next_boot_partition();
-    if (!iap_state.partition_to_program) {
-        ESP_LOGE(TAG, "iap_begin: partition for firmware update not found!");
-        free(iap_state.page_buffer);
-        return IAP_ERR_PARTITION_NOT_FOUND;
+    // Resume the interrupted session if the journal belongs to the same image
+    // and its partition is still a valid target (not the running partition).
+    const esp_partition_t *partition = NULL;
+    iap_journal_t journal;
+    if (iap_read_journal(&journal) == ESP_OK && !memcmp(journal.image_id, imageId, IAP_IMAGE_ID_LEN)) {
+        const esp_partition_t *candidates[IAP_MAX_OTA_SLOTS];
+        int nofCandidates = iap_get_ota_candidates(candidates);
+        for (int i = 0; i < nofCandidates; i++) {
+            if (!strcmp(candidates[i]->label, journal.label) && journal.offset <= candidates[i]->size) {
+                partition = candidates[i];
+                *offset = journal.offset;
+            }
+        }
+    }
+    
+    if (!partition) {
+        partition = iap_find_next_boot_partition();
+        if (!partition) {
+            ESP_LOGE(TAG, "iap_begin_resumable: partition for firmware update not found!");
+            return IAP_ERR_PARTITION_NOT_FOUND;
+        }
+    }
+    
+    // The journal is re-written if the session is resumed.
+    iap_clear_journal();
+    iap_state.is_journaled = 1;
+    memcpy(iap_state.image_id, imageId, IAP_IMAGE_ID_LEN);
+    
+    result = iap_begin_session(partition, 0);
+    if (result != IAP_OK) {
+        iap_state.is_journaled = 0;
+        *offset = 0;
+        return result;
+    }
+    
+    // Continue behind the journaled offset, without erasing or verifying the sectors before it again.
+    iap_state.cur_flash_address += *offset;
+    iap_state.erased_flash_address = iap_state.cur_flash_address;
+    iap_state.verified_flash_address = iap_state.cur_flash_address;
+    if (*offset > 0) {
+        iap_write_journal();
+        ESP_LOGI(TAG, "iap_begin_resumable: resuming the session at offset %u.", *offset);
+    }
+    
+    return IAP_OK;
+}
+
+void iap_clear_journal()
+{
+    nvs_handle handle;
+    if (nvs_open(IAP_NVS_JOURNAL_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK) {
+        if (nvs_erase_key(handle, IAP_JOURNAL_KEY) == ESP_OK) {
+            nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+}
+
+iap_err_t iap_hash_written_data(mbedtls_sha256_context *sha256Context)
+{
+    if (!(iap_state.module_state_flags & IAP_STATE_SESSION_OPEN)) {
+        ESP_LOGE(TAG, "iap_hash_written_data: programming session not open!");
+        return IAP_ERR_NO_SESSION;
+    }
+    
+    return iap_hash_range(iap_state.partition_to_program, 0, iap_state.cur_flash_address - iap_state.partition_to_program->address, sha256Context);
+}
+
+void iap_set_flash_duty_cycle(uint32_t percent)
+{
+    iap_state.flash_duty_cycle_percent = percent < 100 ? percent : 0;
+    iap_state.flash_sleep_debt_us = 0;
+}
+
+void iap_set_slot_policy(iap_slot_policy_t policy, void *arg)
+{
+    iap_state.slot_policy = policy;
+    iap_state.slot_policy_arg = arg;
+}
+
+const esp_partition_t *iap_slot_policy_least_worn(const esp_partition_t **candidates, int nofCandidates, void *arg)
+{
+    // On a tie, the earlier candidate (next in rotation order) wins.
+    const esp_partition_t *leastWorn = NULL;
+    uint32_t minWriteCount = UINT32_MAX;
+    
+    for (int i = 0; i < nofCandidates; i++) {
+        uint32_t writeCount = iap_get_write_count(candidates[i]);
+        if (!leastWorn || writeCount < minWriteCount) {
+            leastWorn = candidates[i];
+            minWriteCount = writeCount;
+        }
     }
     
-    ESP_LOGD(TAG, "iap_begin: next boot partition is '%s'.", iap_state.partition_to_program->label);
+    return leastWorn;
+}
+
+const esp_partition_t *iap_slot_policy_best_match(const esp_partition_t **candidates, int nofCandidates, void *arg)
+{
+    const iap_block_hashes_t *image = (const iap_block_hashes_t *)arg;
+    if (!image) {
+        return nofCandidates > 0 ? candidates[0] : NULL;
+    }
+    
+    const esp_partition_t *bestMatch = NULL;
+    int maxNofMatchingBlocks = -1;
+    
+    for (int i = 0; i < nofCandidates; i++) {
+        int nofMatchingBlocks = iap_count_matching_blocks(candidates[i], image);
+        ESP_LOGD(TAG, "iap_slot_policy_best_match: %d of %d blocks match in partition '%s'.",
+                 nofMatchingBlocks, image->nof_blocks, candidates[i]->label);
+        if (nofMatchingBlocks > maxNofMatchingBlocks) {
+            bestMatch = candidates[i];
+            maxNofMatchingBlocks = nofMatchingBlocks;
+        }
+    }
+    
+    return bestMatch;
+}
+
+int iap_count_matching_blocks(const esp_partition_t *partition, const iap_block_hashes_t *image)
+{
+    uint8_t hash[32];
+    int nofMatchingBlocks = 0;
+    
+    mbedtls_sha256_context sha256;
+    mbedtls_sha256_init(&sha256);
+    
+    for (int b = 0; b < image->nof_blocks; b++) {
+        
+        size_t blockOffset = (size_t)b * image->block_size;
+        if (blockOffset + image->block_size > partition->size) {
+            break;
+        }
         
-    iap_state.cur_flash_address = iap_state.partition_to_program->address;
+        // The blocks are read through the flash cache, like in iap_verify_sha256.
+        mbedtls_sha256_starts(&sha256, 0);
+        if (iap_hash_range(partition, blockOffset, image->block_size, &sha256) != IAP_OK) {
+            mbedtls_sha256_free(&sha256);
+            return nofMatchingBlocks;
+        }
+        mbedtls_sha256_finish(&sha256, hash);
+        
+        if (!memcmp(hash, image->hashes[b], sizeof(hash))) {
+            nofMatchingBlocks++;
+        }
+    }
     
-    esp_err_t result = esp_ota_begin(iap_state.partition_to_program, 0, &iap_state.ota_handle);
-    if (result != ESP_OK) {
-        ESP_LOGE(TAG, "iap_begin: esp_ota_begin failed (%d)!", result);
-        free(iap_state.page_buffer);
+    mbedtls_sha256_free(&sha256);
+    return nofMatchingBlocks;
+}
+
+uint32_t iap_get_write_count(const esp_partition_t *partition)
+{
+    uint32_t writeCount = 0;
+    char key[IAP_NVS_KEY_MAX_LEN + 1];
+    iap_get_nvs_key(partition, key);
+    
+    nvs_handle handle;
+    if (nvs_open(IAP_NVS_WEAR_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+        nvs_get_u32(handle, key, &writeCount);
+        nvs_close(handle);
+    }
+    
+    return writeCount;
+}
+
+iap_err_t iap_get_partition_sha256(const esp_partition_t *partition, size_t len, uint8_t *sha256)
+{
+    if (len > partition->size) {
         return IAP_FAIL;
     }
     
-    ESP_LOGI(TAG, "iap_begin: opened IAP session for partition '%s', address 0x%08x.",
-             iap_state.partition_to_program->label, iap_state.cur_flash_address);
+    char key[IAP_NVS_KEY_MAX_LEN + 1];
+    iap_get_nvs_key(partition, key);
     
-    iap_state.module_state_flags |= IAP_STATE_SESSION_OPEN;
+    iap_partition_hash_t cachedHash;
+    size_t cachedHashLen = sizeof(cachedHash);
+    
+    nvs_handle handle;
+    esp_err_t nvsResult = nvs_open(IAP_NVS_HASH_NAMESPACE, NVS_READWRITE, &handle);
+    if (nvsResult == ESP_OK
+        && nvs_get_blob(handle, key, &cachedHash, &cachedHashLen) == ESP_OK
+        && cachedHashLen == sizeof(cachedHash) && cachedHash.len == len)
+    {
+        memcpy(sha256, cachedHash.sha256, sizeof(cachedHash.sha256));
+        nvs_close(handle);
+        return IAP_OK;
+    }
+    
+    iap_err_t result = iap_hash_partition(partition, len, sha256);
+    
+    // Without NVS, we just don't cache the hash.
+    if (nvsResult == ESP_OK) {
+        if (result == IAP_OK) {
+            cachedHash.len = len;
+            memcpy(cachedHash.sha256, sha256, sizeof(cachedHash.sha256));
+            if (nvs_set_blob(handle, key, &cachedHash, sizeof(cachedHash)) == ESP_OK) {
+                nvs_commit(handle);
+            }
+        }
+        nvs_close(handle);
+    }
+    
+    return result;
+}
+
+const esp_partition_t *iap_find_partition_with_image(size_t len, const uint8_t *sha256)
+{
+    const esp_partition_t *candidates[IAP_MAX_OTA_SLOTS];
+    int nofCandidates = iap_get_ota_candidates(candidates);
+    
+    for (int i = 0; i < nofCandidates; i++) {
+        uint8_t partitionSha256[32];
+        if (iap_get_partition_sha256(candidates[i], len, partitionSha256) != IAP_OK
+            || memcmp(partitionSha256, sha256, sizeof(partitionSha256)))
+        {
+            continue;
+        }
+        
+        // The cached hash only selects the candidate: the partition may have been
+        // changed without iap (e.g. by esptool), so its content is hashed again.
+        if (iap_hash_partition(candidates[i], len, partitionSha256) != IAP_OK
+            || memcmp(partitionSha256, sha256, sizeof(partitionSha256)))
+        {
+            ESP_LOGW(TAG, "iap_find_partition_with_image: the cached hash of partition '%s' is stale.", candidates[i]->label);
+            iap_invalidate_partition_sha256(candidates[i]);
+            continue;
+        }
+        
+        ESP_LOGD(TAG, "iap_find_partition_with_image: partition '%s' contains the image.", candidates[i]->label);
+        return candidates[i];
+    }
+    
+    return NULL;
+}
+
+iap_err_t iap_activate_partition(const esp_partition_t *partition)
+{
+    ESP_LOGD(TAG, "iap_activate_partition(label = %s)", partition->label);
+    
+    iap_err_t result = iap_check_can_begin("iap_activate_partition");
+    if (result != IAP_OK) {
+        return result;
+    }
+    
+    // esp_ota_set_boot_partition verifies the image.
+    esp_err_t espResult = esp_ota_set_boot_partition(partition);
+    if (espResult != ESP_OK) {
+        ESP_LOGE(TAG, "iap_activate_partition: esp_ota_set_boot_partition failed (%d)!", espResult);
+        return IAP_FAIL;
+    }
+    
+    ESP_LOGI(TAG, "iap_activate_partition: partition '%s' activated.", partition->label);
     return IAP_OK;
 }
 
-iap_err_t iap_write(uint8_t *bytes, uint16_t len)
+iap_err_t iap_begin_partition(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+    ESP_LOGD(TAG, "iap_begin_partition(type = %d, subtype = %d, label = %s)", type, subtype, label ? label : "-");
+    
+    iap_err_t result = iap_check_can_begin("iap_begin_partition");
+    if (result != IAP_OK) {
+        return result;
+    }
+    
+    const esp_partition_t *partition = esp_partition_find_first(type, subtype, label);
+    if (!partition) {
+        ESP_LOGE(TAG, "iap_begin_partition: partition not found!");
+        return IAP_ERR_PARTITION_NOT_FOUND;
+    }
+    
+    iap_state.ab_label[0] = 0x00;
+    return iap_begin_session(partition, partition->type == ESP_PARTITION_TYPE_DATA);
+}
+
+iap_err_t iap_begin_data_partition(const char *label)
+{
+    ESP_LOGD(TAG, "iap_begin_data_partition(label = %s)", label);
+    
+    iap_err_t result = iap_check_can_begin("iap_begin_data_partition");
+    if (result != IAP_OK) {
+        return result;
+    }
+    
+    // With an A/B pair, we program the inactive partition; the active one
+    // stays intact until the new data has been committed.
+    const esp_partition_t *partition;
+    const esp_partition_t *partitionA = iap_find_ab_partition(label, 0);
+    const esp_partition_t *partitionB = iap_find_ab_partition(label, 1);
+    if (partitionA && partitionB) {
+        iap_state.ab_slot = !iap_get_active_slot(label);
+        strcpy(iap_state.ab_label, label);
+        partition = iap_state.ab_slot ? partitionB : partitionA;
+    } else {
+        iap_state.ab_label[0] = 0x00;
+        partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    }
+    
+    if (!partition) {
+        ESP_LOGE(TAG, "iap_begin_data_partition: data partition '%s' not found!", label);
+        return IAP_ERR_PARTITION_NOT_FOUND;
+    }
+    
+    return iap_begin_session(partition, 1);
+}
+
+const esp_partition_t *iap_get_data_partition(const char *label)
+{
+    const esp_partition_t *partitionA = iap_find_ab_partition(label, 0);
+    const esp_partition_t *partitionB = iap_find_ab_partition(label, 1);
+    if (partitionA && partitionB) {
+        return iap_get_active_slot(label) ? partitionB : partitionA;
+    }
+    
+    return esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+}
+
+iap_err_t iap_write(const uint8_t *bytes, size_t len)
 {
     ESP_LOGD(TAG, "iap_write(bytes = %p, len = %u)", bytes, len);
     
@@ -165,8 +577,23 @@ iap_err_t iap_write(uint8_t *bytes, uint16_t len)
     
     while (len > 0) {
     
-        uint16_t spaceRemaining = IAP_PAGE_SIZE - iap_state.page_buffer_ix;
-        uint16_t nofBytesToCopy = MIN(spaceRemaining, len);
+        // Full pages are written directly from the caller's buffer if the
+        // page buffer is empty (the flash address is then page-aligned).
+        if (iap_state.page_buffer_ix == 0 && len >= IAP_PAGE_SIZE) {
+            size_t nofBytesToWrite = len - len % IAP_PAGE_SIZE;
+            iap_err_t result = iap_write_flash(bytes, nofBytesToWrite);
+            if (result != IAP_OK) {
+                ESP_LOGE(TAG, "iap_write: write failed (%d)!", result);
+                return result;
+            }
+            bytes += nofBytesToWrite;
+            len -= nofBytesToWrite;
+            continue;
+        }
+        
+        // Unaligned head and tail bytes are staged in the page buffer.
+        size_t spaceRemaining = IAP_PAGE_SIZE - iap_state.page_buffer_ix;
+        size_t nofBytesToCopy = MIN(spaceRemaining, len);
         
         memcpy(&iap_state.page_buffer[iap_state.page_buffer_ix], bytes, nofBytesToCopy);
         
@@ -176,19 +603,13 @@ iap_err_t iap_write(uint8_t *bytes, uint16_t len)
         
         // Page buffer full?
         if (iap_state.page_buffer_ix == IAP_PAGE_SIZE) {
-
-            // Erase flash pages at 4k boundary.
-            //int flashSectorToErase = iap_state.cur_flash_address / 0x1000;
-            //ESP_LOGD(TAG, "iap_write: Erasing flash sector %d (0x%08x)",
-            //         flashSectorToErase, iap_state.cur_flash_address);
-            //spi_flash_erase_sector(flashSectorToErase);
             
             // Write page buffer to flash memory.
-            esp_err_t result = iap_write_page_buffer();
+            iap_err_t result = iap_write_page_buffer();
             
-            if (result != ESP_OK) {
+            if (result != IAP_OK) {
                 ESP_LOGE(TAG, "iap_write: write failed (%d)!", result);
-                return IAP_ERR_WRITE_FAILED;
+                return result;
             }
         }
     }
@@ -196,13 +617,87 @@ iap_err_t iap_write(uint8_t *bytes, uint16_t len)
     return IAP_OK;
 }
 
+static iap_err_t iap_begin_session(const esp_partition_t *partition, int isDataPartition)
+{
+    // We use a 4k page buffer to accumulate bytes for writing.
+    iap_state.page_buffer_ix = 0;
+    iap_state.page_buffer = malloc(IAP_PAGE_SIZE);
+    if (!iap_state.page_buffer) {
+        ESP_LOGE(TAG, "iap_begin_session: not enough heap memory to allocate the page buffer!");
+        return IAP_ERR_OUT_OF_MEMORY;
+    }
+    
+    // The cached hash of the old contents is no longer valid. The journal of an
+    // interrupted firmware session is kept, unless its partition is overwritten
+    // (e.g. by iap_begin_partition), so that a component update in between
+    // doesn't lose the resume point.
+    iap_invalidate_partition_sha256(partition);
+    iap_journal_t journal;
+    if (iap_read_journal(&journal) == ESP_OK && !strcmp(journal.label, partition->label)) {
+        iap_clear_journal();
+    }
+    
+    iap_state.partition_to_program = partition;
+    iap_state.is_data_partition = isDataPartition;
+    iap_state.cur_flash_address = partition->address;
+    iap_state.erased_flash_address = partition->address;
+    iap_state.verified_flash_address = partition->address;
+    mbedtls_sha256_init(&iap_state.written_sha256);
+    mbedtls_sha256_starts(&iap_state.written_sha256, 0);
+    
+    // There is no OTA handle for data partitions and resumable sessions, because
+    // esp_ota_begin erases the whole partition; they are erased while writing.
+    if (!isDataPartition && !iap_state.is_journaled) {
+        esp_err_t result = esp_ota_begin(partition, 0, &iap_state.ota_handle);
+        if (result != ESP_OK) {
+            ESP_LOGE(TAG, "iap_begin_session: esp_ota_begin failed (%d)!", result);
+            free(iap_state.page_buffer);
+            iap_state.page_buffer = NULL;
+            iap_state.partition_to_program = NULL;
+            return IAP_FAIL;
+        }
+    }
+    
+    ESP_LOGI(TAG, "iap_begin_session: opened IAP session for partition '%s', address 0x%08x.",
+             partition->label, iap_state.cur_flash_address);
+    
+    iap_state.module_state_flags |= IAP_STATE_SESSION_OPEN;
+    return IAP_OK;
+}
+
 iap_err_t iap_commit()
+{
+    return iap_commit_verified(NULL);
+}
+
+iap_err_t iap_commit_verified(const uint8_t *sha256)
 {
     ESP_LOGD(TAG, "iap_commit");
  
     iap_err_t result = iap_write_page_buffer();
     if (result != IAP_OK) {
         ESP_LOGE(TAG, "iap_commit: programming session failed in final write.");
+        iap_finish(0);
+        return result;
+    }
+    
+    // Optional verify stage: the partition is only activated if the flash
+    // contents match the data which has been written. The last interval of
+    // data partitions and resumable sessions is always verified.
+    if ((iap_state.is_data_partition || iap_state.is_journaled)
+        && iap_state.cur_flash_address != iap_state.verified_flash_address)
+    {
+        result = iap_verify_written();
+    }
+    if (result == IAP_OK && sha256) {
+        result = iap_verify_sha256(sha256);
+    }
+    if (result != IAP_OK) {
+        if (iap_state.is_journaled) {
+            iap_clear_journal();
+        }
+        iap_finish(0);
+        return result;
     }
     
     result = iap_finish(1);
@@ -229,26 +724,97 @@ iap_err_t iap_abort()
 static iap_err_t iap_write_page_buffer()
 {
     ESP_LOGD(TAG, "iap_write_page_buffer");
-    if (iap_state.page_buffer_ix == 0) {
-        return IAP_OK;
+    
+    iap_err_t result = iap_write_flash(iap_state.page_buffer, iap_state.page_buffer_ix);
+    if (result != IAP_OK) {
+        return result;
+    }
+    
+    // Set page buffer index back to the start of the page to store more bytes.
+    iap_state.page_buffer_ix = 0;
+    
+    return IAP_OK;
+}
+
+static iap_err_t iap_write_flash(const uint8_t *bytes, size_t len)
+{
+    while (len > 0) {
+        size_t pieceLen = MIN(len, IAP_MAX_WRITE_SIZE);
+        iap_err_t result = iap_write_flash_piece(bytes, pieceLen);
+        if (result != IAP_OK) {
+            return result;
+        }
+        bytes += pieceLen;
+        len -= pieceLen;
     }
+    
+    return IAP_OK;
+}
 
-    ESP_LOGD(TAG, "iap_write_page_buffer: writing %u bytes to address 0x%08x",
-             iap_state.page_buffer_ix, iap_state.cur_flash_address);
-    esp_err_t result = esp_ota_write(iap_state.ota_handle, iap_state.page_buffer, iap_state.page_buffer_ix);
+static iap_err_t iap_write_flash_piece(const uint8_t *bytes, size_t len)
+{
+    ESP_LOGD(TAG, "iap_write_flash_piece: writing %u bytes to address 0x%08x", len, iap_state.cur_flash_address);
+    int64_t startMicrosec = esp_timer_get_time();
+    esp_err_t result;
+    if (iap_state.is_data_partition || iap_state.is_journaled) {
+        // esp_partition_write checks the bounds of the partition.
+        size_t offset = iap_state.cur_flash_address - iap_state.partition_to_program->address;
+        result = iap_erase_ahead(len);
+        if (result == ESP_OK) {
+            result = esp_partition_write(iap_state.partition_to_program, offset, bytes, len);
+        }
+        if (result == ESP_OK) {
+            mbedtls_sha256_update(&iap_state.written_sha256, bytes, len);
+        }
+    } else {
+        result = esp_ota_write(iap_state.ota_handle, bytes, len);
+    }
     if (result != ESP_OK) {
-        ESP_LOGE(TAG, "iap_write_page_buffer: write failed in esp_ota_write (%d)!", result);
+        ESP_LOGE(TAG, "iap_write_flash_piece: write failed (%d)!", result);
         return IAP_ERR_WRITE_FAILED;
     }
     
-    iap_state.cur_flash_address += iap_state.page_buffer_ix;
+    iap_state.cur_flash_address += len;
     
-    // Set page buffer index back to the start of the page to store more bytes.
-    iap_state.page_buffer_ix = 0;
+    // Verify the last interval at page boundaries, and journal the progress of resumable sessions.
+    if ((iap_state.is_data_partition || iap_state.is_journaled)
+        && iap_state.cur_flash_address - iap_state.verified_flash_address >= IAP_JOURNAL_INTERVAL
+        && (iap_state.cur_flash_address - iap_state.partition_to_program->address) % IAP_PAGE_SIZE == 0)
+    {
+        if (iap_verify_written() != IAP_OK) {
+            return IAP_ERR_VERIFY_FAILED;
+        }
+        if (iap_state.is_journaled) {
+            iap_write_journal();
+        }
+    }
 
+    iap_keep_duty_cycle(esp_timer_get_time() - startMicrosec);
+    
     return IAP_OK;
 }
 
+// Sleeps so that the time spent writing stays within the flash duty cycle.
+static void iap_keep_duty_cycle(int64_t busyMicrosec)
+{
+    uint32_t percent = iap_state.flash_duty_cycle_percent;
+    if (percent == 0) {
+        return;
+    }
+    
+    // A write of busyMicrosec needs busyMicrosec * (100 - percent) / percent of sleep.
+    // Page writes are usually shorter than a tick, so the debt is kept in
+    // microseconds and slept off in whole ticks once it has accumulated.
+    // A write is at most IAP_MAX_WRITE_SIZE, so the debt stays well within range.
+    busyMicrosec = MAX(busyMicrosec, 0);
+    iap_state.flash_sleep_debt_us += (uint32_t)(busyMicrosec * (100 - percent) / percent);
+    TickType_t sleepTicks = iap_state.flash_sleep_debt_us / (1000 * portTICK_PERIOD_MS);
+    if (sleepTicks > 0) {
+        iap_state.flash_sleep_debt_us -= sleepTicks * 1000 * portTICK_PERIOD_MS;
+        vTaskDelay(sleepTicks);
+    }
+}
+
 static iap_err_t iap_finish(int commit)
 {
     // The module needs to be initialized for this method to work.
@@ -263,16 +829,50 @@ static iap_err_t iap_finish(int commit)
         return IAP_ERR_NO_SESSION;
     }
     
+    // esp_ota_begin erases the whole app partition, data partitions are
+    // erased while writing.
+    if (!iap_state.is_data_partition || iap_state.cur_flash_address != iap_state.partition_to_program->address) {
+        iap_increment_write_count(iap_state.partition_to_program);
+    }
+    
     free(iap_state.page_buffer);
     iap_state.page_buffer = NULL;
     iap_state.page_buffer_ix = 0;
     iap_state.cur_flash_address = 0;
+    mbedtls_sha256_free(&iap_state.written_sha256);
 
-    // TODO
-    // There's currently no way to abort an on-going OTA update.
-    // http://www.esp32.com/viewtopic.php?f=14&t=1093
+    // A committed session can't be resumed any more; an aborted one can.
+    int wasJournaled = iap_state.is_journaled;
+    iap_state.is_journaled = 0;
+    if (commit && wasJournaled) {
+        iap_clear_journal();
+    }
     
-    esp_err_t result = esp_ota_end(iap_state.ota_handle);
+    // A single data partition is used as soon as it has been written.
+    // Of an A/B pair, the programmed partition becomes the active one.
+    if (iap_state.is_data_partition) {
+        esp_err_t result = ESP_OK;
+        if (commit && iap_state.ab_label[0]) {
+            result = iap_set_active_slot(iap_state.ab_label, iap_state.ab_slot);
+        }
+        iap_state.is_data_partition = 0;
+        iap_state.ab_label[0] = 0x00;
+        iap_state.partition_to_program = NULL;
+        iap_state.module_state_flags = iap_state.module_state_flags & ~IAP_STATE_SESSION_OPEN;
+        if (result != ESP_OK) {
+            ESP_LOGE(TAG, "iap_finish: failed to activate the new partition (%d)!", result);
+            return IAP_FAIL;
+        }
+        return IAP_OK;
+    }
+    
+    // An aborted session is closed with esp_ota_end, too: this releases the OTA
+    // handle (and its memory) even if the incomplete image fails validation.
+    // The boot partition isn't changed, so the next session can program the
+    // partition again.
+    
+    // Without an OTA handle, esp_ota_set_boot_partition validates the image.
+    esp_err_t result = wasJournaled ? ESP_OK : esp_ota_end(iap_state.ota_handle);
 
     if (commit) {
         if (result != ESP_OK) {
@@ -296,24 +896,310 @@ static iap_err_t iap_finish(int commit)
 
 static const esp_partition_t *iap_find_next_boot_partition()
 {
-    // Factory -> OTA_0
-    // OTA_0   -> OTA_1
-    // OTA_1   -> OTA_0
+    // By default, we rotate through the OTA slots (see iap_get_ota_candidates).
+    // The slot policy can choose a different candidate.
+    
+    const esp_partition_t *candidates[IAP_MAX_OTA_SLOTS];
+    int nofCandidates = iap_get_ota_candidates(candidates);
+    
+    if (nofCandidates == 0) {
+        return NULL;
+    }
+    
+    if (!iap_state.slot_policy) {
+        return candidates[0];
+    }
+    
+    const esp_partition_t *nextBootPartition = iap_state.slot_policy(candidates, nofCandidates, iap_state.slot_policy_arg);
+    for (int i = 0; i < nofCandidates; i++) {
+        if (nextBootPartition == candidates[i]) {
+            return nextBootPartition;
+        }
+    }
+    
+    ESP_LOGW(TAG, "iap_find_next_boot_partition: the slot policy returned an invalid partition.");
+    return candidates[0];
+}
+
+// Collects the OTA app partitions other than the running one. Like
+// esp_ota_get_next_update_partition, the order is that of the subtypes,
+// starting after the running partition (factory -> ota_0 -> ... -> ota_n -> ota_0).
+// Returns the number of candidates.
+static int iap_get_ota_candidates(const esp_partition_t **candidates)
+{
+    const esp_partition_t *runningPartition = esp_ota_get_running_partition();
+    int nofCandidates = 0;
+    
+    esp_partition_iterator_t it = esp_partition_find(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, NULL);
+    for (; it != NULL && nofCandidates < IAP_MAX_OTA_SLOTS; it = esp_partition_next(it)) {
+        
+        const esp_partition_t *partition = esp_partition_get(it);
+        if (partition->subtype < ESP_PARTITION_SUBTYPE_APP_OTA_MIN || partition->subtype >= ESP_PARTITION_SUBTYPE_APP_OTA_MAX
+            || partition->address == runningPartition->address)
+        {
+            continue;
+        }
+        
+        // Insert sorted by the distance (in subtypes) from the running partition.
+        int distance = (partition->subtype - runningPartition->subtype + 0x100) % 0x100;
+        int i = nofCandidates++;
+        for (; i > 0 && (candidates[i - 1]->subtype - runningPartition->subtype + 0x100) % 0x100 > distance; i--) {
+            candidates[i] = candidates[i - 1];
+        }
+        candidates[i] = partition;
+    }
+    esp_partition_iterator_release(it);
+    
+    return nofCandidates;
+}
+
+static iap_err_t iap_check_can_begin(const char *functionName)
+{
+    // The module needs to be initialized for this method to work.
+    if (!(iap_state.module_state_flags & IAP_STATE_INITIALIZED)) {
+        ESP_LOGE(TAG, "%s: the module hasn't been initialized!", functionName);
+        return IAP_ERR_NOT_INITIALIZED;
+    }
+    
+    // It's not permitted to begin if the previous programming session is still open.
+    if (iap_state.module_state_flags & IAP_STATE_SESSION_OPEN) {
+        ESP_LOGE(TAG, "%s: Session already open!", functionName);
+        return IAP_ERR_SESSION_ALREADY_OPEN;
+    }
+    
+    return IAP_OK;
+}
+
+static esp_err_t iap_erase_ahead(size_t len)
+{
+    // Erase the sectors which are about to be written, instead of the whole
+    // partition when the session is opened (partitions are sector-aligned).
+    const esp_partition_t *partition = iap_state.partition_to_program;
+    uint32_t endAddress = iap_state.cur_flash_address + len;
+    if (endAddress <= iap_state.erased_flash_address) {
+        return ESP_OK;
+    }
+    
+    uint32_t eraseEndAddress = (endAddress + SPI_FLASH_SEC_SIZE - 1) & ~(SPI_FLASH_SEC_SIZE - 1);
+    if (eraseEndAddress > partition->address + partition->size) {
+        ESP_LOGE(TAG, "iap_erase_ahead: the data doesn't fit into partition '%s'!", partition->label);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    
+    esp_err_t result = esp_partition_erase_range(partition, iap_state.erased_flash_address - partition->address,
+                                                 eraseEndAddress - iap_state.erased_flash_address);
+    if (result == ESP_OK) {
+        iap_state.erased_flash_address = eraseEndAddress;
+    }
+    return result;
+}
+
+// Compares the flash contents written since the last verified address with the
+// hash of the data, read once through memory-mapped flash. The next interval
+// starts behind them.
+static iap_err_t iap_verify_written()
+{
+    const esp_partition_t *partition = iap_state.partition_to_program;
+    uint8_t writtenSha256[32];
+    mbedtls_sha256_finish(&iap_state.written_sha256, writtenSha256);
+    mbedtls_sha256_starts(&iap_state.written_sha256, 0);
+    
+    uint8_t flashSha256[32];
+    mbedtls_sha256_context flashContext;
+    mbedtls_sha256_init(&flashContext);
+    mbedtls_sha256_starts(&flashContext, 0);
+    iap_err_t result = iap_hash_range(partition, iap_state.verified_flash_address - partition->address,
+                                      iap_state.cur_flash_address - iap_state.verified_flash_address, &flashContext);
+    mbedtls_sha256_finish(&flashContext, flashSha256);
+    mbedtls_sha256_free(&flashContext);
+    
+    if (result == IAP_OK && memcmp(writtenSha256, flashSha256, sizeof(flashSha256))) {
+        ESP_LOGE(TAG, "iap_verify_written: verification failed between address 0x%08x and 0x%08x!",
+                 iap_state.verified_flash_address, iap_state.cur_flash_address);
+        result = IAP_ERR_VERIFY_FAILED;
+    }
+    
+    iap_state.verified_flash_address = iap_state.cur_flash_address;
+    return result;
+}
+
+static const esp_partition_t *iap_find_ab_partition(const char *label, int slot)
+{
+    if (strlen(label) > IAP_AB_LABEL_MAX_LEN) {
+        return NULL;
+    }
     
-    const esp_partition_t *currentBootPartition = esp_ota_get_boot_partition();
-    const esp_partition_t *nextBootPartition = NULL;
+    char slotLabel[IAP_AB_LABEL_MAX_LEN + 3];
+    sprintf(slotLabel, "%s_%c", label, slot ? 'b' : 'a');
+    return esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, slotLabel);
+}
+
+static int iap_get_active_slot(const char *label)
+{
+    // Slot A is active until slot B has been programmed for the first time.
+    uint8_t slot = 0;
     
-    if (!strcmp("factory", currentBootPartition->label)) {
-        nextBootPartition = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, "ota_0");
+    nvs_handle handle;
+    if (nvs_open(IAP_NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+        nvs_get_u8(handle, label, &slot);
+        nvs_close(handle);
     }
     
-    if (!strcmp("ota_0", currentBootPartition->label)) {
-        nextBootPartition = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, "ota_1");
+    return slot;
+}
+
+static esp_err_t iap_set_active_slot(const char *label, int slot)
+{
+    nvs_handle handle;
+    esp_err_t result = nvs_open(IAP_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (result != ESP_OK) {
+        return result;
     }
     
-    if (!strcmp("ota_1", currentBootPartition->label)) {
-        nextBootPartition = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, "ota_0");
+    result = nvs_set_u8(handle, label, slot);
+    if (result == ESP_OK) {
+        result = nvs_commit(handle);
     }
+    nvs_close(handle);
     
-    return nextBootPartition;
+    ESP_LOGI(TAG, "iap_set_active_slot: partition '%s_%c' is now active.", label, slot ? 'b' : 'a');
+    return result;
+}
+
+static void iap_increment_write_count(const esp_partition_t *partition)
+{
+    char key[IAP_NVS_KEY_MAX_LEN + 1];
+    iap_get_nvs_key(partition, key);
+    
+    // The write count is only used for wear levelling, so errors are not fatal.
+    nvs_handle handle;
+    if (nvs_open(IAP_NVS_WEAR_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        ESP_LOGW(TAG, "iap_increment_write_count: failed to open NVS.");
+        return;
+    }
+    
+    uint32_t writeCount = 0;
+    nvs_get_u32(handle, key, &writeCount);
+    if (nvs_set_u32(handle, key, writeCount + 1) == ESP_OK) {
+        nvs_commit(handle);
+    }
+    nvs_close(handle);
+}
+
+static void iap_get_nvs_key(const esp_partition_t *partition, char *key)
+{
+    strncpy(key, partition->label, IAP_NVS_KEY_MAX_LEN);
+    key[IAP_NVS_KEY_MAX_LEN] = 0x00;
+}
+
+static void iap_invalidate_partition_sha256(const esp_partition_t *partition)
+{
+    char key[IAP_NVS_KEY_MAX_LEN + 1];
+    iap_get_nvs_key(partition, key);
+    
+    nvs_handle handle;
+    if (nvs_open(IAP_NVS_HASH_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK) {
+        if (nvs_erase_key(handle, key) == ESP_OK) {
+            nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+}
+
+static iap_err_t iap_hash_partition(const esp_partition_t *partition, size_t len, uint8_t *sha256)
+{
+    mbedtls_sha256_context sha256Context;
+    mbedtls_sha256_init(&sha256Context);
+    mbedtls_sha256_starts(&sha256Context, 0);
+    
+    iap_err_t result = iap_hash_range(partition, 0, len, &sha256Context);
+    
+    mbedtls_sha256_finish(&sha256Context, sha256);
+    mbedtls_sha256_free(&sha256Context);
+    return result;
+}
+
+// Adds 'len' bytes of the partition, starting at 'offset', to the hash.
+// The windows end at MMU page boundaries, so that each maps a single page.
+static iap_err_t iap_hash_range(const esp_partition_t *partition, size_t offset, size_t len, mbedtls_sha256_context *sha256Context)
+{
+    size_t end = offset + len;
+    while (offset < end) {
+        
+        size_t windowLen = MIN(IAP_MMAP_WINDOW_SIZE - (partition->address + offset) % IAP_MMAP_WINDOW_SIZE, end - offset);
+        const void *window;
+        spi_flash_mmap_handle_t mmapHandle;
+        if (esp_partition_mmap(partition, offset, windowLen, SPI_FLASH_MMAP_DATA, &window, &mmapHandle) != ESP_OK) {
+            ESP_LOGE(TAG, "iap_hash_range: failed to map partition '%s' at offset 0x%08x!", partition->label, offset);
+            return IAP_FAIL;
+        }
+        mbedtls_sha256_update(sha256Context, (const unsigned char *)window, windowLen);
+        spi_flash_munmap(mmapHandle);
+        offset += windowLen;
+    }
+    
+    return IAP_OK;
+}
+
+static iap_err_t iap_verify_sha256(const uint8_t *expectedSha256)
+{
+    size_t len = iap_state.cur_flash_address - iap_state.partition_to_program->address;
+    TickType_t startTicks = xTaskGetTickCount();
+    
+    uint8_t sha256[32];
+    iap_err_t result = iap_hash_partition(iap_state.partition_to_program, len, sha256);
+    if (result != IAP_OK) {
+        return result;
+    }
+    
+    uint32_t verifyMillisec = (xTaskGetTickCount() - startTicks) * portTICK_PERIOD_MS;
+    ESP_LOGI(TAG, "iap_verify_sha256: verified %u bytes in %u ms (%u ms/MB).", len, verifyMillisec,
+             len > 0 ? (uint32_t)((uint64_t)verifyMillisec * 1024 * 1024 / len) : 0);
+    
+    if (memcmp(sha256, expectedSha256, sizeof(sha256))) {
+        ESP_LOGE(TAG, "iap_verify_sha256: the flash contents don't match the written data!");
+        return IAP_ERR_VERIFY_FAILED;
+    }
+    
+    return IAP_OK;
+}
+
+static esp_err_t iap_read_journal(iap_journal_t *journal)
+{
+    nvs_handle handle;
+    esp_err_t result = nvs_open(IAP_NVS_JOURNAL_NAMESPACE, NVS_READONLY, &handle);
+    if (result != ESP_OK) {
+        return result;
+    }
+    
+    size_t len = sizeof(iap_journal_t);
+    result = nvs_get_blob(handle, IAP_JOURNAL_KEY, journal, &len);
+    nvs_close(handle);
+    
+    if (result == ESP_OK && len != sizeof(iap_journal_t)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    journal->label[sizeof(journal->label) - 1] = 0x00;
+    return result;
+}
+
+static void iap_write_journal()
+{
+    iap_journal_t journal;
+    memset(&journal, 0, sizeof(journal));
+    strncpy(journal.label, iap_state.partition_to_program->label, sizeof(journal.label) - 1);
+    memcpy(journal.image_id, iap_state.image_id, IAP_IMAGE_ID_LEN);
+    journal.offset = iap_state.cur_flash_address - iap_state.partition_to_program->address;
+    
+    // Without the journal, the session just can't be resumed.
+    nvs_handle handle;
+    if (nvs_open(IAP_NVS_JOURNAL_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        ESP_LOGW(TAG, "iap_write_journal: failed to open NVS.");
+        return;
+    }
+    
+    if (nvs_set_blob(handle, IAP_JOURNAL_KEY, &journal, sizeof(journal)) == ESP_OK && nvs_commit(handle) == ESP_OK) {
+        ESP_LOGD(TAG, "iap_write_journal: offset %u journaled.", journal.offset);
+    }
+    nvs_close(handle);
 }
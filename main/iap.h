@@ -32,6 +32,9 @@
 #ifndef __IAP__
 #define __IAP__ 1
 
+#include "esp_partition.h"
+#include "mbedtls/sha256.h"
+
 
 typedef int32_t iap_err_t;
 
@@ -44,6 +47,23 @@ typedef int32_t iap_err_t;
 #define IAP_ERR_NO_SESSION              0x105
 #define IAP_ERR_PARTITION_NOT_FOUND     0x106
 #define IAP_ERR_WRITE_FAILED            0x107
+#define IAP_ERR_VERIFY_FAILED           0x108
+
+// Length of the image ID of resumable sessions (e.g. the SHA-256 hash of the image).
+#define IAP_IMAGE_ID_LEN 32
+
+
+// Chooses the app partition to program from the OTA slots other than the
+// running one. The candidates are ordered by subtype, starting after the
+// running partition, so candidates[0] is the default rotation.
+typedef const esp_partition_t *(*iap_slot_policy_t)(const esp_partition_t **candidates, int nofCandidates, void *arg);
+
+// SHA-256 hashes of the new image, block by block, for iap_slot_policy_best_match.
+typedef struct iap_block_hashes_ {
+    const uint8_t (*hashes)[32];
+    int nof_blocks;
+    size_t block_size;
+} iap_block_hashes_t;
 
 
 // Call once at application startup, before calling any other function of this module.
@@ -53,14 +73,91 @@ iap_err_t iap_init();
 // Sets the programming pointer to the start of the next OTA flash partition.
 iap_err_t iap_begin();
 
+// Like iap_begin, but the session survives power loss and aborts: the last
+// written and verified offset is journaled in NVS every 64k. If the journal
+// belongs to the same image (identified by 'imageId'), the interrupted session
+// is resumed without erasing the data already written, and 'offset' is set to
+// the number of bytes already in the flash; continue writing from there.
+// Otherwise, a new session is started at offset 0.
+// The partition is written without an OTA handle; the image is validated on commit.
+iap_err_t iap_begin_resumable(const uint8_t *imageId, size_t *offset);
+
+// Discards the journal, e.g. if the data of the session is invalid.
+void iap_clear_journal();
+
+// Adds the data which has been written in the current session (e.g. before
+// it was resumed) to the SHA-256 hash.
+iap_err_t iap_hash_written_data(mbedtls_sha256_context *sha256Context);
+
+// Sets the policy to choose the partition programmed by iap_begin.
+// 'arg' is passed to the policy. With NULL (default), the OTA slots are used in turn.
+void iap_set_slot_policy(iap_slot_policy_t policy, void *arg);
+
+// Slot policy: the partition with the fewest programming sessions.
+const esp_partition_t *iap_slot_policy_least_worn(const esp_partition_t **candidates, int nofCandidates, void *arg);
+
+// Slot policy: the partition whose contents already match most blocks of the
+// new image ('arg' is an iap_block_hashes_t). Reads all candidates completely.
+const esp_partition_t *iap_slot_policy_best_match(const esp_partition_t **candidates, int nofCandidates, void *arg);
+
+// Returns the number of blocks of the image which the partition already contains.
+int iap_count_matching_blocks(const esp_partition_t *partition, const iap_block_hashes_t *image);
+
+// Returns the number of programming sessions of the partition (stored in NVS).
+uint32_t iap_get_write_count(const esp_partition_t *partition);
+
+// Limits the share of time spent writing the flash to 'percent' (1..100, 0 = 100):
+// after each write, the calling task sleeps long enough to keep the duty cycle,
+// so that other tasks get the CPU and the flash cache. Can be changed at any time.
+void iap_set_flash_duty_cycle(uint32_t percent);
+
+// Calculates the SHA-256 hash of the first 'len' bytes of the partition.
+// The hash is cached in NVS until the partition is programmed again.
+iap_err_t iap_get_partition_sha256(const esp_partition_t *partition, size_t len, uint8_t *sha256);
+
+// Returns the OTA app partition (other than the running one) whose first 'len'
+// bytes have the specified SHA-256 hash, or NULL.
+// The partition found via the cached hash is hashed again to confirm it.
+const esp_partition_t *iap_find_partition_with_image(size_t len, const uint8_t *sha256);
+
+// Makes an app partition which already contains a valid image the boot partition,
+// without programming it. Not permitted while a programming session is open.
+iap_err_t iap_activate_partition(const esp_partition_t *partition);
+
+// Like iap_begin, but programs any partition, looked up by type, subtype (or
+// ESP_PARTITION_SUBTYPE_ANY) and label (or NULL). An app partition becomes the
+// boot partition on commit.
+iap_err_t iap_begin_partition(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label);
+
+// Like iap_begin, but programs the data partition with the specified label
+// (e.g. a SPIFFS image) instead of the next app partition.
+// If the partition table contains the pair "<label>_a" and "<label>_b" instead,
+// the inactive partition of the pair is programmed and becomes the active one
+// on commit (A/B swap, the active slot is stored in NVS).
+// Data partitions are erased sector by sector ahead of writing, and read back
+// every 64k (and on commit) to compare the hash of the flash with the written data.
+iap_err_t iap_begin_data_partition(const char *label);
+
+// Returns the data partition with the specified label or, for an A/B pair,
+// the active partition of the pair. NULL if there is no such partition.
+const esp_partition_t *iap_get_data_partition(const char *label);
+
 // Call to write a block of data to the current location in flash.
+// Full 4k pages are written directly from 'bytes' whenever the flash address
+// is page-aligned; only the remaining bytes are copied to the page buffer.
 // If the write fails, you need to abort the current programming session
 // with 'iap_abort' and start again from the beginning.
-iap_err_t iap_write(uint8_t *bytes, uint16_t len);
+iap_err_t iap_write(const uint8_t *bytes, size_t len);
 
 // Call to close a programming session and activate the programmed partition.
 iap_err_t iap_commit();
 
+// Like iap_commit, but first reads back everything written in this session
+// (memory-mapped, in 64k windows) and compares its SHA-256 hash with 'sha256',
+// e.g. the hash calculated while downloading the data. On a mismatch, the session
+// is aborted instead and IAP_ERR_VERIFY_FAILED is returned.
+iap_err_t iap_commit_verified(const uint8_t *sha256);
+
 // Abort the current programming session.
 iap_err_t iap_abort();
 
@@ -0,0 +1,221 @@
+//
+//  iap_cbor.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  This module reads CBOR (RFC 7049) encoded data in place, without
+//  allocating memory. Only definite length items are supported.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_log.h"
+
+#include "iap_cbor.h"
+
+
+#define TAG "iap_cbor"
+
+
+static int iap_cbor_skip_nested(iap_cbor_reader_t *reader, int depth);
+
+
+void iap_cbor_reader_init(iap_cbor_reader_t *reader, const uint8_t *data, size_t len)
+{
+    reader->data = data;
+    reader->len = len;
+    reader->pos = 0;
+}
+
+int iap_cbor_at_end(iap_cbor_reader_t *reader)
+{
+    return reader->pos >= reader->len;
+}
+
+int iap_cbor_peek_major(iap_cbor_reader_t *reader)
+{
+    if (iap_cbor_at_end(reader)) {
+        return -1;
+    }
+    return reader->data[reader->pos] >> 5;
+}
+
+int iap_cbor_read_head(iap_cbor_reader_t *reader, int *major, uint64_t *argument)
+{
+    if (iap_cbor_at_end(reader)) {
+        return -1;
+    }
+    
+    uint8_t initialByte = reader->data[reader->pos++];
+    uint8_t additionalInfo = initialByte & 0x1f;
+    *major = initialByte >> 5;
+    
+    if (additionalInfo < 24) {
+        *argument = additionalInfo;
+        return 0;
+    }
+    
+    // 24..27: the argument follows in 1, 2, 4 or 8 bytes (big endian).
+    // 28..31: reserved or indefinite length, not supported.
+    if (additionalInfo > 27) {
+        ESP_LOGD(TAG, "iap_cbor_read_head: unsupported additional info %d", additionalInfo);
+        return -1;
+    }
+    
+    size_t nofBytes = 1 << (additionalInfo - 24);
+    if (reader->len - reader->pos < nofBytes) {
+        return -1;
+    }
+    
+    uint64_t value = 0;
+    for (size_t i = 0; i < nofBytes; i++) {
+        value = (value << 8) | reader->data[reader->pos++];
+    }
+    *argument = value;
+    
+    return 0;
+}
+
+int iap_cbor_read_int(iap_cbor_reader_t *reader, int64_t *value)
+{
+    int major;
+    uint64_t argument;
+    if (iap_cbor_read_head(reader, &major, &argument)) {
+        return -1;
+    }
+    
+    if ((major != IAP_CBOR_MAJOR_UINT && major != IAP_CBOR_MAJOR_NINT) || argument > INT64_MAX) {
+        return -1;
+    }
+    
+    // A negative integer n is encoded as -1 - n.
+    *value = major == IAP_CBOR_MAJOR_UINT ? (int64_t)argument : -1 - (int64_t)argument;
+    return 0;
+}
+
+int iap_cbor_read_string(iap_cbor_reader_t *reader, int major, const uint8_t **str, size_t *len)
+{
+    int actualMajor;
+    uint64_t argument;
+    if (iap_cbor_read_head(reader, &actualMajor, &argument)) {
+        return -1;
+    }
+    
+    if (actualMajor != major || argument > reader->len - reader->pos) {
+        return -1;
+    }
+    
+    *str = &reader->data[reader->pos];
+    *len = (size_t)argument;
+    reader->pos += (size_t)argument;
+    return 0;
+}
+
+int iap_cbor_skip(iap_cbor_reader_t *reader)
+{
+    return iap_cbor_skip_nested(reader, 0);
+}
+
+size_t iap_cbor_encode_head(uint8_t *buf, int major, uint64_t argument)
+{
+    uint8_t initialByte = major << 5;
+    
+    if (argument < 24) {
+        buf[0] = initialByte | (uint8_t)argument;
+        return 1;
+    }
+    
+    size_t nofBytes;
+    if (argument <= 0xff) {
+        buf[0] = initialByte | 24;
+        nofBytes = 1;
+    } else if (argument <= 0xffff) {
+        buf[0] = initialByte | 25;
+        nofBytes = 2;
+    } else if (argument <= 0xffffffff) {
+        buf[0] = initialByte | 26;
+        nofBytes = 4;
+    } else {
+        buf[0] = initialByte | 27;
+        nofBytes = 8;
+    }
+    
+    for (size_t i = 0; i < nofBytes; i++) {
+        buf[nofBytes - i] = (uint8_t)(argument >> (8 * i));
+    }
+    
+    return nofBytes + 1;
+}
+
+static int iap_cbor_skip_nested(iap_cbor_reader_t *reader, int depth)
+{
+    if (depth > IAP_CBOR_MAX_DEPTH) {
+        ESP_LOGD(TAG, "iap_cbor_skip_nested: nesting too deep");
+        return -1;
+    }
+    
+    int major;
+    uint64_t argument;
+    if (iap_cbor_read_head(reader, &major, &argument)) {
+        return -1;
+    }
+    
+    switch (major) {
+        
+        case IAP_CBOR_MAJOR_BSTR:
+        case IAP_CBOR_MAJOR_TSTR:
+            if (argument > reader->len - reader->pos) {
+                return -1;
+            }
+            reader->pos += (size_t)argument;
+            return 0;
+        
+        case IAP_CBOR_MAJOR_MAP:
+            // Each pair consists of two items.
+            if (argument > reader->len) {
+                return -1;
+            }
+            argument *= 2;
+            // Fall through.
+        
+        case IAP_CBOR_MAJOR_ARRAY:
+            // Every item needs at least one byte, which limits the loop for bogus lengths.
+            if (argument > reader->len - reader->pos) {
+                return -1;
+            }
+            for (uint64_t i = 0; i < argument; i++) {
+                if (iap_cbor_skip_nested(reader, depth + 1)) {
+                    return -1;
+                }
+            }
+            return 0;
+        
+        case IAP_CBOR_MAJOR_TAG:
+            return iap_cbor_skip_nested(reader, depth + 1);
+        
+        default:
+            // Integers and simple values consist of the head only.
+            return 0;
+    }
+}
@@ -0,0 +1,84 @@
+//
+//  iap_cbor.h
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  This module reads CBOR (RFC 7049) encoded data in place, without
+//  allocating memory. Only definite length items are supported.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __IAP_CBOR__
+#define __IAP_CBOR__ 1
+
+
+// CBOR major types.
+#define IAP_CBOR_MAJOR_UINT     0
+#define IAP_CBOR_MAJOR_NINT     1
+#define IAP_CBOR_MAJOR_BSTR     2
+#define IAP_CBOR_MAJOR_TSTR     3
+#define IAP_CBOR_MAJOR_ARRAY    4
+#define IAP_CBOR_MAJOR_MAP      5
+#define IAP_CBOR_MAJOR_TAG      6
+#define IAP_CBOR_MAJOR_SIMPLE   7
+
+// Maximum nesting of arrays and maps skipped with iap_cbor_skip.
+#define IAP_CBOR_MAX_DEPTH      8
+
+
+typedef struct iap_cbor_reader_ {
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+} iap_cbor_reader_t;
+
+
+void iap_cbor_reader_init(iap_cbor_reader_t *reader, const uint8_t *data, size_t len);
+
+// Returns 1 if all data has been read.
+int iap_cbor_at_end(iap_cbor_reader_t *reader);
+
+// Peek at the major type of the next item. Returns -1 at the end of the data.
+int iap_cbor_peek_major(iap_cbor_reader_t *reader);
+
+// Read the head of the next item: the major type and the argument (the value
+// of an integer, the length of a string, the number of array items or map
+// pairs, the tag number). Returns 0 on success.
+int iap_cbor_read_head(iap_cbor_reader_t *reader, int *major, uint64_t *argument);
+
+// Read an unsigned or negative integer which fits into an int64_t.
+int iap_cbor_read_int(iap_cbor_reader_t *reader, int64_t *value);
+
+// Read a byte string (IAP_CBOR_MAJOR_BSTR) or text string (IAP_CBOR_MAJOR_TSTR).
+// The string is not copied, *str points into the data.
+int iap_cbor_read_string(iap_cbor_reader_t *reader, int major, const uint8_t **str, size_t *len);
+
+// Skip the next item, including the contents of arrays, maps and tags.
+int iap_cbor_skip(iap_cbor_reader_t *reader);
+
+// Encode the head of an item. buf needs to have room for 9 bytes.
+// Returns the number of bytes written.
+size_t iap_cbor_encode_head(uint8_t *buf, int major, uint64_t argument);
+
+
+#endif // __IAP_CBOR__
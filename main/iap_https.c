@@ -28,26 +28,44 @@
 //
 
 #include <string.h>
+#include <time.h>
 
 #include "esp_system.h"
 #include "esp_event_loop.h"
+#include "esp_wifi.h"
 #include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "nvs.h"
 
 #include "freertos/event_groups.h"
+#include "freertos/queue.h"
+
+#include "mbedtls/sha256.h"
+
+#include "lwip/sockets.h"
 
 #include "wifi_sta.h"
+#include "https_transport.h"
 #include "wifi_tls.h"
+#include "dns_txt.h"
 #include "https_client.h"
 #include "iap.h"
+#include "iap_metadata.h"
 #include "iap_https.h"
 
 
 #define TAG "fwup_wifi"
 
+// NVS namespace for the installed versions of the components.
+#define IAP_HTTPS_NVS_NAMESPACE "iap_https"
+
 
 // The TLS context to communicate with the firmware update server.
 static struct wifi_tls_context_ *tls_context;
 
+// The transport used for all requests (TLS unless configured otherwise).
+static https_transport_t transport;
+
 // Module configuration.
 static iap_https_config_t *fwupdater_config;
 
@@ -57,30 +75,242 @@ static http_request_t http_metadata_request;
 // The firmware image request.
 static http_request_t http_firmware_data_request;
 
-// The event group for our processing task.
-#define FWUP_CHECK_FOR_UPDATE (1 << 0)
-#define FWUP_DOWNLOAD_IMAGE   (1 << 1)
-static EventGroupHandle_t event_group;
+// The long-poll request to the notify endpoint (if configured).
+static http_request_t http_notify_request;
+static char notify_request_headers[128];
+static int has_notification;
+static uint32_t nof_failed_notifications;
+
+// Version of the metadata of the last check which found nothing to install,
+// -1 if unknown. The DNS pre-check compares the announced version with it.
+static int up_to_date_version = -1;
+
+// Set if the server has announced a new version, which bypasses the DNS pre-check.
+static int is_check_forced;
+
+// The metadata is parsed while it is received (text format) or collected
+// and decoded at the end (CBOR format).
+static iap_metadata_parser_t metadata_parser;
+static iap_metadata_t metadata;
+static uint8_t metadata_cbor[IAP_METADATA_MAX_CBOR_LEN];
+static size_t metadata_nof_bytes_received;
+static int metadata_is_cbor;
+
+// Metadata of the image which is being downloaded, checked before the image is committed.
+static iap_metadata_t update_metadata;
+static mbedtls_sha256_context update_sha256;
+
+// Parts of the update which need to be installed: the firmware image and
+// the components (bit n = update_metadata.components[n]).
+static int update_firmware;
+static uint32_t update_component_mask;
+
+// Component which is currently being downloaded, or -1 for the firmware image.
+static int update_component_ix;
+
+// Set while the connection to the server is open and can be re-used.
+static int is_connected;
+
+// Device identification, sent with all requests.
+static char device_id[13];
+static char request_headers[96];
+
+// Headers of a firmware request which resumes an interrupted download
+// (request_headers with a Range header).
+static char resume_request_headers[128];
+
+// Staging buffers in internal RAM leave at least this much free heap for
+// TLS and the application.
+#define IAP_HTTPS_STAGING_HEAP_RESERVE (48 * 1024)
+
+// If the image doesn't fit, staging is only used with windows of at least this size.
+#define IAP_HTTPS_MIN_STAGING_WINDOW (64 * 1024)
+
+// Staging windows are a multiple of this size, for the zero-copy path of iap_write.
+#define IAP_HTTPS_STAGING_WINDOW_ALIGN 4096
+
+// Maximum time to wait for the answer to the DNS pre-check.
+#define IAP_HTTPS_DNS_PRECHECK_TIMEOUT_MS 3000
+
+// Maximum length of the DNS announcement.
+#define IAP_HTTPS_DNS_PRECHECK_MAX_LEN 256
+
+// Earlier system times mean that the clock hasn't been set (2017-01-01).
+#define IAP_HTTPS_MIN_VALID_TIME 1483228800
+
+// Hold time of notify requests if not configured.
+#define IAP_HTTPS_NOTIFY_DEFAULT_HOLD_TIME_S 300
+
+// Time to wait for the answer to a notify request in addition to the hold time.
+#define IAP_HTTPS_NOTIFY_READ_MARGIN_S 15
+
+// Delay before the next notify request after a failed one; doubles with each
+// consecutive failure, up to 64 times this value.
+#define IAP_HTTPS_NOTIFY_RETRY_DELAY_S 30
+
+// Delay before retrying a failed first check until its deadline.
+#define IAP_HTTPS_FIRST_CHECK_RETRY_MS 2000
+
+// Maximum time to wait for a DNS server after connecting.
+#define IAP_HTTPS_DNS_WAIT_MS 5000
+
+// While waiting for the network, the interval to check for queued commands
+// and for a DNS server.
+#define IAP_HTTPS_NETWORK_POLL_MS 100
+
+// After a timeout, don't wait for a DNS server again until one shows up.
+static int has_dns_wait_timed_out;
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+// Commands for our processing task, and its state.
+#define IAP_HTTPS_COMMAND_QUEUE_LEN 8
+static QueueHandle_t command_queue;
+static volatile iap_https_state_t state;
+
+// Set while a check command is queued, to avoid duplicate checks.
+static volatile int is_check_queued;
+
+// Pause or cancel command which stops the download in progress (0 if none).
+static volatile int stop_command;
+
+// While paused: the state before the pause.
+static iap_https_state_t paused_state;
+
+// Set if a check was skipped while paused, or deferred by a command while
+// waiting for the network (the check re-arms the polling timer, so it is
+// made as soon as the task is idle and not paused).
+static int is_check_missed;
+
+// Delay of the first check after the network is ready, to spread the first
+// checks of devices which start at the same time (0 once it has elapsed).
+static uint32_t first_check_delay_ms;
+
+// Set if the last check found an update which hasn't been installed yet.
+static int is_update_pending;
 
 // The timer for the periodic checking.
 static TimerHandle_t check_for_updates_timer;
 
+// Per-device pseudo-random sequence for the jitter of the polling interval.
+static uint32_t jitter_state;
+
+// Number of consecutive failed checks, for the backoff of the polling interval.
+static uint32_t nof_failed_checks;
+static int has_request_failed;
+
+// Delay until the next check requested by the server (Retry-After, or
+// Cache-Control max-age of the metadata response if longer than the polling
+// interval), 0 if none.
+static uint32_t server_delay_s;
+
 static int has_iap_session;
 static int has_new_firmware;
 static int total_nof_bytes_received;
+static int total_nof_bytes_written;
+
+// With use_staging_buffer, the received data is collected here and programmed
+// when the buffer is full or after the download has been completed.
+static uint8_t *staging_buffer;
+static size_t staging_buffer_size;
+static size_t staging_nof_bytes;
+static int is_staging_complete;
+
+// Number of bytes of the firmware image which were already in the flash
+// when the download was started (resumed session).
+static size_t resume_offset;
+
+// Default task configuration.
+#define IAP_HTTPS_DEFAULT_TASK_PRIORITY 1
+#define IAP_HTTPS_DEFAULT_TASK_STACK_SIZE 4096
+#define IAP_HTTPS_DEFAULT_FLASH_TASK_STACK_SIZE 3072
+
+// In split mode, the data is passed to the flash task in two alternating buffers.
+#define IAP_HTTPS_NOF_FLASH_BUFFERS 2
+#define IAP_HTTPS_FLASH_BUFFER_SIZE 4096
+
+typedef struct iap_https_flash_buffer_ {
+    uint8_t *bytes;
+    size_t len;
+} iap_https_flash_buffer_t;
+
+static TaskHandle_t update_task;
+static TaskHandle_t flash_task;
+
+// Buffers with data to be written by the flash task, and buffers which can be filled.
+static QueueHandle_t flash_write_queue;
+static QueueHandle_t flash_free_queue;
+
+// Result of the writes of the flash task in the current session.
+static volatile iap_err_t flash_task_result;
+
+// Performance figures, see iap_https_get_statistics.
+static iap_https_statistics_t statistics;
+static TickType_t check_start_ticks;
+static TickType_t update_start_ticks;
+static TickType_t download_start_ticks;
+static uint32_t update_nof_connections;
+
+// Progress of the current download, see iap_https_report_progress.
+#define IAP_HTTPS_DEFAULT_PROGRESS_INTERVAL_MS 1000
+static iap_https_progress_t progress;
+static TickType_t progress_ticks;
+static int progress_bytes;
+static int progress_start_bytes;
+static int is_progress_started;
+static int is_download_complete;
 
 static void iap_https_periodic_check_timer_callback(TimerHandle_t xTimer);
 static void iap_https_task(void *pvParameter);
 static void iap_https_prepare_timer();
+static uint32_t iap_https_get_poll_delay_ms();
+static uint32_t iap_https_jitter(uint32_t range);
 static void iap_https_trigger_processing();
+static int iap_https_wait_for_network();
+static int iap_https_delay_first_check();
+static int iap_https_is_first_check_due();
+static void iap_https_record_first_check(int isSuccess);
 static void iap_https_check_for_update();
+static void iap_https_process_command(iap_https_command_t command);
+static void iap_https_download_update();
+static int iap_https_dns_precheck();
+static void iap_https_wait_for_notification();
+static void iap_https_interrupt_notification();
 static void iap_https_download_image();
+static void iap_https_download_component(int componentIx);
+static int iap_https_activate_existing_image();
+static void iap_https_reboot_if_configured();
+static http_err_t iap_https_send_request(http_request_t *request);
+static int iap_https_connect();
+static void iap_https_disconnect();
+static iap_err_t iap_https_begin_session();
+static iap_err_t iap_https_write(const uint8_t *bytes, size_t len);
+static iap_err_t iap_https_queue_write(const uint8_t *bytes, size_t len);
+static iap_err_t iap_https_wait_for_flash_task();
+static void iap_https_flash_task(void *pvParameter);
+static void iap_https_start_tasks();
+static void iap_https_finish_download();
+static void iap_https_abort_session();
+static void iap_https_start_progress(int contentLength);
+static void iap_https_report_progress(iap_https_phase_t phase, int isForced);
+static void iap_https_alloc_staging_buffer(int contentLength);
+static iap_err_t iap_https_flush_staging_buffer();
+static void iap_https_free_staging_buffer();
+static int iap_https_is_in_rollout(const iap_metadata_t *md);
+static int iap_https_get_component_version(const char *name);
+static void iap_https_set_component_version(const char *name, int version);
+static void iap_https_init_request_headers();
+static void iap_https_sample_heap();
 
 http_continue_receiving_t iap_https_metadata_headers_callback(struct http_request_ *request, int statusCode, int contentLength);
 http_continue_receiving_t iap_https_metadata_body_callback(struct http_request_ *request, size_t bytesReceived);
 http_continue_receiving_t iap_https_firmware_headers_callback(struct http_request_ *request, int statusCode, int contentLength);
 http_continue_receiving_t iap_https_firmware_body_callback(struct http_request_ *request, size_t bytesReceived);
 void iap_https_error_callback(struct http_request_ *request, http_err_t error, int additionalInfo);
+http_continue_receiving_t iap_https_notify_headers_callback(struct http_request_ *request, int statusCode, int contentLength);
+http_continue_receiving_t iap_https_notify_body_callback(struct http_request_ *request, size_t bytesReceived);
+void iap_https_notify_error_callback(struct http_request_ *request, http_err_t error, int additionalInfo);
 
 
 int iap_https_init(iap_https_config_t *config)
@@ -91,23 +321,32 @@ int iap_https_init(iap_https_config_t *config)
     
     fwupdater_config = config;
     
-    // Initialise the HTTPS context to the OTA server.
+    // Initialise the HTTPS context to the OTA server, unless the application
+    // provides its own transport.
     
-    wifi_tls_init_struct_t tlsInitStruct = {
-        .server_host_name = config->server_host_name,
-        .server_port = config->server_port,
-        .server_root_ca_public_key_pem = config->server_root_ca_public_key_pem,
-        .peer_public_key_pem = config->peer_public_key_pem
-    };
-    tls_context = wifi_tls_create_context(&tlsInitStruct);
+    if (config->transport) {
+        transport = *config->transport;
+    } else {
+        wifi_tls_init_struct_t tlsInitStruct = {
+            .server_host_name = config->server_host_name,
+            .server_port = config->server_port,
+            .server_root_ca_public_key_pem = config->server_root_ca_public_key_pem,
+            .peer_public_key_pem = config->peer_public_key_pem
+        };
+        tls_context = wifi_tls_create_context(&tlsInitStruct);
+        wifi_tls_init_transport(tls_context, &transport);
+    }
     
     
     // Initialise two requests, one to get the metadata and one to get the actual firmware image.
     
+    iap_https_init_request_headers();
+    
     http_metadata_request.verb = HTTP_GET;
     http_metadata_request.host = config->server_host_name;
     http_metadata_request.path = config->server_metadata_path;
-    http_metadata_request.response_mode = HTTP_WAIT_FOR_COMPLETE_BODY;
+    http_metadata_request.additional_headers = request_headers;
+    http_metadata_request.response_mode = HTTP_STREAM_BODY;
     http_metadata_request.response_buffer_len = 512;
     http_metadata_request.response_buffer = malloc(http_metadata_request.response_buffer_len * sizeof(char));
     http_metadata_request.error_callback = iap_https_error_callback;
@@ -117,20 +356,41 @@ int iap_https_init(iap_https_config_t *config)
     http_firmware_data_request.verb = HTTP_GET;
     http_firmware_data_request.host = config->server_host_name;
     http_firmware_data_request.path = config->server_firmware_path;
+    http_firmware_data_request.additional_headers = request_headers;
     http_firmware_data_request.response_mode = HTTP_STREAM_BODY;
     http_firmware_data_request.response_buffer_len = 4096;
     http_firmware_data_request.response_buffer = malloc(http_firmware_data_request.response_buffer_len * sizeof(char));
     http_firmware_data_request.error_callback = iap_https_error_callback;
     http_firmware_data_request.headers_callback = iap_https_firmware_headers_callback;
     http_firmware_data_request.body_callback = iap_https_firmware_body_callback;
+    iap_https_set_throttle(config->max_download_bytes_per_s, config->flash_duty_cycle_percent);
+    
+    // The notify request is held open by the server, so it needs a longer read timeout.
+    
+    if (config->server_notify_path[0]) {
+        uint32_t holdTimeSec = config->notify_hold_time_s ? config->notify_hold_time_s : IAP_HTTPS_NOTIFY_DEFAULT_HOLD_TIME_S;
+        sprintf(notify_request_headers, "%sPrefer: wait=%u\r\n", request_headers, holdTimeSec);
+        
+        http_notify_request.verb = HTTP_GET;
+        http_notify_request.host = config->server_host_name;
+        http_notify_request.path = config->server_notify_path;
+        http_notify_request.additional_headers = notify_request_headers;
+        http_notify_request.response_mode = HTTP_STREAM_BODY;
+        http_notify_request.response_buffer_len = 512;
+        http_notify_request.response_buffer = malloc(http_notify_request.response_buffer_len * sizeof(char));
+        http_notify_request.error_callback = iap_https_notify_error_callback;
+        http_notify_request.headers_callback = iap_https_notify_headers_callback;
+        http_notify_request.body_callback = iap_https_notify_body_callback;
+        http_notify_request.read_timeout_ms = 1000 * MIN(holdTimeSec + IAP_HTTPS_NOTIFY_READ_MARGIN_S, UINT32_MAX / 1000);
+    }
     
     // Start our processing task.
     
-    event_group = xEventGroupCreate();
+    command_queue = xQueueCreate(IAP_HTTPS_COMMAND_QUEUE_LEN, sizeof(iap_https_command_t));
 
     iap_https_prepare_timer();
     
-    xTaskCreate(&iap_https_task, "fwup_wifi_task", 4096, NULL, 1, NULL);
+    iap_https_start_tasks();
 
     return 0;
 }
@@ -142,6 +402,36 @@ int iap_https_check_now()
     return 0;
 }
 
+int iap_https_send_command(iap_https_command_t command)
+{
+    ESP_LOGD(TAG, "iap_https_send_command: %d", command);
+    
+    if (command == IAP_HTTPS_CMD_CHECK) {
+        iap_https_trigger_processing();
+        return 0;
+    }
+    
+    // The download runs in our task, so it checks this flag while receiving data.
+    // It is set before queueing, so that the command can't be processed first.
+    int previousStopCommand = stop_command;
+    if (command == IAP_HTTPS_CMD_PAUSE || command == IAP_HTTPS_CMD_CANCEL) {
+        stop_command = command;
+    }
+    
+    if (xQueueSend(command_queue, &command, 0) != pdTRUE) {
+        ESP_LOGE(TAG, "iap_https_send_command: command queue full");
+        stop_command = previousStopCommand;
+        return -1;
+    }
+    iap_https_interrupt_notification();
+    return 0;
+}
+
+iap_https_state_t iap_https_get_state()
+{
+    return state;
+}
+
 int iap_https_update_in_progress()
 {
     return has_iap_session;
@@ -152,24 +442,104 @@ int iap_https_new_firmware_installed()
     return has_new_firmware;
 }
 
+int iap_https_set_throttle(uint32_t maxBytesPerSec, uint32_t flashDutyCyclePercent)
+{
+    ESP_LOGD(TAG, "iap_https_set_throttle: %d bytes/s, flash duty cycle %d%%", maxBytesPerSec, flashDutyCyclePercent);
+    
+    if (!fwupdater_config) {
+        ESP_LOGE(TAG, "iap_https_set_throttle: the module hasn't been initialized!");
+        return -1;
+    }
+    
+    // Only the image downloads are limited, the metadata is small.
+    // The limits are kept in the request and in the iap module, not in the configuration.
+    http_firmware_data_request.max_bytes_per_s = maxBytesPerSec;
+    iap_set_flash_duty_cycle(flashDutyCyclePercent);
+    return 0;
+}
+
+void iap_https_get_statistics(iap_https_statistics_t *stats)
+{
+    // The high-water mark is the minimum unused stack (in bytes on the ESP32).
+    if (update_task) {
+        statistics.task_stack_min_free = uxTaskGetStackHighWaterMark(update_task);
+    }
+    if (flash_task) {
+        statistics.flash_task_stack_min_free = uxTaskGetStackHighWaterMark(flash_task);
+    }
+    *stats = statistics;
+}
+
+static void iap_https_start_tasks()
+{
+    uint32_t priority = fwupdater_config->task_priority ? fwupdater_config->task_priority : IAP_HTTPS_DEFAULT_TASK_PRIORITY;
+    uint32_t stackSize = fwupdater_config->task_stack_size ? fwupdater_config->task_stack_size : IAP_HTTPS_DEFAULT_TASK_STACK_SIZE;
+    BaseType_t coreId = fwupdater_config->pin_task_to_core ? fwupdater_config->task_core_id : tskNO_AFFINITY;
+    
+    if (fwupdater_config->use_flash_task) {
+        
+        flash_write_queue = xQueueCreate(IAP_HTTPS_NOF_FLASH_BUFFERS, sizeof(iap_https_flash_buffer_t));
+        flash_free_queue = xQueueCreate(IAP_HTTPS_NOF_FLASH_BUFFERS, sizeof(iap_https_flash_buffer_t));
+        for (int i = 0; flash_write_queue && flash_free_queue && i < IAP_HTTPS_NOF_FLASH_BUFFERS; i++) {
+            iap_https_flash_buffer_t buffer = { malloc(IAP_HTTPS_FLASH_BUFFER_SIZE), 0 };
+            if (buffer.bytes) {
+                xQueueSend(flash_free_queue, &buffer, 0);
+            }
+        }
+        
+        uint32_t flashStackSize = fwupdater_config->flash_task_stack_size
+            ? fwupdater_config->flash_task_stack_size : IAP_HTTPS_DEFAULT_FLASH_TASK_STACK_SIZE;
+        BaseType_t flashCoreId = fwupdater_config->pin_task_to_core ? fwupdater_config->flash_task_core_id : tskNO_AFFINITY;
+        
+        if (!flash_write_queue || !flash_free_queue || uxQueueMessagesWaiting(flash_free_queue) != IAP_HTTPS_NOF_FLASH_BUFFERS
+            || xTaskCreatePinnedToCore(&iap_https_flash_task, "fwup_flash_task", flashStackSize, NULL, priority, &flash_task, flashCoreId) != pdPASS)
+        {
+            // The buffers and queues are kept, they're small and not used without the task.
+            ESP_LOGE(TAG, "iap_https_start_tasks: failed to start the flash task, programming the flash in the updater task");
+            flash_task = NULL;
+        }
+    }
+    
+    if (xTaskCreatePinnedToCore(&iap_https_task, "fwup_wifi_task", stackSize, NULL, priority, &update_task, coreId) != pdPASS) {
+        ESP_LOGE(TAG, "iap_https_start_tasks: failed to start the updater task");
+        update_task = NULL;
+    }
+}
+
 static void iap_https_periodic_check_timer_callback(TimerHandle_t xTimer)
 {
-    xEventGroupSetBits(event_group, FWUP_CHECK_FOR_UPDATE);
+    iap_https_trigger_processing();
 }
 
 static void iap_https_trigger_processing()
 {
     ESP_LOGD(TAG, "iap_https_trigger_processing: checking flag");
     
-    if (xEventGroupGetBits(event_group) & FWUP_CHECK_FOR_UPDATE) {
-        ESP_LOGD(TAG, "iap_https_trigger_processing: flag is already set");
+    if (is_check_queued) {
+        ESP_LOGD(TAG, "iap_https_trigger_processing: check is already queued");
         return;
     }
 
-    ESP_LOGD(TAG, "iap_https_trigger_processing: flag is not set, setting it");
+    ESP_LOGD(TAG, "iap_https_trigger_processing: queueing a check");
     
     // Trigger processing in our task.
-    xEventGroupSetBits(event_group, FWUP_CHECK_FOR_UPDATE);
+    is_check_queued = 1;
+    iap_https_command_t command = IAP_HTTPS_CMD_CHECK;
+    if (xQueueSend(command_queue, &command, 0) != pdTRUE) {
+        ESP_LOGE(TAG, "iap_https_trigger_processing: command queue full");
+        is_check_queued = 0;
+        return;
+    }
+    iap_https_interrupt_notification();
+}
+
+// Lets a pending notify request return within 100 ms, so that our task
+// processes the queued command without waiting for the hold time.
+static void iap_https_interrupt_notification()
+{
+    if (http_notify_request.path) {
+        http_notify_request.is_cancelled = 1;
+    }
 }
 
 static void iap_https_task(void *pvParameter)
@@ -177,42 +547,256 @@ static void iap_https_task(void *pvParameter)
     ESP_LOGI(TAG, "Firmware updater task started.");
 
     // When the time has come, trigger the firmware update process.
+    // The check waits for the network itself, so that commands are processed meanwhile.
 
-    xEventGroupWaitBits(wifi_sta_get_event_group(), WIFI_STA_EVENT_GROUP_CONNECTED_FLAG, pdFALSE, pdFALSE, portMAX_DELAY);
-
-    vTaskDelay(5000 / portTICK_PERIOD_MS);
+    if (fwupdater_config->polling_interval_s > 0 || fwupdater_config->first_check_deadline_s > 0) {
+        // Spread the first checks of devices which start at the same time,
+        // unless the check is needed by a deadline.
+        if (!fwupdater_config->first_check_deadline_s) {
+            first_check_delay_ms = iap_https_jitter(1000 * fwupdater_config->first_check_spread_s);
+            ESP_LOGD(TAG, "iap_https_task: first check %d ms after the network is ready", first_check_delay_ms);
+        }
+        iap_https_trigger_processing();
+    }
 
     while (1) {
-        // Wait until we get waked up (periodically or because somebody manually
-        // requests a firmware update check) and until we're connected to the WIFI
-        // network.
-
-        BaseType_t clearOnExit = pdFALSE;
-        BaseType_t waitForAllBits = pdFALSE;
-        EventBits_t bits = xEventGroupWaitBits(event_group, FWUP_CHECK_FOR_UPDATE | FWUP_DOWNLOAD_IMAGE, clearOnExit, waitForAllBits, portMAX_DELAY);
+        // Wait for the next command (from the timer, the application or after
+        // a notification from the server).
+        // With a notify endpoint, the task doesn't sleep but waits for the server
+        // to announce a new version whenever there's nothing else to do.
+        
+        iap_https_command_t command;
+        if (xQueueReceive(command_queue, &command, 0) != pdTRUE) {
+            // Continue the work which a command has interrupted while waiting
+            // for the network (unless it is a pause or cancel, still being queued).
+            if (state == IAP_HTTPS_STATE_DOWNLOADING && !stop_command) {
+                iap_https_download_update();
+                continue;
+            }
+            if (is_check_missed && state != IAP_HTTPS_STATE_PAUSED) {
+                is_check_missed = 0;
+                iap_https_trigger_processing();
+                continue;
+            }
+            
+            // No notifications while paused, or after installing an update (which needs a re-boot first).
+            int isNotifyActive = http_notify_request.path && state != IAP_HTTPS_STATE_PAUSED && state != IAP_HTTPS_STATE_INSTALLED;
+            if (isNotifyActive) {
+                iap_https_wait_for_notification();
+                continue;
+            }
+            xQueueReceive(command_queue, &command, portMAX_DELAY);
+        }
         
-        xEventGroupWaitBits(wifi_sta_get_event_group(), WIFI_STA_EVENT_GROUP_CONNECTED_FLAG, pdFALSE, pdFALSE, portMAX_DELAY);
+        iap_https_process_command(command);
+    }
+}
 
-        // We give FWUP_DOWNLOAD_IMAGE priority because if it's set, the check for update has
-        // previously been executed and the result was that we should update the firmware.
+static void iap_https_process_command(iap_https_command_t command)
+{
+    ESP_LOGD(TAG, "iap_https_process_command: command %d in state %d", command, state);
 
-        if (bits & FWUP_DOWNLOAD_IMAGE) {
-            ESP_LOGI(TAG, "Firmware updater task will now download the new firmware image.");
-            iap_https_download_image();
-            xEventGroupClearBits(event_group, FWUP_DOWNLOAD_IMAGE);
+    switch (command) {
             
-        } else if (bits & FWUP_CHECK_FOR_UPDATE) {
+        case IAP_HTTPS_CMD_CHECK:
+            is_check_queued = 0;
+            if (state == IAP_HTTPS_STATE_PAUSED) {
+                ESP_LOGD(TAG, "iap_https_process_command: paused, skipping the check");
+                is_check_missed = 1;
+                break;
+            }
+            if (!iap_https_wait_for_network() || !iap_https_delay_first_check()) {
+                // A command arrived first: it is processed, then the check is made.
+                ESP_LOGD(TAG, "iap_https_process_command: check deferred by a command");
+                is_check_missed = 1;
+                break;
+            }
+            is_check_missed = 0;
             ESP_LOGI(TAG, "Firmware updater task checking for firmware update.");
+            iap_https_state_t previousState = state;
+            state = IAP_HTTPS_STATE_CHECKING;
+            is_update_pending = 0;
             iap_https_check_for_update();
 
             // If periodic OTA update checks are enabled, re-start the timer.
-            // Clear the bit *after* resetting the timer to avoid the race condition
-            // where the timer could have elapsed during the update check and we would
-            // immediately check again.
-            
             iap_https_prepare_timer();
-            xEventGroupClearBits(event_group, FWUP_CHECK_FOR_UPDATE);
+            
+            if (is_update_pending && !fwupdater_config->download_on_command && !stop_command) {
+                iap_https_download_update();
+            } else {
+                state = is_update_pending ? IAP_HTTPS_STATE_UPDATE_AVAILABLE
+                    : previousState == IAP_HTTPS_STATE_INSTALLED ? IAP_HTTPS_STATE_INSTALLED : IAP_HTTPS_STATE_IDLE;
+            }
+            break;
+        
+        case IAP_HTTPS_CMD_DOWNLOAD:
+            if (state == IAP_HTTPS_STATE_UPDATE_AVAILABLE) {
+                iap_https_download_update();
+            }
+            break;
+        
+        case IAP_HTTPS_CMD_PAUSE:
+            // A download in progress has already been interrupted (see stop_command)
+            // and is still in the DOWNLOADING state.
+            stop_command = 0;
+            if (state != IAP_HTTPS_STATE_PAUSED) {
+                paused_state = state;
+                state = IAP_HTTPS_STATE_PAUSED;
+            }
+            ESP_LOGI(TAG, "Firmware updater paused.");
+            break;
+        
+        case IAP_HTTPS_CMD_RESUME:
+            if (state != IAP_HTTPS_STATE_PAUSED) {
+                break;
+            }
+            ESP_LOGI(TAG, "Firmware updater resumed.");
+            state = paused_state;
+            if (state == IAP_HTTPS_STATE_DOWNLOADING) {
+                // An interrupted firmware download continues where it stopped.
+                iap_https_download_update();
+            } else if (state == IAP_HTTPS_STATE_UPDATE_AVAILABLE && !fwupdater_config->download_on_command) {
+                // The pause interrupted the check which found the update, before its download.
+                iap_https_download_update();
+            }
+            if (is_check_missed) {
+                is_check_missed = 0;
+                iap_https_trigger_processing();
+            }
+            break;
+        
+        case IAP_HTTPS_CMD_CANCEL:
+            stop_command = 0;
+            if (is_update_pending) {
+                ESP_LOGI(TAG, "Update cancelled.");
+                iap_clear_journal();
+                is_update_pending = 0;
+            }
+            // While paused, the updater remains paused.
+            if (state == IAP_HTTPS_STATE_PAUSED) {
+                paused_state = has_new_firmware ? IAP_HTTPS_STATE_INSTALLED : IAP_HTTPS_STATE_IDLE;
+            } else {
+                state = has_new_firmware ? IAP_HTTPS_STATE_INSTALLED : IAP_HTTPS_STATE_IDLE;
+            }
+            break;
+        
+        case IAP_HTTPS_CMD_APPLY:
+            if (has_new_firmware) {
+                ESP_LOGI(TAG, "Re-booting into the new firmware.");
+                esp_restart();
+            }
+            break;
+    }
+}
+
+// Downloads and installs the update found by the last check, unless
+// the download is stopped by a pause or cancel command.
+// If any command arrives while waiting for the network, it is processed first
+// and the download continues afterwards (see iap_https_task).
+static void iap_https_download_update()
+{
+    state = IAP_HTTPS_STATE_DOWNLOADING;
+    if (!iap_https_wait_for_network()) {
+        return;
+    }
+    
+    ESP_LOGI(TAG, "Firmware updater task will now download the new firmware image.");
+    iap_https_download_image();
+    
+    if (stop_command) {
+        // The pause or cancel command is processed next and sets the state;
+        // the update remains pending until then.
+        ESP_LOGI(TAG, "Download stopped.");
+        return;
+    }
+    
+    // After a failure, the next check finds the update again.
+    is_update_pending = 0;
+    state = has_new_firmware ? IAP_HTTPS_STATE_INSTALLED : IAP_HTTPS_STATE_IDLE;
+}
+
+// Waits until the WIFI network is connected and host names can be resolved.
+// A host name given as an IP address doesn't need DNS. Without a DNS server
+// (e.g. none from DHCP), the connection is attempted anyway after a while.
+// Returns 1 when the network is ready, or 0 as soon as a command is queued
+// before: the caller defers its work, so that the command is processed.
+static int iap_https_wait_for_network()
+{
+    int needsDns = inet_addr(fwupdater_config->server_host_name) == INADDR_NONE;
+    EventBits_t readyFlag = needsDns ? WIFI_STA_EVENT_GROUP_DNS_READY_FLAG : WIFI_STA_EVENT_GROUP_CONNECTED_FLAG;
+    uint32_t dnsWaitMillisec = has_dns_wait_timed_out ? 0 : IAP_HTTPS_DNS_WAIT_MS;
+    
+    while (!wifi_sta_is_connected() || (needsDns && !wifi_sta_is_dns_ready())) {
+        if (wifi_sta_is_connected()) {
+            if (dnsWaitMillisec < IAP_HTTPS_NETWORK_POLL_MS) {
+                if (!has_dns_wait_timed_out) {
+                    ESP_LOGW(TAG, "iap_https_wait_for_network: no DNS server, connecting anyway");
+                    has_dns_wait_timed_out = 1;
+                }
+                break;
+            }
+            dnsWaitMillisec -= IAP_HTTPS_NETWORK_POLL_MS;
+        }
+        
+        if (uxQueueMessagesWaiting(command_queue) > 0) {
+            return 0;
+        }
+        xEventGroupWaitBits(wifi_sta_get_event_group(), readyFlag, pdFALSE, pdFALSE, pdMS_TO_TICKS(IAP_HTTPS_NETWORK_POLL_MS));
+    }
+    if (needsDns && wifi_sta_is_dns_ready()) {
+        has_dns_wait_timed_out = 0;
+    }
+    
+    if (!statistics.network_ready_ms) {
+        statistics.network_ready_ms = MAX(xTaskGetTickCount() * portTICK_PERIOD_MS, 1);
+        ESP_LOGD(TAG, "iap_https_wait_for_network: network ready after %d ms", statistics.network_ready_ms);
+    }
+    return 1;
+}
+
+// Waits until the delay of the first check after the network is ready has elapsed.
+// Returns 0 if a command is queued before (like iap_https_wait_for_network).
+static int iap_https_delay_first_check()
+{
+    while (first_check_delay_ms) {
+        uint32_t elapsedMillisec = xTaskGetTickCount() * portTICK_PERIOD_MS - statistics.network_ready_ms;
+        if (elapsedMillisec >= first_check_delay_ms) {
+            first_check_delay_ms = 0;
+            break;
         }
+        
+        iap_https_command_t command;
+        TickType_t ticksToWait = MAX(pdMS_TO_TICKS(first_check_delay_ms - elapsedMillisec), 1);
+        if (xQueuePeek(command_queue, &command, ticksToWait) == pdTRUE) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Returns 1 while a failed first check needs to be retried before its deadline.
+static int iap_https_is_first_check_due()
+{
+    return fwupdater_config->first_check_deadline_s > 0
+        && !statistics.first_check_ms && !statistics.first_check_deadline_missed;
+}
+
+static void iap_https_record_first_check(int isSuccess)
+{
+    if (statistics.first_check_ms) {
+        return;
+    }
+    
+    uint32_t nowMillisec = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    if (isSuccess) {
+        statistics.first_check_ms = MAX(nowMillisec, 1);
+        ESP_LOGI(TAG, "First check completed %d ms after startup.", nowMillisec);
+    }
+    
+    uint32_t deadlineMillisec = 1000 * fwupdater_config->first_check_deadline_s;
+    if (deadlineMillisec > 0 && nowMillisec > deadlineMillisec && !statistics.first_check_deadline_missed) {
+        ESP_LOGE(TAG, "The first check missed its deadline of %d s after startup.", fwupdater_config->first_check_deadline_s);
+        statistics.first_check_deadline_missed = 1;
     }
 }
 
@@ -220,7 +804,7 @@ static void iap_https_prepare_timer()
 {
     // Make sure we have a timer if we need one and don't have one if we don't need one.
     
-    if (fwupdater_config->polling_interval_s > 0) {
+    if (fwupdater_config->polling_interval_s > 0 || iap_https_is_first_check_due()) {
         if (!check_for_updates_timer) {
             // We need a timer but don't have one. Create it.
             BaseType_t autoReload = pdFALSE;
@@ -233,7 +817,7 @@ static void iap_https_prepare_timer()
         
         // We need and have a timer, so make sure it uses the correct interval, then start it.
 
-        uint32_t timerMillisec = 1000 * fwupdater_config->polling_interval_s;
+        uint32_t timerMillisec = iap_https_get_poll_delay_ms();
         ESP_LOGD(TAG, "iap_https_prepare_timer: timer interval = %d ms", timerMillisec);
         TickType_t timerPeriod = pdMS_TO_TICKS(timerMillisec);
 
@@ -255,152 +839,935 @@ static void iap_https_prepare_timer()
     }
 }
 
-static void iap_https_check_for_update()
+static uint32_t iap_https_get_poll_delay_ms()
 {
-    ESP_LOGD(TAG, "iap_https_check_for_update");
+    // The server asked us to come back after a certain time: don't come back earlier.
+    if (server_delay_s > 0) {
+        uint64_t delayMillisec = 1000 * (uint64_t)server_delay_s;
+        uint64_t jitterMillisec = delayMillisec * MIN(fwupdater_config->polling_jitter_percent, 100) / 100;
+        delayMillisec += iap_https_jitter(MIN(jitterMillisec, UINT32_MAX));
+        return (uint32_t)MIN(MAX(delayMillisec, 1000), UINT32_MAX / configTICK_RATE_HZ);
+    }
     
-    int tlsResult = wifi_tls_connect(tls_context);
-    if (tlsResult) {
-        ESP_LOGE(TAG, "iap_https_check_for_update: failed to initiate SSL/TLS connection; wifi_tls_connect returned %d", tlsResult);
-        return;
+    // A failed first check is retried quickly until its deadline.
+    if (nof_failed_checks > 0 && iap_https_is_first_check_due()) {
+        return IAP_HTTPS_FIRST_CHECK_RETRY_MS;
     }
-
-    ESP_LOGI(TAG, "Requesting firmware metadata from server.");
-    http_err_t httpResult = https_send_request(tls_context, &http_metadata_request);
-    if (httpResult != HTTP_SUCCESS) {
-        ESP_LOGE(TAG, "iap_https_check_for_update: failed to send HTTPS metadata request; https_send_request returned %d", httpResult);
+    
+    uint64_t delayMillisec = 1000 * (uint64_t)fwupdater_config->polling_interval_s;
+    
+    // Exponential backoff after failed checks, e.g. while the server is overloaded.
+    uint64_t maxDelayMillisec = 1000 * (uint64_t)fwupdater_config->max_backoff_interval_s;
+    for (uint32_t i = 0; i < nof_failed_checks && delayMillisec < maxDelayMillisec; i++) {
+        delayMillisec = MIN(2 * delayMillisec, maxDelayMillisec);
     }
+    
+    // Vary the interval by +/- polling_jitter_percent.
+    uint64_t jitterMillisec = delayMillisec * MIN(fwupdater_config->polling_jitter_percent, 100) / 100;
+    jitterMillisec = MIN(jitterMillisec, UINT32_MAX / 2);
+    delayMillisec = delayMillisec - jitterMillisec + iap_https_jitter(2 * jitterMillisec);
+    
+    // pdMS_TO_TICKS calculates with 32 bits (about 12 hours at 100 Hz).
+    return (uint32_t)MIN(MAX(delayMillisec, 1000), UINT32_MAX / configTICK_RATE_HZ);
 }
 
-static void iap_https_download_image()
+// Returns a per-device pseudo-random value from 0 to 'range' (inclusive).
+static uint32_t iap_https_jitter(uint32_t range)
 {
-    int tlsResult = wifi_tls_connect(tls_context);
-    if (tlsResult) {
-        ESP_LOGE(TAG, "iap_https_download_image: failed to initiate SSL/TLS connection; wifi_tls_connect returned %d", tlsResult);
+    if (range == 0) {
+        return 0;
     }
     
-    // Make sure we open a new IAP session in the callback.
-    has_iap_session = 0;
+    // xorshift32; the state is never 0.
+    jitter_state ^= jitter_state << 13;
+    jitter_state ^= jitter_state >> 17;
+    jitter_state ^= jitter_state << 5;
     
-    ESP_LOGI(TAG, "Requesting firmware image '%s' from web server.", fwupdater_config->server_firmware_path);
-    http_err_t httpResult = https_send_request(tls_context, &http_firmware_data_request);
-    if (httpResult != HTTP_SUCCESS) {
-        ESP_LOGE(TAG, "iap_https_download_image: failed to send HTTPS firmware image request; https_send_request returned %d", httpResult);
-    }
+    return (uint32_t)((uint64_t)jitter_state * ((uint64_t)range + 1) >> 32);
 }
 
-http_continue_receiving_t iap_https_metadata_body_callback(struct http_request_ *request, size_t bytesReceived)
+static void iap_https_check_for_update()
 {
-    ESP_LOGD(TAG, "iap_https_metadata_body_callback");
+    ESP_LOGD(TAG, "iap_https_check_for_update");
     
-    // --- Process the metadata information ---
+    // Most checks find nothing new; a DNS query is much cheaper than a TLS handshake.
+    if (!is_check_forced && iap_https_dns_precheck()) {
+        ESP_LOGI(TAG, "The DNS announcement confirms version %d, skipping the metadata request.", up_to_date_version);
+        statistics.nof_dns_prechecks_up_to_date++;
+        nof_failed_checks = 0;
+        server_delay_s = 0;
+        iap_https_record_first_check(1);
+        return;
+    }
+    is_check_forced = 0;
     
-    // (Optional) interval to check for firmware updates.
-    int intervalSeconds = 0;
-    if (!http_parse_key_value_int(request->response_buffer, "INTERVAL=", &intervalSeconds)) {
-        ESP_LOGD(TAG, "[INTERVAL=] '%d'", intervalSeconds);
-        if (intervalSeconds != fwupdater_config->polling_interval_s) {
-            ESP_LOGD(TAG, "iap_https_metadata_body_callback: polling interval changed from %d s to %d s",
-                     fwupdater_config->polling_interval_s, intervalSeconds);
-            fwupdater_config->polling_interval_s = intervalSeconds;
-        }
+    check_start_ticks = xTaskGetTickCount();
+    update_nof_connections = 0;
+    
+    iap_metadata_parser_init(&metadata_parser, &metadata);
+    metadata_nof_bytes_received = 0;
+    metadata_is_cbor = 0;
+    
+    ESP_LOGI(TAG, "Requesting firmware metadata from server.");
+    has_request_failed = 0;
+    http_err_t httpResult = iap_https_send_request(&http_metadata_request);
+    if (httpResult != HTTP_SUCCESS) {
+        ESP_LOGE(TAG, "iap_https_check_for_update: failed to send HTTPS metadata request; https_send_request returned %d", httpResult);
     }
     
-    int version = 0;
-    if (!http_parse_key_value_int(request->response_buffer, "VERSION=", &version)) {
-        ESP_LOGD(TAG, "[VERSION=] '%d'", version);
+    // Back off while the server can't be reached or returns errors.
+    if (httpResult != HTTP_SUCCESS || has_request_failed) {
+        nof_failed_checks++;
     } else {
-        ESP_LOGW(TAG, "iap_https_metadata_body_callback: firmware version not provided, skipping firmware update");
-        return HTTP_STOP_RECEIVING;
+        nof_failed_checks = 0;
     }
+    iap_https_record_first_check(nof_failed_checks == 0);
     
-    char fileName[256];
-    if (!http_parse_key_value_string(request->response_buffer, "FILE=", fileName, sizeof(fileName) / sizeof(char))) {
-        ESP_LOGD(TAG, "[FILE=] '%s'", fileName);
-        strncpy(fwupdater_config->server_firmware_path, fileName, sizeof(fwupdater_config->server_firmware_path) / sizeof(char));
-    } else {
-        ESP_LOGW(TAG, "iap_https_metadata_body_callback: firmware file name not provided, skipping firmware update");
-        return HTTP_STOP_RECEIVING;
+    // An overloaded server can tell us when to come back with a cheap response
+    // (429 or 503 with Retry-After), a healthy one with the cache lifetime of the metadata.
+    // The cache lifetime only lengthens the polling interval: a short CDN default
+    // (e.g. max-age=60) must not make the whole fleet poll more often.
+    server_delay_s = 0;
+    if (httpResult == HTTP_SUCCESS && has_request_failed && http_metadata_request.retry_after_s >= 0) {
+        server_delay_s = http_metadata_request.retry_after_s;
+        ESP_LOGI(TAG, "The server asks to retry after %d s.", server_delay_s);
+    } else if (httpResult == HTTP_SUCCESS && !has_request_failed && http_metadata_request.max_age_s > 0
+               && (uint32_t)http_metadata_request.max_age_s > fwupdater_config->polling_interval_s) {
+        server_delay_s = http_metadata_request.max_age_s;
+        ESP_LOGD(TAG, "iap_https_check_for_update: metadata max-age is %d s", server_delay_s);
     }
+    
+    // Only keep the connection open if the download follows right away.
+    if (!is_update_pending || fwupdater_config->download_on_command) {
+        iap_https_disconnect();
+    }
+}
 
-
-    // --- Check if the version on the server is the same as the currently installed version ---
+// Returns 1 if the signed DNS announcement confirms the version of the last check.
+static int iap_https_dns_precheck()
+{
+    if (!fwupdater_config->dns_precheck_name || !fwupdater_config->dns_precheck_public_key_pem || up_to_date_version < 0) {
+        return 0;
+    }
     
-    if (version == fwupdater_config->current_software_version) {
-        ESP_LOGD(TAG, "iap_https_metadata_body_callback: we're up-to-date!");
-        return HTTP_STOP_RECEIVING;
+    char txt[IAP_HTTPS_DNS_PRECHECK_MAX_LEN];
+    if (dns_txt_query(fwupdater_config->dns_precheck_name, fwupdater_config->dns_precheck_server,
+                      txt, sizeof(txt), IAP_HTTPS_DNS_PRECHECK_TIMEOUT_MS) < 0)
+    {
+        return 0;
     }
     
-    ESP_LOGD(TAG, "iap_https_metadata_body_callback: our version is %d, the version on the server is %d",
-             fwupdater_config->current_software_version, version);
-
-    // --- Request the firmware image ---
-
-    xEventGroupSetBits(event_group, FWUP_DOWNLOAD_IMAGE);
+    int version;
+    int64_t expiry;
+    iap_metadata_err_t result = iap_metadata_decode_announcement(txt, fwupdater_config->dns_precheck_public_key_pem, &version, &expiry);
+    if (result != IAP_METADATA_OK) {
+        ESP_LOGW(TAG, "iap_https_dns_precheck: invalid announcement (0x%x)", result);
+        return 0;
+    }
     
-    return HTTP_STOP_RECEIVING;
+    // Without a valid system time, an expired (e.g. replayed) announcement can't be detected.
+    time_t now = time(NULL);
+    if (now < IAP_HTTPS_MIN_VALID_TIME || (int64_t)now >= expiry) {
+        ESP_LOGD(TAG, "iap_https_dns_precheck: announcement expired or system time not set");
+        return 0;
+    }
+    
+    if (version != up_to_date_version) {
+        ESP_LOGI(TAG, "The DNS announcement has version %d.", version);
+        return 0;
+    }
+    
+    return 1;
 }
 
-http_continue_receiving_t iap_https_firmware_body_callback(struct http_request_ *request, size_t bytesReceived)
+static void iap_https_wait_for_notification()
 {
-    ESP_LOGD(TAG, "iap_https_firmware_body_callback");
+    if (!iap_https_wait_for_network()) {
+        return;
+    }
     
-    // The first time we receive the callback, we neet to start the IAP session.
-    if (!has_iap_session) {
-        ESP_LOGD(TAG, "iap_https_firmware_body_callback: starting IPA session.");
-        iap_err_t result = iap_begin();
-        if (result == IAP_ERR_SESSION_ALREADY_OPEN) {
-            iap_abort();
-            result = iap_begin();
-        }
-        if (result != IAP_OK) {
-            ESP_LOGE(TAG, "iap_https_firmware_body_callback: iap_begin failed (%d)!", result);
-            return HTTP_STOP_RECEIVING;
-        }
-        total_nof_bytes_received = 0;
-        has_iap_session = 1;
+    ESP_LOGD(TAG, "iap_https_wait_for_notification: waiting for the server to announce a new version");
+    
+    // Commands interrupt the notify request (see iap_https_interrupt_notification);
+    // one which arrived before the flag was cleared is processed first.
+    http_notify_request.is_cancelled = 0;
+    if (uxQueueMessagesWaiting(command_queue) > 0) {
+        return;
     }
     
-    if (bytesReceived > 0) {
-        // Write the received data to the flash.
-        iap_err_t result = iap_write((uint8_t*)request->response_buffer, bytesReceived);
-        total_nof_bytes_received += bytesReceived;
-        if (result != IAP_OK) {
-            ESP_LOGE(TAG, "iap_https_firmware_body_callback: write failed (%d), aborting firmware update!", result);
-            iap_abort();
-            return HTTP_STOP_RECEIVING;
+    has_notification = 0;
+    has_request_failed = 0;
+    http_err_t httpResult = iap_https_send_request(&http_notify_request);
+    
+    if (httpResult == HTTP_ERR_CANCELLED) {
+        ESP_LOGD(TAG, "iap_https_wait_for_notification: interrupted by a command");
+        return;
+    }
+    
+    if (httpResult == HTTP_SUCCESS && !has_request_failed) {
+        nof_failed_notifications = 0;
+        if (has_notification) {
+            ESP_LOGI(TAG, "The server announces a new firmware version.");
+            is_check_forced = 1;
+            iap_https_trigger_processing();
         }
-        return HTTP_CONTINUE_RECEIVING;
+        // Otherwise, the hold time has expired: send the next request right away,
+        // on the same connection if the server keeps it open.
+        return;
     }
     
-    // After all data has been received, we get one last callback (with bytesReceived == 0).
-    // If this happens, we need to finish the IAP session and, if configured, reboot the device.
+    // The notify endpoint isn't available; periodic polling (if enabled) continues
+    // until the next attempt. A manual check or the timer ends the delay early.
     
-    ESP_LOGD(TAG, "iap_https_firmware_body_callback: all data received (%d bytes), closing session", total_nof_bytes_received);
-    has_iap_session = 0;
+    iap_https_disconnect();
     
-    if (total_nof_bytes_received > 0) {
-        iap_err_t result = iap_commit();
-        if (result != IAP_OK) {
-            ESP_LOGE(TAG, "iap_https_firmware_body_callback: closing the session has failed (%d)!", result);
+    nof_failed_notifications++;
+    uint32_t delayMillisec = (1000 * IAP_HTTPS_NOTIFY_RETRY_DELAY_S) << MIN(nof_failed_notifications - 1, 6);
+    if (httpResult == HTTP_SUCCESS && http_notify_request.retry_after_s > 0) {
+        delayMillisec = MAX(delayMillisec, 1000 * (uint32_t)MIN(http_notify_request.retry_after_s, 24 * 3600));
+    }
+    delayMillisec += iap_https_jitter(delayMillisec / 4);
+    
+    ESP_LOGW(TAG, "Notify request failed, trying again in %d s.", delayMillisec / 1000);
+    iap_https_command_t command;
+    xQueuePeek(command_queue, &command, pdMS_TO_TICKS(delayMillisec));
+}
+
+static void iap_https_download_image()
+{
+    // All parts are downloaded over the same connection (if the server keeps it open).
+    // The firmware image comes last because the device may re-boot after installing it.
+    
+    for (int i = 0; i < update_metadata.nof_components && !stop_command; i++) {
+        if (update_component_mask & (1 << i)) {
+            iap_https_download_component(i);
+        }
+    }
+    
+    if (update_firmware && !stop_command && !iap_https_activate_existing_image()) {
+        iap_https_download_component(-1);
+    }
+    
+    iap_https_disconnect();
+}
+
+// Returns 1 if one of the OTA partitions already contains the new firmware image
+// (e.g. after a roll-back, or if the update was interrupted after iap_commit),
+// and the partition has been activated instead of downloading the image again.
+static int iap_https_activate_existing_image()
+{
+    const uint32_t requiredFields = IAP_METADATA_HAS_SIZE | IAP_METADATA_HAS_SHA256;
+    if ((update_metadata.fields & requiredFields) != requiredFields) {
+        return 0;
+    }
+    
+    const esp_partition_t *partition = iap_find_partition_with_image(update_metadata.size, update_metadata.sha256);
+    if (!partition || iap_activate_partition(partition) != IAP_OK) {
+        return 0;
+    }
+    
+    has_new_firmware = 1;
+    
+    statistics.last_update_nof_connections = update_nof_connections;
+    statistics.last_update_nof_bytes = 0;
+    statistics.last_update_duration_ms = (xTaskGetTickCount() - update_start_ticks) * portTICK_PERIOD_MS;
+    statistics.last_update_bytes_per_s = 0;
+    
+    ESP_LOGI(TAG, "Update installed: partition '%s' already contains the image, nothing downloaded.", partition->label);
+    
+    iap_https_reboot_if_configured();
+    return 1;
+}
+
+static void iap_https_reboot_if_configured()
+{
+    if (fwupdater_config->auto_reboot) {
+        ESP_LOGI(TAG, "Automatic re-boot in 2 seconds - goodbye!...");
+        vTaskDelay(2000 / portTICK_RATE_MS);
+        esp_restart();
+    }
+}
+
+static void iap_https_download_component(int componentIx)
+{
+    update_component_ix = componentIx;
+    http_firmware_data_request.path = componentIx < 0
+        ? fwupdater_config->server_firmware_path : update_metadata.components[componentIx].file;
+    
+    // Make sure we open a new IAP session in the callback.
+    has_iap_session = 0;
+    flash_task_result = IAP_OK;
+    is_progress_started = 0;
+    is_download_complete = 0;
+    
+    // The firmware image is downloaded in a resumable session, which continues
+    // where a previous download of the same image (same hash) was interrupted.
+    resume_offset = 0;
+    http_firmware_data_request.additional_headers = request_headers;
+    if (componentIx < 0 && (update_metadata.fields & IAP_METADATA_HAS_SHA256)
+        && iap_begin_resumable(update_metadata.sha256, &resume_offset) == IAP_OK)
+    {
+        has_iap_session = 1;
+        if (resume_offset > 0) {
+            snprintf(resume_request_headers, sizeof(resume_request_headers), "%sRange: bytes=%u-\r\n", request_headers, resume_offset);
+            http_firmware_data_request.additional_headers = resume_request_headers;
+            ESP_LOGI(TAG, "Resuming the download at offset %u.", resume_offset);
+        }
+    }
+    
+    ESP_LOGI(TAG, "Requesting firmware image '%s' from web server.", http_firmware_data_request.path);
+    http_err_t httpResult = iap_https_send_request(&http_firmware_data_request);
+    if (httpResult != HTTP_SUCCESS) {
+        ESP_LOGE(TAG, "iap_https_download_component: failed to send HTTPS firmware image request; https_send_request returned %d", httpResult);
+    }
+    
+    // Staged data is programmed after the request. The firmware image is
+    // always downloaded last, so we don't need the connection any more.
+    if (is_staging_complete) {
+        is_staging_complete = 0;
+        if (componentIx < 0) {
+            iap_https_disconnect();
+        }
+        iap_https_report_progress(IAP_HTTPS_PHASE_PROGRAMMING, 1);
+        if (iap_https_flush_staging_buffer() == IAP_OK) {
+            iap_https_finish_download();
+        }
+    }
+    iap_https_free_staging_buffer();
+    
+    // The session is still open if the download has been interrupted.
+    if (has_iap_session) {
+        ESP_LOGE(TAG, "iap_https_download_component: download incomplete, aborting the update of '%s'", http_firmware_data_request.path);
+        mbedtls_sha256_free(&update_sha256);
+        iap_https_abort_session();
+    }
+    
+    if (is_progress_started && !is_download_complete) {
+        iap_https_report_progress(IAP_HTTPS_PHASE_FAILED, 1);
+    }
+}
+
+static http_err_t iap_https_send_request(http_request_t *request)
+{
+    // Re-use the connection of the previous request if the server kept it open.
+    int isReused = is_connected;
+    if (!is_connected) {
+        int connectResult = iap_https_connect();
+        if (connectResult) {
+            ESP_LOGE(TAG, "iap_https_send_request: failed to connect to the server; connect returned %d", connectResult);
+            return HTTP_ERR_SEND_FAILED;
+        }
+    }
+    
+    request->keep_alive = 1;
+    http_err_t result = https_send_request(&transport, request);
+    is_connected = request->keep_alive;
+    
+    // The server may close an idle connection at any time. If it did so before
+    // answering, try again once on a new connection.
+    if (isReused && result == HTTP_ERR_CONNECTION_CLOSED) {
+        ESP_LOGD(TAG, "iap_https_send_request: connection closed by the server, reconnecting");
+        return iap_https_send_request(request);
+    }
+    
+    return result;
+}
+
+static void iap_https_init_request_headers()
+{
+    uint8_t mac[6];
+    if (esp_wifi_get_mac(ESP_IF_WIFI_STA, mac) == ESP_OK) {
+        sprintf(device_id, "%02x%02x%02x%02x%02x%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    } else {
+        ESP_LOGW(TAG, "iap_https_init_request_headers: failed to read the MAC address");
+        strcpy(device_id, "unknown");
+    }
+    
+    int len = sprintf(request_headers, "User-Agent: esp32-ota-https/%d\r\n", fwupdater_config->current_software_version);
+    if (fwupdater_config->send_device_id) {
+        sprintf(&request_headers[len], "X-Device-Id: %s\r\n", device_id);
+    }
+    
+    ESP_LOGD(TAG, "iap_https_init_request_headers: device id = %s", device_id);
+    
+    // Seed the jitter from the device id (FNV-1a), so that each device has its own
+    // but reproducible sequence of polling intervals.
+    jitter_state = 2166136261u;
+    for (const char *c = device_id; *c; c++) {
+        jitter_state = (jitter_state ^ (uint8_t)*c) * 16777619u;
+    }
+    if (!strcmp(device_id, "unknown") || jitter_state == 0) {
+        jitter_state = esp_random() | 1;
+    }
+}
+
+static int iap_https_connect()
+{
+    statistics.nof_connections++;
+    update_nof_connections++;
+    iap_https_sample_heap();
+    
+    int result = transport.connect(transport.context);
+    is_connected = (result == 0);
+    
+    iap_https_sample_heap();
+    return result;
+}
+
+static void iap_https_disconnect()
+{
+    if (is_connected) {
+        transport.close(transport.context);
+        is_connected = 0;
+    }
+}
+
+// Returns 1 if the device is one of the ROLLOUT percent of the devices which install
+// the image. The hash of the salt and the device id gives each device a fixed position
+// from 0 to 99, so a growing rollout only adds devices.
+static int iap_https_is_in_rollout(const iap_metadata_t *md)
+{
+    if (!(md->fields & IAP_METADATA_HAS_ROLLOUT) || md->rollout_percent >= 100) {
+        return 1;
+    }
+    if (md->rollout_percent <= 0) {
+        return 0;
+    }
+    
+    uint8_t hash[32];
+    mbedtls_sha256_context sha256;
+    mbedtls_sha256_init(&sha256);
+    mbedtls_sha256_starts(&sha256, 0);
+    mbedtls_sha256_update(&sha256, (const unsigned char *)md->rollout_salt, strlen(md->rollout_salt));
+    mbedtls_sha256_update(&sha256, (const unsigned char *)":", 1);
+    mbedtls_sha256_update(&sha256, (const unsigned char *)device_id, strlen(device_id));
+    mbedtls_sha256_finish(&sha256, hash);
+    mbedtls_sha256_free(&sha256);
+    
+    uint32_t value = ((uint32_t)hash[0] << 24) | ((uint32_t)hash[1] << 16) | ((uint32_t)hash[2] << 8) | hash[3];
+    int position = (int)(((uint64_t)value * 100) >> 32);
+    
+    ESP_LOGD(TAG, "iap_https_is_in_rollout: position %d, rollout %d%%", position, md->rollout_percent);
+    return position < md->rollout_percent;
+}
+
+static int iap_https_get_component_version(const char *name)
+{
+    // Components which have never been installed by the updater have version 0.
+    int32_t version = 0;
+    
+    nvs_handle handle;
+    if (nvs_open(IAP_HTTPS_NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+        nvs_get_i32(handle, name, &version);
+        nvs_close(handle);
+    }
+    
+    return version;
+}
+
+static void iap_https_set_component_version(const char *name, int version)
+{
+    nvs_handle handle;
+    esp_err_t result = nvs_open(IAP_HTTPS_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (result == ESP_OK) {
+        result = nvs_set_i32(handle, name, version);
+        if (result == ESP_OK) {
+            result = nvs_commit(handle);
         }
+        nvs_close(handle);
+    }
+    
+    if (result != ESP_OK) {
+        ESP_LOGE(TAG, "iap_https_set_component_version: failed to store the version of '%s' (%d)", name, result);
+    }
+}
+
+static void iap_https_sample_heap()
+{
+    uint32_t freeHeap = esp_get_free_heap_size();
+    if (statistics.min_free_heap_size == 0 || freeHeap < statistics.min_free_heap_size) {
+        statistics.min_free_heap_size = freeHeap;
+    }
+}
+
+http_continue_receiving_t iap_https_metadata_body_callback(struct http_request_ *request, size_t bytesReceived)
+{
+    ESP_LOGD(TAG, "iap_https_metadata_body_callback");
+    
+    if (bytesReceived > 0) {
         
-        has_new_firmware = 1;
+        // The first byte tells us which format the server uses.
+        if (metadata_nof_bytes_received == 0) {
+            metadata_is_cbor = iap_metadata_is_cbor(request->response_buffer[0]);
+        }
         
-        if (fwupdater_config->auto_reboot) {
-            ESP_LOGI(TAG, "Automatic re-boot in 2 seconds - goodbye!...");
-            vTaskDelay(2000 / portTICK_RATE_MS);
-            esp_restart();
+        if (metadata_is_cbor) {
+            // CBOR is decoded in one piece, after all data has been received.
+            if (metadata_nof_bytes_received + bytesReceived > sizeof(metadata_cbor)) {
+                ESP_LOGE(TAG, "iap_https_metadata_body_callback: CBOR metadata larger than %d bytes, skipping firmware update", sizeof(metadata_cbor));
+                return HTTP_STOP_RECEIVING;
+            }
+            memcpy(&metadata_cbor[metadata_nof_bytes_received], request->response_buffer, bytesReceived);
+        } else {
+            // The text is parsed fragment by fragment, so its size doesn't depend on the response buffer.
+            iap_metadata_parser_feed(&metadata_parser, request->response_buffer, bytesReceived);
         }
         
+        metadata_nof_bytes_received += bytesReceived;
+        return HTTP_CONTINUE_RECEIVING;
+    }
+    
+    // After all data has been received, we get one last callback (with bytesReceived == 0).
+    
+    if (metadata_is_cbor) {
+        iap_metadata_err_t result = iap_metadata_decode_cbor(metadata_cbor, metadata_nof_bytes_received,
+                                                             fwupdater_config->metadata_public_key_pem, &metadata);
+        if (result != IAP_METADATA_OK) {
+            ESP_LOGE(TAG, "iap_https_metadata_body_callback: invalid CBOR metadata (0x%x), skipping firmware update", result);
+            return HTTP_STOP_RECEIVING;
+        }
     } else {
-        ESP_LOGE(TAG, "iap_https_firmware_body_callback: something's not OK - the new firmware image is empty!");
-        iap_abort();
+        if (fwupdater_config->metadata_public_key_pem) {
+            ESP_LOGE(TAG, "iap_https_metadata_body_callback: metadata is not signed, skipping firmware update");
+            return HTTP_STOP_RECEIVING;
+        }
+        if (iap_metadata_parser_finish(&metadata_parser) != IAP_METADATA_OK) {
+            ESP_LOGE(TAG, "iap_https_metadata_body_callback: invalid metadata (line %d), skipping firmware update", metadata_parser.error_line_nr);
+            return HTTP_STOP_RECEIVING;
+        }
+    }
+    
+    // --- Process the metadata information ---
+    
+    // (Optional) interval to check for firmware updates.
+    if (metadata.fields & IAP_METADATA_HAS_INTERVAL) {
+        ESP_LOGD(TAG, "[INTERVAL=] '%d'", metadata.interval_s);
+        if (metadata.interval_s != fwupdater_config->polling_interval_s) {
+            ESP_LOGD(TAG, "iap_https_metadata_body_callback: polling interval changed from %d s to %d s",
+                     fwupdater_config->polling_interval_s, metadata.interval_s);
+            fwupdater_config->polling_interval_s = metadata.interval_s;
+        }
+    }
+    
+    // --- Check if the firmware image on the server is newer than the currently installed version ---
+    
+    update_firmware = 0;
+    update_component_mask = 0;
+    int isRolloutPending = 0;
+    
+    if (!(metadata.fields & IAP_METADATA_HAS_VERSION)) {
+        ESP_LOGW(TAG, "iap_https_metadata_body_callback: firmware version not provided, skipping firmware update");
+        
+    } else if (!(metadata.fields & IAP_METADATA_HAS_FILE)) {
+        ESP_LOGW(TAG, "iap_https_metadata_body_callback: firmware file name not provided, skipping firmware update");
+        
+    } else if (metadata.version == fwupdater_config->current_software_version) {
+        ESP_LOGD(TAG, "iap_https_metadata_body_callback: firmware is up-to-date!");
+        
+    } else if ((metadata.fields & IAP_METADATA_HAS_MIN_VERSION) && fwupdater_config->current_software_version < metadata.min_version) {
+        ESP_LOGW(TAG, "iap_https_metadata_body_callback: the new version requires at least version %d, skipping firmware update",
+                 metadata.min_version);
+        
+    } else if (metadata.fields & IAP_METADATA_HAS_DELTA_BASE) {
+        ESP_LOGW(TAG, "iap_https_metadata_body_callback: delta images are not supported, skipping firmware update");
+        
+    } else if (!iap_https_is_in_rollout(&metadata)) {
+        ESP_LOGI(TAG, "Version %d is rolled out to %d%% of the devices, not yet to this one.", metadata.version, metadata.rollout_percent);
+        isRolloutPending = 1;
+        
+    } else {
+        ESP_LOGD(TAG, "iap_https_metadata_body_callback: our version is %d, the version on the server is %d",
+                 fwupdater_config->current_software_version, metadata.version);
+        ESP_LOGD(TAG, "[FILE=] '%s'", metadata.file);
+        strncpy(fwupdater_config->server_firmware_path, metadata.file, sizeof(fwupdater_config->server_firmware_path) / sizeof(char));
+        update_firmware = 1;
+    }
+    
+    // --- Check which components have changed ---
+    
+    const uint32_t requiredComponentFields = IAP_METADATA_HAS_VERSION | IAP_METADATA_HAS_FILE | IAP_METADATA_HAS_PARTITION;
+    for (int i = 0; i < metadata.nof_components; i++) {
+        iap_metadata_component_t *component = &metadata.components[i];
+        if ((component->fields & requiredComponentFields) != requiredComponentFields) {
+            ESP_LOGW(TAG, "iap_https_metadata_body_callback: VERSION, FILE or PARTITION of component '%s' missing, skipping it", component->name);
+            continue;
+        }
+        int installedVersion = iap_https_get_component_version(component->name);
+        if (component->version != installedVersion) {
+            ESP_LOGD(TAG, "iap_https_metadata_body_callback: component '%s' changed from version %d to %d",
+                     component->name, installedVersion, component->version);
+            update_component_mask |= (1 << i);
+        }
+    }
+
+    if (!update_firmware && !update_component_mask) {
+        ESP_LOGD(TAG, "iap_https_metadata_body_callback: we're up-to-date!");
+        // The rollout can grow without a new version, so keep requesting the metadata.
+        up_to_date_version = (metadata.fields & IAP_METADATA_HAS_VERSION) && !isRolloutPending ? metadata.version : -1;
+        return HTTP_STOP_RECEIVING;
     }
+    
+    // Until the update has been installed, the metadata needs to be requested again.
+    up_to_date_version = -1;
+    
+    // The update starts with the metadata request which announced the new version.
+    update_start_ticks = check_start_ticks;
+    update_metadata = metadata;
 
+    // --- Request the firmware image ---
+
+    is_update_pending = 1;
+    
     return HTTP_STOP_RECEIVING;
 }
 
+http_continue_receiving_t iap_https_firmware_body_callback(struct http_request_ *request, size_t bytesReceived)
+{
+    ESP_LOGD(TAG, "iap_https_firmware_body_callback");
+    
+    // Pause or cancel: the session is aborted and the connection closed after the request.
+    if (stop_command) {
+        return HTTP_STOP_RECEIVING;
+    }
+    
+    if (bytesReceived > 0) {
+        total_nof_bytes_received += bytesReceived;
+        mbedtls_sha256_update(&update_sha256, (const unsigned char *)request->response_buffer, bytesReceived);
+        
+        iap_err_t result = IAP_OK;
+        if (staging_buffer) {
+            // Program a full window if the image doesn't fit into the staging buffer.
+            if (staging_nof_bytes + bytesReceived > staging_buffer_size) {
+                result = iap_https_flush_staging_buffer();
+            }
+            if (result == IAP_OK) {
+                memcpy(&staging_buffer[staging_nof_bytes], request->response_buffer, bytesReceived);
+                staging_nof_bytes += bytesReceived;
+            }
+        } else {
+            // Write the received data to the flash.
+            result = iap_https_write((const uint8_t *)request->response_buffer, bytesReceived);
+        }
+        iap_https_sample_heap();
+        iap_https_report_progress(IAP_HTTPS_PHASE_DOWNLOADING, 0);
+        
+        return result == IAP_OK ? HTTP_CONTINUE_RECEIVING : HTTP_STOP_RECEIVING;
+    }
+    
+    // After all data has been received, we get one last callback (with bytesReceived == 0).
+    // Staged data is programmed after the request has been completed (see iap_https_download_component).
+    if (staging_nof_bytes > 0) {
+        is_staging_complete = 1;
+        return HTTP_STOP_RECEIVING;
+    }
+    
+    iap_https_finish_download();
+    return HTTP_STOP_RECEIVING;
+}
+
+// Finishes the IAP session after all data has been written and, if configured, reboots the device.
+static void iap_https_finish_download()
+{
+    ESP_LOGD(TAG, "iap_https_finish_download: all data received (%d bytes), closing session", total_nof_bytes_received);
+    
+    if (iap_https_wait_for_flash_task() != IAP_OK) {
+        ESP_LOGE(TAG, "iap_https_finish_download: write failed (%d), aborting firmware update!", flash_task_result);
+        mbedtls_sha256_free(&update_sha256);
+        iap_https_abort_session();
+        return;
+    }
+    
+    uint8_t sha256[IAP_METADATA_SHA256_LEN];
+    mbedtls_sha256_finish(&update_sha256, sha256);
+    mbedtls_sha256_free(&update_sha256);
+    
+    // The expected size and hash of the firmware image or of the component.
+    iap_metadata_component_t *component = update_component_ix >= 0 ? &update_metadata.components[update_component_ix] : NULL;
+    uint32_t expectedFields = component ? component->fields : update_metadata.fields;
+    int expectedSize = component ? component->size : update_metadata.size;
+    const uint8_t *expectedSha256 = component ? component->sha256 : update_metadata.sha256;
+    
+    // The session can't be resumed if the data is wrong (only the firmware image
+    // is journaled; the journal is kept while a component is updated).
+    if ((expectedFields & IAP_METADATA_HAS_SIZE) && total_nof_bytes_received != expectedSize) {
+        ESP_LOGE(TAG, "iap_https_finish_download: image size is %d bytes, expected %d bytes; aborting firmware update!",
+                 total_nof_bytes_received, expectedSize);
+        if (!component) {
+            iap_clear_journal();
+        }
+        iap_https_abort_session();
+        return;
+    }
+    
+    if ((expectedFields & IAP_METADATA_HAS_SHA256) && memcmp(sha256, expectedSha256, sizeof(sha256))) {
+        ESP_LOGE(TAG, "iap_https_finish_download: SHA-256 hash mismatch, aborting firmware update!");
+        if (!component) {
+            iap_clear_journal();
+        }
+        iap_https_abort_session();
+        return;
+    }
+    
+    if (total_nof_bytes_received == 0) {
+        ESP_LOGE(TAG, "iap_https_finish_download: something's not OK - the new firmware image is empty!");
+        iap_https_abort_session();
+        return;
+    }
+
+    has_iap_session = 0;
+    iap_err_t result = fwupdater_config->verify_flash ? iap_commit_verified(sha256) : iap_commit();
+    if (result != IAP_OK) {
+        ESP_LOGE(TAG, "iap_https_finish_download: closing the session has failed (%d)!", result);
+    } else {
+        is_download_complete = 1;
+        iap_https_report_progress(IAP_HTTPS_PHASE_COMPLETE, 1);
+    }
+    
+    // A component is in use as soon as it has been written.
+    if (component) {
+        if (result == IAP_OK) {
+            iap_https_set_component_version(component->name, component->version);
+            ESP_LOGI(TAG, "Component '%s' version %d installed: %d bytes.", component->name, component->version, total_nof_bytes_received);
+        }
+        return;
+    }
+    
+    has_new_firmware = 1;
+    
+    TickType_t now = xTaskGetTickCount();
+    uint32_t downloadMillisec = (now - download_start_ticks) * portTICK_PERIOD_MS;
+    statistics.last_update_nof_connections = update_nof_connections;
+    statistics.last_update_nof_bytes = total_nof_bytes_received;
+    statistics.last_update_duration_ms = (now - update_start_ticks) * portTICK_PERIOD_MS;
+    statistics.last_update_bytes_per_s = downloadMillisec > 0
+        ? (uint32_t)((uint64_t)total_nof_bytes_received * 1000 / downloadMillisec) : 0;
+    
+    ESP_LOGI(TAG, "Update installed: %d bytes in %d ms (%d bytes/s), %d connections, min. free heap %d bytes.",
+             statistics.last_update_nof_bytes, statistics.last_update_duration_ms, statistics.last_update_bytes_per_s,
+             statistics.last_update_nof_connections, statistics.min_free_heap_size);
+    
+    iap_https_reboot_if_configured();
+}
+
+static iap_err_t iap_https_begin_session()
+{
+    if (update_component_ix < 0) {
+        if (update_metadata.fields & IAP_METADATA_HAS_SHA256) {
+            size_t offset;
+            return iap_begin_resumable(update_metadata.sha256, &offset);
+        }
+        return iap_begin();
+    }
+    return iap_begin_data_partition(update_metadata.components[update_component_ix].partition);
+}
+
+// Writes to the flash, opening the IAP session with the first write.
+static iap_err_t iap_https_write(const uint8_t *bytes, size_t len)
+{
+    if (!has_iap_session) {
+        ESP_LOGD(TAG, "iap_https_write: starting IAP session.");
+        iap_err_t result = iap_https_begin_session();
+        if (result == IAP_ERR_SESSION_ALREADY_OPEN) {
+            iap_abort();
+            result = iap_https_begin_session();
+        }
+        if (result != IAP_OK) {
+            ESP_LOGE(TAG, "iap_https_write: iap_begin failed (%d)!", result);
+            return result;
+        }
+        has_iap_session = 1;
+    }
+    
+    iap_err_t result = flash_task ? iap_https_queue_write(bytes, len) : iap_write(bytes, len);
+    if (result != IAP_OK) {
+        ESP_LOGE(TAG, "iap_https_write: write failed (%d), aborting firmware update!", result);
+        iap_https_abort_session();
+        return result;
+    }
+    total_nof_bytes_written += len;
+    return result;
+}
+
+// Passes the data to the flash task (split mode). Returns when the data has been
+// copied, or the error of a previous write of the flash task.
+static iap_err_t iap_https_queue_write(const uint8_t *bytes, size_t len)
+{
+    while (len > 0 && flash_task_result == IAP_OK) {
+        iap_https_flash_buffer_t buffer;
+        xQueueReceive(flash_free_queue, &buffer, portMAX_DELAY);
+        buffer.len = MIN(len, IAP_HTTPS_FLASH_BUFFER_SIZE);
+        memcpy(buffer.bytes, bytes, buffer.len);
+        xQueueSend(flash_write_queue, &buffer, portMAX_DELAY);
+        bytes += buffer.len;
+        len -= buffer.len;
+    }
+    return flash_task_result;
+}
+
+// Waits until the flash task has written all queued data (split mode), and
+// returns the result of its writes. Call before any other IAP function.
+static iap_err_t iap_https_wait_for_flash_task()
+{
+    if (!flash_task) {
+        return IAP_OK;
+    }
+    
+    // All buffers are back in the free queue when the flash task is idle.
+    iap_https_flash_buffer_t buffers[IAP_HTTPS_NOF_FLASH_BUFFERS];
+    for (int i = 0; i < IAP_HTTPS_NOF_FLASH_BUFFERS; i++) {
+        xQueueReceive(flash_free_queue, &buffers[i], portMAX_DELAY);
+    }
+    for (int i = 0; i < IAP_HTTPS_NOF_FLASH_BUFFERS; i++) {
+        xQueueSend(flash_free_queue, &buffers[i], 0);
+    }
+    
+    return flash_task_result;
+}
+
+static void iap_https_flash_task(void *pvParameter)
+{
+    ESP_LOGI(TAG, "Flash task started.");
+    
+    while (1) {
+        iap_https_flash_buffer_t buffer;
+        xQueueReceive(flash_write_queue, &buffer, portMAX_DELAY);
+        
+        // After a failed write, the rest of the session is discarded.
+        if (flash_task_result == IAP_OK) {
+            flash_task_result = iap_write(buffer.bytes, buffer.len);
+        }
+        
+        xQueueSend(flash_free_queue, &buffer, portMAX_DELAY);
+    }
+}
+
+static void iap_https_abort_session()
+{
+    iap_https_wait_for_flash_task();
+    if (has_iap_session) {
+        iap_abort();
+        has_iap_session = 0;
+    }
+}
+
+static void iap_https_start_progress(int contentLength)
+{
+    iap_metadata_component_t *component = update_component_ix >= 0 ? &update_metadata.components[update_component_ix] : NULL;
+    uint32_t expectedFields = component ? component->fields : update_metadata.fields;
+    int expectedSize = component ? component->size : update_metadata.size;
+    
+    // A resumed download only receives the rest of the image.
+    memset(&progress, 0, sizeof(progress));
+    progress.component_name = component ? component->name : NULL;
+    if (contentLength > 0) {
+        progress.total_bytes = total_nof_bytes_received + contentLength;
+    } else if (expectedFields & IAP_METADATA_HAS_SIZE) {
+        progress.total_bytes = expectedSize;
+    }
+    
+    // The data in the flash before the download doesn't count towards the download rate.
+    total_nof_bytes_written = total_nof_bytes_received;
+    progress_start_bytes = total_nof_bytes_received;
+    progress_bytes = total_nof_bytes_received;
+    progress_ticks = download_start_ticks;
+    is_progress_started = 1;
+    
+    iap_https_report_progress(IAP_HTTPS_PHASE_DOWNLOADING, 1);
+}
+
+// Calls the progress callback. While data is received, this is called for every
+// block, so the progress is only calculated if the interval has elapsed.
+static void iap_https_report_progress(iap_https_phase_t phase, int isForced)
+{
+    if (!fwupdater_config->progress_callback) {
+        return;
+    }
+    
+    TickType_t now = xTaskGetTickCount();
+    uint32_t intervalMillisec = fwupdater_config->progress_interval_ms
+        ? fwupdater_config->progress_interval_ms : IAP_HTTPS_DEFAULT_PROGRESS_INTERVAL_MS;
+    if (!isForced && now - progress_ticks < pdMS_TO_TICKS(intervalMillisec)) {
+        return;
+    }
+    
+    uint32_t elapsedMillisec = (now - progress_ticks) * portTICK_PERIOD_MS;
+    uint32_t downloadMillisec = (now - download_start_ticks) * portTICK_PERIOD_MS;
+    
+    progress.phase = phase;
+    progress.bytes_received = total_nof_bytes_received;
+    progress.bytes_written = total_nof_bytes_written;
+    progress.bytes_per_s = elapsedMillisec > 0
+        ? (uint32_t)((uint64_t)(total_nof_bytes_received - progress_bytes) * 1000 / elapsedMillisec) : 0;
+    progress.average_bytes_per_s = downloadMillisec > 0
+        ? (uint32_t)((uint64_t)(total_nof_bytes_received - progress_start_bytes) * 1000 / downloadMillisec) : 0;
+    
+    progress.eta_s = -1;
+    if (phase == IAP_HTTPS_PHASE_COMPLETE) {
+        progress.eta_s = 0;
+    } else if (phase == IAP_HTTPS_PHASE_DOWNLOADING && progress.total_bytes >= progress.bytes_received && progress.average_bytes_per_s > 0) {
+        progress.eta_s = (progress.total_bytes - progress.bytes_received) / progress.average_bytes_per_s;
+    }
+    
+    progress_ticks = now;
+    progress_bytes = total_nof_bytes_received;
+    
+    fwupdater_config->progress_callback(&progress, fwupdater_config->progress_callback_arg);
+}
+
+static void iap_https_alloc_staging_buffer(int contentLength)
+{
+    iap_https_free_staging_buffer();
+    if (!fwupdater_config->use_staging_buffer || contentLength <= 0) {
+        return;
+    }
+    
+    // Prefer PSRAM; in internal RAM, keep a reserve for TLS and the application.
+    const uint32_t caps[] = { MALLOC_CAP_SPIRAM, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT };
+    const size_t reserve[] = { 0, IAP_HTTPS_STAGING_HEAP_RESERVE };
+    
+    for (int i = 0; i < sizeof(caps) / sizeof(caps[0]); i++) {
+        
+        size_t freeSize = heap_caps_get_free_size(caps[i]);
+        size_t available = freeSize > reserve[i] ? MIN(freeSize - reserve[i], heap_caps_get_largest_free_block(caps[i])) : 0;
+        
+        // The whole image, or the largest window which fits.
+        size_t size = (size_t)contentLength;
+        if (size > available) {
+            size = available - available % IAP_HTTPS_STAGING_WINDOW_ALIGN;
+            if (size < IAP_HTTPS_MIN_STAGING_WINDOW) {
+                continue;
+            }
+        }
+        
+        staging_buffer = heap_caps_malloc(size, caps[i]);
+        if (staging_buffer) {
+            staging_buffer_size = size;
+            staging_nof_bytes = 0;
+            ESP_LOGI(TAG, "Staging %d of %d bytes in %s.", staging_buffer_size, contentLength,
+                     caps[i] == MALLOC_CAP_SPIRAM ? "PSRAM" : "RAM");
+            return;
+        }
+    }
+    
+    ESP_LOGI(TAG, "Not enough memory to stage the image, writing it directly to the flash.");
+}
+
+static iap_err_t iap_https_flush_staging_buffer()
+{
+    iap_err_t result = iap_https_write(staging_buffer, staging_nof_bytes);
+    staging_nof_bytes = 0;
+    return result;
+}
+
+static void iap_https_free_staging_buffer()
+{
+    free(staging_buffer);
+    staging_buffer = NULL;
+    staging_buffer_size = 0;
+    staging_nof_bytes = 0;
+    is_staging_complete = 0;
+}
+
 http_continue_receiving_t iap_https_metadata_headers_callback(struct http_request_ *request, int statusCode, int contentLength)
 {
     ESP_LOGD(TAG, "iap_https_metadata_headers_callback");
@@ -410,6 +1777,33 @@ http_continue_receiving_t iap_https_metadata_headers_callback(struct http_reques
 http_continue_receiving_t iap_https_firmware_headers_callback(struct http_request_ *request, int statusCode, int contentLength)
 {
     ESP_LOGD(TAG, "iap_https_firmware_headers_callback");
+    
+    // The download starts; the IAP session is opened with the first write.
+    total_nof_bytes_received = 0;
+    mbedtls_sha256_init(&update_sha256);
+    mbedtls_sha256_starts(&update_sha256, 0);
+    download_start_ticks = xTaskGetTickCount();
+    
+    if (resume_offset > 0) {
+        if (statusCode == 206 && iap_hash_written_data(&update_sha256) == IAP_OK) {
+            // The hash covers the whole image, including the part already in the flash.
+            total_nof_bytes_received = resume_offset;
+        } else {
+            // The server ignored the Range header: start again with the whole image.
+            ESP_LOGW(TAG, "iap_https_firmware_headers_callback: the download can't be resumed, restarting it.");
+            iap_clear_journal();
+            iap_https_abort_session();
+            mbedtls_sha256_starts(&update_sha256, 0);
+            if (statusCode == 206) {
+                return HTTP_STOP_RECEIVING;
+            }
+        }
+        resume_offset = 0;
+    }
+    
+    iap_https_start_progress(contentLength);
+    iap_https_alloc_staging_buffer(contentLength);
+    
     return HTTP_CONTINUE_RECEIVING;
 }
 
@@ -417,6 +1811,8 @@ void iap_https_error_callback(struct http_request_ *request, http_err_t error, i
 {
     ESP_LOGE(TAG, "iap_https_error_callback: error=%d additionalInfo=%d", error, additionalInfo);
     
+    has_request_failed = 1;
+    
     if (error == HTTP_ERR_NON_200_STATUS_CODE) {
         switch (additionalInfo) {
             case 401:
@@ -428,6 +1824,12 @@ void iap_https_error_callback(struct http_request_ *request, http_err_t error, i
             case 404:
                 ESP_LOGE(TAG, "HTTP status code 404: Resource not found on the server.");
                 break;
+            case 429:
+                ESP_LOGW(TAG, "HTTP status code 429: Too many requests, the server asks us to slow down.");
+                break;
+            case 503:
+                ESP_LOGW(TAG, "HTTP status code 503: The server is temporarily unavailable.");
+                break;
             default:
                 ESP_LOGE(TAG, "Non-200 status code received: %d", additionalInfo);
                 break;
@@ -436,3 +1838,27 @@ void iap_https_error_callback(struct http_request_ *request, http_err_t error, i
 }
 
 
+
+http_continue_receiving_t iap_https_notify_headers_callback(struct http_request_ *request, int statusCode, int contentLength)
+{
+    ESP_LOGD(TAG, "iap_https_notify_headers_callback: status code %d", statusCode);
+    has_notification = (statusCode == 200);
+    return HTTP_CONTINUE_RECEIVING;
+}
+
+http_continue_receiving_t iap_https_notify_body_callback(struct http_request_ *request, size_t bytesReceived)
+{
+    // The content of the notification is ignored, the metadata tells what's new.
+    return HTTP_CONTINUE_RECEIVING;
+}
+
+void iap_https_notify_error_callback(struct http_request_ *request, http_err_t error, int additionalInfo)
+{
+    // 204 (No Content): nothing has been published during the hold time.
+    if (error == HTTP_ERR_NON_200_STATUS_CODE && additionalInfo == 204) {
+        ESP_LOGD(TAG, "iap_https_notify_error_callback: hold time expired");
+        return;
+    }
+    
+    iap_https_error_callback(request, error, additionalInfo);
+}
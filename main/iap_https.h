@@ -31,6 +31,81 @@
 #define __IAP_HTTPS__ 1
 
 
+// Forward declaration of the transport interface (see https_transport.h).
+struct https_transport_;
+
+// Commands for the updater task (see iap_https_send_command).
+typedef enum {
+    
+    // Check for updates now (like iap_https_check_now). Ignored while paused.
+    IAP_HTTPS_CMD_CHECK,
+    
+    // Download the update found by the last check (see download_on_command).
+    IAP_HTTPS_CMD_DOWNLOAD,
+    
+    // Stop all network activity: a download in progress is interrupted (it is
+    // continued with IAP_HTTPS_CMD_RESUME), and no checks are made.
+    IAP_HTTPS_CMD_PAUSE,
+    
+    // Continue after IAP_HTTPS_CMD_PAUSE, including an interrupted download.
+    IAP_HTTPS_CMD_RESUME,
+    
+    // Stop a download in progress and discard it and the update found by the last check.
+    IAP_HTTPS_CMD_CANCEL,
+    
+    // Re-boot into the new firmware if it has been installed (see auto_reboot).
+    IAP_HTTPS_CMD_APPLY,
+
+} iap_https_command_t;
+
+// States of the updater task.
+typedef enum {
+    IAP_HTTPS_STATE_IDLE,               // waiting for the next check
+    IAP_HTTPS_STATE_CHECKING,           // requesting the metadata
+    IAP_HTTPS_STATE_UPDATE_AVAILABLE,   // waiting for IAP_HTTPS_CMD_DOWNLOAD
+    IAP_HTTPS_STATE_DOWNLOADING,
+    IAP_HTTPS_STATE_PAUSED,
+    IAP_HTTPS_STATE_INSTALLED,          // waiting for IAP_HTTPS_CMD_APPLY (or a re-boot)
+} iap_https_state_t;
+
+// Phases of a download, see iap_https_progress_t.
+typedef enum {
+    IAP_HTTPS_PHASE_DOWNLOADING,        // receiving the image (and programming it, unless staged)
+    IAP_HTTPS_PHASE_PROGRAMMING,        // programming the staged image after the download
+    IAP_HTTPS_PHASE_COMPLETE,           // the image has been installed
+    IAP_HTTPS_PHASE_FAILED,             // the download has failed or has been stopped
+} iap_https_phase_t;
+
+// Progress of the download of an image (the firmware or a component).
+typedef struct iap_https_progress_ {
+    
+    iap_https_phase_t phase;
+    
+    // Name of the component, or NULL for the firmware image.
+    const char *component_name;
+    
+    // Number of bytes of the image received, and written to (or queued for) the
+    // flash, including the part already in the flash if the download was resumed.
+    uint32_t bytes_received;
+    uint32_t bytes_written;
+    
+    // Size of the image (from the Content-Length header or the metadata), 0 if unknown.
+    uint32_t total_bytes;
+    
+    // Download rate since the previous report and since the start of the download, in bytes/s.
+    uint32_t bytes_per_s;
+    uint32_t average_bytes_per_s;
+    
+    // Estimated time until the download is complete (at the average rate), in seconds.
+    // -1 if unknown.
+    int eta_s;
+
+} iap_https_progress_t;
+
+// Receives the progress of downloads in the updater task. Keep it short, e.g.
+// copy the progress into a queue of the UI or telemetry task.
+typedef void (*iap_https_progress_callback_t)(const iap_https_progress_t *progress, void *arg);
+
 typedef struct iap_https_config_ {
   
     // Version number of the running firmware image.
@@ -52,10 +127,27 @@ typedef struct iap_https_config_ {
     
     // Path to the metadata file which contains information on the firmware image,
     // e.g. /ota/meta.txt. We perform an HTTP/1.1 GET request on this file.
+    // The metadata can also list components which are installed into data partitions
+    // (see iap_metadata.h). Their installed versions are stored in NVS, so the
+    // application needs to call nvs_flash_init before iap_https_init.
     char server_metadata_path[256];
     
     // Path to the firmware image file.
     char server_firmware_path[256];
+    
+    // (Optional) path to a long-poll notification endpoint, e.g. /ota/notify.
+    // If set, the device keeps a GET request on this path open while it's idle.
+    // The server answers it when a new version is published (status 200, the body
+    // is ignored), which triggers a check for updates, or with status 204 when
+    // the hold time has expired, and the device sends the next request.
+    // Periodic polling remains active as a fallback (use a long interval).
+    // Commands (including manual and periodic checks) interrupt the notify request.
+    // No notify requests are sent after an update has been installed.
+    char server_notify_path[256];
+    
+    // Time the server may hold a notify request open, in seconds. Sent as
+    // "Prefer: wait=<hold time>" (RFC 7240). Defaults to 300 seconds if 0.
+    uint32_t notify_hold_time_s;
   
     // Default time between two checks, in seconds.
     // If you want to trigger the check manually, set the value to 0 and call the
@@ -65,13 +157,161 @@ typedef struct iap_https_config_ {
     // to keep the network traffic low (e.g. 3600 for 1 hour).
     uint32_t polling_interval_s;
     
+    // Spreads the checks of many devices over time, e.g. if they all re-boot at
+    // the same time after a power outage: each polling interval is varied by up to
+    // +/- this percentage, with a per-device random sequence seeded from the MAC address.
+    uint32_t polling_jitter_percent;
+    
+    // After failed checks, the polling interval doubles with each consecutive
+    // failure, up to this value in seconds. 0 disables the backoff.
+    uint32_t max_backoff_interval_s;
+    
+    // The first check is made as soon as the network is ready after startup (IP
+    // address and, unless server_host_name is an IP address, a DNS server; up to
+    // 5 seconds are spent waiting for it), unless polling_interval_s is 0. It is delayed by up
+    // to this many seconds (per-device random delay), except with a deadline.
+    uint32_t first_check_spread_s;
+    
+    // (Optional) time after startup, in seconds, by which the first check needs to
+    // have completed, e.g. so that a recovery update is installed right after power-on.
+    // Until then, a failed first check is retried every 2 seconds. A missed deadline
+    // is logged and reported in iap_https_statistics_t.
+    uint32_t first_check_deadline_s;
+    
     // Automatic re-boot after upgrade.
     // If the application can't handle arbitrary re-boots, set this to 'false'
     // and manually trigger the reboot.
     int auto_reboot;
+    
+    // Don't download an update found by a check until the application sends
+    // IAP_HTTPS_CMD_DOWNLOAD, e.g. to choose a convenient time.
+    int download_on_command;
+    
+    // (Optional) transport to use instead of the TLS connection to the server,
+    // e.g. a plain TCP connection (tcp_transport) or scripted responses (mem_transport).
+    // If NULL, the module connects with TLS and certificate pinning.
+    struct https_transport_ *transport;
+    
+    // Identify the device in every request with an "X-Device-Id" header (the
+    // WIFI station MAC address), in addition to the "User-Agent" header which
+    // contains the current software version. This lets the update server track
+    // request rates and the rollout progress per device.
+    int send_device_id;
+    
+    // (Optional) public key which signs the metadata file, in PEM format (ES256,
+    // i.e. ECDSA with the P-256 curve and SHA-256). If set, only metadata in CBOR
+    // format with a valid COSE_Sign1 signature is accepted. If NULL, both the
+    // KEY=VALUE text format and unsigned CBOR are accepted.
+    const char *metadata_public_key_pem;
+
+    // (Optional) name of a DNS TXT record which announces the version of the
+    // metadata, e.g. "_ota.example.com" (see iap_metadata_decode_announcement for
+    // the format). It is queried before each check with a single UDP request. If the
+    // announcement is signed with dns_precheck_public_key_pem, hasn't expired and
+    // announces the version of the previous check, no HTTPS connection is opened.
+    // The version in the record needs to change whenever the metadata changes.
+    // Expiry needs the system time (e.g. from SNTP); without it, every check uses HTTPS.
+    const char *dns_precheck_name;
+    
+    // Public key which signs the DNS announcement, in PEM format (ES256).
+    const char *dns_precheck_public_key_pem;
+    
+    // (Optional) IPv4 address of the DNS server for the pre-check, e.g. "192.168.1.1".
+    // If NULL, the DNS server configured by DHCP is used.
+    const char *dns_precheck_server;
+    
+    // Read back each downloaded image from flash and compare its hash with
+    // the hash of the received data before activating it (see iap_commit_verified).
+    // Adds the time to read the image through the flash cache (logged per MB).
+    int verify_flash;
+
+    // Receive each image into a RAM buffer (PSRAM if available) as fast as the
+    // network allows, and program the flash after the download, when the connection
+    // has been closed. Falls back to large windows of the image if the whole image
+    // doesn't fit, and to direct streaming to the flash if memory is short.
+    int use_staging_buffer;
+
+    // Limits the cost of a download for the rest of the application, so that an update
+    // trickles in while the device goes on with its work: the download rate in bytes/s
+    // (0 = no limit), and the share of time spent writing the flash in percent
+    // (0 = no limit, see iap_set_flash_duty_cycle). Initial values; iap_https_set_throttle
+    // changes the limits without modifying this structure.
+    uint32_t max_download_bytes_per_s;
+    uint32_t flash_duty_cycle_percent;
+
+    // Priority and stack size (in bytes) of the updater task, which runs the TLS
+    // connection and, unless use_flash_task is set, programs the flash.
+    // 0 selects the defaults (priority 1, 4096 bytes). See the stack high-water
+    // marks in iap_https_statistics_t before reducing the stack size.
+    uint32_t task_priority;
+    uint32_t task_stack_size;
+    
+    // Pin the updater task to core 'task_core_id' (0 or 1), e.g. to keep TLS away
+    // from the core of a time-critical application task. Otherwise, it runs on any core.
+    int pin_task_to_core;
+    int task_core_id;
+    
+    // Split mode: program the flash in a separate task (with the same priority),
+    // so that receiving and decrypting the next data overlaps with writing the
+    // previous data. With pin_task_to_core, the flash task is pinned to
+    // 'flash_task_core_id', typically the other core.
+    // Stack size in bytes, 0 selects the default (3072 bytes).
+    int use_flash_task;
+    int flash_task_core_id;
+    uint32_t flash_task_stack_size;
+
+    // (Optional) callback for the progress of downloads, e.g. for a UI or telemetry
+    // about the link quality. It is called at the start and end of each download,
+    // when the phase changes, and at most every progress_interval_ms while data is
+    // received (0 selects 1000 ms). 'progress_callback_arg' is passed to the callback.
+    iap_https_progress_callback_t progress_callback;
+    void *progress_callback_arg;
+    uint32_t progress_interval_ms;
 
 } iap_https_config_t;
 
+// Performance figures of the firmware updater, e.g. to compare transport or
+// IAP changes against a baseline.
+typedef struct iap_https_statistics_ {
+    
+    // Number of connections (TLS handshakes) opened since startup.
+    uint32_t nof_connections;
+    
+    // Number of connections opened for the last update, from the metadata
+    // request which announced the new version until the image was committed.
+    uint32_t last_update_nof_connections;
+    
+    // Number of firmware image bytes received during the last update.
+    uint32_t last_update_nof_bytes;
+    
+    // Time from the start of the metadata request which announced the new
+    // version until the image was committed, in milliseconds.
+    uint32_t last_update_duration_ms;
+    
+    // Average download rate of the firmware image during the last update, in bytes/s.
+    uint32_t last_update_bytes_per_s;
+    
+    // Lowest amount of free heap memory observed during updates, in bytes.
+    uint32_t min_free_heap_size;
+    
+    // Number of checks answered by the DNS pre-check, without an HTTPS request.
+    uint32_t nof_dns_prechecks_up_to_date;
+
+    // Minimum amount of unused stack of the updater task and of the flash task
+    // (split mode) since startup, in bytes.
+    uint32_t task_stack_min_free;
+    uint32_t flash_task_stack_min_free;
+
+    // Time from startup until the network was first ready for a request, and until the first check
+    // completed successfully (0 if it hasn't yet), in milliseconds.
+    uint32_t network_ready_ms;
+    uint32_t first_check_ms;
+    
+    // Set if the first check didn't complete within first_check_deadline_s.
+    int first_check_deadline_missed;
+
+} iap_https_statistics_t;
+
 
 // Module initialisation, call once at application startup.
 int iap_https_init(iap_https_config_t *config);
@@ -81,11 +321,29 @@ int iap_https_init(iap_https_config_t *config);
 // If automatic checks are enabled, calling this function causes the timer to be re-set.
 int iap_https_check_now();
 
+// Send a command to the updater task. Returns 0 if the command has been queued.
+// IAP_HTTPS_CMD_PAUSE and IAP_HTTPS_CMD_CANCEL interrupt a download in progress
+// within one read timeout (usually much faster) and release the TLS connection
+// and the IAP session.
+int iap_https_send_command(iap_https_command_t command);
+
+// Returns the current state of the updater task.
+iap_https_state_t iap_https_get_state();
+
 // Returns 1 if an update is currently in progress, 0 otherwise.
 int iap_https_update_in_progress();
 
 // Returns 1 if a new firmware has been installed but not yet booted, 0 otherwise.
 int iap_https_new_firmware_installed();
 
+// Change the download rate limit (bytes/s) and the flash duty cycle (percent), e.g.
+// while the application needs the network or the CPU. 0 removes the limit.
+// Takes effect immediately, also during a download.
+// Returns 0 on success, -1 if the module hasn't been initialized.
+int iap_https_set_throttle(uint32_t maxBytesPerSec, uint32_t flashDutyCyclePercent);
+
+// Copy the current performance figures into the provided structure.
+void iap_https_get_statistics(iap_https_statistics_t *statistics);
+
 
 #endif // __IAP_HTTPS__
@@ -0,0 +1,844 @@
+//
+//  iap_metadata.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  This module parses the firmware metadata file (KEY=VALUE lines) in a
+//  single pass while the data arrives, without buffering the file. It also
+//  decodes the CBOR variant of the file, optionally signed with COSE_Sign1.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+#include "esp_log.h"
+
+#include "mbedtls/pk.h"
+#include "mbedtls/ecdsa.h"
+#include "mbedtls/sha256.h"
+
+#include "iap_cbor.h"
+#include "iap_metadata.h"
+
+
+#define TAG "iap_meta"
+
+// Position of the parser in the current line.
+#define IAP_METADATA_STATE_KEY      0
+#define IAP_METADATA_STATE_VALUE    1
+#define IAP_METADATA_STATE_SKIP     2
+#define IAP_METADATA_STATE_SECTION  3
+
+typedef enum {
+    IAP_METADATA_TYPE_INT,
+    IAP_METADATA_TYPE_STRING,
+    IAP_METADATA_TYPE_HEX,
+} iap_metadata_type_t;
+
+// COSE (RFC 8152) constants.
+#define IAP_METADATA_COSE_SIGN1_TAG     18
+#define IAP_METADATA_COSE_HEADER_ALG    1
+#define IAP_METADATA_COSE_ALG_ES256     -7
+#define IAP_METADATA_ES256_SIG_LEN      64
+
+// Optional at the start of the text format.
+static const uint8_t utf8_bom[] = { 0xef, 0xbb, 0xbf };
+
+// CBOR keys of the component list (top level) and of the component name.
+#define IAP_METADATA_CBOR_KEY_COMPONENTS    10
+#define IAP_METADATA_CBOR_KEY_NAME          0
+
+// Describes where and how the value of a key is stored in iap_metadata_t.
+// In the CBOR format, the key is an integer instead of a string.
+typedef struct iap_metadata_field_ {
+    const char *key;
+    int cbor_key;
+    uint32_t flag;
+    iap_metadata_type_t type;
+    size_t offset;
+    size_t size;
+    // For variable length HEX fields, offset of the size_t length field; 0 if the length is fixed.
+    size_t len_offset;
+} iap_metadata_field_t;
+
+static const iap_metadata_field_t iap_metadata_fields[] = {
+    { "VERSION", 1, IAP_METADATA_HAS_VERSION, IAP_METADATA_TYPE_INT, offsetof(iap_metadata_t, version), sizeof(int), 0 },
+    { "FILE", 2, IAP_METADATA_HAS_FILE, IAP_METADATA_TYPE_STRING, offsetof(iap_metadata_t, file), IAP_METADATA_MAX_FILE_LEN, 0 },
+    { "INTERVAL", 3, IAP_METADATA_HAS_INTERVAL, IAP_METADATA_TYPE_INT, offsetof(iap_metadata_t, interval_s), sizeof(int), 0 },
+    { "SIZE", 4, IAP_METADATA_HAS_SIZE, IAP_METADATA_TYPE_INT, offsetof(iap_metadata_t, size), sizeof(int), 0 },
+    { "SHA256", 5, IAP_METADATA_HAS_SHA256, IAP_METADATA_TYPE_HEX, offsetof(iap_metadata_t, sha256), IAP_METADATA_SHA256_LEN, 0 },
+    { "SIGNATURE", 6, IAP_METADATA_HAS_SIGNATURE, IAP_METADATA_TYPE_HEX, offsetof(iap_metadata_t, signature), IAP_METADATA_MAX_SIGNATURE_LEN, offsetof(iap_metadata_t, signature_len) },
+    { "DELTA_BASE", 7, IAP_METADATA_HAS_DELTA_BASE, IAP_METADATA_TYPE_INT, offsetof(iap_metadata_t, delta_base_version), sizeof(int), 0 },
+    { "MIN_VERSION", 8, IAP_METADATA_HAS_MIN_VERSION, IAP_METADATA_TYPE_INT, offsetof(iap_metadata_t, min_version), sizeof(int), 0 },
+    { "ROLLOUT", 9, IAP_METADATA_HAS_ROLLOUT, IAP_METADATA_TYPE_INT, offsetof(iap_metadata_t, rollout_percent), sizeof(int), 0 },
+    { "SALT", 12, IAP_METADATA_HAS_SALT, IAP_METADATA_TYPE_STRING, offsetof(iap_metadata_t, rollout_salt), IAP_METADATA_MAX_SALT_LEN, 0 },
+};
+
+#define IAP_METADATA_NOF_FIELDS (sizeof(iap_metadata_fields) / sizeof(iap_metadata_fields[0]))
+
+// Fields of a [component] section.
+static const iap_metadata_field_t iap_metadata_component_fields[] = {
+    { "VERSION", 1, IAP_METADATA_HAS_VERSION, IAP_METADATA_TYPE_INT, offsetof(iap_metadata_component_t, version), sizeof(int), 0 },
+    { "FILE", 2, IAP_METADATA_HAS_FILE, IAP_METADATA_TYPE_STRING, offsetof(iap_metadata_component_t, file), IAP_METADATA_MAX_FILE_LEN, 0 },
+    { "SIZE", 4, IAP_METADATA_HAS_SIZE, IAP_METADATA_TYPE_INT, offsetof(iap_metadata_component_t, size), sizeof(int), 0 },
+    { "SHA256", 5, IAP_METADATA_HAS_SHA256, IAP_METADATA_TYPE_HEX, offsetof(iap_metadata_component_t, sha256), IAP_METADATA_SHA256_LEN, 0 },
+    { "PARTITION", 11, IAP_METADATA_HAS_PARTITION, IAP_METADATA_TYPE_STRING, offsetof(iap_metadata_component_t, partition), IAP_METADATA_MAX_PARTITION_LEN, 0 },
+};
+
+#define IAP_METADATA_NOF_COMPONENT_FIELDS (sizeof(iap_metadata_component_fields) / sizeof(iap_metadata_component_fields[0]))
+
+
+static void iap_metadata_begin_section(iap_metadata_parser_t *parser);
+static void iap_metadata_begin_value(iap_metadata_parser_t *parser);
+static const iap_metadata_field_t *iap_metadata_current_field(iap_metadata_parser_t *parser, uint8_t **base, uint32_t **fields);
+static void iap_metadata_value_char(iap_metadata_parser_t *parser, char c);
+static void iap_metadata_end_value(iap_metadata_parser_t *parser);
+static void iap_metadata_set_error(iap_metadata_parser_t *parser, iap_metadata_err_t error);
+static int iap_metadata_hex_digit(char c);
+static iap_metadata_err_t iap_metadata_decode_cbor_map(const uint8_t *data, size_t len, iap_metadata_t *metadata);
+static iap_metadata_err_t iap_metadata_decode_cbor_components(iap_cbor_reader_t *reader, iap_metadata_t *metadata);
+static iap_metadata_err_t iap_metadata_decode_cbor_value(iap_cbor_reader_t *reader, int64_t key, const iap_metadata_field_t *table,
+                                                         int nofFields, uint8_t *base, uint32_t *fields);
+static iap_metadata_err_t iap_metadata_decode_cose_sign1(iap_cbor_reader_t *reader, const char *publicKeyPem, iap_metadata_t *metadata);
+static int iap_metadata_cose_alg_is_es256(const uint8_t *protectedHeader, size_t len);
+static void iap_metadata_sha256_bstr(mbedtls_sha256_context *sha256, const uint8_t *data, size_t len);
+static int iap_metadata_verify_es256(const char *publicKeyPem, const uint8_t *hash, const uint8_t *signature);
+static int iap_metadata_parse_decimal(const char **str, int64_t *value);
+
+
+void iap_metadata_parser_init(iap_metadata_parser_t *parser, iap_metadata_t *metadata)
+{
+    memset(parser, 0, sizeof(iap_metadata_parser_t));
+    memset(metadata, 0, sizeof(iap_metadata_t));
+    
+    parser->metadata = metadata;
+    parser->state = IAP_METADATA_STATE_KEY;
+    parser->field_ix = -1;
+    parser->component_ix = -1;
+    parser->line_nr = 1;
+}
+
+void iap_metadata_parser_feed(iap_metadata_parser_t *parser, const char *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+        
+        if (c == '\r') {
+            continue;
+        }
+        
+        if (c == '\n') {
+            if (parser->state == IAP_METADATA_STATE_VALUE) {
+                iap_metadata_end_value(parser);
+            } else if (parser->state == IAP_METADATA_STATE_SECTION) {
+                // "[name" without the closing bracket.
+                iap_metadata_set_error(parser, IAP_METADATA_ERR_INVALID_VALUE);
+            }
+            parser->state = IAP_METADATA_STATE_KEY;
+            parser->key_len = 0;
+            parser->line_nr++;
+            continue;
+        }
+        
+        // A UTF-8 byte order mark at the start of the file is skipped.
+        if (parser->line_nr == 1 && parser->key_len == 0 && parser->state == IAP_METADATA_STATE_KEY
+            && parser->bom_len < sizeof(utf8_bom) && (uint8_t)c == utf8_bom[parser->bom_len])
+        {
+            parser->bom_len++;
+            continue;
+        }
+        
+        switch (parser->state) {
+            
+            case IAP_METADATA_STATE_KEY:
+                if (c == '#' && parser->key_len == 0) {
+                    // Comment line.
+                    parser->state = IAP_METADATA_STATE_SKIP;
+                } else if (c == '[' && parser->key_len == 0) {
+                    // The following lines describe a component.
+                    parser->state = IAP_METADATA_STATE_SECTION;
+                } else if (c == '=') {
+                    parser->key[parser->key_len] = 0x00;
+                    iap_metadata_begin_value(parser);
+                    parser->state = IAP_METADATA_STATE_VALUE;
+                } else if (parser->key_len < sizeof(parser->key) - 1) {
+                    parser->key[parser->key_len++] = c;
+                } else {
+                    // Longer than any key we know.
+                    parser->state = IAP_METADATA_STATE_SKIP;
+                }
+                break;
+            
+            case IAP_METADATA_STATE_VALUE:
+                iap_metadata_value_char(parser, c);
+                break;
+            
+            case IAP_METADATA_STATE_SECTION:
+                if (c == ']') {
+                    parser->key[parser->key_len] = 0x00;
+                    iap_metadata_begin_section(parser);
+                } else if (parser->key_len < IAP_METADATA_MAX_NAME_LEN - 1) {
+                    parser->key[parser->key_len++] = c;
+                } else {
+                    iap_metadata_set_error(parser, IAP_METADATA_ERR_VALUE_TOO_LONG);
+                    parser->component_ix = IAP_METADATA_MAX_COMPONENTS;
+                }
+                break;
+            
+            default:
+                break;
+        }
+    }
+}
+
+iap_metadata_err_t iap_metadata_parser_finish(iap_metadata_parser_t *parser)
+{
+    // The last line doesn't need to end with a newline.
+    if (parser->state == IAP_METADATA_STATE_VALUE) {
+        iap_metadata_end_value(parser);
+    } else if (parser->state == IAP_METADATA_STATE_SECTION) {
+        iap_metadata_set_error(parser, IAP_METADATA_ERR_INVALID_VALUE);
+    }
+    parser->state = IAP_METADATA_STATE_SKIP;
+    
+    if (parser->error != IAP_METADATA_OK) {
+        ESP_LOGW(TAG, "iap_metadata_parser_finish: error 0x%x in line %d", parser->error, parser->error_line_nr);
+    }
+    
+    return parser->error;
+}
+
+int iap_metadata_is_cbor(uint8_t firstByte)
+{
+    // The text format starts with an ASCII character or a UTF-8 byte order mark,
+    // which is neither a CBOR map nor the head of a COSE_Sign1 structure.
+    return (firstByte >> 5) == IAP_CBOR_MAJOR_MAP
+        || firstByte == (IAP_CBOR_MAJOR_TAG << 5 | IAP_METADATA_COSE_SIGN1_TAG)
+        || firstByte == (IAP_CBOR_MAJOR_ARRAY << 5 | 4);
+}
+
+iap_metadata_err_t iap_metadata_decode_cbor(const uint8_t *data, size_t len, const char *publicKeyPem, iap_metadata_t *metadata)
+{
+    memset(metadata, 0, sizeof(iap_metadata_t));
+    
+    iap_cbor_reader_t reader;
+    iap_cbor_reader_init(&reader, data, len);
+    
+    int major = iap_cbor_peek_major(&reader);
+    
+    if (major == IAP_CBOR_MAJOR_MAP) {
+        if (publicKeyPem) {
+            ESP_LOGE(TAG, "iap_metadata_decode_cbor: metadata is not signed");
+            return IAP_METADATA_ERR_NOT_SIGNED;
+        }
+        return iap_metadata_decode_cbor_map(data, len, metadata);
+    }
+    
+    if (major == IAP_CBOR_MAJOR_TAG || major == IAP_CBOR_MAJOR_ARRAY) {
+        return iap_metadata_decode_cose_sign1(&reader, publicKeyPem, metadata);
+    }
+    
+    ESP_LOGE(TAG, "iap_metadata_decode_cbor: unexpected CBOR item (major type %d)", major);
+    return IAP_METADATA_ERR_INVALID_FORMAT;
+}
+
+iap_metadata_err_t iap_metadata_decode_announcement(const char *text, const char *publicKeyPem, int *version, int64_t *expiry)
+{
+    // The signed part ends before ";sig=".
+    const char *sig = strstr(text, ";sig=");
+    if (!sig || strncmp(text, "v=", 2)) {
+        return IAP_METADATA_ERR_INVALID_FORMAT;
+    }
+    
+    int64_t versionValue;
+    int64_t expiryValue;
+    const char *c = &text[2];
+    if (iap_metadata_parse_decimal(&c, &versionValue) || versionValue > INT_MAX || strncmp(c, ";exp=", 5)) {
+        return IAP_METADATA_ERR_INVALID_FORMAT;
+    }
+    c += 5;
+    if (iap_metadata_parse_decimal(&c, &expiryValue) || c != sig) {
+        return IAP_METADATA_ERR_INVALID_FORMAT;
+    }
+    
+    const char *hex = &sig[5];
+    if (strlen(hex) != 2 * IAP_METADATA_ES256_SIG_LEN) {
+        return IAP_METADATA_ERR_INVALID_FORMAT;
+    }
+    uint8_t signature[IAP_METADATA_ES256_SIG_LEN];
+    for (int i = 0; i < IAP_METADATA_ES256_SIG_LEN; i++) {
+        int high = iap_metadata_hex_digit(hex[2 * i]);
+        int low = iap_metadata_hex_digit(hex[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            return IAP_METADATA_ERR_INVALID_FORMAT;
+        }
+        signature[i] = (high << 4) | low;
+    }
+    
+    uint8_t hash[32];
+    mbedtls_sha256_context sha256;
+    mbedtls_sha256_init(&sha256);
+    mbedtls_sha256_starts(&sha256, 0);
+    mbedtls_sha256_update(&sha256, (const unsigned char *)text, sig - text);
+    mbedtls_sha256_finish(&sha256, hash);
+    mbedtls_sha256_free(&sha256);
+    
+    if (iap_metadata_verify_es256(publicKeyPem, hash, signature)) {
+        ESP_LOGE(TAG, "iap_metadata_decode_announcement: invalid signature");
+        return IAP_METADATA_ERR_SIGNATURE;
+    }
+    
+    *version = (int)versionValue;
+    *expiry = expiryValue;
+    return IAP_METADATA_OK;
+}
+
+
+static void iap_metadata_begin_section(iap_metadata_parser_t *parser)
+{
+    iap_metadata_t *metadata = parser->metadata;
+    
+    // The rest of the line is ignored.
+    parser->state = IAP_METADATA_STATE_SKIP;
+    
+    if (parser->key_len == 0) {
+        iap_metadata_set_error(parser, IAP_METADATA_ERR_INVALID_VALUE);
+        return;
+    }
+    
+    if (metadata->nof_components >= IAP_METADATA_MAX_COMPONENTS) {
+        iap_metadata_set_error(parser, IAP_METADATA_ERR_TOO_MANY_COMPONENTS);
+        // Don't mix the keys of this section into the previous component.
+        parser->component_ix = IAP_METADATA_MAX_COMPONENTS;
+        return;
+    }
+    
+    parser->component_ix = metadata->nof_components++;
+    strcpy(metadata->components[parser->component_ix].name, parser->key);
+}
+
+static void iap_metadata_begin_value(iap_metadata_parser_t *parser)
+{
+    // Keys of a section which couldn't be stored are skipped.
+    const iap_metadata_field_t *table = iap_metadata_fields;
+    int nofFields = IAP_METADATA_NOF_FIELDS;
+    if (parser->component_ix >= IAP_METADATA_MAX_COMPONENTS) {
+        nofFields = 0;
+    } else if (parser->component_ix >= 0) {
+        table = iap_metadata_component_fields;
+        nofFields = IAP_METADATA_NOF_COMPONENT_FIELDS;
+    }
+    
+    parser->field_ix = -1;
+    for (int i = 0; i < nofFields; i++) {
+        if (!strcmp(parser->key, table[i].key)) {
+            parser->field_ix = i;
+            break;
+        }
+    }
+    
+    if (parser->field_ix < 0) {
+        // Unknown keys are skipped, so that newer servers can add fields.
+        ESP_LOGD(TAG, "iap_metadata_begin_value: skipping unknown key '%s'", parser->key);
+        parser->state = IAP_METADATA_STATE_SKIP;
+        return;
+    }
+    
+    uint8_t *base;
+    uint32_t *fields;
+    const iap_metadata_field_t *field = iap_metadata_current_field(parser, &base, &fields);
+    
+    // A repeated key replaces the previous value.
+    *fields &= ~field->flag;
+    
+    parser->value_len = 0;
+    parser->int_value = 0;
+    parser->is_negative = 0;
+}
+
+static const iap_metadata_field_t *iap_metadata_current_field(iap_metadata_parser_t *parser, uint8_t **base, uint32_t **fields)
+{
+    if (parser->component_ix < 0) {
+        *base = (uint8_t *)parser->metadata;
+        *fields = &parser->metadata->fields;
+        return &iap_metadata_fields[parser->field_ix];
+    }
+    
+    iap_metadata_component_t *component = &parser->metadata->components[parser->component_ix];
+    *base = (uint8_t *)component;
+    *fields = &component->fields;
+    return &iap_metadata_component_fields[parser->field_ix];
+}
+
+static void iap_metadata_value_char(iap_metadata_parser_t *parser, char c)
+{
+    if (parser->field_ix < 0) {
+        return;
+    }
+    
+    uint8_t *base;
+    uint32_t *fields;
+    const iap_metadata_field_t *field = iap_metadata_current_field(parser, &base, &fields);
+    uint8_t *dest = base + field->offset;
+    
+    switch (field->type) {
+        
+        case IAP_METADATA_TYPE_INT:
+            if (c == '-' && parser->value_len == 0) {
+                parser->is_negative = 1;
+                break;
+            }
+            if (c < '0' || c > '9') {
+                iap_metadata_set_error(parser, IAP_METADATA_ERR_INVALID_VALUE);
+                return;
+            }
+            parser->int_value = parser->int_value * 10 + (c - '0');
+            if (parser->int_value > INT_MAX) {
+                iap_metadata_set_error(parser, IAP_METADATA_ERR_INVALID_VALUE);
+                return;
+            }
+            break;
+        
+        case IAP_METADATA_TYPE_STRING:
+            // Leave room for the terminating zero.
+            if (parser->value_len >= field->size - 1) {
+                iap_metadata_set_error(parser, IAP_METADATA_ERR_VALUE_TOO_LONG);
+                return;
+            }
+            dest[parser->value_len] = c;
+            break;
+        
+        case IAP_METADATA_TYPE_HEX: {
+            int nibble = iap_metadata_hex_digit(c);
+            if (nibble < 0) {
+                iap_metadata_set_error(parser, IAP_METADATA_ERR_INVALID_VALUE);
+                return;
+            }
+            size_t byteIx = parser->value_len / 2;
+            if (byteIx >= field->size) {
+                iap_metadata_set_error(parser, IAP_METADATA_ERR_VALUE_TOO_LONG);
+                return;
+            }
+            if (parser->value_len % 2 == 0) {
+                dest[byteIx] = nibble << 4;
+            } else {
+                dest[byteIx] |= nibble;
+            }
+            break;
+        }
+    }
+    
+    parser->value_len++;
+}
+
+static void iap_metadata_end_value(iap_metadata_parser_t *parser)
+{
+    if (parser->field_ix < 0) {
+        return;
+    }
+    
+    uint8_t *base;
+    uint32_t *fields;
+    const iap_metadata_field_t *field = iap_metadata_current_field(parser, &base, &fields);
+    uint8_t *dest = base + field->offset;
+    
+    switch (field->type) {
+        
+        case IAP_METADATA_TYPE_INT:
+            if (parser->value_len == 0 || (parser->is_negative && parser->value_len == 1)) {
+                iap_metadata_set_error(parser, IAP_METADATA_ERR_INVALID_VALUE);
+                return;
+            }
+            *(int *)dest = parser->is_negative ? -(int)parser->int_value : (int)parser->int_value;
+            break;
+        
+        case IAP_METADATA_TYPE_STRING:
+            dest[parser->value_len] = 0x00;
+            break;
+        
+        case IAP_METADATA_TYPE_HEX:
+            if (parser->value_len % 2 != 0 || (!field->len_offset && parser->value_len / 2 != field->size)) {
+                iap_metadata_set_error(parser, IAP_METADATA_ERR_INVALID_VALUE);
+                return;
+            }
+            if (field->len_offset) {
+                *(size_t *)(base + field->len_offset) = parser->value_len / 2;
+            }
+            break;
+    }
+    
+    *fields |= field->flag;
+    parser->field_ix = -1;
+}
+
+static void iap_metadata_set_error(iap_metadata_parser_t *parser, iap_metadata_err_t error)
+{
+    ESP_LOGW(TAG, "iap_metadata_set_error: invalid value for key '%s' in line %d", parser->key, parser->line_nr);
+    
+    // Remember the first error, skip the rest of the line.
+    if (parser->error == IAP_METADATA_OK) {
+        parser->error = error;
+        parser->error_line_nr = parser->line_nr;
+    }
+    parser->field_ix = -1;
+    parser->state = IAP_METADATA_STATE_SKIP;
+}
+
+static int iap_metadata_hex_digit(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static iap_metadata_err_t iap_metadata_decode_cbor_map(const uint8_t *data, size_t len, iap_metadata_t *metadata)
+{
+    iap_cbor_reader_t reader;
+    iap_cbor_reader_init(&reader, data, len);
+    
+    int major;
+    uint64_t nofPairs;
+    if (iap_cbor_read_head(&reader, &major, &nofPairs) || major != IAP_CBOR_MAJOR_MAP) {
+        return IAP_METADATA_ERR_INVALID_FORMAT;
+    }
+    
+    for (uint64_t i = 0; i < nofPairs; i++) {
+        
+        int64_t key;
+        if (iap_cbor_read_int(&reader, &key)) {
+            return IAP_METADATA_ERR_INVALID_FORMAT;
+        }
+        
+        iap_metadata_err_t result;
+        if (key == IAP_METADATA_CBOR_KEY_COMPONENTS) {
+            result = iap_metadata_decode_cbor_components(&reader, metadata);
+        } else {
+            result = iap_metadata_decode_cbor_value(&reader, key, iap_metadata_fields, IAP_METADATA_NOF_FIELDS,
+                                                    (uint8_t *)metadata, &metadata->fields);
+        }
+        if (result != IAP_METADATA_OK) {
+            return result;
+        }
+    }
+    
+    if (!iap_cbor_at_end(&reader)) {
+        return IAP_METADATA_ERR_INVALID_FORMAT;
+    }
+    
+    return IAP_METADATA_OK;
+}
+
+// An array of maps, each with the component name (key 0) and the component fields.
+static iap_metadata_err_t iap_metadata_decode_cbor_components(iap_cbor_reader_t *reader, iap_metadata_t *metadata)
+{
+    int major;
+    uint64_t nofComponents;
+    if (iap_cbor_read_head(reader, &major, &nofComponents) || major != IAP_CBOR_MAJOR_ARRAY) {
+        return IAP_METADATA_ERR_INVALID_FORMAT;
+    }
+    
+    if (nofComponents > IAP_METADATA_MAX_COMPONENTS) {
+        return IAP_METADATA_ERR_TOO_MANY_COMPONENTS;
+    }
+    
+    metadata->nof_components = 0;
+    for (int c = 0; c < nofComponents; c++) {
+        
+        iap_metadata_component_t *component = &metadata->components[c];
+        memset(component, 0, sizeof(iap_metadata_component_t));
+        
+        uint64_t nofPairs;
+        if (iap_cbor_read_head(reader, &major, &nofPairs) || major != IAP_CBOR_MAJOR_MAP) {
+            return IAP_METADATA_ERR_INVALID_FORMAT;
+        }
+        
+        for (uint64_t i = 0; i < nofPairs; i++) {
+            
+            int64_t key;
+            if (iap_cbor_read_int(reader, &key)) {
+                return IAP_METADATA_ERR_INVALID_FORMAT;
+            }
+            
+            if (key == IAP_METADATA_CBOR_KEY_NAME) {
+                const uint8_t *str;
+                size_t strLen;
+                if (iap_cbor_read_string(reader, IAP_CBOR_MAJOR_TSTR, &str, &strLen)) {
+                    return IAP_METADATA_ERR_INVALID_VALUE;
+                }
+                if (strLen >= sizeof(component->name)) {
+                    return IAP_METADATA_ERR_VALUE_TOO_LONG;
+                }
+                memcpy(component->name, str, strLen);
+                component->name[strLen] = 0x00;
+                continue;
+            }
+            
+            iap_metadata_err_t result = iap_metadata_decode_cbor_value(reader, key, iap_metadata_component_fields, IAP_METADATA_NOF_COMPONENT_FIELDS,
+                                                                       (uint8_t *)component, &component->fields);
+            if (result != IAP_METADATA_OK) {
+                return result;
+            }
+        }
+        
+        // The name identifies the installed version of the component.
+        if (component->name[0] == 0x00) {
+            return IAP_METADATA_ERR_INVALID_VALUE;
+        }
+        
+        metadata->nof_components++;
+    }
+    
+    return IAP_METADATA_OK;
+}
+
+static iap_metadata_err_t iap_metadata_decode_cbor_value(iap_cbor_reader_t *reader, int64_t key, const iap_metadata_field_t *table,
+                                                         int nofFields, uint8_t *base, uint32_t *fields)
+{
+    const iap_metadata_field_t *field = NULL;
+    for (int f = 0; f < nofFields; f++) {
+        if (table[f].cbor_key == key) {
+            field = &table[f];
+            break;
+        }
+    }
+    
+    // Unknown keys are skipped, so that newer servers can add fields.
+    if (!field) {
+        return iap_cbor_skip(reader) ? IAP_METADATA_ERR_INVALID_FORMAT : IAP_METADATA_OK;
+    }
+    
+    uint8_t *dest = base + field->offset;
+    const uint8_t *str;
+    size_t strLen;
+    int64_t value;
+    
+    switch (field->type) {
+        
+        case IAP_METADATA_TYPE_INT:
+            if (iap_cbor_read_int(reader, &value) || value < INT_MIN || value > INT_MAX) {
+                return IAP_METADATA_ERR_INVALID_VALUE;
+            }
+            *(int *)dest = (int)value;
+            break;
+        
+        case IAP_METADATA_TYPE_STRING:
+            if (iap_cbor_read_string(reader, IAP_CBOR_MAJOR_TSTR, &str, &strLen)) {
+                return IAP_METADATA_ERR_INVALID_VALUE;
+            }
+            if (strLen >= field->size) {
+                return IAP_METADATA_ERR_VALUE_TOO_LONG;
+            }
+            memcpy(dest, str, strLen);
+            dest[strLen] = 0x00;
+            break;
+        
+        case IAP_METADATA_TYPE_HEX:
+            // Binary values are byte strings instead of hex digits.
+            if (iap_cbor_read_string(reader, IAP_CBOR_MAJOR_BSTR, &str, &strLen)) {
+                return IAP_METADATA_ERR_INVALID_VALUE;
+            }
+            if (strLen > field->size || (!field->len_offset && strLen != field->size)) {
+                return IAP_METADATA_ERR_VALUE_TOO_LONG;
+            }
+            memcpy(dest, str, strLen);
+            if (field->len_offset) {
+                *(size_t *)(base + field->len_offset) = strLen;
+            }
+            break;
+    }
+    
+    *fields |= field->flag;
+    return IAP_METADATA_OK;
+}
+
+// COSE_Sign1 = #6.18([ protected : bstr, unprotected : map, payload : bstr, signature : bstr ])
+static iap_metadata_err_t iap_metadata_decode_cose_sign1(iap_cbor_reader_t *reader, const char *publicKeyPem, iap_metadata_t *metadata)
+{
+    int major;
+    uint64_t argument;
+    
+    // The tag is optional if the context identifies the structure.
+    if (iap_cbor_peek_major(reader) == IAP_CBOR_MAJOR_TAG) {
+        if (iap_cbor_read_head(reader, &major, &argument) || argument != IAP_METADATA_COSE_SIGN1_TAG) {
+            return IAP_METADATA_ERR_INVALID_FORMAT;
+        }
+    }
+    
+    if (iap_cbor_read_head(reader, &major, &argument) || major != IAP_CBOR_MAJOR_ARRAY || argument != 4) {
+        return IAP_METADATA_ERR_INVALID_FORMAT;
+    }
+    
+    const uint8_t *protectedHeader;
+    size_t protectedHeaderLen;
+    const uint8_t *payload;
+    size_t payloadLen;
+    const uint8_t *signature;
+    size_t signatureLen;
+    
+    if (iap_cbor_read_string(reader, IAP_CBOR_MAJOR_BSTR, &protectedHeader, &protectedHeaderLen)
+        || iap_cbor_peek_major(reader) != IAP_CBOR_MAJOR_MAP || iap_cbor_skip(reader)
+        || iap_cbor_read_string(reader, IAP_CBOR_MAJOR_BSTR, &payload, &payloadLen)
+        || iap_cbor_read_string(reader, IAP_CBOR_MAJOR_BSTR, &signature, &signatureLen)
+        || !iap_cbor_at_end(reader))
+    {
+        return IAP_METADATA_ERR_INVALID_FORMAT;
+    }
+    
+    if (publicKeyPem) {
+        
+        if (!iap_metadata_cose_alg_is_es256(protectedHeader, protectedHeaderLen) || signatureLen != IAP_METADATA_ES256_SIG_LEN) {
+            ESP_LOGE(TAG, "iap_metadata_decode_cose_sign1: unsupported signature algorithm");
+            return IAP_METADATA_ERR_SIGNATURE;
+        }
+        
+        // The signature covers the CBOR encoding of the Sig_structure
+        // [ "Signature1", protected, external_aad (empty), payload ].
+        // Hash it piece by piece instead of assembling it in memory.
+        static const uint8_t sigStructureHead[] = { 0x84, 0x6a, 'S', 'i', 'g', 'n', 'a', 't', 'u', 'r', 'e', '1' };
+        static const uint8_t emptyExternalAad[] = { 0x40 };
+        uint8_t hash[32];
+        
+        mbedtls_sha256_context sha256;
+        mbedtls_sha256_init(&sha256);
+        mbedtls_sha256_starts(&sha256, 0);
+        mbedtls_sha256_update(&sha256, sigStructureHead, sizeof(sigStructureHead));
+        iap_metadata_sha256_bstr(&sha256, protectedHeader, protectedHeaderLen);
+        mbedtls_sha256_update(&sha256, emptyExternalAad, sizeof(emptyExternalAad));
+        iap_metadata_sha256_bstr(&sha256, payload, payloadLen);
+        mbedtls_sha256_finish(&sha256, hash);
+        mbedtls_sha256_free(&sha256);
+        
+        if (iap_metadata_verify_es256(publicKeyPem, hash, signature)) {
+            ESP_LOGE(TAG, "iap_metadata_decode_cose_sign1: invalid signature");
+            return IAP_METADATA_ERR_SIGNATURE;
+        }
+        
+    } else {
+        ESP_LOGW(TAG, "iap_metadata_decode_cose_sign1: no public key configured, signature not verified");
+    }
+    
+    return iap_metadata_decode_cbor_map(payload, payloadLen, metadata);
+}
+
+static int iap_metadata_cose_alg_is_es256(const uint8_t *protectedHeader, size_t len)
+{
+    iap_cbor_reader_t reader;
+    iap_cbor_reader_init(&reader, protectedHeader, len);
+    
+    int major;
+    uint64_t nofPairs;
+    if (iap_cbor_read_head(&reader, &major, &nofPairs) || major != IAP_CBOR_MAJOR_MAP) {
+        return 0;
+    }
+    
+    for (uint64_t i = 0; i < nofPairs; i++) {
+        int64_t label;
+        int64_t value;
+        if (iap_cbor_read_int(&reader, &label)) {
+            // Text labels are allowed, but not used for the algorithm.
+            return 0;
+        }
+        if (label != IAP_METADATA_COSE_HEADER_ALG) {
+            if (iap_cbor_skip(&reader)) {
+                return 0;
+            }
+            continue;
+        }
+        return !iap_cbor_read_int(&reader, &value) && value == IAP_METADATA_COSE_ALG_ES256;
+    }
+    
+    return 0;
+}
+
+static void iap_metadata_sha256_bstr(mbedtls_sha256_context *sha256, const uint8_t *data, size_t len)
+{
+    uint8_t head[9];
+    size_t headLen = iap_cbor_encode_head(head, IAP_CBOR_MAJOR_BSTR, len);
+    mbedtls_sha256_update(sha256, head, headLen);
+    mbedtls_sha256_update(sha256, data, len);
+}
+
+static int iap_metadata_verify_es256(const char *publicKeyPem, const uint8_t *hash, const uint8_t *signature)
+{
+    mbedtls_pk_context pk;
+    mbedtls_mpi r;
+    mbedtls_mpi s;
+    
+    mbedtls_pk_init(&pk);
+    mbedtls_mpi_init(&r);
+    mbedtls_mpi_init(&s);
+    
+    // The PEM parser expects the length to include the terminating zero.
+    int result = mbedtls_pk_parse_public_key(&pk, (const unsigned char *)publicKeyPem, strlen(publicKeyPem) + 1);
+    if (result) {
+        ESP_LOGE(TAG, "iap_metadata_verify_es256: failed to parse the public key (-0x%x)", -result);
+    } else if (!mbedtls_pk_can_do(&pk, MBEDTLS_PK_ECKEY)) {
+        ESP_LOGE(TAG, "iap_metadata_verify_es256: the public key is not an EC key");
+        result = -1;
+    } else if (mbedtls_pk_ec(pk)->grp.id != MBEDTLS_ECP_DP_SECP256R1) {
+        // ES256 is ECDSA with P-256; a key on another curve would verify signatures of another algorithm.
+        ESP_LOGE(TAG, "iap_metadata_verify_es256: the public key is not on the P-256 curve");
+        result = -1;
+    } else {
+        // COSE uses the raw r|s encoding instead of ASN.1.
+        mbedtls_ecp_keypair *ec = mbedtls_pk_ec(pk);
+        result = mbedtls_mpi_read_binary(&r, signature, IAP_METADATA_ES256_SIG_LEN / 2);
+        if (!result) {
+            result = mbedtls_mpi_read_binary(&s, &signature[IAP_METADATA_ES256_SIG_LEN / 2], IAP_METADATA_ES256_SIG_LEN / 2);
+        }
+        if (!result) {
+            result = mbedtls_ecdsa_verify(&ec->grp, hash, 32, &ec->Q, &r, &s);
+        }
+    }
+    
+    mbedtls_mpi_free(&s);
+    mbedtls_mpi_free(&r);
+    mbedtls_pk_free(&pk);
+    
+    return result;
+}
+
+// Parses a non-negative decimal number (at most 18 digits) and advances 'str' behind it.
+static int iap_metadata_parse_decimal(const char **str, int64_t *value)
+{
+    int nofDigits = 0;
+    *value = 0;
+    
+    while (**str >= '0' && **str <= '9') {
+        if (++nofDigits > 18) {
+            return -1;
+        }
+        *value = 10 * *value + (**str - '0');
+        (*str)++;
+    }
+    
+    return nofDigits > 0 ? 0 : -1;
+}
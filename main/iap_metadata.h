@@ -0,0 +1,226 @@
+//
+//  iap_metadata.h
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  This module parses the firmware metadata file (KEY=VALUE lines) in a
+//  single pass while the data arrives, without buffering the file. It also
+//  decodes the CBOR variant of the file, optionally signed with COSE_Sign1.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __IAP_METADATA__
+#define __IAP_METADATA__ 1
+
+
+#define IAP_METADATA_MAX_FILE_LEN       256
+#define IAP_METADATA_SHA256_LEN         32
+#define IAP_METADATA_MAX_SIGNATURE_LEN  256
+
+// Additional components (e.g. a SPIFFS image) listed in the metadata.
+#define IAP_METADATA_MAX_COMPONENTS     3
+
+// Component names are used as NVS keys (max. 15 characters).
+#define IAP_METADATA_MAX_NAME_LEN       16
+#define IAP_METADATA_MAX_PARTITION_LEN  17
+
+// Maximum length of the rollout salt (including the terminating zero).
+#define IAP_METADATA_MAX_SALT_LEN       33
+
+// Maximum size of metadata in CBOR format (which is decoded as a whole).
+#define IAP_METADATA_MAX_CBOR_LEN       1024
+
+// Bits in iap_metadata_t.fields, set for every field found in the metadata.
+#define IAP_METADATA_HAS_VERSION        (1 << 0)
+#define IAP_METADATA_HAS_FILE           (1 << 1)
+#define IAP_METADATA_HAS_INTERVAL       (1 << 2)
+#define IAP_METADATA_HAS_SIZE           (1 << 3)
+#define IAP_METADATA_HAS_SHA256         (1 << 4)
+#define IAP_METADATA_HAS_SIGNATURE      (1 << 5)
+#define IAP_METADATA_HAS_DELTA_BASE     (1 << 6)
+#define IAP_METADATA_HAS_MIN_VERSION    (1 << 7)
+#define IAP_METADATA_HAS_ROLLOUT        (1 << 8)
+#define IAP_METADATA_HAS_PARTITION      (1 << 9)
+#define IAP_METADATA_HAS_SALT           (1 << 10)
+
+typedef int32_t iap_metadata_err_t;
+
+#define IAP_METADATA_OK                 0
+#define IAP_METADATA_ERR_INVALID_VALUE  0x101 // additional info = line number
+#define IAP_METADATA_ERR_VALUE_TOO_LONG 0x102 // additional info = line number
+#define IAP_METADATA_ERR_INVALID_FORMAT 0x103
+#define IAP_METADATA_ERR_SIGNATURE      0x104
+#define IAP_METADATA_ERR_NOT_SIGNED     0x105
+#define IAP_METADATA_ERR_TOO_MANY_COMPONENTS 0x106
+
+
+// Contents of the metadata file. Example:
+//
+//   VERSION=5
+//   FILE=/esp32/esp32-ota-https.bin
+//   INTERVAL=3600
+//   SIZE=812304
+//   SHA256=9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08
+//
+// A component which is installed in a data partition. In the text format, each
+// component starts with a "[name]" line, followed by its fields:
+//
+//   [storage]
+//   VERSION=3
+//   FILE=/esp32/storage.bin
+//   PARTITION=storage
+//
+typedef struct iap_metadata_component_ {
+    
+    // IAP_METADATA_HAS_... bits of the fields below that were present.
+    uint32_t fields;
+    
+    // Name of the component, identifies the installed version on the device.
+    char name[IAP_METADATA_MAX_NAME_LEN];
+    
+    // VERSION=, FILE=, SIZE=, SHA256= as for the firmware image.
+    int version;
+    char file[IAP_METADATA_MAX_FILE_LEN];
+    int size;
+    uint8_t sha256[IAP_METADATA_SHA256_LEN];
+    
+    // PARTITION= label of the data partition to write.
+    char partition[IAP_METADATA_MAX_PARTITION_LEN];
+
+} iap_metadata_component_t;
+
+// In the CBOR format, the metadata is a map with integer keys, numbered in the
+// order of the fields below (VERSION = 1, FILE = 2, ... ROLLOUT = 9). SHA256
+// and SIGNATURE are byte strings instead of hex digits. Key 10 is an array of
+// components, each a map with the name (key 0), the fields with the same keys
+// as above and PARTITION (key 11). SALT is key 12.
+//
+typedef struct iap_metadata_ {
+    
+    // IAP_METADATA_HAS_... bits of the fields below that were present.
+    uint32_t fields;
+    
+    // VERSION= version number of the firmware image on the server.
+    int version;
+    
+    // FILE= path to the firmware image on the server.
+    char file[IAP_METADATA_MAX_FILE_LEN];
+    
+    // INTERVAL= time between two checks, in seconds.
+    int interval_s;
+    
+    // SIZE= size of the firmware image, in bytes.
+    int size;
+    
+    // SHA256= SHA-256 hash of the firmware image (64 hex digits).
+    uint8_t sha256[IAP_METADATA_SHA256_LEN];
+    
+    // SIGNATURE= signature of the firmware image (hex digits).
+    uint8_t signature[IAP_METADATA_MAX_SIGNATURE_LEN];
+    size_t signature_len;
+    
+    // DELTA_BASE= the image is a delta against this firmware version.
+    int delta_base_version;
+    
+    // MIN_VERSION= devices need to run at least this version to install the image.
+    int min_version;
+    
+    // ROLLOUT= percentage of the devices (0..100) which should install the image.
+    int rollout_percent;
+    
+    // SALT= selects the devices of the rollout. Each device hashes its ID with
+    // the salt; keeping the salt while ROLLOUT grows only adds devices, a new
+    // salt (e.g. per release) selects a different group for the first percent.
+    char rollout_salt[IAP_METADATA_MAX_SALT_LEN];
+    
+    // Components listed after the firmware image fields.
+    iap_metadata_component_t components[IAP_METADATA_MAX_COMPONENTS];
+    int nof_components;
+
+} iap_metadata_t;
+
+// Parser state. Fixed size, independent of the length of the metadata file.
+typedef struct iap_metadata_parser_ {
+    
+    iap_metadata_t *metadata;
+    
+    // Current position in the line (see iap_metadata.c).
+    int state;
+    
+    // Key of the current line.
+    char key[16];
+    int key_len;
+    
+    // Number of bytes of a UTF-8 byte order mark skipped at the start of the file.
+    int bom_len;
+    
+    // Field of the current line, or -1 if the key is unknown.
+    int field_ix;
+    
+    // Component of the current section, or -1 before the first section.
+    int component_ix;
+    
+    // Value of the current line, decoded on the fly.
+    int value_len;
+    int64_t int_value;
+    int is_negative;
+    
+    int line_nr;
+    iap_metadata_err_t error;
+    int error_line_nr;
+
+} iap_metadata_parser_t;
+
+
+// Prepare the parser to fill the metadata structure (which is cleared).
+void iap_metadata_parser_init(iap_metadata_parser_t *parser, iap_metadata_t *metadata);
+
+// Process the next part of the metadata file.
+void iap_metadata_parser_feed(iap_metadata_parser_t *parser, const char *data, size_t len);
+
+// Complete the parsing after the last part has been fed to the parser.
+// Returns IAP_METADATA_OK or the first error (see parser->error_line_nr).
+iap_metadata_err_t iap_metadata_parser_finish(iap_metadata_parser_t *parser);
+
+// Returns 1 if the metadata starting with this byte is in CBOR format rather than text
+// (a map, or a COSE_Sign1 array with or without its tag).
+int iap_metadata_is_cbor(uint8_t first_byte);
+
+// Decode metadata in CBOR format, either a plain map or a COSE_Sign1 structure
+// (RFC 8152, algorithm ES256) with the map as payload. If public_key_pem is not
+// NULL, the metadata needs to be signed with the corresponding private key.
+// Doesn't allocate memory, apart from parsing the public key.
+iap_metadata_err_t iap_metadata_decode_cbor(const uint8_t *data, size_t len, const char *public_key_pem, iap_metadata_t *metadata);
+
+// Decode a signed version announcement, e.g. published in a DNS TXT record:
+//
+//   v=5;exp=1735689600;sig=<128 hex digits>
+//
+// 'v' is the version of the metadata, 'exp' the expiry time (seconds since
+// 1970-01-01 UTC). The signature (ES256, r and s as 32 bytes each) covers the
+// text before ";sig=". The announcement needs to be signed with the private key
+// corresponding to public_key_pem.
+iap_metadata_err_t iap_metadata_decode_announcement(const char *text, const char *public_key_pem, int *version, int64_t *expiry);
+
+
+#endif // __IAP_METADATA__
@@ -51,6 +51,7 @@ static iap_https_config_t ota_config;
 
 static void init_wifi();
 static void init_ota();
+static void ota_progress_callback(const iap_https_progress_t *progress, void *arg);
 static esp_err_t app_event_handler(void *ctx, system_event_t *event);
 
 
@@ -144,6 +145,8 @@ static void init_ota()
     ota_config.peer_public_key_pem = peer_public_key_pem;
     ota_config.polling_interval_s = OTA_POLLING_INTERVAL_S;
     ota_config.auto_reboot = OTA_AUTO_REBOOT;
+    ota_config.progress_callback = ota_progress_callback;
+    ota_config.progress_interval_ms = 2000;
     
     iap_https_init(&ota_config);
     
@@ -151,6 +154,15 @@ static void init_ota()
     iap_https_check_now();
 }
 
+static void ota_progress_callback(const iap_https_progress_t *progress, void *arg)
+{
+    // A real application could show this in its UI or report the download rate
+    // as a measure of the link quality.
+    ESP_LOGI(TAG, "Update progress (phase %d): %u of %u bytes, %u bytes/s (average %u bytes/s), %d s left.",
+             progress->phase, progress->bytes_received, progress->total_bytes,
+             progress->bytes_per_s, progress->average_bytes_per_s, progress->eta_s);
+}
+
 static esp_err_t app_event_handler(void *ctx, system_event_t *event)
 {
     esp_err_t result = ESP_OK;
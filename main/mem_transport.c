@@ -0,0 +1,200 @@
+//
+//  mem_transport.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  This module provides an in-memory transport which replays scripted
+//  server responses through the https_transport interface. It lets us
+//  measure the throughput of the HTTP parsing and streaming code without
+//  the cost of sockets and cryptography, and reproduce recorded downloads
+//  with their original read boundaries.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+#include "https_transport.h"
+#include "mem_transport.h"
+
+
+#define TAG "mem_trsp"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+
+// Internal state for a single in-memory context.
+typedef struct mem_transport_context_ {
+    
+    mem_transport_init_struct_t params;
+    
+    // Index of the response which is replayed on the next connection.
+    int next_response_ix;
+    
+    // Response of the current connection, NULL if not connected.
+    const mem_transport_response_t *cur_response;
+    
+    // Number of response bytes already delivered on the current connection.
+    size_t cur_response_offset;
+    
+    // Index of the next read boundary (if the response defines chunk lengths).
+    int cur_chunk_ix;
+    
+    // Bytes of the current chunk which didn't fit into the caller's buffer.
+    size_t cur_chunk_remaining;
+    
+    // Total number of request bytes written to this context.
+    size_t nof_bytes_written;
+
+} mem_transport_context_t;
+
+
+static int mem_transport_connect(void *context);
+static int mem_transport_write(void *context, const char *buf, size_t len);
+static int mem_transport_read(void *context, char *buf, size_t len);
+static void mem_transport_close(void *context);
+static int mem_transport_wait_readable(void *context, uint32_t timeout_ms);
+
+
+mem_transport_context_t *mem_transport_create_context(mem_transport_init_struct_t *params)
+{
+    if (!params->responses || params->nof_responses < 1) {
+        ESP_LOGE(TAG, "mem_transport_create_context: no responses provided");
+        return NULL;
+    }
+    
+    mem_transport_context_t *ctx = calloc(1, sizeof(mem_transport_context_t));
+    if (!ctx) {
+        ESP_LOGE(TAG, "mem_transport_create_context: out of memory");
+        return NULL;
+    }
+    
+    ctx->params = *params;
+    return ctx;
+}
+
+void mem_transport_free_context(mem_transport_context_t *ctx)
+{
+    free(ctx);
+}
+
+size_t mem_transport_get_nof_bytes_written(mem_transport_context_t *ctx)
+{
+    return ctx->nof_bytes_written;
+}
+
+void mem_transport_init_transport(mem_transport_context_t *ctx, https_transport_t *transport)
+{
+    transport->context = ctx;
+    transport->connect = mem_transport_connect;
+    transport->write = mem_transport_write;
+    transport->read = mem_transport_read;
+    transport->close = mem_transport_close;
+    transport->wait_readable = mem_transport_wait_readable;
+}
+
+
+static int mem_transport_connect(void *context)
+{
+    mem_transport_context_t *ctx = (mem_transport_context_t *)context;
+    
+    ctx->cur_response = &ctx->params.responses[ctx->next_response_ix];
+    ctx->cur_response_offset = 0;
+    ctx->cur_chunk_ix = 0;
+    ctx->cur_chunk_remaining = 0;
+    ctx->next_response_ix = (ctx->next_response_ix + 1) % ctx->params.nof_responses;
+    
+    ESP_LOGD(TAG, "mem_transport_connect: replaying response of %d bytes", ctx->cur_response->len);
+    return 0;
+}
+
+static int mem_transport_write(void *context, const char *buf, size_t len)
+{
+    mem_transport_context_t *ctx = (mem_transport_context_t *)context;
+    
+    if (!ctx->cur_response) {
+        ESP_LOGE(TAG, "mem_transport_write: not connected");
+        return -1;
+    }
+    
+    // The request itself is irrelevant, the response has been scripted.
+    ctx->nof_bytes_written += len;
+    return len;
+}
+
+static int mem_transport_read(void *context, char *buf, size_t len)
+{
+    mem_transport_context_t *ctx = (mem_transport_context_t *)context;
+    
+    if (!ctx->cur_response) {
+        ESP_LOGE(TAG, "mem_transport_read: not connected");
+        return -1;
+    }
+    
+    size_t remaining = ctx->cur_response->len - ctx->cur_response_offset;
+    if (remaining == 0) {
+        return 0; // EOF
+    }
+    
+    size_t n = MIN(remaining, len);
+    if (ctx->cur_response->chunk_lengths) {
+        // Replay the recorded read boundaries.
+        if (ctx->cur_chunk_remaining == 0 && ctx->cur_chunk_ix < ctx->cur_response->nof_chunks) {
+            ctx->cur_chunk_remaining = ctx->cur_response->chunk_lengths[ctx->cur_chunk_ix++];
+        }
+        if (ctx->cur_chunk_remaining > 0) {
+            n = MIN(n, ctx->cur_chunk_remaining);
+            ctx->cur_chunk_remaining -= n;
+        }
+    } else if (ctx->params.chunk_size > 0) {
+        n = MIN(n, ctx->params.chunk_size);
+    }
+    
+    if (ctx->params.chunk_delay_ms > 0) {
+        vTaskDelay(ctx->params.chunk_delay_ms / portTICK_PERIOD_MS);
+    }
+    
+    memcpy(buf, &ctx->cur_response->data[ctx->cur_response_offset], n);
+    ctx->cur_response_offset += n;
+    
+    return n;
+}
+
+static void mem_transport_close(void *context)
+{
+    mem_transport_context_t *ctx = (mem_transport_context_t *)context;
+    
+    ctx->cur_response = NULL;
+    ctx->cur_response_offset = 0;
+}
+
+static int mem_transport_wait_readable(void *context, uint32_t timeout_ms)
+{
+    mem_transport_context_t *ctx = (mem_transport_context_t *)context;
+    
+    // Scripted data is always available (the chunk delay is applied in the read function).
+    return ctx->cur_response ? 1 : -1;
+}
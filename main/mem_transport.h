@@ -0,0 +1,94 @@
+//
+//  mem_transport.h
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  This module provides an in-memory transport which replays scripted
+//  server responses through the https_transport interface. It lets us
+//  measure the throughput of the HTTP parsing and streaming code without
+//  the cost of sockets and cryptography, and reproduce recorded downloads
+//  with their original read boundaries.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __MEM_TRANSPORT__
+#define __MEM_TRANSPORT__ 1
+
+
+// Forward declaration of the opaque context object.
+struct mem_transport_context_;
+
+// Forward declaration of the transport interface (see https_transport.h).
+struct https_transport_;
+
+
+// A single scripted server response (HTTP headers and message body).
+typedef struct mem_transport_response_ {
+    
+    // Raw response data, e.g. "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nOK".
+    const char *data;
+    
+    // Number of bytes in data.
+    size_t len;
+    
+    // (Optional) exact length of every read, e.g. from a recording made with
+    // the rec_transport module. If set, chunk_size is ignored for this response.
+    const uint32_t *chunk_lengths;
+    int nof_chunks;
+    
+} mem_transport_response_t;
+
+typedef struct mem_transport_init_struct_ {
+    
+    // Responses to replay. Every connection replays the next response;
+    // after the last one, the sequence starts again with the first.
+    // The responses are not copied and need to be kept in memory.
+    const mem_transport_response_t *responses;
+    
+    // Number of responses.
+    int nof_responses;
+    
+    // Maximum number of bytes returned by a single read, 0 for no limit.
+    size_t chunk_size;
+    
+    // Delay before each chunk is delivered, in milliseconds.
+    uint32_t chunk_delay_ms;
+    
+} mem_transport_init_struct_t;
+
+
+// Create a context which replays the scripted responses.
+struct mem_transport_context_ *mem_transport_create_context(mem_transport_init_struct_t *params);
+
+// Release the context.
+void mem_transport_free_context(struct mem_transport_context_ *context);
+
+// Returns the number of request bytes written to the transport since the context was created.
+size_t mem_transport_get_nof_bytes_written(struct mem_transport_context_ *context);
+
+// Initialise the transport structure so that the https_client module
+// reads the scripted responses of the context.
+void mem_transport_init_transport(struct mem_transport_context_ *context, struct https_transport_ *transport);
+
+
+#endif // __MEM_TRANSPORT__
@@ -0,0 +1,190 @@
+//
+//  rec_transport.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  This module wraps another https_transport and records the received
+//  (decrypted) byte stream together with the boundaries of the individual
+//  reads. A recording can be replayed with exactly the same boundaries
+//  through the mem_transport module.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+
+#include "https_transport.h"
+#include "mem_transport.h"
+#include "rec_transport.h"
+
+
+#define TAG "rec_trsp"
+
+
+// Internal state for a single recording context.
+typedef struct rec_transport_context_ {
+    
+    rec_transport_init_struct_t params;
+    
+    // The wrapped transport.
+    https_transport_t inner;
+    
+    // Number of bytes stored in the data buffer.
+    size_t nof_bytes;
+    
+    // Number of read boundaries stored in the chunk buffer.
+    int nof_chunks;
+    
+    // Set if data or boundaries didn't fit into the buffers.
+    int is_truncated;
+
+} rec_transport_context_t;
+
+
+static int rec_transport_connect(void *context);
+static int rec_transport_write(void *context, const char *buf, size_t len);
+static int rec_transport_read(void *context, char *buf, size_t len);
+static void rec_transport_close(void *context);
+static int rec_transport_wait_readable(void *context, uint32_t timeout_ms);
+
+
+rec_transport_context_t *rec_transport_create_context(rec_transport_init_struct_t *params)
+{
+    if (!params->transport || !params->data_buffer || !params->chunk_lengths) {
+        ESP_LOGE(TAG, "rec_transport_create_context: parameter missing");
+        return NULL;
+    }
+    
+    rec_transport_context_t *ctx = calloc(1, sizeof(rec_transport_context_t));
+    if (!ctx) {
+        ESP_LOGE(TAG, "rec_transport_create_context: out of memory");
+        return NULL;
+    }
+    
+    ctx->params = *params;
+    ctx->inner = *params->transport;
+    return ctx;
+}
+
+void rec_transport_free_context(rec_transport_context_t *ctx)
+{
+    free(ctx);
+}
+
+void rec_transport_reset(rec_transport_context_t *ctx)
+{
+    ctx->nof_bytes = 0;
+    ctx->nof_chunks = 0;
+    ctx->is_truncated = 0;
+}
+
+int rec_transport_get_recording(rec_transport_context_t *ctx, mem_transport_response_t *response)
+{
+    response->data = ctx->params.data_buffer;
+    response->len = ctx->nof_bytes;
+    response->chunk_lengths = ctx->params.chunk_lengths;
+    response->nof_chunks = ctx->nof_chunks;
+    
+    return !ctx->is_truncated;
+}
+
+void rec_transport_dump(rec_transport_context_t *ctx)
+{
+    ESP_LOGI(TAG, "Recording: %d bytes in %d reads%s.", ctx->nof_bytes, ctx->nof_chunks,
+             ctx->is_truncated ? " (truncated)" : "");
+    
+    size_t offset = 0;
+    for (int i = 0; i < ctx->nof_chunks; i++) {
+        printf("# read %d: %u bytes at offset %u\n", i, ctx->params.chunk_lengths[i], offset);
+        for (size_t j = 0; j < ctx->params.chunk_lengths[i]; j++) {
+            printf("%02x", (uint8_t)ctx->params.data_buffer[offset + j]);
+            if (j % 32 == 31 || j + 1 == ctx->params.chunk_lengths[i]) {
+                printf("\n");
+            }
+        }
+        offset += ctx->params.chunk_lengths[i];
+    }
+}
+
+void rec_transport_init_transport(rec_transport_context_t *ctx, https_transport_t *transport)
+{
+    transport->context = ctx;
+    transport->connect = rec_transport_connect;
+    transport->write = rec_transport_write;
+    transport->read = rec_transport_read;
+    transport->close = rec_transport_close;
+    transport->wait_readable = ctx->inner.wait_readable ? rec_transport_wait_readable : NULL;
+}
+
+
+static int rec_transport_connect(void *context)
+{
+    rec_transport_context_t *ctx = (rec_transport_context_t *)context;
+    
+    rec_transport_reset(ctx);
+    return ctx->inner.connect(ctx->inner.context);
+}
+
+static int rec_transport_write(void *context, const char *buf, size_t len)
+{
+    rec_transport_context_t *ctx = (rec_transport_context_t *)context;
+    return ctx->inner.write(ctx->inner.context, buf, len);
+}
+
+static int rec_transport_read(void *context, char *buf, size_t len)
+{
+    rec_transport_context_t *ctx = (rec_transport_context_t *)context;
+    
+    int ret = ctx->inner.read(ctx->inner.context, buf, len);
+    if (ret <= 0 || ctx->is_truncated) {
+        return ret;
+    }
+    
+    // Only record complete reads, a partial chunk couldn't be replayed faithfully.
+    size_t spaceRemaining = ctx->params.data_buffer_size - ctx->nof_bytes;
+    if (ret > spaceRemaining || ctx->nof_chunks == ctx->params.max_nof_chunks) {
+        ESP_LOGW(TAG, "rec_transport_read: recording buffer full after %d bytes", ctx->nof_bytes);
+        ctx->is_truncated = 1;
+        return ret;
+    }
+    
+    memcpy(&ctx->params.data_buffer[ctx->nof_bytes], buf, ret);
+    ctx->nof_bytes += ret;
+    ctx->params.chunk_lengths[ctx->nof_chunks++] = ret;
+    
+    return ret;
+}
+
+static void rec_transport_close(void *context)
+{
+    rec_transport_context_t *ctx = (rec_transport_context_t *)context;
+    ctx->inner.close(ctx->inner.context);
+}
+
+static int rec_transport_wait_readable(void *context, uint32_t timeout_ms)
+{
+    rec_transport_context_t *ctx = (rec_transport_context_t *)context;
+    return ctx->inner.wait_readable(ctx->inner.context, timeout_ms);
+}
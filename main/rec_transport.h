@@ -0,0 +1,86 @@
+//
+//  rec_transport.h
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  This module wraps another https_transport and records the received
+//  (decrypted) byte stream together with the boundaries of the individual
+//  reads. A recording can be replayed with exactly the same boundaries
+//  through the mem_transport module.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __REC_TRANSPORT__
+#define __REC_TRANSPORT__ 1
+
+
+// Forward declaration of the opaque context object.
+struct rec_transport_context_;
+
+// Forward declarations (see https_transport.h and mem_transport.h).
+struct https_transport_;
+struct mem_transport_response_;
+
+
+typedef struct rec_transport_init_struct_ {
+    
+    // The transport which actually communicates with the server.
+    // The structure is copied.
+    struct https_transport_ *transport;
+    
+    // Buffer to store the received bytes.
+    // Data beyond the end of the buffer is not recorded.
+    char *data_buffer;
+    size_t data_buffer_size;
+    
+    // Buffer to store the length of every read.
+    uint32_t *chunk_lengths;
+    int max_nof_chunks;
+    
+} rec_transport_init_struct_t;
+
+
+// Create a recording context. The buffers are not copied and need to be
+// kept in memory as long as the context is used.
+struct rec_transport_context_ *rec_transport_create_context(rec_transport_init_struct_t *params);
+
+// Release the context. The wrapped transport is not released.
+void rec_transport_free_context(struct rec_transport_context_ *context);
+
+// Start a new recording (the buffers are re-used).
+// Every connect also starts a new recording.
+void rec_transport_reset(struct rec_transport_context_ *context);
+
+// Make the current recording available for replay with the mem_transport module.
+// Returns 1 if the complete stream has been recorded, 0 if it has been truncated.
+int rec_transport_get_recording(struct rec_transport_context_ *context, struct mem_transport_response_ *response);
+
+// Print the current recording (read boundaries and hex dump) to the console,
+// e.g. to capture the stream of a device in the field.
+void rec_transport_dump(struct rec_transport_context_ *context);
+
+// Initialise the transport structure so that all reads through it are recorded.
+void rec_transport_init_transport(struct rec_transport_context_ *context, struct https_transport_ *transport);
+
+
+#endif // __REC_TRANSPORT__
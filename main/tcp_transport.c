@@ -0,0 +1,213 @@
+//
+//  tcp_transport.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  This module provides plain (unencrypted) TCP connections through the
+//  https_transport interface, e.g. for servers in a trusted local network.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "esp_log.h"
+
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+
+#include "https_transport.h"
+#include "tcp_transport.h"
+
+
+#define TAG "tcp_trsp"
+
+
+// Internal state for a single TCP context (single connection).
+typedef struct tcp_transport_context_ {
+    
+    char *server_host_name;
+    char *server_port;
+    
+    // Socket of the current connection, -1 if not connected.
+    int socket_fd;
+
+} tcp_transport_context_t;
+
+
+static int tcp_transport_connect(void *context);
+static int tcp_transport_write(void *context, const char *buf, size_t len);
+static int tcp_transport_read(void *context, char *buf, size_t len);
+static void tcp_transport_close(void *context);
+static int tcp_transport_wait_readable(void *context, uint32_t timeout_ms);
+
+
+tcp_transport_context_t *tcp_transport_create_context(const char *serverHostName, const char *serverPort)
+{
+    if (!serverHostName || !serverPort) {
+        ESP_LOGE(TAG, "tcp_transport_create_context: parameter missing");
+        return NULL;
+    }
+    
+    tcp_transport_context_t *ctx = calloc(1, sizeof(tcp_transport_context_t));
+    if (!ctx) {
+        ESP_LOGE(TAG, "tcp_transport_create_context: out of memory");
+        return NULL;
+    }
+    
+    ctx->server_host_name = strdup(serverHostName);
+    ctx->server_port = strdup(serverPort);
+    if (!ctx->server_host_name || !ctx->server_port) {
+        ESP_LOGE(TAG, "tcp_transport_create_context: out of memory");
+        free(ctx->server_host_name);
+        free(ctx->server_port);
+        free(ctx);
+        return NULL;
+    }
+    
+    ctx->socket_fd = -1;
+    
+    ESP_LOGD(TAG, "tcp_transport_create_context: context created for server: %s", ctx->server_host_name);
+    return ctx;
+}
+
+void tcp_transport_free_context(tcp_transport_context_t *ctx)
+{
+    tcp_transport_close(ctx);
+    
+    free(ctx->server_host_name);
+    free(ctx->server_port);
+    free(ctx);
+}
+
+void tcp_transport_init_transport(tcp_transport_context_t *ctx, https_transport_t *transport)
+{
+    transport->context = ctx;
+    transport->connect = tcp_transport_connect;
+    transport->write = tcp_transport_write;
+    transport->read = tcp_transport_read;
+    transport->close = tcp_transport_close;
+    transport->wait_readable = tcp_transport_wait_readable;
+}
+
+
+static int tcp_transport_connect(void *context)
+{
+    tcp_transport_context_t *ctx = (tcp_transport_context_t *)context;
+    
+    // Make sure we don't leak a previous connection.
+    tcp_transport_close(ctx);
+    
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    
+    struct addrinfo *addrList = NULL;
+    int gaiResult = getaddrinfo(ctx->server_host_name, ctx->server_port, &hints, &addrList);
+    if (gaiResult != 0 || !addrList) {
+        ESP_LOGE(TAG, "tcp_transport_connect: DNS lookup failed for '%s' (%d)", ctx->server_host_name, gaiResult);
+        return -1;
+    }
+    
+    int fd = socket(addrList->ai_family, addrList->ai_socktype, 0);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "tcp_transport_connect: failed to create socket (%d)", errno);
+        freeaddrinfo(addrList);
+        return -1;
+    }
+    
+    if (connect(fd, addrList->ai_addr, addrList->ai_addrlen) != 0) {
+        ESP_LOGE(TAG, "tcp_transport_connect: failed to connect to server '%s' (%d)", ctx->server_host_name, errno);
+        close(fd);
+        freeaddrinfo(addrList);
+        return -1;
+    }
+    
+    freeaddrinfo(addrList);
+    ctx->socket_fd = fd;
+    
+    ESP_LOGI(TAG, "Started TCP session with server '%s'.", ctx->server_host_name);
+    return 0;
+}
+
+static int tcp_transport_write(void *context, const char *buf, size_t len)
+{
+    tcp_transport_context_t *ctx = (tcp_transport_context_t *)context;
+    
+    int ret = send(ctx->socket_fd, buf, len, 0);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "tcp_transport_write: send failed (%d)", errno);
+        return -1;
+    }
+    
+    return ret;
+}
+
+static int tcp_transport_read(void *context, char *buf, size_t len)
+{
+    tcp_transport_context_t *ctx = (tcp_transport_context_t *)context;
+    
+    int ret = recv(ctx->socket_fd, buf, len, 0);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "tcp_transport_read: recv failed (%d)", errno);
+        return -1;
+    }
+    
+    return ret;
+}
+
+static void tcp_transport_close(void *context)
+{
+    tcp_transport_context_t *ctx = (tcp_transport_context_t *)context;
+    
+    if (ctx->socket_fd < 0) {
+        return;
+    }
+    
+    close(ctx->socket_fd);
+    ctx->socket_fd = -1;
+    
+    ESP_LOGI(TAG, "Ended TCP session with server '%s'.", ctx->server_host_name);
+}
+
+static int tcp_transport_wait_readable(void *context, uint32_t timeout_ms)
+{
+    tcp_transport_context_t *ctx = (tcp_transport_context_t *)context;
+    
+    fd_set readFds;
+    FD_ZERO(&readFds);
+    FD_SET(ctx->socket_fd, &readFds);
+    
+    struct timeval timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+    
+    int ret = select(ctx->socket_fd + 1, &readFds, NULL, NULL, &timeout);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "tcp_transport_wait_readable: select failed (%d)", errno);
+        return -1;
+    }
+    
+    return ret > 0 ? 1 : 0;
+}
@@ -0,0 +1,56 @@
+//
+//  tcp_transport.h
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  This module provides plain (unencrypted) TCP connections through the
+//  https_transport interface, e.g. for servers in a trusted local network.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __TCP_TRANSPORT__
+#define __TCP_TRANSPORT__ 1
+
+
+// Forward declaration of the opaque context object.
+struct tcp_transport_context_;
+
+// Forward declaration of the transport interface (see https_transport.h).
+struct https_transport_;
+
+
+// Create a context for TCP communication to a server.
+// The context can be re-used for multiple connections to the same server on the same port.
+// The host name and port are copied and can be released after calling this function.
+struct tcp_transport_context_ *tcp_transport_create_context(const char *serverHostName, const char *serverPort);
+
+// Release the context.
+// Closes the connection (if any) and releases all memory associated with the context.
+void tcp_transport_free_context(struct tcp_transport_context_ *context);
+
+// Initialise the transport structure so that the https_client module
+// communicates through a TCP connection of the context.
+void tcp_transport_init_transport(struct tcp_transport_context_ *context, struct https_transport_ *transport);
+
+
+#endif // __TCP_TRANSPORT__
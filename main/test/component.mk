@@ -0,0 +1,6 @@
+#
+# Component makefile for the unit tests of the main component,
+# built by the ESP-IDF unit test app (make TEST_COMPONENTS=main).
+#
+
+COMPONENT_ADD_LDFLAGS = -Wl,--whole-archive -l$(COMPONENT_NAME) -Wl,--no-whole-archive
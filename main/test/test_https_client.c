@@ -0,0 +1,336 @@
+//
+//  test_https_client.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  Replays scripted responses through https_send_request with the
+//  mem_transport module: headers split across reads, truncated responses,
+//  206 (Partial Content) on a kept-alive connection, cancellation and the
+//  rate limit.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "unity.h"
+
+#include "https_client.h"
+#include "https_transport.h"
+#include "mem_transport.h"
+
+
+#define BODY "0123456789abcdefghijklmnopqrstuvwxyz"
+#define RESPONSE_200 "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 36\r\n\r\n" BODY
+
+
+// What the request callbacks have seen.
+typedef struct {
+    int nof_headers_callbacks;
+    int status_code;
+    int content_length;
+    int nof_body_callbacks;
+    int nof_end_callbacks;
+    char body[256];
+    size_t body_len;
+    int nof_error_callbacks;
+    http_err_t error;
+    int error_info;
+    size_t cancel_after_bytes;
+} test_result_t;
+
+static test_result_t result;
+static char response_buffer[512];
+
+
+static http_continue_receiving_t test_headers_callback(http_request_t *request, int statusCode, int contentLength)
+{
+    result.nof_headers_callbacks++;
+    result.status_code = statusCode;
+    result.content_length = contentLength;
+    return HTTP_CONTINUE_RECEIVING;
+}
+
+static http_continue_receiving_t test_body_callback(http_request_t *request, size_t bytesReceived)
+{
+    if (bytesReceived == 0) {
+        result.nof_end_callbacks++;
+        return HTTP_CONTINUE_RECEIVING;
+    }
+    
+    // Only the start of large bodies is kept.
+    result.nof_body_callbacks++;
+    if (result.body_len + bytesReceived <= sizeof(result.body)) {
+        memcpy(&result.body[result.body_len], request->response_buffer, bytesReceived);
+    }
+    result.body_len += bytesReceived;
+    
+    if (result.cancel_after_bytes && result.body_len >= result.cancel_after_bytes) {
+        request->is_cancelled = 1;
+    }
+    return HTTP_CONTINUE_RECEIVING;
+}
+
+static void test_error_callback(http_request_t *request, http_err_t error, int additionalInfo)
+{
+    result.nof_error_callbacks++;
+    result.error = error;
+    result.error_info = additionalInfo;
+}
+
+static void test_init_request(http_request_t *request, http_response_mode_t mode)
+{
+    memset(&result, 0, sizeof(result));
+    memset(request, 0, sizeof(*request));
+    request->verb = HTTP_GET;
+    request->host = "localhost";
+    request->path = "/fw.bin";
+    request->response_buffer = response_buffer;
+    request->response_buffer_len = sizeof(response_buffer);
+    request->error_callback = test_error_callback;
+    request->headers_callback = test_headers_callback;
+    request->body_callback = test_body_callback;
+    request->response_mode = mode;
+}
+
+// Replays the responses on a new connection and sends the request.
+static http_err_t test_send(mem_transport_init_struct_t *params, https_transport_t *transport, http_request_t *request)
+{
+    struct mem_transport_context_ *ctx = mem_transport_create_context(params);
+    TEST_ASSERT_NOT_NULL(ctx);
+    mem_transport_init_transport(ctx, transport);
+    TEST_ASSERT_EQUAL(0, transport->connect(transport->context));
+    
+    http_err_t err = https_send_request(transport, request);
+    TEST_ASSERT_GREATER_THAN(0, mem_transport_get_nof_bytes_written(ctx));
+    return err;
+}
+
+static void test_assert_body_received(void)
+{
+    TEST_ASSERT_EQUAL(0, result.nof_error_callbacks);
+    TEST_ASSERT_EQUAL(1, result.nof_headers_callbacks);
+    TEST_ASSERT_EQUAL(200, result.status_code);
+    TEST_ASSERT_EQUAL(strlen(BODY), result.content_length);
+    TEST_ASSERT_EQUAL(strlen(BODY), result.body_len);
+    TEST_ASSERT_EQUAL_MEMORY(BODY, result.body, result.body_len);
+}
+
+
+TEST_CASE("headers split at every position", "[https_client]")
+{
+    const char *data = RESPONSE_200;
+    uint32_t len = strlen(data);
+    
+    for (uint32_t split = 1; split < len; split++) {
+        uint32_t chunks[] = { split, len - split };
+        mem_transport_response_t response = { data, len, chunks, 2 };
+        mem_transport_init_struct_t params = { &response, 1, 0, 0 };
+        https_transport_t transport;
+        http_request_t request;
+        test_init_request(&request, HTTP_STREAM_BODY);
+        
+        TEST_ASSERT_EQUAL(HTTP_SUCCESS, test_send(&params, &transport, &request));
+        test_assert_body_received();
+        TEST_ASSERT_EQUAL(1, result.nof_end_callbacks);
+        mem_transport_free_context(transport.context);
+    }
+}
+
+TEST_CASE("response read byte by byte", "[https_client]")
+{
+    mem_transport_response_t response = { RESPONSE_200, strlen(RESPONSE_200), NULL, 0 };
+    mem_transport_init_struct_t params = { &response, 1, 1, 0 };
+    https_transport_t transport;
+    http_request_t request;
+    
+    test_init_request(&request, HTTP_STREAM_BODY);
+    TEST_ASSERT_EQUAL(HTTP_SUCCESS, test_send(&params, &transport, &request));
+    test_assert_body_received();
+    TEST_ASSERT_EQUAL(strlen(BODY), result.nof_body_callbacks);
+    TEST_ASSERT_EQUAL(1, result.nof_end_callbacks);
+    mem_transport_free_context(transport.context);
+    
+    test_init_request(&request, HTTP_WAIT_FOR_COMPLETE_BODY);
+    TEST_ASSERT_EQUAL(HTTP_SUCCESS, test_send(&params, &transport, &request));
+    test_assert_body_received();
+    TEST_ASSERT_EQUAL(1, result.nof_body_callbacks);
+    mem_transport_free_context(transport.context);
+}
+
+TEST_CASE("truncated body is reported with the bytes received", "[https_client]")
+{
+    // Content-Length 36, but the connection ends after 10 body bytes.
+    const char *data = "HTTP/1.1 200 OK\r\nContent-Length: 36\r\n\r\n0123456789";
+    mem_transport_response_t response = { data, strlen(data), NULL, 0 };
+    mem_transport_init_struct_t params = { &response, 1, 7, 0 };
+    https_transport_t transport;
+    http_request_t request;
+    
+    test_init_request(&request, HTTP_STREAM_BODY);
+    request.keep_alive = 1;
+    TEST_ASSERT_EQUAL(HTTP_ERR_RESPONSE_TRUNCATED, test_send(&params, &transport, &request));
+    TEST_ASSERT_EQUAL(1, result.nof_error_callbacks);
+    TEST_ASSERT_EQUAL(HTTP_ERR_RESPONSE_TRUNCATED, result.error);
+    TEST_ASSERT_EQUAL(10, result.error_info);
+    TEST_ASSERT_EQUAL(10, result.body_len);
+    TEST_ASSERT_EQUAL(0, result.nof_end_callbacks);
+    TEST_ASSERT_EQUAL(0, request.keep_alive);
+    mem_transport_free_context(transport.context);
+    
+    // The received part stays in the buffer, the body callback isn't invoked.
+    test_init_request(&request, HTTP_WAIT_FOR_COMPLETE_BODY);
+    TEST_ASSERT_EQUAL(HTTP_ERR_RESPONSE_TRUNCATED, test_send(&params, &transport, &request));
+    TEST_ASSERT_EQUAL(HTTP_ERR_RESPONSE_TRUNCATED, result.error);
+    TEST_ASSERT_EQUAL(10, result.error_info);
+    TEST_ASSERT_EQUAL(0, result.nof_body_callbacks);
+    mem_transport_free_context(transport.context);
+}
+
+TEST_CASE("connection closed within the headers or before the response", "[https_client]")
+{
+    const char *data = "HTTP/1.1 200 OK\r\nContent-Len";
+    mem_transport_response_t responses[] = {
+        { data, strlen(data), NULL, 0 },
+        { "", 0, NULL, 0 },
+    };
+    mem_transport_init_struct_t params = { &responses[0], 1, 0, 0 };
+    https_transport_t transport;
+    http_request_t request;
+    
+    test_init_request(&request, HTTP_STREAM_BODY);
+    TEST_ASSERT_EQUAL(HTTP_ERR_RESPONSE_TRUNCATED, test_send(&params, &transport, &request));
+    TEST_ASSERT_EQUAL(1, result.nof_error_callbacks);
+    TEST_ASSERT_EQUAL(0, result.error_info);
+    TEST_ASSERT_EQUAL(0, result.nof_headers_callbacks);
+    mem_transport_free_context(transport.context);
+    
+    // Nothing received: the request can be repeated, the application isn't notified.
+    params.responses = &responses[1];
+    test_init_request(&request, HTTP_STREAM_BODY);
+    TEST_ASSERT_EQUAL(HTTP_ERR_CONNECTION_CLOSED, test_send(&params, &transport, &request));
+    TEST_ASSERT_EQUAL(0, result.nof_error_callbacks);
+    mem_transport_free_context(transport.context);
+}
+
+TEST_CASE("206 responses on a kept-alive connection", "[https_client]")
+{
+    // Two ranges of the same file, answered on the same connection.
+    const char *data =
+        "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes 0-9/36\r\nContent-Length: 10\r\n\r\n0123456789"
+        "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes 10-35/36\r\nContent-Length: 26\r\n\r\nabcdefghijklmnopqrstuvwxyz";
+    uint32_t firstLen = strstr(data, "9HTTP") - data + 1;
+    uint32_t chunks[] = { firstLen, strlen(data) - firstLen };
+    mem_transport_response_t response = { data, strlen(data), chunks, 2 };
+    mem_transport_init_struct_t params = { &response, 1, 0, 0 };
+    https_transport_t transport;
+    http_request_t request;
+    
+    test_init_request(&request, HTTP_STREAM_BODY);
+    request.additional_headers = "Range: bytes=0-9\r\n";
+    request.keep_alive = 1;
+    TEST_ASSERT_EQUAL(HTTP_SUCCESS, test_send(&params, &transport, &request));
+    TEST_ASSERT_EQUAL(206, result.status_code);
+    TEST_ASSERT_EQUAL(10, result.content_length);
+    TEST_ASSERT_EQUAL_MEMORY("0123456789", result.body, 10);
+    TEST_ASSERT_EQUAL(1, result.nof_end_callbacks);
+    TEST_ASSERT_EQUAL(1, request.keep_alive);
+    
+    // The second request uses the open connection.
+    test_init_request(&request, HTTP_WAIT_FOR_COMPLETE_BODY);
+    request.additional_headers = "Range: bytes=10-\r\n";
+    request.keep_alive = 1;
+    TEST_ASSERT_EQUAL(HTTP_SUCCESS, https_send_request(&transport, &request));
+    TEST_ASSERT_EQUAL(0, result.nof_error_callbacks);
+    TEST_ASSERT_EQUAL(206, result.status_code);
+    TEST_ASSERT_EQUAL(26, result.body_len);
+    TEST_ASSERT_EQUAL_MEMORY("abcdefghijklmnopqrstuvwxyz", result.body, 26);
+    TEST_ASSERT_EQUAL(1, request.keep_alive);
+    mem_transport_free_context(transport.context);
+}
+
+TEST_CASE("connection close ends keep-alive", "[https_client]")
+{
+    const char *data = "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 36\r\n\r\n" BODY;
+    mem_transport_response_t response = { data, strlen(data), NULL, 0 };
+    mem_transport_init_struct_t params = { &response, 1, 0, 0 };
+    https_transport_t transport;
+    http_request_t request;
+    
+    test_init_request(&request, HTTP_STREAM_BODY);
+    request.keep_alive = 1;
+    TEST_ASSERT_EQUAL(HTTP_SUCCESS, test_send(&params, &transport, &request));
+    test_assert_body_received();
+    TEST_ASSERT_EQUAL(0, request.keep_alive);
+    mem_transport_free_context(transport.context);
+}
+
+TEST_CASE("request cancelled while receiving the body", "[https_client]")
+{
+    mem_transport_response_t response = { RESPONSE_200, strlen(RESPONSE_200), NULL, 0 };
+    mem_transport_init_struct_t params = { &response, 1, 0, 0 };
+    https_transport_t transport;
+    http_request_t request;
+    
+    // Headers in the first read, then 4 body bytes per read.
+    uint32_t headerLen = strlen(RESPONSE_200) - strlen(BODY);
+    uint32_t chunks[] = { headerLen, 4, 4, 4, 4, 4, 4, 4, 4, 4 };
+    response.chunk_lengths = chunks;
+    response.nof_chunks = sizeof(chunks) / sizeof(chunks[0]);
+    
+    test_init_request(&request, HTTP_STREAM_BODY);
+    request.keep_alive = 1;
+    result.cancel_after_bytes = 8;
+    TEST_ASSERT_EQUAL(HTTP_ERR_CANCELLED, test_send(&params, &transport, &request));
+    TEST_ASSERT_EQUAL(0, result.nof_error_callbacks);
+    TEST_ASSERT_EQUAL(8, result.body_len);
+    TEST_ASSERT_EQUAL(0, result.nof_end_callbacks);
+    TEST_ASSERT_EQUAL(0, request.keep_alive);
+    mem_transport_free_context(transport.context);
+}
+
+TEST_CASE("response read at the rate limit", "[https_client]")
+{
+    // About 8000 bytes at 4000 bytes/s: 2 s (the token bucket starts empty).
+    static char data[8100];
+    const size_t bodyLen = 7960;
+    size_t len = sprintf(data, "HTTP/1.1 200 OK\r\nContent-Length: %u\r\n\r\n", (unsigned)bodyLen);
+    memset(&data[len], 'x', bodyLen);
+    len += bodyLen;
+    
+    mem_transport_response_t response = { data, len, NULL, 0 };
+    mem_transport_init_struct_t params = { &response, 1, 0, 0 };
+    https_transport_t transport;
+    http_request_t request;
+    
+    test_init_request(&request, HTTP_STREAM_BODY);
+    request.max_bytes_per_s = 4000;
+    int64_t start = esp_timer_get_time();
+    TEST_ASSERT_EQUAL(HTTP_SUCCESS, test_send(&params, &transport, &request));
+    int64_t elapsedMillisec = (esp_timer_get_time() - start) / 1000;
+    
+    TEST_ASSERT_EQUAL(bodyLen, result.body_len);
+    TEST_ASSERT_INT_WITHIN(150, 2000, elapsedMillisec);
+    mem_transport_free_context(transport.context);
+}
@@ -0,0 +1,92 @@
+//
+//  test_iap.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  Tests of the iap module: the flash duty cycle (iap_set_flash_duty_cycle)
+//  of large writes.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_ota_ops.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+#include "unity.h"
+
+#include "iap.h"
+
+
+// Size of the largest write, if there is enough memory for it.
+#define TEST_MAX_WRITE_SIZE (1024 * 1024)
+#define TEST_MIN_WRITE_SIZE (64 * 1024)
+
+
+// Writes the image with a single iap_write call and returns the time it took, in microseconds.
+static int64_t test_timed_write(const uint8_t *image, size_t len)
+{
+    TEST_ASSERT_EQUAL(IAP_OK, iap_begin());
+    
+    int64_t start = esp_timer_get_time();
+    TEST_ASSERT_EQUAL(IAP_OK, iap_write(image, len));
+    int64_t elapsed = esp_timer_get_time() - start;
+    
+    TEST_ASSERT_EQUAL(IAP_OK, iap_abort());
+    return elapsed;
+}
+
+
+TEST_CASE("flash duty cycle of a large aligned write", "[iap]")
+{
+    nvs_flash_init();
+    TEST_ASSERT_EQUAL(IAP_OK, iap_init());
+    
+    // As large as memory permits: the whole partition (up to 1 MB) on the host,
+    // which takes longer than a second to write; less on the device.
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+    TEST_ASSERT_NOT_NULL(partition);
+    size_t len = partition->size < TEST_MAX_WRITE_SIZE ? partition->size : TEST_MAX_WRITE_SIZE;
+    uint8_t *image = NULL;
+    for (; len >= TEST_MIN_WRITE_SIZE && !(image = malloc(len)); len /= 2) {
+    }
+    TEST_ASSERT_NOT_NULL(image);
+    for (size_t i = 0; i < len; i++) {
+        image[i] = i * 31;
+    }
+    image[0] = 0xe9; // image header magic
+    
+    iap_set_flash_duty_cycle(0);
+    int64_t fullSpeed = test_timed_write(image, len);
+    
+    // At 50 %, the task sleeps as long as it writes.
+    iap_set_flash_duty_cycle(50);
+    int64_t halfSpeed = test_timed_write(image, len);
+    
+    iap_set_flash_duty_cycle(0);
+    free(image);
+    
+    printf("%u bytes: %d ms at 100 %%, %d ms at 50 %% ", (unsigned)len, (int)(fullSpeed / 1000), (int)(halfSpeed / 1000));
+    TEST_ASSERT_INT_WITHIN(fullSpeed / 4, 2 * fullSpeed, halfSpeed);
+}
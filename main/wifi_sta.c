@@ -34,6 +34,8 @@
 #include "esp_wifi.h"
 #include "esp_log.h"
 
+#include "lwip/dns.h"
+
 #include "wifi_sta.h"
 
 
@@ -45,6 +47,7 @@ static EventGroupHandle_t wifi_sta_event_group;
 
 
 static void wifi_sta_set_connected(bool c);
+static int wifi_sta_has_dns_server();
 
 esp_err_t wifi_sta_init(wifi_sta_init_struct_t *param)
 {
@@ -170,6 +173,16 @@ int wifi_sta_is_connected()
     return (xEventGroupGetBits(wifi_sta_event_group) & WIFI_STA_EVENT_GROUP_CONNECTED_FLAG) ? 1 : 0;
 }
 
+int wifi_sta_is_dns_ready()
+{
+    EventBits_t bits = xEventGroupGetBits(wifi_sta_event_group);
+    if ((bits & WIFI_STA_EVENT_GROUP_CONNECTED_FLAG) && !(bits & WIFI_STA_EVENT_GROUP_DNS_READY_FLAG) && wifi_sta_has_dns_server()) {
+        ESP_LOGD(TAG, "wifi_sta_is_dns_ready: DNS server configured");
+        bits = xEventGroupSetBits(wifi_sta_event_group, WIFI_STA_EVENT_GROUP_DNS_READY_FLAG);
+    }
+    return (bits & WIFI_STA_EVENT_GROUP_DNS_READY_FLAG) ? 1 : 0;
+}
+
 
 static void wifi_sta_set_connected(bool c)
 {
@@ -178,10 +191,23 @@ static void wifi_sta_set_connected(bool c)
     }
     
     if (c) {
-        xEventGroupSetBits(wifi_sta_event_group, WIFI_STA_EVENT_GROUP_CONNECTED_FLAG);
+        // The DNS servers from DHCP are configured before the IP address is reported.
+        EventBits_t bits = WIFI_STA_EVENT_GROUP_CONNECTED_FLAG;
+        if (wifi_sta_has_dns_server()) {
+            bits |= WIFI_STA_EVENT_GROUP_DNS_READY_FLAG;
+        } else {
+            ESP_LOGW(TAG, "wifi_sta_set_connected: no DNS server");
+        }
+        xEventGroupSetBits(wifi_sta_event_group, bits);
     } else {
-        xEventGroupClearBits(wifi_sta_event_group, WIFI_STA_EVENT_GROUP_CONNECTED_FLAG);
+        xEventGroupClearBits(wifi_sta_event_group, WIFI_STA_EVENT_GROUP_CONNECTED_FLAG | WIFI_STA_EVENT_GROUP_DNS_READY_FLAG);
     }
     
     ESP_LOGI(TAG, "Device is now %s WIFI network", c ? "connected to" : "disconnected from");
 }
+
+static int wifi_sta_has_dns_server()
+{
+    ip_addr_t dnsServer = dns_getserver(0);
+    return ip4_addr_get_u32(ip_2_ip4(&dnsServer)) != 0;
+}
@@ -34,6 +34,10 @@
 
 #define WIFI_STA_EVENT_GROUP_CONNECTED_FLAG (1 << 0)
 
+// Set while connected if a DNS server is known (e.g. from DHCP), i.e. host names
+// can be resolved. See wifi_sta_is_dns_ready for DNS servers configured later.
+#define WIFI_STA_EVENT_GROUP_DNS_READY_FLAG (1 << 1)
+
 
 typedef struct wifi_sta_init_struct_ {
     
@@ -55,6 +59,11 @@ esp_err_t wifi_sta_handle_event(void *ctx, system_event_t *event, int *handled);
 // Returns 1 if the device is currently connected to the specified network, 0 otherwise.
 int wifi_sta_is_connected();
 
+// Returns 1 if the device is connected and has a DNS server, 0 otherwise.
+// Updates WIFI_STA_EVENT_GROUP_DNS_READY_FLAG if the DNS server has been
+// configured after the device got its IP address.
+int wifi_sta_is_dns_ready();
+
 // Let other modules wait on connectivity changes.
 EventGroupHandle_t wifi_sta_get_event_group();
 
@@ -29,6 +29,7 @@
 //
 
 #include <string.h>
+#include <errno.h>
 #include "freertos/FreeRTOS.h"
 #include "esp_event_loop.h"
 #include "esp_log.h"
@@ -40,11 +41,19 @@
 #include "mbedtls/ctr_drbg.h"
 #include "mbedtls/error.h"
 
+#include "lwip/sockets.h"
+
+#include "https_transport.h"
 #include "wifi_tls.h"
 
 
 #define TAG "wifi_tls"
 
+// Delay between the TCP connect and the TLS handshake (0 = none).
+#ifndef WIFI_TLS_CONNECT_DELAY_MS
+#define WIFI_TLS_CONNECT_DELAY_MS 0
+#endif
+
 
 // Internal state for a single TLS context (single connection).
 typedef struct wifi_tls_context_ {
@@ -89,6 +98,12 @@ static int wifi_tls_cert_pinning(wifi_tls_context_t *ctx);
 static void wifi_tls_print_mbedtls_error(char *message, int code);
 static void wifi_tls_dump_hex_buffer(char *buf, int len);
 
+static int wifi_tls_transport_connect(void *context);
+static int wifi_tls_transport_write(void *context, const char *buf, size_t len);
+static int wifi_tls_transport_read(void *context, char *buf, size_t len);
+static void wifi_tls_transport_close(void *context);
+static int wifi_tls_transport_wait_readable(void *context, uint32_t timeout_ms);
+
 
 wifi_tls_context_t *wifi_tls_create_context(wifi_tls_init_struct_t *params)
 {
@@ -190,9 +205,11 @@ int wifi_tls_connect(wifi_tls_context_t *ctx)
     
     ESP_LOGD(TAG, "wifi_tls_connect: connected to server '%s', fd = %d", ctx->server_host_name, ctx->server_fd.fd);
 
-    // WORKAROUND
+    // WORKAROUND for early ESP-IDF versions, not needed with current lwIP.
     // http://www.esp32.com/viewtopic.php?f=14&t=1007
-    vTaskDelay(200 / portTICK_PERIOD_MS);
+    if (WIFI_TLS_CONNECT_DELAY_MS > 0) {
+        vTaskDelay(WIFI_TLS_CONNECT_DELAY_MS / portTICK_PERIOD_MS);
+    }
 
 
     // Define input and output functions for sending and receiving network data.
@@ -242,83 +259,125 @@ void wifi_tls_disconnect(wifi_tls_context_t *ctx)
     wifi_tls_reset_context(ctx);
 }
 
-int wifi_tls_send_request(wifi_tls_context_t *ctx, wifi_tls_request_t *request)
+int wifi_tls_write(wifi_tls_context_t *ctx, const char *buf, size_t len)
 {
-    size_t lenRemaining = request->request_len;
-    char *p = request->request_buffer;
-    
-    ESP_LOGD(TAG, "wifi_tls_send_request: '%s'", request->request_buffer);
-    
-    while (lenRemaining > 0) {
-        int ret = mbedtls_ssl_write(&ctx->ssl, (unsigned char *)p, lenRemaining);
+    while (1) {
+        int ret = mbedtls_ssl_write(&ctx->ssl, (const unsigned char *)buf, len);
         if (ret > 0) {
-            lenRemaining -= ret;
-            p += ret;
-            ESP_LOGD(TAG, "wifi_tls_send_request: partial write: %d bytes written, %d bytes remaining", ret, lenRemaining);
-            continue;
+            ESP_LOGD(TAG, "wifi_tls_write: %d of %d bytes written", ret, len);
+            return ret;
         }
         
         if (ret == MBEDTLS_ERR_SSL_WANT_READ) {
-            ESP_LOGD(TAG, "wifi_tls_send_request: write: MBEDTLS_ERR_SSL_WANT_READ");
+            ESP_LOGD(TAG, "wifi_tls_write: MBEDTLS_ERR_SSL_WANT_READ");
             continue;
         }
         
         if (ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
-            ESP_LOGD(TAG, "wifi_tls_send_request: write: MBEDTLS_ERR_SSL_WANT_WRITE");
+            ESP_LOGD(TAG, "wifi_tls_write: MBEDTLS_ERR_SSL_WANT_WRITE");
             continue;
         }
         
-        // Context is invalid, need to disconnect.
-        wifi_tls_print_mbedtls_error("wifi_tls_send_request: write: error, disconnecting, context is invalid", ret);
-        wifi_tls_disconnect(ctx);
+        // Context is invalid, the caller needs to disconnect.
+        wifi_tls_print_mbedtls_error("wifi_tls_write: error, context is invalid", ret);
         return -1;
     }
-    
-    // INV: Request successfully written.
-    // Read the response.
+}
 
-    int callbackIndex = 0;
+int wifi_tls_read(wifi_tls_context_t *ctx, char *buf, size_t len)
+{
     while (1) {
-        int ret = mbedtls_ssl_read(&ctx->ssl, (unsigned char *)request->response_buffer, request->response_buffer_size);
-        
-        if (ret == 0) {
-            ESP_LOGD(TAG, "wifi_tls_send_request: EOF");
-            // EOF
-            wifi_tls_disconnect(ctx);
-            return 0;
+        int ret = mbedtls_ssl_read(&ctx->ssl, (unsigned char *)buf, len);
+        if (ret >= 0) {
+            ESP_LOGD(TAG, "wifi_tls_read: %d bytes read", ret);
+            return ret;
         }
         
-        if (ret > 0) {
-            // Partial read
-            ESP_LOGD(TAG, "wifi_tls_send_request: partial read: %d bytes read", ret);
-            int continueReading = request->response_callback(ctx, request, callbackIndex, ret);
-            if (!continueReading) {
-                wifi_tls_disconnect(ctx);
-                return 0;
-            }
-            callbackIndex++;
-            continue;
+        if (ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+            ESP_LOGD(TAG, "wifi_tls_read: close notify received");
+            return 0;
         }
         
         if (ret == MBEDTLS_ERR_SSL_WANT_READ) {
-            ESP_LOGD(TAG, "wifi_tls_send_request: read: MBEDTLS_ERR_SSL_WANT_READ");
+            ESP_LOGD(TAG, "wifi_tls_read: MBEDTLS_ERR_SSL_WANT_READ");
             continue;
         }
         
         if (ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
-            ESP_LOGD(TAG, "wifi_tls_send_request: read: MBEDTLS_ERR_SSL_WANT_WRITE");
+            ESP_LOGD(TAG, "wifi_tls_read: MBEDTLS_ERR_SSL_WANT_WRITE");
             continue;
         }
         
-        // Context is invalid, need to disconnect.
-        wifi_tls_print_mbedtls_error("wifi_tls_send_request: read: error, disconnecting, context is invalid", ret);
-        wifi_tls_disconnect(ctx);
+        // Context is invalid, the caller needs to disconnect.
+        wifi_tls_print_mbedtls_error("wifi_tls_read: error, context is invalid", ret);
         return -1;
     }
+}
+
+int wifi_tls_wait_readable(wifi_tls_context_t *ctx, uint32_t timeoutMs)
+{
+    // Data which has already been decrypted can be read immediately.
+    if (mbedtls_ssl_get_bytes_avail(&ctx->ssl) > 0) {
+        return 1;
+    }
     
-    return 0;
+    fd_set readFds;
+    FD_ZERO(&readFds);
+    FD_SET(ctx->server_fd.fd, &readFds);
+    
+    struct timeval timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_usec = (timeoutMs % 1000) * 1000;
+    
+    int ret = select(ctx->server_fd.fd + 1, &readFds, NULL, NULL, &timeout);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "wifi_tls_wait_readable: select failed (%d)", errno);
+        return -1;
+    }
+    
+    return ret > 0 ? 1 : 0;
+}
+
+void wifi_tls_init_transport(wifi_tls_context_t *ctx, https_transport_t *transport)
+{
+    transport->context = ctx;
+    transport->connect = wifi_tls_transport_connect;
+    transport->write = wifi_tls_transport_write;
+    transport->read = wifi_tls_transport_read;
+    transport->close = wifi_tls_transport_close;
+    transport->wait_readable = wifi_tls_transport_wait_readable;
+}
+
+
+static int wifi_tls_transport_connect(void *context)
+{
+    return wifi_tls_connect((wifi_tls_context_t *)context);
+}
+
+static int wifi_tls_transport_write(void *context, const char *buf, size_t len)
+{
+    return wifi_tls_write((wifi_tls_context_t *)context, buf, len);
 }
 
+static int wifi_tls_transport_read(void *context, char *buf, size_t len)
+{
+    return wifi_tls_read((wifi_tls_context_t *)context, buf, len);
+}
+
+static void wifi_tls_transport_close(void *context)
+{
+    wifi_tls_context_t *ctx = (wifi_tls_context_t *)context;
+    
+    // The connection has already been closed if the connect failed.
+    if (ctx->is_valid) {
+        wifi_tls_disconnect(ctx);
+    }
+}
+
+static int wifi_tls_transport_wait_readable(void *context, uint32_t timeout_ms)
+{
+    return wifi_tls_wait_readable((wifi_tls_context_t *)context, timeout_ms);
+}
 
 static int wifi_tls_init_context(wifi_tls_context_t *ctx)
 {
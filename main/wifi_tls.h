@@ -35,6 +35,9 @@
 // Forward declaration of the opaque context object.
 struct wifi_tls_context_;
 
+// Forward declaration of the transport interface (see https_transport.h).
+struct https_transport_;
+
 typedef struct wifi_tls_init_struct_ {
     
     // Name of the host that provides the firmware images, e.g. "www.classycode.io".
@@ -53,35 +56,6 @@ typedef struct wifi_tls_init_struct_ {
     
 } wifi_tls_init_struct_t;
 
-typedef struct wifi_tls_request_ {
-    
-    // Request buffer.
-    // Example: "GET https://www.classycode.io/esp32/ota.txt HTTP/1.1\nHost: www.classycode.io\n\n"
-    // Not necessarily zero-terminated.
-    char *request_buffer;
-    
-    // Number of bytes in the request buffer.
-    uint32_t request_len;
-    
-    // Response buffer.
-    // This buffer will be filled with the data received from the server.
-    // Data may be received in chunks. Every chunk is stored in the buffer and provided
-    // to the client via the response_callback function (see below).
-    char *response_buffer;
-    
-    // Size of the response buffer.
-    // Defines the maximum number of bytes that will be read into the response buffer.
-    uint32_t response_buffer_size;
-    
-    // Make custom data available to the callback.
-    void *custom_data;
-    
-    // Callback function to handle the response.
-    // Return 1 to continue reading, 0 to end reading.
-    int (*response_callback)(struct wifi_tls_context_ *context, struct wifi_tls_request_ *request, int index, size_t len);
-    
-} wifi_tls_request_t;
-
 
 // Create a context for TLS communication to a server.
 // The context can be re-used for multiple connections to the same server on the same port.
@@ -99,10 +73,21 @@ int wifi_tls_connect(struct wifi_tls_context_ *context);
 // Disconnects from the server.
 void wifi_tls_disconnect(struct wifi_tls_context_ *context);
 
-// Send a request to the server.
-// Calls the response callback function defined in the request structure.
-// Returns 0 on success.
-int wifi_tls_send_request(struct wifi_tls_context_ *context, wifi_tls_request_t *request);
+// Write up to len bytes to the server.
+// Returns the number of bytes written, or -1 on error.
+int wifi_tls_write(struct wifi_tls_context_ *context, const char *buf, size_t len);
+
+// Read up to len bytes from the server.
+// Returns the number of bytes read, 0 on EOF, or -1 on error.
+int wifi_tls_read(struct wifi_tls_context_ *context, char *buf, size_t len);
+
+// Wait until data can be read from the server.
+// Returns 1 if data is available, 0 on timeout, -1 on error.
+int wifi_tls_wait_readable(struct wifi_tls_context_ *context, uint32_t timeoutMs);
+
+// Initialise the transport structure so that the https_client module
+// communicates through the TLS connection of the context.
+void wifi_tls_init_transport(struct wifi_tls_context_ *context, struct https_transport_ *transport);
 
 
 #endif // __WIFI_TLS__
@@ -0,0 +1,310 @@
+//
+//  bench.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  Measures complete updates on the host: the updater task, the HTTP client,
+//  the TLS transport and the IAP module are the ones of the firmware; they
+//  download an image from the test server over links with different shaping
+//  into the emulated flash. Each run is a fresh device (a child process),
+//  from iap_https_init until the image has been installed.
+//
+//  Usage: bench [-s <image size in KB>] [-h <free heap in KB>] [-t] [<scenario> ...]
+//    -h  free internal RAM of the device when the updater starts (default 200 KB).
+//    -t  disables the emulated flash timing (erase and write times).
+//
+//  Task stacks are larger on the host, so their high-water marks are not reported.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "mbedtls/sha256.h"
+
+#include "iap_https.h"
+#include "host.h"
+#include "test_server.h"
+
+
+#define TAG "bench"
+
+#define BENCH_DEFAULT_IMAGE_SIZE (512 * 1024)
+#define BENCH_DEFAULT_FREE_HEAP (200 * 1024)
+#define BENCH_TIMEOUT_MS 300000
+
+// Runs with these properties are compared with the baseline.
+typedef struct bench_scenario_ {
+    const char *name;
+    uint32_t bandwidth_bytes_per_s;
+    uint32_t rtt_ms;
+    uint32_t loss_per_mille;
+    uint32_t max_record_size;
+} bench_scenario_t;
+
+typedef struct bench_mode_ {
+    const char *name;
+    int use_staging_buffer;
+    int use_flash_task;
+    int verify_flash;
+} bench_mode_t;
+
+// Reported by the device process.
+typedef struct bench_result_ {
+    int is_installed;
+    int is_image_ok;
+    uint32_t time_to_installed_ms;
+    uint32_t peak_heap;
+    iap_https_statistics_t statistics;
+    host_flash_stats_t flash_stats;
+} bench_result_t;
+
+static const bench_scenario_t scenarios[] = {
+    { "baseline",       0,          0,   0,  16384 },
+    { "wifi-good",      2000000,    10,  0,  16384 },
+    { "wifi-poor",      250000,     60,  10, 16384 },
+    { "cellular",       125000,     150, 2,  16384 },
+    { "small-records",  2000000,    10,  0,  1024 },
+};
+
+static const bench_mode_t modes[] = {
+    { "stream",   0, 0, 0 },
+    { "staging",  1, 0, 0 },
+    { "flashtask", 0, 1, 0 },
+    { "verify",   0, 0, 1 },
+};
+
+static uint8_t *image;
+static size_t image_size = BENCH_DEFAULT_IMAGE_SIZE;
+static char metadata[512];
+static size_t free_heap = BENCH_DEFAULT_FREE_HEAP;
+static int is_flash_timing_enabled = 1;
+
+
+static void bench_create_image();
+static int bench_run(const bench_scenario_t *scenario, const bench_mode_t *mode, bench_result_t *result, test_server_stats_t *serverStats);
+static void bench_device(uint16_t port, const bench_mode_t *mode, int resultFd);
+
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "s:h:t")) != -1) {
+        switch (opt) {
+            case 's':
+                image_size = strtoul(optarg, NULL, 0) * 1024;
+                break;
+            case 'h':
+                free_heap = strtoul(optarg, NULL, 0) * 1024;
+                break;
+            case 't':
+                is_flash_timing_enabled = 0;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-s <image size in KB>] [-h <free heap in KB>] [-t] [<scenario> ...]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (image_size < 1024 || image_size > 1024 * 1024) {
+        fprintf(stderr, "image size: 1..1024 KB\n");
+        return 2;
+    }
+    
+    bench_create_image();
+    
+    printf("image %u bytes, free heap %u bytes, flash timing %s\n\n", (unsigned)image_size, (unsigned)free_heap,
+           is_flash_timing_enabled ? "on" : "off");
+    printf("%-14s %-9s %9s %9s %9s %6s %6s %6s %10s %9s %5s\n", "scenario", "mode", "time_ms", "bytes/s", "flash_ms",
+           "hs_srv", "hs_dev", "reqs", "peak_heap", "seg_lost", "ok");
+    
+    int failures = 0;
+    uint32_t baselineMs[sizeof(modes) / sizeof(modes[0])] = { 0 };
+    for (int s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++) {
+        int selected = optind == argc;
+        for (int i = optind; i < argc; i++) {
+            selected |= strcmp(argv[i], scenarios[s].name) == 0;
+        }
+        if (!selected) {
+            continue;
+        }
+        
+        for (int m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+            bench_result_t result;
+            test_server_stats_t serverStats;
+            int ok = bench_run(&scenarios[s], &modes[m], &result, &serverStats) == 0 && result.is_installed && result.is_image_ok;
+            failures += !ok;
+            
+            uint32_t ms = result.time_to_installed_ms;
+            if (s == 0) {
+                baselineMs[m] = ms;
+            }
+            printf("%-14s %-9s %9u %9u %9u %6u %6u %6u %10u %9u %5s", scenarios[s].name, modes[m].name, ms,
+                   ms ? (unsigned)(image_size * 1000ull / ms) : 0, (unsigned)(result.flash_stats.busy_us / 1000),
+                   serverStats.nof_handshakes, result.statistics.nof_connections, serverStats.nof_requests,
+                   result.peak_heap, serverStats.nof_segments_lost, ok ? "yes" : "NO");
+            if (s > 0 && baselineMs[m] && ms) {
+                printf("  x%.2f", (double)ms / baselineMs[m]);
+            }
+            printf("\n");
+            fflush(stdout);
+        }
+    }
+    
+    free(image);
+    return failures ? 1 : 0;
+}
+
+static void bench_create_image()
+{
+    // Pseudo-random contents with the header magic of an app image.
+    image = malloc(image_size);
+    uint32_t x = 0x12345678;
+    for (size_t i = 0; i < image_size; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        image[i] = (uint8_t)x;
+    }
+    image[0] = 0xe9;
+    
+    uint8_t hash[32];
+    char hex[65];
+    mbedtls_sha256_ret(image, image_size, hash, 0);
+    for (int i = 0; i < 32; i++) {
+        sprintf(hex + 2 * i, "%02x", hash[i]);
+    }
+    snprintf(metadata, sizeof(metadata), "VERSION=2\nFILE=/fw.bin\nINTERVAL=3600\nSIZE=%u\nSHA256=%s\n", (unsigned)image_size, hex);
+}
+
+static int bench_run(const bench_scenario_t *scenario, const bench_mode_t *mode, bench_result_t *result, test_server_stats_t *serverStats)
+{
+    memset(result, 0, sizeof(bench_result_t));
+    
+    test_server_config_t serverConfig = {
+        .bandwidth_bytes_per_s = scenario->bandwidth_bytes_per_s,
+        .rtt_ms = scenario->rtt_ms,
+        .loss_per_mille = scenario->loss_per_mille,
+        .max_record_size = scenario->max_record_size,
+        .metadata_path = "/meta.txt",
+        .metadata = metadata,
+        .image_path = "/fw.bin",
+        .image = image,
+        .image_size = image_size,
+    };
+    uint16_t port;
+    fflush(stdout);
+    fflush(stderr);
+    if (test_server_start(&serverConfig, &port) != 0) {
+        fprintf(stderr, "failed to start the test server\n");
+        return -1;
+    }
+    
+    // The updater is a singleton with a task, so each run is a new process.
+    int pipeFds[2];
+    if (pipe(pipeFds) != 0) {
+        test_server_stop();
+        return -1;
+    }
+    pid_t device = fork();
+    if (device == 0) {
+        close(pipeFds[0]);
+        bench_device(port, mode, pipeFds[1]);
+        _exit(0);
+    }
+    close(pipeFds[1]);
+    
+    ssize_t len = device > 0 ? read(pipeFds[0], result, sizeof(bench_result_t)) : -1;
+    close(pipeFds[0]);
+    if (device > 0) {
+        kill(device, SIGKILL);
+        waitpid(device, NULL, 0);
+    }
+    
+    test_server_stop();
+    test_server_get_stats(serverStats);
+    return len == sizeof(bench_result_t) ? 0 : -1;
+}
+
+static void bench_device(uint16_t port, const bench_mode_t *mode, int resultFd)
+{
+    bench_result_t result;
+    memset(&result, 0, sizeof(result));
+    
+    char portString[8];
+    sprintf(portString, "%u", port);
+    
+    static iap_https_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.current_software_version = 1;
+    config.server_host_name = "localhost";
+    config.server_port = portString;
+    config.server_root_ca_public_key_pem = test_server_cert_pem;
+    config.peer_public_key_pem = test_server_cert_pem;
+    strcpy(config.server_metadata_path, "/meta.txt");
+    strcpy(config.server_firmware_path, "/fw.bin");
+    config.use_staging_buffer = mode->use_staging_buffer;
+    config.use_flash_task = mode->use_flash_task;
+    config.verify_flash = mode->verify_flash;
+    
+    host_flash_set_timing(is_flash_timing_enabled);
+    host_wifi_sta_set_connected(1);
+    host_wifi_sta_set_dns_ready(1);
+    
+    // The memory allocated so far (e.g. the image) isn't part of the device.
+    size_t baselineHeap = host_heap_get_used();
+    host_heap_set_size(baselineHeap + free_heap);
+    host_heap_reset_peak();
+    
+    int64_t start = esp_timer_get_time();
+    iap_https_init(&config);
+    iap_https_check_now();
+    
+    while (iap_https_get_state() != IAP_HTTPS_STATE_INSTALLED) {
+        if (esp_timer_get_time() - start > BENCH_TIMEOUT_MS * 1000ll) {
+            ESP_LOGE(TAG, "timeout");
+            break;
+        }
+        vTaskDelay(1);
+    }
+    
+    result.time_to_installed_ms = (esp_timer_get_time() - start) / 1000;
+    result.is_installed = iap_https_get_state() == IAP_HTTPS_STATE_INSTALLED;
+    result.is_image_ok = memcmp(host_flash_get_contents(0x110000), image, image_size) == 0;
+    result.peak_heap = host_heap_get_peak() - baselineHeap;
+    iap_https_get_statistics(&result.statistics);
+    host_flash_get_stats(&result.flash_stats);
+    
+    if (write(resultFd, &result, sizeof(result)) != sizeof(result)) {
+        ESP_LOGE(TAG, "failed to report the result");
+    }
+    close(resultFd);
+}
@@ -0,0 +1,633 @@
+//
+//  fleet.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  Simulates a fleet of devices which poll one update server, to see the load
+//  on the server and how fast a staged rollout reaches the devices. Each device
+//  is a complete updater (task, timers, TLS connection, flash) with its own
+//  configuration, version and polling interval. All devices run as cooperative
+//  tasks on one thread (host_fiber.c): the statics of the component are
+//  swapped per device (see fleet_switch), and the clock skips ahead while all
+//  devices are idle, so hours of polling take minutes.
+//
+//  Usage: fleet [-n <devices>] [-i <interval s>[,...]] [-j <jitter %>] [-s <first check spread s>]
+//               [-v <version>[,...]] [-V <new version>] [-r <time s>:<rollout %>[,...]]
+//               [-t <duration s>] [-b <bucket s>] [-z <image size in KB>] [-c <max connections>]
+//    -i, -v  values assigned to the devices in turn, e.g. -i 600,3600.
+//    -r      schedule of the rollout of the new version (ROLLOUT= in the metadata),
+//            0 % until the first entry.
+//    -c      connections open at the same time; further devices wait for one
+//            to close (wifi_tls waits with select, so descriptors stay below FD_SETSIZE).
+//
+//  Reported per bucket: requests, handshakes and bytes per second at the server,
+//  open connections, and the share of the devices which have installed the new
+//  version. 'cpu' is the share of the bucket the simulator was busy; near 100 %,
+//  the rates are limited by the simulator rather than by the devices.
+//
+//  Devices don't re-boot into the new version: a device counts as updated when
+//  the image is installed, and its later checks find the image in the flash.
+//  The flash timing is disabled, and the DNS pre-check isn't supported.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+
+#include "mbedtls/sha256.h"
+
+#include "iap_https.h"
+#include "https_transport.h"
+#include "wifi_tls.h"
+#include "host.h"
+#include "test_server.h"
+
+
+#define TAG "fleet"
+
+#define FLEET_MAX_LIST_LEN 16
+#define FLEET_MAX_ROLLOUT_STEPS 16
+
+// The statics of the updater and of the emulated flash and Wi-Fi (renamed
+// into this section by the Makefile), swapped per device.
+extern uint8_t __start_fleet_state[];
+extern uint8_t __stop_fleet_state[];
+
+typedef struct fleet_device_ {
+    int index;
+    uint8_t mac[6];
+    uint8_t *state;
+    iap_https_config_t config;
+    
+    // The TLS transport of the device, wrapped to count and limit the connections.
+    struct wifi_tls_context_ *tls_context;
+    https_transport_t tls_transport;
+    https_transport_t transport;
+    int has_connection_slot;
+    
+    // Virtual time when the new version was installed, 0 if not yet.
+    int64_t installed_us;
+} fleet_device_t;
+
+typedef struct fleet_counters_ {
+    uint32_t nof_connects;
+    uint32_t nof_connect_failures;
+    uint32_t nof_slot_waits;
+    uint32_t nof_installed;
+} fleet_counters_t;
+
+static int nof_devices = 1000;
+static int intervals[FLEET_MAX_LIST_LEN] = { 600 };
+static int nof_intervals = 1;
+static int versions[FLEET_MAX_LIST_LEN] = { 1 };
+static int nof_versions = 1;
+static int jitter_percent = 10;
+static int first_check_spread_s = 300;
+static int new_version = 2;
+static int rollout_times_s[FLEET_MAX_ROLLOUT_STEPS] = { 0, 1200, 2400 };
+static int rollout_percents[FLEET_MAX_ROLLOUT_STEPS] = { 5, 25, 100 };
+static int nof_rollout_steps = 3;
+static int duration_s = 3600;
+static int bucket_s = 60;
+static size_t image_size = 64 * 1024;
+static int max_connections = 512;
+
+static uint8_t *image;
+static char image_hash[65];
+static char port_string[8];
+
+static fleet_device_t *devices;
+static fleet_device_t *state_owner;
+static uint8_t *pristine_state;
+static size_t state_size;
+static QueueHandle_t connection_slots;
+static fleet_counters_t counters;
+
+
+static int fleet_parse_list(const char *text, int *values, int maxValues);
+static int fleet_parse_rollout(const char *text);
+static void fleet_create_image();
+static void fleet_set_rollout(int percent, char *metadata, size_t size);
+static int fleet_add_device(int index);
+static void fleet_switch(void *owner);
+static void fleet_progress(const iap_https_progress_t *progress, void *arg);
+static int fleet_transport_connect(void *context);
+static int fleet_transport_write(void *context, const char *buf, size_t len);
+static int fleet_transport_read(void *context, char *buf, size_t len);
+static void fleet_transport_close(void *context);
+static int fleet_transport_wait_readable(void *context, uint32_t timeoutMs);
+static void fleet_release_slot(fleet_device_t *device);
+static void fleet_print_milestone(const char *name, int percent);
+static int fleet_compare_times(const void *a, const void *b);
+static int fleet_busy_percent(int64_t realUs, int64_t virtualUs);
+static int64_t fleet_real_us();
+static long fleet_memory_kb();
+
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "n:i:j:s:v:V:r:t:b:z:c:")) != -1) {
+        int isValid = 1;
+        switch (opt) {
+            case 'n':
+                nof_devices = atoi(optarg);
+                isValid = nof_devices > 0;
+                break;
+            case 'i':
+                nof_intervals = fleet_parse_list(optarg, intervals, FLEET_MAX_LIST_LEN);
+                isValid = nof_intervals > 0;
+                break;
+            case 'j':
+                jitter_percent = atoi(optarg);
+                break;
+            case 's':
+                first_check_spread_s = atoi(optarg);
+                break;
+            case 'v':
+                nof_versions = fleet_parse_list(optarg, versions, FLEET_MAX_LIST_LEN);
+                isValid = nof_versions > 0;
+                break;
+            case 'V':
+                new_version = atoi(optarg);
+                break;
+            case 'r':
+                isValid = fleet_parse_rollout(optarg) == 0;
+                break;
+            case 't':
+                duration_s = atoi(optarg);
+                isValid = duration_s > 0;
+                break;
+            case 'b':
+                bucket_s = atoi(optarg);
+                isValid = bucket_s > 0;
+                break;
+            case 'z':
+                image_size = strtoul(optarg, NULL, 0) * 1024;
+                isValid = image_size >= 1024 && image_size <= 1024 * 1024;
+                break;
+            case 'c':
+                max_connections = atoi(optarg);
+                isValid = max_connections > 0 && max_connections <= 900;
+                break;
+            default:
+                isValid = 0;
+                break;
+        }
+        if (!isValid) {
+            fprintf(stderr, "usage: %s [-n <devices>] [-i <interval s>[,...]] [-j <jitter %%>] [-s <first check spread s>]\n"
+                    "       [-v <version>[,...]] [-V <new version>] [-r <time s>:<rollout %%>[,...]]\n"
+                    "       [-t <duration s>] [-b <bucket s>] [-z <image size in KB, 1..1024>] [-c <max connections, 1..900>]\n", argv[0]);
+            return 2;
+        }
+    }
+    
+    fleet_create_image();
+    
+    // The rollout starts at 0 % unless the schedule begins at once.
+    int rolloutStep = 0;
+    int rolloutPercent = 0;
+    if (rollout_times_s[0] == 0) {
+        rolloutPercent = rollout_percents[0];
+        rolloutStep = 1;
+    }
+    static char metadata[TEST_SERVER_MAX_METADATA_LEN];
+    fleet_set_rollout(rolloutPercent, metadata, sizeof(metadata));
+    
+    test_server_config_t serverConfig = {
+        .metadata_path = "/meta.txt",
+        .metadata = metadata,
+        .image_path = "/fw.bin",
+        .image = image,
+        .image_size = image_size,
+    };
+    uint16_t port;
+    fflush(stdout);
+    fflush(stderr);
+    if (test_server_start(&serverConfig, &port) != 0) {
+        fprintf(stderr, "failed to start the test server\n");
+        return 1;
+    }
+    sprintf(port_string, "%u", port);
+    
+    // The memory of the devices is only limited by the host.
+    host_heap_set_size(UINT32_MAX);
+    
+    // All devices start with the same factory image; each one writes into a private copy of the flash.
+    host_flash_reset();
+    if (host_flash_freeze() != 0) {
+        fprintf(stderr, "failed to create the copy-on-write flash\n");
+        test_server_stop();
+        return 1;
+    }
+    
+    state_size = __stop_fleet_state - __start_fleet_state;
+    pristine_state = malloc(state_size);
+    memcpy(pristine_state, __start_fleet_state, state_size);
+    host_fiber_set_switch_handler(fleet_switch);
+    
+    connection_slots = xQueueCreate(max_connections, sizeof(uint8_t));
+    for (int i = 0; i < max_connections; i++) {
+        uint8_t slot = 0;
+        xQueueSend(connection_slots, &slot, 0);
+    }
+    
+    devices = calloc(nof_devices, sizeof(fleet_device_t));
+    if (!devices) {
+        fprintf(stderr, "out of memory\n");
+        test_server_stop();
+        return 1;
+    }
+    int64_t realStart = fleet_real_us();
+    for (int i = 0; i < nof_devices; i++) {
+        if (fleet_add_device(i) != 0) {
+            fprintf(stderr, "failed to start device %d\n", i);
+            test_server_stop();
+            return 1;
+        }
+    }
+    host_fiber_set_owner(NULL);
+    
+    printf("%d devices, intervals", nof_devices);
+    for (int i = 0; i < nof_intervals; i++) {
+        printf("%s%d", i ? "," : " ", intervals[i]);
+    }
+    printf(" s (+/- %d %%), first check spread %d s, image %u bytes, max %d connections, %u bytes of state per device\n\n",
+           jitter_percent, first_check_spread_s, (unsigned)image_size, max_connections, (unsigned)state_size);
+    printf("%7s %7s %8s %8s %8s %8s %9s %6s %6s %9s %7s %5s\n", "time_s", "rollout", "req/s", "meta/s", "image/s", "hs/s",
+           "KB/s", "open", "waits", "installed", "inst_%", "cpu");
+    
+    test_server_stats_t previous;
+    memset(&previous, 0, sizeof(previous));
+    fleet_counters_t previousCounters = counters;
+    int64_t bucketStart = host_fiber_now_us();
+    int64_t bucketRealStart = fleet_real_us();
+    int64_t end = bucketStart + (int64_t)duration_s * 1000000;
+    double peakRequestsPerS = 0;
+    double peakHandshakesPerS = 0;
+    
+    while (host_fiber_now_us() < end) {
+        int64_t bucketEnd = bucketStart + (int64_t)bucket_s * 1000000;
+        if (bucketEnd > end) {
+            bucketEnd = end;
+        }
+    
+        // Run until the end of the bucket, changing the rollout on the way.
+        for (;;) {
+            int64_t until = bucketEnd;
+            if (rolloutStep < nof_rollout_steps && (int64_t)rollout_times_s[rolloutStep] * 1000000 < until) {
+                until = (int64_t)rollout_times_s[rolloutStep] * 1000000;
+            }
+            host_fiber_run(until);
+            if (until == bucketEnd) {
+                break;
+            }
+            rolloutPercent = rollout_percents[rolloutStep++];
+            fleet_set_rollout(rolloutPercent, metadata, sizeof(metadata));
+            test_server_set_metadata(metadata);
+        }
+    
+        int64_t now = host_fiber_now_us();
+        int64_t realNow = fleet_real_us();
+        test_server_stats_t stats;
+        test_server_get_stats(&stats);
+        double seconds = (now - bucketStart) / 1e6;
+        double requestsPerS = (stats.nof_requests - previous.nof_requests) / seconds;
+        double imagesPerS = (stats.nof_image_requests - previous.nof_image_requests) / seconds;
+        double handshakesPerS = (stats.nof_handshakes - previous.nof_handshakes) / seconds;
+        peakRequestsPerS = requestsPerS > peakRequestsPerS ? requestsPerS : peakRequestsPerS;
+        peakHandshakesPerS = handshakesPerS > peakHandshakesPerS ? handshakesPerS : peakHandshakesPerS;
+    
+        printf("%7d %6d%% %8.1f %8.1f %8.1f %8.1f %9.1f %6d %6u %9u %6.1f%% %4d%%\n", (int)(now / 1000000), rolloutPercent,
+               requestsPerS, requestsPerS - imagesPerS, imagesPerS, handshakesPerS,
+               (stats.nof_body_bytes - previous.nof_body_bytes) / 1024.0 / seconds,
+               max_connections - (int)uxQueueMessagesWaiting(connection_slots),
+               counters.nof_slot_waits - previousCounters.nof_slot_waits, counters.nof_installed,
+               100.0 * counters.nof_installed / nof_devices, fleet_busy_percent(realNow - bucketRealStart, now - bucketStart));
+        fflush(stdout);
+    
+        previous = stats;
+        previousCounters = counters;
+        bucketStart = now;
+        bucketRealStart = realNow;
+    }
+    
+    test_server_stats_t stats;
+    test_server_get_stats(&stats);
+    host_fiber_stats_t fiberStats;
+    host_fiber_get_stats(&fiberStats);
+    int64_t realUs = fleet_real_us() - realStart;
+    
+    printf("\n%d s simulated in %.1f s (x%.0f), %ld MB of memory\n", duration_s, realUs / 1e6,
+           duration_s * 1e6 / realUs, fleet_memory_kb() / 1024);
+    printf("server: %u connections, %u handshakes, %u requests (%u for the image), %.1f MB, peak %.1f requests/s, %.1f handshakes/s\n",
+           stats.nof_connections, stats.nof_handshakes, stats.nof_requests, stats.nof_image_requests,
+           stats.nof_body_bytes / 1048576.0, peakRequestsPerS, peakHandshakesPerS);
+    printf("devices: %u connections (%u failed), %u waited for a connection, %u of %d installed version %d\n",
+           counters.nof_connects, counters.nof_connect_failures, counters.nof_slot_waits, counters.nof_installed,
+           nof_devices, new_version);
+    printf("simulator: %llu task switches, %llu device switches, %llu timer callbacks, %.0f s skipped while idle\n",
+           (unsigned long long)fiberStats.nof_task_switches, (unsigned long long)fiberStats.nof_owner_switches,
+           (unsigned long long)fiberStats.nof_timer_callbacks, fiberStats.skipped_us / 1e6);
+    fleet_print_milestone("50 %", 50);
+    fleet_print_milestone("90 %", 90);
+    fleet_print_milestone("100 %", 100);
+    
+    test_server_stop();
+    return counters.nof_connects > 0 ? 0 : 1;
+}
+
+// Parses a comma-separated list of numbers. Returns the number of values, 0 if invalid.
+static int fleet_parse_list(const char *text, int *values, int maxValues)
+{
+    int n = 0;
+    while (*text && n < maxValues) {
+        char *end;
+        values[n++] = (int)strtol(text, &end, 10);
+        if (end == text || (*end && *end != ',')) {
+            return 0;
+        }
+        text = *end ? end + 1 : end;
+    }
+    return *text ? 0 : n;
+}
+
+// Parses the rollout schedule, e.g. "0:10,3600:100". Returns 0 if valid.
+static int fleet_parse_rollout(const char *text)
+{
+    int n = 0;
+    while (*text && n < FLEET_MAX_ROLLOUT_STEPS) {
+        char *end;
+        rollout_times_s[n] = (int)strtol(text, &end, 10);
+        if (end == text || *end != ':' || (n > 0 && rollout_times_s[n] <= rollout_times_s[n - 1])) {
+            return -1;
+        }
+        text = end + 1;
+        rollout_percents[n] = (int)strtol(text, &end, 10);
+        if (end == text || (*end && *end != ',') || rollout_percents[n] < 0 || rollout_percents[n] > 100) {
+            return -1;
+        }
+        n++;
+        text = *end ? end + 1 : end;
+    }
+    if (*text || n == 0) {
+        return -1;
+    }
+    nof_rollout_steps = n;
+    return 0;
+}
+
+static void fleet_create_image()
+{
+    // Like bench.c: pseudo-random contents with the header magic of an app image.
+    image = malloc(image_size);
+    uint32_t x = 0x12345678;
+    for (size_t i = 0; i < image_size; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        image[i] = (uint8_t)x;
+    }
+    image[0] = 0xe9;
+    
+    uint8_t hash[32];
+    mbedtls_sha256_ret(image, image_size, hash, 0);
+    for (int i = 0; i < 32; i++) {
+        sprintf(image_hash + 2 * i, "%02x", hash[i]);
+    }
+}
+
+// No INTERVAL=, so that the devices keep their own polling intervals.
+static void fleet_set_rollout(int percent, char *metadata, size_t size)
+{
+    snprintf(metadata, size, "VERSION=%d\nFILE=/fw.bin\nSIZE=%u\nSHA256=%s\nROLLOUT=%d\nSALT=fleet\n",
+             new_version, (unsigned)image_size, image_hash, percent);
+}
+
+static int fleet_add_device(int index)
+{
+    fleet_device_t *device = &devices[index];
+    device->index = index;
+    device->mac[0] = 0x24;
+    device->mac[1] = 0x0a;
+    device->mac[2] = 0xc4;
+    device->mac[3] = (uint8_t)(index >> 16);
+    device->mac[4] = (uint8_t)(index >> 8);
+    device->mac[5] = (uint8_t)index;
+    device->state = malloc(state_size);
+    if (!device->state) {
+        return -1;
+    }
+    memcpy(device->state, pristine_state, state_size);
+    
+    // From here on, the statics are the ones of the device, and its tasks and timers belong to it.
+    host_fiber_set_owner(device);
+    if (host_flash_clone() != 0) {
+        return -1;
+    }
+    host_wifi_sta_set_connected(1);
+    host_wifi_sta_set_dns_ready(1);
+    
+    iap_https_config_t *config = &device->config;
+    config->current_software_version = versions[index % nof_versions];
+    config->server_host_name = "localhost";
+    config->server_port = port_string;
+    config->server_root_ca_public_key_pem = test_server_cert_pem;
+    config->peer_public_key_pem = test_server_cert_pem;
+    strcpy(config->server_metadata_path, "/meta.txt");
+    strcpy(config->server_firmware_path, "/fw.bin");
+    config->polling_interval_s = intervals[index % nof_intervals];
+    config->polling_jitter_percent = jitter_percent;
+    config->first_check_spread_s = first_check_spread_s;
+    config->send_device_id = 1;
+    config->progress_callback = fleet_progress;
+    config->progress_callback_arg = device;
+    
+    wifi_tls_init_struct_t tlsInitStruct = {
+        .server_host_name = config->server_host_name,
+        .server_port = config->server_port,
+        .server_root_ca_public_key_pem = config->server_root_ca_public_key_pem,
+        .peer_public_key_pem = config->peer_public_key_pem
+    };
+    device->tls_context = wifi_tls_create_context(&tlsInitStruct);
+    if (!device->tls_context) {
+        return -1;
+    }
+    wifi_tls_init_transport(device->tls_context, &device->tls_transport);
+    device->transport.context = device;
+    device->transport.connect = fleet_transport_connect;
+    device->transport.write = fleet_transport_write;
+    device->transport.read = fleet_transport_read;
+    device->transport.close = fleet_transport_close;
+    device->transport.wait_readable = fleet_transport_wait_readable;
+    config->transport = &device->transport;
+    
+    return iap_https_init(config) == 0 ? 0 : -1;
+}
+
+// Saves the statics of the previous device and loads the ones of the next.
+// The main loop (owner NULL) doesn't use them, so they are swapped lazily.
+static void fleet_switch(void *owner)
+{
+    fleet_device_t *device = owner;
+    if (!device || device == state_owner) {
+        return;
+    }
+    if (state_owner) {
+        memcpy(state_owner->state, __start_fleet_state, state_size);
+    }
+    memcpy(__start_fleet_state, device->state, state_size);
+    state_owner = device;
+    host_wifi_set_mac(device->mac);
+}
+
+static void fleet_progress(const iap_https_progress_t *progress, void *arg)
+{
+    fleet_device_t *device = arg;
+    if (progress->phase == IAP_HTTPS_PHASE_COMPLETE && !progress->component_name && !device->installed_us) {
+        device->installed_us = host_fiber_now_us() > 0 ? host_fiber_now_us() : 1;
+        counters.nof_installed++;
+    }
+}
+
+static int fleet_transport_connect(void *context)
+{
+    fleet_device_t *device = context;
+    if (!device->has_connection_slot) {
+        if (uxQueueMessagesWaiting(connection_slots) == 0) {
+            counters.nof_slot_waits++;
+        }
+        uint8_t slot;
+        xQueueReceive(connection_slots, &slot, portMAX_DELAY);
+        device->has_connection_slot = 1;
+    }
+    
+    counters.nof_connects++;
+    int result = device->tls_transport.connect(device->tls_transport.context);
+    if (result != 0) {
+        counters.nof_connect_failures++;
+        fleet_release_slot(device);
+    }
+    return result;
+}
+
+static int fleet_transport_write(void *context, const char *buf, size_t len)
+{
+    fleet_device_t *device = context;
+    return device->tls_transport.write(device->tls_transport.context, buf, len);
+}
+
+static int fleet_transport_read(void *context, char *buf, size_t len)
+{
+    fleet_device_t *device = context;
+    return device->tls_transport.read(device->tls_transport.context, buf, len);
+}
+
+static void fleet_transport_close(void *context)
+{
+    fleet_device_t *device = context;
+    device->tls_transport.close(device->tls_transport.context);
+    fleet_release_slot(device);
+}
+
+static int fleet_transport_wait_readable(void *context, uint32_t timeoutMs)
+{
+    fleet_device_t *device = context;
+    return device->tls_transport.wait_readable(device->tls_transport.context, timeoutMs);
+}
+
+static void fleet_release_slot(fleet_device_t *device)
+{
+    if (device->has_connection_slot) {
+        uint8_t slot = 0;
+        xQueueSend(connection_slots, &slot, 0);
+        device->has_connection_slot = 0;
+    }
+}
+
+// Prints when the given share of the fleet had installed the new version.
+static void fleet_print_milestone(const char *name, int percent)
+{
+    int needed = (nof_devices * percent + 99) / 100;
+    int64_t *times = malloc(nof_devices * sizeof(int64_t));
+    int n = 0;
+    for (int i = 0; i < nof_devices; i++) {
+        if (devices[i].installed_us) {
+            times[n++] = devices[i].installed_us;
+        }
+    }
+    qsort(times, n, sizeof(int64_t), fleet_compare_times);
+    
+    if (needed > 0 && n >= needed) {
+        printf("%s of the devices updated after %d s\n", name, (int)(times[needed - 1] / 1000000));
+    } else {
+        printf("%s of the devices updated: not reached\n", name);
+    }
+    free(times);
+}
+
+static int fleet_compare_times(const void *a, const void *b)
+{
+    int64_t timeA = *(const int64_t *)a;
+    int64_t timeB = *(const int64_t *)b;
+    return timeA < timeB ? -1 : timeA > timeB;
+}
+
+// The clock only skips ahead while the simulator is idle, otherwise it follows the real time.
+static int fleet_busy_percent(int64_t realUs, int64_t virtualUs)
+{
+    int percent = virtualUs > 0 ? (int)(100 * realUs / virtualUs) : 100;
+    return percent < 100 ? percent : 100;
+}
+
+static int64_t fleet_real_us()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Proportional set size: the pages of the flash template, shared by all devices, count once.
+static long fleet_memory_kb()
+{
+    FILE *file = fopen("/proc/self/smaps_rollup", "r");
+    if (!file) {
+        return 0;
+    }
+    char line[128];
+    long kb = 0;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "Pss: %ld kB", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(file);
+    return kb;
+}
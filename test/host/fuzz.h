@@ -0,0 +1,46 @@
+//
+//  fuzz.h
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  The libFuzzer interface of the fuzz targets (fuzz_*.c). With clang, the
+//  targets link against libFuzzer; otherwise fuzz_main.c runs them on a
+//  corpus and on mutations of it.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __FUZZ__
+#define __FUZZ__ 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+// Called once before the first input.
+int LLVMFuzzerInitialize(int *argc, char ***argv);
+
+// Runs a single input. Aborts if the code under test misbehaves.
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+
+#endif // __FUZZ__
@@ -0,0 +1,88 @@
+//
+//  fuzz_http_parse.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  Fuzz target for the value parsers of the https_client module
+//  (http_parse_int, http_parse_key_value_int, http_parse_key_value_string).
+//
+//  Input: text, e.g. a header block. The parsers are run with the keys of
+//  the HTTP headers and metadata fields.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "esp_log.h"
+
+#include "https_client.h"
+#include "fuzz.h"
+
+
+#define FUZZ_STRING_LEN 16
+
+#define FUZZ_CHECK(condition) do { if (!(condition)) abort(); } while (0)
+
+
+static const char *keys[] = {
+    "Content-Length: ",
+    "Retry-After: ",
+    "max-age=",
+    "VERSION=",
+    "FILE=",
+    "\r\n",
+};
+
+
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    char *text = malloc(size + 1);
+    memcpy(text, data, size);
+    text[size] = 0x00;
+    
+    int value = INT_MIN;
+    if (http_parse_int(text, &value) == 0) {
+        FUZZ_CHECK(strtol(text, NULL, 10) == value);
+    }
+    
+    // Exactly the string size, so that the address sanitizer sees overflows.
+    char *str = malloc(FUZZ_STRING_LEN);
+    for (int i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        http_parse_key_value_int(text, keys[i], &value);
+        if (http_parse_key_value_string(text, keys[i], str, FUZZ_STRING_LEN) == 0) {
+            FUZZ_CHECK(strlen(str) < FUZZ_STRING_LEN);
+            FUZZ_CHECK(!strpbrk(str, "\r\n"));
+        }
+    }
+    
+    free(str);
+    free(text);
+    return 0;
+}
@@ -0,0 +1,172 @@
+//
+//  fuzz_https_client.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  Fuzz target for the response parser of the https_client module
+//  (https_tls_callback): the input is replayed as the server's response to
+//  https_send_request through the mem_transport module.
+//
+//  Input: <flags> <read size> <response stream>
+//    flags bit 0: HTTP_WAIT_FOR_COMPLETE_BODY instead of HTTP_STREAM_BODY
+//    flags bit 1: keep-alive, a second request reads the rest of the stream
+//    read size: maximum number of bytes per read (0 = no limit)
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+#include "https_client.h"
+#include "https_transport.h"
+#include "mem_transport.h"
+#include "fuzz.h"
+
+
+// The size of the metadata response buffer of the iap_https module.
+#define FUZZ_RESPONSE_BUFFER_LEN 512
+
+#define FUZZ_FLAG_WAIT_FOR_COMPLETE_BODY (1 << 0)
+#define FUZZ_FLAG_KEEP_ALIVE             (1 << 1)
+
+#define FUZZ_CHECK(condition) do { if (!(condition)) abort(); } while (0)
+
+
+// What the callbacks of the current request have seen.
+static int content_length;
+static size_t body_total;
+static int is_headers_received;
+static int is_body_complete;
+
+
+static http_continue_receiving_t fuzz_headers_callback(http_request_t *request, int statusCode, int contentLength)
+{
+    FUZZ_CHECK(!is_headers_received);
+    FUZZ_CHECK(statusCode == 200 || statusCode == 206);
+    FUZZ_CHECK(contentLength >= 0);
+    is_headers_received = 1;
+    content_length = contentLength;
+    return HTTP_CONTINUE_RECEIVING;
+}
+
+static http_continue_receiving_t fuzz_body_callback(http_request_t *request, size_t bytesReceived)
+{
+    FUZZ_CHECK(is_headers_received && !is_body_complete);
+    FUZZ_CHECK(bytesReceived < request->response_buffer_len);
+    
+    if (bytesReceived == 0 || request->response_mode == HTTP_WAIT_FOR_COMPLETE_BODY) {
+        is_body_complete = 1;
+    }
+    
+    // Touch every byte, so that the sanitizers see reads outside of the data.
+    volatile uint8_t sum = 0;
+    for (size_t i = 0; i < bytesReceived; i++) {
+        sum += request->response_buffer[i];
+    }
+    FUZZ_CHECK(bytesReceived == 0 || request->response_buffer[bytesReceived] == 0x00);
+    
+    body_total += bytesReceived;
+    FUZZ_CHECK(body_total <= content_length);
+    FUZZ_CHECK(!is_body_complete || body_total == content_length);
+    return HTTP_CONTINUE_RECEIVING;
+}
+
+static void fuzz_error_callback(http_request_t *request, http_err_t error, int additionalInfo)
+{
+    FUZZ_CHECK(error != HTTP_ERR_CANCELLED && error != HTTP_ERR_CONNECTION_CLOSED);
+    if (error == HTTP_ERR_RESPONSE_TRUNCATED) {
+        FUZZ_CHECK(is_headers_received ? additionalInfo >= 0 && additionalInfo < content_length : additionalInfo == 0);
+    }
+}
+
+static http_err_t fuzz_send_request(https_transport_t *transport, http_request_t *request)
+{
+    content_length = 0;
+    body_total = 0;
+    is_headers_received = 0;
+    is_body_complete = 0;
+    
+    http_err_t err = https_send_request(transport, request);
+    
+    FUZZ_CHECK(err != HTTP_SUCCESS || !is_headers_received || is_body_complete);
+    FUZZ_CHECK(err == HTTP_SUCCESS || request->keep_alive == 0);
+    return err;
+}
+
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size < 2) {
+        return 0;
+    }
+    uint8_t flags = data[0];
+    mem_transport_response_t response = {
+        .data = (const char *)&data[2],
+        .len = size - 2,
+    };
+    mem_transport_init_struct_t params = {
+        .responses = &response,
+        .nof_responses = 1,
+        .chunk_size = data[1],
+    };
+    
+    https_transport_t transport;
+    struct mem_transport_context_ *ctx = mem_transport_create_context(&params);
+    mem_transport_init_transport(ctx, &transport);
+    transport.connect(transport.context);
+    
+    // Exactly the buffer size, so that the address sanitizer sees overflows.
+    char *responseBuffer = malloc(FUZZ_RESPONSE_BUFFER_LEN);
+    
+    http_request_t request;
+    memset(&request, 0, sizeof(request));
+    request.verb = HTTP_GET;
+    request.host = "localhost";
+    request.path = "/meta.txt";
+    request.response_buffer = responseBuffer;
+    request.response_buffer_len = FUZZ_RESPONSE_BUFFER_LEN;
+    request.error_callback = fuzz_error_callback;
+    request.headers_callback = fuzz_headers_callback;
+    request.body_callback = fuzz_body_callback;
+    request.response_mode = (flags & FUZZ_FLAG_WAIT_FOR_COMPLETE_BODY) ? HTTP_WAIT_FOR_COMPLETE_BODY : HTTP_STREAM_BODY;
+    request.keep_alive = (flags & FUZZ_FLAG_KEEP_ALIVE) ? 1 : 0;
+    
+    http_err_t err = fuzz_send_request(&transport, &request);
+    
+    // A kept-alive connection continues with the rest of the stream.
+    if (err == HTTP_SUCCESS && request.keep_alive) {
+        request.response_mode = HTTP_STREAM_BODY;
+        fuzz_send_request(&transport, &request);
+    }
+    
+    free(responseBuffer);
+    mem_transport_free_context(ctx);
+    return 0;
+}
@@ -0,0 +1,259 @@
+//
+//  fuzz_main.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  Runs a fuzz target without libFuzzer (e.g. with gcc): first every input
+//  of the corpus, then random mutations of them. Build with the address and
+//  undefined behaviour sanitizers; if one of them or the target aborts, the
+//  input is written to crash-<run>.
+//
+//  Usage: fuzz_<target> [-n <runs>] [-s <seed>] <corpus file or directory> ...
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "fuzz.h"
+
+
+#define FUZZ_MAX_INPUT_LEN 65536
+#define FUZZ_MAX_MUTATIONS 8
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+} fuzz_input_t;
+
+static fuzz_input_t *corpus;
+static int nof_inputs;
+
+// The input of the current run, written to a file if the run crashes.
+static uint8_t current[FUZZ_MAX_INPUT_LEN];
+static size_t current_len;
+static unsigned long current_run;
+
+static uint64_t random_state;
+
+// Tokens of the formats under test, inserted by the mutator.
+static const char *tokens[] = {
+    "\r\n", "\r\n\r\n", "HTTP/1.1 ", "200 ", "206 ", "204 ", "Content-Length: ", "Connection: close",
+    "Retry-After: ", "Cache-Control: max-age=", "0", "-1", "2147483648", "99999999999999999999",
+    "\n", "=", "VERSION=", "FILE=", "SIZE=", "SHA256=", "SIGNATURE=", "ROLLOUT=", "SALT=", "[", "]",
+    "\xef\xbb\xbf", ";sig=", "v=", ";exp=", "\xa1", "\xd2\x84", "\x1b", "\x5f",
+};
+
+
+void __sanitizer_set_death_callback(void (*callback)(void)) __attribute__((weak));
+
+// Let the address sanitizer handle the aborts of the targets, too (and save the input).
+const char *__asan_default_options(void)
+{
+    return "handle_abort=1";
+}
+
+
+static uint32_t fuzz_random(uint32_t range)
+{
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return range ? (uint32_t)((random_state * 0x2545f4914f6cdd1dull) >> 32) % range : 0;
+}
+
+static void fuzz_save_crash(void)
+{
+    char path[32];
+    snprintf(path, sizeof(path), "crash-%lu", current_run);
+    FILE *f = fopen(path, "wb");
+    if (f) {
+        fwrite(current, 1, current_len, f);
+        fclose(f);
+        fprintf(stderr, "fuzz: input written to %s\n", path);
+    }
+}
+
+static void fuzz_add_file(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return;
+    }
+    fuzz_input_t input;
+    input.data = malloc(FUZZ_MAX_INPUT_LEN);
+    input.len = fread(input.data, 1, FUZZ_MAX_INPUT_LEN, f);
+    fclose(f);
+    
+    corpus = realloc(corpus, (nof_inputs + 1) * sizeof(fuzz_input_t));
+    corpus[nof_inputs++] = input;
+}
+
+static void fuzz_add_path(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "fuzz: %s not found\n", path);
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        fuzz_add_file(path);
+        return;
+    }
+    
+    DIR *dir = opendir(path);
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir))) {
+        if (entry->d_name[0] != '.') {
+            char filePath[1024];
+            snprintf(filePath, sizeof(filePath), "%s/%s", path, entry->d_name);
+            fuzz_add_file(filePath);
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+}
+
+static void fuzz_insert(size_t pos, const uint8_t *data, size_t len)
+{
+    if (current_len + len > FUZZ_MAX_INPUT_LEN) {
+        return;
+    }
+    memmove(&current[pos + len], &current[pos], current_len - pos);
+    memcpy(&current[pos], data, len);
+    current_len += len;
+}
+
+static void fuzz_mutate(void)
+{
+    int nofMutations = 1 + fuzz_random(FUZZ_MAX_MUTATIONS);
+    for (int i = 0; i < nofMutations; i++) {
+        size_t pos = fuzz_random(current_len + 1);
+        switch (fuzz_random(7)) {
+            case 0: // flip a bit
+                if (pos < current_len) {
+                    current[pos] ^= 1 << fuzz_random(8);
+                }
+                break;
+            case 1: // random byte
+                if (pos < current_len) {
+                    current[pos] = fuzz_random(256);
+                }
+                break;
+            case 2: { // insert a random byte
+                uint8_t b = fuzz_random(256);
+                fuzz_insert(pos, &b, 1);
+                break;
+            }
+            case 3: { // delete a block
+                size_t len = 1 + fuzz_random(16);
+                if (pos + len <= current_len) {
+                    memmove(&current[pos], &current[pos + len], current_len - pos - len);
+                    current_len -= len;
+                }
+                break;
+            }
+            case 4: { // insert a token
+                const char *token = tokens[fuzz_random(sizeof(tokens) / sizeof(tokens[0]))];
+                fuzz_insert(pos, (const uint8_t *)token, strlen(token));
+                break;
+            }
+            case 5: { // duplicate a block
+                size_t len = 1 + fuzz_random(64);
+                if (pos + len <= current_len) {
+                    uint8_t block[64];
+                    memcpy(block, &current[pos], len);
+                    fuzz_insert(fuzz_random(current_len + 1), block, len);
+                }
+                break;
+            }
+            case 6: { // splice: continue with the end of another input
+                fuzz_input_t *other = &corpus[fuzz_random(nof_inputs)];
+                size_t otherPos = fuzz_random(other->len + 1);
+                if (pos + other->len - otherPos <= FUZZ_MAX_INPUT_LEN) {
+                    memcpy(&current[pos], &other->data[otherPos], other->len - otherPos);
+                    current_len = pos + other->len - otherPos;
+                }
+                break;
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long nofRuns = 100000;
+    unsigned long long seed = 1;
+    
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+            case 'n':
+                nofRuns = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n <runs>] [-s <seed>] <corpus file or directory> ...\n", argv[0]);
+                return 2;
+        }
+    }
+    for (int i = optind; i < argc; i++) {
+        fuzz_add_path(argv[i]);
+    }
+    if (nof_inputs == 0) {
+        // Start from an empty input.
+        fuzz_add_file("/dev/null");
+    }
+    
+    random_state = seed * 0x9e3779b97f4a7c15ull | 1;
+    if (__sanitizer_set_death_callback) {
+        __sanitizer_set_death_callback(fuzz_save_crash);
+    }
+    LLVMFuzzerInitialize(&argc, &argv);
+    
+    // The corpus as it is, then mutations of it.
+    for (current_run = 0; current_run < nof_inputs + nofRuns; current_run++) {
+        fuzz_input_t *input = &corpus[current_run < nof_inputs ? current_run : fuzz_random(nof_inputs)];
+        memcpy(current, input->data, input->len);
+        current_len = input->len;
+        if (current_run >= nof_inputs) {
+            fuzz_mutate();
+        }
+        
+        // A copy of exactly the input size, so that the sanitizers see reads behind the end.
+        uint8_t *data = malloc(current_len ? current_len : 1);
+        memcpy(data, current, current_len);
+        LLVMFuzzerTestOneInput(data, current_len);
+        free(data);
+    }
+    
+    printf("fuzz: %d corpus inputs and %lu mutations (seed %llu) done\n", nof_inputs, nofRuns, seed);
+    return 0;
+}
@@ -0,0 +1,114 @@
+//
+//  fuzz_metadata.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  Fuzz target for the metadata parsers of the iap_metadata module, as used
+//  by the metadata body callback of the iap_https module: the text parser
+//  (iap_metadata_parser_feed) and the CBOR decoder, plus the signed version
+//  announcement.
+//
+//  Input: <split> <metadata>
+//    split: size of the parts fed to the text parser (1..64)
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+
+#include "iap_metadata.h"
+#include "fuzz.h"
+
+
+#define FUZZ_CHECK(condition) do { if (!(condition)) abort(); } while (0)
+
+// The public key of the test server (see test_server.c), so that signed
+// metadata gets as far as the signature verification.
+static const char *fuzz_public_key_pem =
+    "-----BEGIN PUBLIC KEY-----\n"
+    "MFkwEwYHKoZIzj0CAQYIKoZIzj0DAQcDQgAEy8OhMDyuMod9OYKxfERw0fKa812G\n"
+    "zr4KaZlZ0hFxSiMIGmEA/awnHwzgiNALsDpDWRFUgp98YQqUvRqB6RJ69Q==\n"
+    "-----END PUBLIC KEY-----\n";
+
+
+static void fuzz_check_metadata(const iap_metadata_t *metadata)
+{
+    FUZZ_CHECK(memchr(metadata->file, 0x00, sizeof(metadata->file)));
+    FUZZ_CHECK(memchr(metadata->rollout_salt, 0x00, sizeof(metadata->rollout_salt)));
+    FUZZ_CHECK(metadata->signature_len <= sizeof(metadata->signature));
+    FUZZ_CHECK(metadata->nof_components >= 0 && metadata->nof_components <= IAP_METADATA_MAX_COMPONENTS);
+    for (int i = 0; i < metadata->nof_components; i++) {
+        FUZZ_CHECK(memchr(metadata->components[i].name, 0x00, sizeof(metadata->components[i].name)));
+        FUZZ_CHECK(memchr(metadata->components[i].file, 0x00, sizeof(metadata->components[i].file)));
+        FUZZ_CHECK(memchr(metadata->components[i].partition, 0x00, sizeof(metadata->components[i].partition)));
+    }
+}
+
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size < 1) {
+        return 0;
+    }
+    size_t split = 1 + data[0] % 64;
+    data++;
+    size--;
+    
+    iap_metadata_t metadata;
+    
+    if (size > 0 && iap_metadata_is_cbor(data[0])) {
+        if (size <= IAP_METADATA_MAX_CBOR_LEN) {
+            iap_metadata_decode_cbor(data, size, NULL, &metadata);
+            fuzz_check_metadata(&metadata);
+            iap_metadata_decode_cbor(data, size, fuzz_public_key_pem, &metadata);
+            fuzz_check_metadata(&metadata);
+        }
+    } else {
+        iap_metadata_parser_t parser;
+        iap_metadata_parser_init(&parser, &metadata);
+        for (size_t pos = 0; pos < size; pos += split) {
+            size_t len = size - pos < split ? size - pos : split;
+            iap_metadata_parser_feed(&parser, (const char *)&data[pos], len);
+        }
+        iap_metadata_err_t err = iap_metadata_parser_finish(&parser);
+        FUZZ_CHECK(err != IAP_METADATA_OK || parser.error == IAP_METADATA_OK);
+        fuzz_check_metadata(&metadata);
+        
+        // The same text as a version announcement (e.g. from a DNS TXT record).
+        char *text = malloc(size + 1);
+        memcpy(text, data, size);
+        text[size] = 0x00;
+        int version;
+        int64_t expiry;
+        iap_metadata_decode_announcement(text, fuzz_public_key_pem, &version, &expiry);
+        free(text);
+    }
+    
+    return 0;
+}
@@ -0,0 +1,146 @@
+//
+//  host.h
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  This module lets the updater run on a Linux host: the FreeRTOS, flash,
+//  NVS, heap and Wi-Fi functions it calls are emulated (see include/ and
+//  host_*.c), while the updater, the HTTP client, the TLS transport and
+//  mbedTLS are the real code. The functions below control the emulation.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __HOST__
+#define __HOST__ 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+// Flash.
+
+// Statistics of the emulated flash since the last host_flash_reset.
+typedef struct host_flash_stats_ {
+    uint32_t bytes_written;
+    uint32_t bytes_erased;
+    uint32_t nof_writes;
+    uint32_t nof_erases;
+    
+    // Time the emulated flash operations took (see host_flash_set_timing), in microseconds.
+    uint64_t busy_us;
+} host_flash_stats_t;
+
+// Erases the whole flash (all bytes 0xff), except the running factory image,
+// which is filled with a dummy image, and resets the boot partition and the statistics.
+void host_flash_reset();
+
+// With timing enabled, erase and write operations take as long as on a typical
+// ESP32 module (sector erase 20 ms, 64 KB block erase 120 ms, 1.5 us per byte written).
+// Disabled by default.
+void host_flash_set_timing(int enabled);
+
+void host_flash_get_stats(host_flash_stats_t *stats);
+
+// Direct access to the flash contents, e.g. to compare an installed image.
+const uint8_t *host_flash_get_contents(uint32_t address);
+
+// Copy-on-write flash for simulations of many devices (see fleet.c).
+// host_flash_freeze keeps the current contents as a read-only template and
+// switches to a private copy of it. host_flash_clone switches to a new private
+// copy, e.g. one per device; the previous one isn't released. A copy only
+// allocates the pages which are written, and erasing a page which is erased in
+// the template releases it again. Both return 0 on success.
+int host_flash_freeze();
+int host_flash_clone();
+
+
+// NVS.
+
+// Forgets all keys of all namespaces.
+void host_nvs_reset();
+
+
+// Heap.
+
+// Size of the emulated internal RAM, reported by esp_get_free_heap_size and
+// heap_caps_get_free_size. Defaults to 300 KB (or HOST_HEAP_SIZE from the environment).
+void host_heap_set_size(size_t size);
+
+// Current and peak number of bytes allocated with malloc (including the task
+// stacks, which are accounted as on the target).
+size_t host_heap_get_used();
+size_t host_heap_get_peak();
+
+// Sets the peak to the current use.
+void host_heap_reset_peak();
+
+
+// Wi-Fi.
+
+// Connectivity as seen by wifi_sta.h, initially disconnected.
+void host_wifi_sta_set_connected(int connected);
+void host_wifi_sta_set_dns_ready(int dnsReady);
+
+// IPv4 address of the DNS server (network byte order) returned by dns_getserver.
+void host_wifi_sta_set_dns_server(uint32_t address);
+
+// Sets the MAC address returned by esp_wifi_get_mac.
+void host_wifi_set_mac(const uint8_t mac[6]);
+
+
+// Cooperative tasks (host_fiber.c, instead of host_freertos.c).
+
+// Called before a task or a timer callback of another owner runs, e.g. to
+// switch to the state of another simulated device. Tasks and timers belong to
+// the owner which was set when they were created.
+typedef void (*host_fiber_switch_handler_t)(void *owner);
+void host_fiber_set_switch_handler(host_fiber_switch_handler_t handler);
+
+// Switches to 'owner' (calling the handler if it changes). NULL initially.
+void host_fiber_set_owner(void *owner);
+
+// Runs the tasks and timers until the virtual clock reaches 'untilUs'. Call it
+// from the main thread, not from a task. The owner is undefined afterwards.
+void host_fiber_run(int64_t untilUs);
+
+// Virtual time since the first call, in microseconds (the ticks follow it).
+int64_t host_fiber_now_us();
+
+typedef struct host_fiber_stats_ {
+    uint32_t nof_tasks;
+    uint64_t nof_task_switches;
+    uint64_t nof_owner_switches;
+    uint64_t nof_timer_callbacks;
+    
+    // Number of times the clock skipped ahead because all tasks were idle, and the time skipped.
+    uint64_t nof_skips;
+    int64_t skipped_us;
+    
+    // Tasks waiting for a socket at the moment.
+    int nof_io_waiters;
+} host_fiber_stats_t;
+
+void host_fiber_get_stats(host_fiber_stats_t *stats);
+
+
+#endif // __HOST__
@@ -0,0 +1,135 @@
+//
+//  host_esp.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  This module implements the ESP-IDF logging, timer and system functions
+//  used by the updater on the host.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "esp_log.h"
+
+#include "host.h"
+
+
+#define TAG "host_esp"
+
+esp_log_level_t host_log_level = ESP_LOG_WARN;
+
+static uint8_t wifi_sta_mac[6] = { 0x24, 0x0a, 0xc4, 0x00, 0x00, 0x01 };
+static uint64_t random_state;
+
+
+__attribute__((constructor))
+static void host_esp_init()
+{
+    const char *level = getenv("HOST_LOG_LEVEL");
+    if (level) {
+        host_log_level = atoi(level);
+    }
+    
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const char *seed = getenv("HOST_RANDOM_SEED");
+    random_state = seed ? strtoull(seed, NULL, 0) : (uint64_t)now.tv_nsec ^ ((uint64_t)getpid() << 32);
+    random_state |= 1;
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    // The level is global on the host.
+    host_log_level = level;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    static const char letters[] = "NEWIDV";
+    char line[512];
+    
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    
+    // One write per line, so that lines of different tasks don't mix.
+    fprintf(stderr, "%c (%u) %s: %s\n", letters[level], (unsigned)(xTaskGetTickCount() * portTICK_PERIOD_MS), tag, line);
+}
+
+int64_t esp_timer_get_time()
+{
+    static struct timespec start;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (start.tv_sec == 0 && start.tv_nsec == 0) {
+        start = now;
+    }
+    return (int64_t)(now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000;
+}
+
+uint32_t esp_random()
+{
+    // xorshift64*, seeded per process (HOST_RANDOM_SEED makes runs repeatable).
+    uint64_t x = __atomic_load_n(&random_state, __ATOMIC_RELAXED);
+    uint64_t next;
+    do {
+        next = x;
+        next ^= next >> 12;
+        next ^= next << 25;
+        next ^= next >> 27;
+    } while (!__atomic_compare_exchange_n(&random_state, &x, next, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return (uint32_t)((next * 0x2545f4914f6cdd1dull) >> 32);
+}
+
+void esp_restart()
+{
+    ESP_LOGW(TAG, "esp_restart: terminating the process");
+    fflush(stderr);
+    exit(0);
+}
+
+esp_err_t esp_wifi_get_mac(esp_interface_t ifx, uint8_t mac[6])
+{
+    if (ifx != ESP_IF_WIFI_STA) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(mac, wifi_sta_mac, sizeof(wifi_sta_mac));
+    return ESP_OK;
+}
+
+void host_wifi_set_mac(const uint8_t mac[6])
+{
+    memcpy(wifi_sta_mac, mac, sizeof(wifi_sta_mac));
+}
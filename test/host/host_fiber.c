@@ -0,0 +1,1035 @@
+//
+//  host_fiber.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  This module implements the FreeRTOS functions used by the updater with
+//  cooperative tasks on a single thread, for the fleet simulator (fleet.c),
+//  instead of host_freertos.c. A task runs until it blocks. Sockets which a
+//  task connects are non-blocking, and their reads and writes wait on one
+//  epoll instance, so thousands of devices share an event loop. The ticks
+//  follow a virtual clock: it runs with the real time while a task waits for
+//  the network, and skips ahead to the next timeout when all tasks are idle.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/event_groups.h"
+#include "freertos/timers.h"
+#include "esp_log.h"
+
+#include "host.h"
+
+
+#define TAG "host_fiber"
+
+// Like host_freertos.c, but the stacks are only touched as far as they are used.
+#define HOST_STACK_FACTOR 4
+#define HOST_STACK_MIN_SIZE (256 * 1024)
+#define HOST_STACK_GUARD_SIZE 4096
+
+#define HOST_FIBER_MAX_EVENTS 256
+#define HOST_FIBER_FOREVER INT64_MAX
+
+// Accounts task stacks on the emulated heap (see host_heap.c).
+void host_heap_account(long delta);
+
+
+// A task or a timer in the heap of timeouts.
+typedef struct host_timeout_ {
+    int64_t due_us;
+    int index;                          // position in the heap, -1 if not queued
+    struct host_task_ *task;            // either the task...
+    struct host_timer_ *timer;          // ...or the timer
+} host_timeout_t;
+
+// The tasks waiting for a queue or an event group to change.
+typedef struct host_wait_list_ {
+    struct host_task_ *first;
+} host_wait_list_t;
+
+struct host_task_ {
+    TaskFunction_t function;
+    void *parameter;
+    void *owner;
+    ucontext_t context;
+    uint8_t *stack;                     // the guard page, followed by the stack
+    size_t stack_size;
+    uint32_t requested_stack_size;
+    
+    host_timeout_t timeout;
+    int has_timed_out;
+    host_wait_list_t *wait_list;
+    struct host_task_ *prev_waiter;
+    struct host_task_ *next_waiter;
+    struct pollfd *io_fds;              // while waiting for sockets
+    int nof_io_fds;
+    struct host_task_ *next_ready;
+    int is_ready;
+    int is_deleted;
+};
+
+struct host_queue_ {
+    host_wait_list_t waiters;
+    uint8_t *items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+struct host_event_group_ {
+    host_wait_list_t waiters;
+    EventBits_t bits;
+};
+
+struct host_timer_ {
+    TimerCallbackFunction_t callback;
+    void *timer_id;
+    void *owner;
+    TickType_t period;
+    int auto_reload;
+    int is_in_callback;
+    int is_deleted;
+    host_timeout_t timeout;
+};
+
+static int64_t start_us;
+static int64_t skipped_us;
+static int epoll_fd = -1;
+static ucontext_t scheduler_context;
+static struct host_task_ *current_task;
+static void *current_owner;
+static host_fiber_switch_handler_t switch_handler;
+
+static struct host_task_ *ready_first;
+static struct host_task_ *ready_last;
+static int nof_io_waiters;
+
+static host_timeout_t **timeouts;
+static int nof_timeouts;
+static int timeouts_capacity;
+
+static host_fiber_stats_t fiber_stats;
+
+
+static int64_t host_fiber_real_us();
+static int64_t host_fiber_deadline(TickType_t ticks);
+static void host_fiber_task_main();
+static void host_fiber_block();
+static void host_fiber_make_ready(struct host_task_ *task);
+static void host_fiber_run_task(struct host_task_ *task);
+static int host_fiber_wait(host_wait_list_t *list, int64_t deadlineUs);
+static void host_fiber_wake_all(host_wait_list_t *list);
+static void host_fiber_unlink_waiter(struct host_task_ *task);
+static int host_fiber_wait_io(struct pollfd *fds, int nfds, int64_t deadlineUs);
+static void host_fiber_end_io_wait(struct host_task_ *task);
+static int host_fiber_dispatch_io(int timeoutMs);
+static void host_fiber_expire(int64_t now);
+static void host_fiber_timer_start(struct host_timer_ *timer);
+static void host_fiber_timeout_add(host_timeout_t *timeout, int64_t dueUs);
+static void host_fiber_timeout_remove(host_timeout_t *timeout);
+static void host_fiber_timeout_sift_up(int index);
+static void host_fiber_timeout_sift_down(int index);
+static BaseType_t host_fiber_queue_send(QueueHandle_t queue, const void *item, TickType_t ticksToWait, int toFront);
+static BaseType_t host_fiber_queue_receive(QueueHandle_t queue, void *item, TickType_t ticksToWait, int remove);
+
+
+// --- Scheduler ---
+
+void host_fiber_set_switch_handler(host_fiber_switch_handler_t handler)
+{
+    switch_handler = handler;
+}
+
+void host_fiber_set_owner(void *owner)
+{
+    if (owner != current_owner) {
+        if (switch_handler) {
+            switch_handler(owner);
+        }
+        current_owner = owner;
+        fiber_stats.nof_owner_switches++;
+    }
+}
+
+int64_t host_fiber_now_us()
+{
+    if (!start_us) {
+        start_us = host_fiber_real_us();
+    }
+    return host_fiber_real_us() - start_us + skipped_us;
+}
+
+void host_fiber_run(int64_t untilUs)
+{
+    if (current_task) {
+        ESP_LOGE(TAG, "host_fiber_run: called from a task");
+        abort();
+    }
+    
+    for (;;) {
+        host_fiber_dispatch_io(0);
+        host_fiber_expire(host_fiber_now_us());
+    
+        // Each task which is ready runs until it blocks; the ones it wakes run in the next round.
+        if (ready_first) {
+            struct host_task_ *task = ready_first;
+            ready_first = NULL;
+            ready_last = NULL;
+            while (task) {
+                struct host_task_ *next = task->next_ready;
+                task->next_ready = NULL;
+                task->is_ready = 0;
+                host_fiber_run_task(task);
+                task = next;
+            }
+            continue;
+        }
+    
+        int64_t now = host_fiber_now_us();
+        if (now >= untilUs) {
+            return;
+        }
+        int64_t next = nof_timeouts > 0 && timeouts[0]->due_us < untilUs ? timeouts[0]->due_us : untilUs;
+        if (next <= now) {
+            continue;
+        }
+    
+        if (nof_io_waiters > 0) {
+            // The network (i.e. the server) sets the pace.
+            int64_t waitUs = next - now;
+            host_fiber_dispatch_io(waitUs > 1000000000ll ? 1000000 : (int)((waitUs + 999) / 1000));
+        } else {
+            // Nothing can happen until the next timeout.
+            skipped_us += next - now;
+            fiber_stats.skipped_us = skipped_us;
+            fiber_stats.nof_skips++;
+        }
+    }
+}
+
+void host_fiber_get_stats(host_fiber_stats_t *stats)
+{
+    *stats = fiber_stats;
+    stats->nof_io_waiters = nof_io_waiters;
+}
+
+static int64_t host_fiber_real_us()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int64_t host_fiber_deadline(TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY) {
+        return HOST_FIBER_FOREVER;
+    }
+    return host_fiber_now_us() + (int64_t)ticks * portTICK_PERIOD_MS * 1000;
+}
+
+static void host_fiber_task_main()
+{
+    current_task->function(current_task->parameter);
+    
+    // FreeRTOS tasks must not return.
+    ESP_LOGE(TAG, "task returned from its function");
+    abort();
+}
+
+// Switches from the current task to the scheduler, until the task is ready again.
+static void host_fiber_block()
+{
+    struct host_task_ *task = current_task;
+    swapcontext(&task->context, &scheduler_context);
+}
+
+static void host_fiber_make_ready(struct host_task_ *task)
+{
+    if (task->is_ready) {
+        return;
+    }
+    task->is_ready = 1;
+    task->next_ready = NULL;
+    if (ready_last) {
+        ready_last->next_ready = task;
+    } else {
+        ready_first = task;
+    }
+    ready_last = task;
+}
+
+static void host_fiber_run_task(struct host_task_ *task)
+{
+    host_fiber_set_owner(task->owner);
+    current_task = task;
+    fiber_stats.nof_task_switches++;
+    swapcontext(&scheduler_context, &task->context);
+    current_task = NULL;
+    
+    // A task which deleted itself can't release the stack it was running on.
+    if (task->is_deleted) {
+        munmap(task->stack, task->stack_size + HOST_STACK_GUARD_SIZE);
+        free(task);
+    }
+}
+
+// Blocks the current task until the list is woken or the deadline has passed.
+// Returns 1 if woken, 0 on timeout. Outside of a task (e.g. in a timer callback), returns 0 at once.
+static int host_fiber_wait(host_wait_list_t *list, int64_t deadlineUs)
+{
+    struct host_task_ *task = current_task;
+    if (!task || deadlineUs <= host_fiber_now_us()) {
+        return 0;
+    }
+    
+    task->wait_list = list;
+    task->prev_waiter = NULL;
+    task->next_waiter = list->first;
+    if (list->first) {
+        list->first->prev_waiter = task;
+    }
+    list->first = task;
+    
+    task->has_timed_out = 0;
+    if (deadlineUs != HOST_FIBER_FOREVER) {
+        host_fiber_timeout_add(&task->timeout, deadlineUs);
+    }
+    host_fiber_block();
+    return !task->has_timed_out;
+}
+
+// Like a condition variable: the woken tasks check their condition again.
+static void host_fiber_wake_all(host_wait_list_t *list)
+{
+    while (list->first) {
+        struct host_task_ *task = list->first;
+        host_fiber_unlink_waiter(task);
+        host_fiber_timeout_remove(&task->timeout);
+        host_fiber_make_ready(task);
+    }
+}
+
+static void host_fiber_unlink_waiter(struct host_task_ *task)
+{
+    host_wait_list_t *list = task->wait_list;
+    if (!list) {
+        return;
+    }
+    if (task->prev_waiter) {
+        task->prev_waiter->next_waiter = task->next_waiter;
+    } else {
+        list->first = task->next_waiter;
+    }
+    if (task->next_waiter) {
+        task->next_waiter->prev_waiter = task->prev_waiter;
+    }
+    task->wait_list = NULL;
+    task->prev_waiter = NULL;
+    task->next_waiter = NULL;
+}
+
+// Blocks the current task until one of the sockets is ready (revents are set) or the
+// deadline has passed. Returns 1 if ready, 0 on timeout, -1 if the sockets can't be waited for.
+static int host_fiber_wait_io(struct pollfd *fds, int nfds, int64_t deadlineUs)
+{
+    struct host_task_ *task = current_task;
+    if (deadlineUs <= host_fiber_now_us()) {
+        return 0;
+    }
+    if (epoll_fd < 0) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            return -1;
+        }
+    }
+    
+    for (int i = 0; i < nfds; i++) {
+        fds[i].revents = 0;
+        struct epoll_event event = { .events = fds[i].events, .data.ptr = task };
+        if (fds[i].fd >= 0 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[i].fd, &event) != 0) {
+            int error = errno;
+            for (int j = 0; j < i; j++) {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fds[j].fd, NULL);
+            }
+            errno = error;
+            return -1;
+        }
+    }
+    task->io_fds = fds;
+    task->nof_io_fds = nfds;
+    nof_io_waiters++;
+    
+    task->has_timed_out = 0;
+    if (deadlineUs != HOST_FIBER_FOREVER) {
+        host_fiber_timeout_add(&task->timeout, deadlineUs);
+    }
+    host_fiber_block();
+    return !task->has_timed_out;
+}
+
+static void host_fiber_end_io_wait(struct host_task_ *task)
+{
+    for (int i = 0; i < task->nof_io_fds; i++) {
+        if (task->io_fds[i].fd >= 0) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, task->io_fds[i].fd, NULL);
+        }
+    }
+    task->io_fds = NULL;
+    task->nof_io_fds = 0;
+    nof_io_waiters--;
+}
+
+// Makes the tasks whose sockets are ready runnable, waiting up to timeoutMs for the first.
+static int host_fiber_dispatch_io(int timeoutMs)
+{
+    if (nof_io_waiters == 0) {
+        return 0;
+    }
+    
+    struct epoll_event events[HOST_FIBER_MAX_EVENTS];
+    int n = epoll_wait(epoll_fd, events, HOST_FIBER_MAX_EVENTS, timeoutMs);
+    for (int i = 0; i < n; i++) {
+        struct host_task_ *task = events[i].data.ptr;
+        if (!task->io_fds) {
+            // Another socket of the task has already woken it.
+            continue;
+        }
+        struct timespec now = { 0, 0 };
+        ppoll(task->io_fds, task->nof_io_fds, &now, NULL);
+        host_fiber_end_io_wait(task);
+        host_fiber_timeout_remove(&task->timeout);
+        host_fiber_make_ready(task);
+    }
+    return n;
+}
+
+// Handles the timeouts which are due: tasks become ready, timers call their callback.
+static void host_fiber_expire(int64_t now)
+{
+    while (nof_timeouts > 0 && timeouts[0]->due_us <= now) {
+        host_timeout_t *timeout = timeouts[0];
+        host_fiber_timeout_remove(timeout);
+    
+        if (timeout->task) {
+            struct host_task_ *task = timeout->task;
+            task->has_timed_out = 1;
+            host_fiber_unlink_waiter(task);
+            if (task->io_fds) {
+                host_fiber_end_io_wait(task);
+            }
+            host_fiber_make_ready(task);
+            continue;
+        }
+    
+        // Timer callbacks run in the scheduler, like in the timer service task they must not block.
+        struct host_timer_ *timer = timeout->timer;
+        if (timer->auto_reload) {
+            host_fiber_timeout_add(&timer->timeout, timeout->due_us + (int64_t)timer->period * portTICK_PERIOD_MS * 1000);
+        }
+        host_fiber_set_owner(timer->owner);
+        timer->is_in_callback = 1;
+        timer->callback(timer);
+        timer->is_in_callback = 0;
+        if (timer->is_deleted) {
+            free(timer);
+        }
+        fiber_stats.nof_timer_callbacks++;
+    }
+}
+
+
+// --- Heap of timeouts (earliest first) ---
+
+static void host_fiber_timeout_add(host_timeout_t *timeout, int64_t dueUs)
+{
+    host_fiber_timeout_remove(timeout);
+    if (nof_timeouts == timeouts_capacity) {
+        int capacity = timeouts_capacity ? 2 * timeouts_capacity : 1024;
+        host_timeout_t **grown = realloc(timeouts, capacity * sizeof(host_timeout_t *));
+        if (!grown) {
+            ESP_LOGE(TAG, "host_fiber_timeout_add: out of memory");
+            abort();
+        }
+        timeouts = grown;
+        timeouts_capacity = capacity;
+    }
+    timeout->due_us = dueUs;
+    timeout->index = nof_timeouts;
+    timeouts[nof_timeouts++] = timeout;
+    host_fiber_timeout_sift_up(timeout->index);
+}
+
+static void host_fiber_timeout_remove(host_timeout_t *timeout)
+{
+    int index = timeout->index;
+    if (index < 0) {
+        return;
+    }
+    timeout->index = -1;
+    nof_timeouts--;
+    if (index == nof_timeouts) {
+        return;
+    }
+    timeouts[index] = timeouts[nof_timeouts];
+    timeouts[index]->index = index;
+    host_fiber_timeout_sift_up(index);
+    host_fiber_timeout_sift_down(timeouts[index]->index);
+}
+
+static void host_fiber_timeout_sift_up(int index)
+{
+    host_timeout_t *timeout = timeouts[index];
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (timeouts[parent]->due_us <= timeout->due_us) {
+            break;
+        }
+        timeouts[index] = timeouts[parent];
+        timeouts[index]->index = index;
+        index = parent;
+    }
+    timeouts[index] = timeout;
+    timeout->index = index;
+}
+
+static void host_fiber_timeout_sift_down(int index)
+{
+    host_timeout_t *timeout = timeouts[index];
+    for (;;) {
+        int child = 2 * index + 1;
+        if (child >= nof_timeouts) {
+            break;
+        }
+        if (child + 1 < nof_timeouts && timeouts[child + 1]->due_us < timeouts[child]->due_us) {
+            child++;
+        }
+        if (timeout->due_us <= timeouts[child]->due_us) {
+            break;
+        }
+        timeouts[index] = timeouts[child];
+        timeouts[index]->index = index;
+        index = child;
+    }
+    timeouts[index] = timeout;
+    timeout->index = index;
+}
+
+
+// --- Tasks ---
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stackDepth,
+                                   void *parameter, UBaseType_t priority, TaskHandle_t *handle, BaseType_t coreId)
+{
+    struct host_task_ *task = calloc(1, sizeof(struct host_task_));
+    if (!task) {
+        return pdFAIL;
+    }
+    
+    task->function = function;
+    task->parameter = parameter;
+    task->owner = current_owner;
+    task->timeout.index = -1;
+    task->timeout.task = task;
+    task->requested_stack_size = stackDepth;
+    task->stack_size = stackDepth * HOST_STACK_FACTOR;
+    if (task->stack_size < HOST_STACK_MIN_SIZE) {
+        task->stack_size = HOST_STACK_MIN_SIZE;
+    }
+    
+    // Pages are only allocated when the task touches them, which keeps thousands of tasks small.
+    task->stack = mmap(NULL, task->stack_size + HOST_STACK_GUARD_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (task->stack == MAP_FAILED) {
+        ESP_LOGE(TAG, "xTaskCreate: failed to map the stack of task '%s' (%d)", name, errno);
+        free(task);
+        return pdFAIL;
+    }
+    mprotect(task->stack, HOST_STACK_GUARD_SIZE, PROT_NONE);
+    host_heap_account(stackDepth);
+    
+    getcontext(&task->context);
+    task->context.uc_stack.ss_sp = task->stack + HOST_STACK_GUARD_SIZE;
+    task->context.uc_stack.ss_size = task->stack_size;
+    task->context.uc_link = NULL;
+    makecontext(&task->context, host_fiber_task_main, 0);
+    
+    fiber_stats.nof_tasks++;
+    host_fiber_make_ready(task);
+    if (handle) {
+        *handle = task;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stackDepth,
+                       void *parameter, UBaseType_t priority, TaskHandle_t *handle)
+{
+    return xTaskCreatePinnedToCore(function, name, stackDepth, parameter, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    // Only tasks deleting themselves are supported; the scheduler releases the stack.
+    if ((task && task != current_task) || !current_task) {
+        ESP_LOGE(TAG, "vTaskDelete: deleting other tasks isn't supported");
+        abort();
+    }
+    host_heap_account(-(long)current_task->requested_stack_size);
+    current_task->is_deleted = 1;
+    fiber_stats.nof_tasks--;
+    host_fiber_block();
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    static host_wait_list_t sleepers;
+    
+    if (!current_task) {
+        return;
+    }
+    if (ticks == 0) {
+        // Let the other ready tasks run first.
+        host_fiber_make_ready(current_task);
+        host_fiber_block();
+        return;
+    }
+    int64_t deadline = host_fiber_deadline(ticks);
+    while (host_fiber_wait(&sleepers, deadline)) {
+    }
+}
+
+TickType_t xTaskGetTickCount()
+{
+    return (TickType_t)(host_fiber_now_us() / (1000 * portTICK_PERIOD_MS));
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    if (!task) {
+        task = current_task;
+        if (!task) {
+            return 0;
+        }
+    }
+    
+    // The stack grows downwards: the lowest resident page is the deepest one used.
+    uint8_t *stack = task->stack + HOST_STACK_GUARD_SIZE;
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t nofPages = task->stack_size / pageSize;
+    unsigned char *resident = malloc(nofPages);
+    if (!resident || mincore(stack, task->stack_size, resident) != 0) {
+        free(resident);
+        return 0;
+    }
+    size_t page = 0;
+    while (page < nofPages && !(resident[page] & 1)) {
+        page++;
+    }
+    free(resident);
+    size_t used = task->stack_size - page * pageSize;
+    return used < task->requested_stack_size ? task->requested_stack_size - used : 0;
+}
+
+
+// --- Queues ---
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    struct host_queue_ *queue = calloc(1, sizeof(struct host_queue_));
+    if (!queue) {
+        return NULL;
+    }
+    queue->items = malloc(length * itemSize + 1);
+    if (!queue->items) {
+        free(queue);
+        return NULL;
+    }
+    queue->length = length;
+    queue->item_size = itemSize;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    free(queue->items);
+    free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait)
+{
+    return host_fiber_queue_send(queue, item, ticksToWait, 0);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticksToWait)
+{
+    return host_fiber_queue_send(queue, item, ticksToWait, 1);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticksToWait)
+{
+    return host_fiber_queue_receive(queue, item, ticksToWait, 1);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t ticksToWait)
+{
+    return host_fiber_queue_receive(queue, item, ticksToWait, 0);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    return queue->count;
+}
+
+static BaseType_t host_fiber_queue_send(QueueHandle_t queue, const void *item, TickType_t ticksToWait, int toFront)
+{
+    int64_t deadline = host_fiber_deadline(ticksToWait);
+    while (queue->count == queue->length) {
+        if (!host_fiber_wait(&queue->waiters, deadline)) {
+            return pdFAIL;
+        }
+    }
+    
+    UBaseType_t index;
+    if (toFront) {
+        queue->head = (queue->head + queue->length - 1) % queue->length;
+        index = queue->head;
+    } else {
+        index = (queue->head + queue->count) % queue->length;
+    }
+    memcpy(queue->items + index * queue->item_size, item, queue->item_size);
+    queue->count++;
+    host_fiber_wake_all(&queue->waiters);
+    return pdTRUE;
+}
+
+static BaseType_t host_fiber_queue_receive(QueueHandle_t queue, void *item, TickType_t ticksToWait, int remove)
+{
+    int64_t deadline = host_fiber_deadline(ticksToWait);
+    while (queue->count == 0) {
+        if (!host_fiber_wait(&queue->waiters, deadline)) {
+            return pdFALSE;
+        }
+    }
+    
+    memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+    if (remove) {
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        host_fiber_wake_all(&queue->waiters);
+    }
+    return pdTRUE;
+}
+
+
+// --- Event groups ---
+
+EventGroupHandle_t xEventGroupCreate()
+{
+    return calloc(1, sizeof(struct host_event_group_));
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    group->bits |= bits;
+    host_fiber_wake_all(&group->waiters);
+    return group->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    EventBits_t previous = group->bits;
+    group->bits &= ~bits;
+    return previous;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    return group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clearOnExit,
+                                BaseType_t waitForAll, TickType_t ticksToWait)
+{
+    int64_t deadline = host_fiber_deadline(ticksToWait);
+    for (;;) {
+        EventBits_t value = group->bits;
+        int isSet = waitForAll ? (value & bits) == bits : (value & bits) != 0;
+        if (isSet) {
+            if (clearOnExit) {
+                group->bits &= ~bits;
+            }
+            return value;
+        }
+        if (!host_fiber_wait(&group->waiters, deadline)) {
+            return value;
+        }
+    }
+}
+
+
+// --- Timers ---
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t autoReload,
+                           void *timerId, TimerCallbackFunction_t callback)
+{
+    struct host_timer_ *timer = calloc(1, sizeof(struct host_timer_));
+    if (!timer) {
+        return NULL;
+    }
+    timer->callback = callback;
+    timer->timer_id = timerId;
+    timer->owner = current_owner;
+    timer->period = period;
+    timer->auto_reload = autoReload;
+    timer->timeout.index = -1;
+    timer->timeout.timer = timer;
+    return timer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticksToWait)
+{
+    return xTimerReset(timer, ticksToWait);
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticksToWait)
+{
+    host_fiber_timeout_remove(&timer->timeout);
+    return pdPASS;
+}
+
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t ticksToWait)
+{
+    host_fiber_timer_start(timer);
+    return pdPASS;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticksToWait)
+{
+    // Like in FreeRTOS, changing the period also starts a dormant timer.
+    timer->period = period;
+    host_fiber_timer_start(timer);
+    return pdPASS;
+}
+
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t ticksToWait)
+{
+    // A timer deleted by its own callback is released after the callback.
+    host_fiber_timeout_remove(&timer->timeout);
+    if (timer->is_in_callback) {
+        timer->is_deleted = 1;
+    } else {
+        free(timer);
+    }
+    return pdPASS;
+}
+
+static void host_fiber_timer_start(struct host_timer_ *timer)
+{
+    host_fiber_timeout_add(&timer->timeout, host_fiber_now_us() + (int64_t)timer->period * portTICK_PERIOD_MS * 1000);
+}
+
+
+// --- Sockets ---
+//
+// Outside of a task, the functions behave as usual. In a task, connect makes the
+// socket non-blocking (and sets TCP_NODELAY), and the task waits for its sockets
+// in the event loop.
+
+int connect(int fd, const struct sockaddr *addr, socklen_t addrLen)
+{
+    if (!current_task) {
+        return syscall(SYS_connect, fd, addr, addrLen);
+    }
+    
+    // On the loopback interface, Nagle's algorithm and the delayed acknowledgements of
+    // the server stall each handshake for 40 ms, in real time the clock can't skip.
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        return -1;
+    }
+    if (syscall(SYS_connect, fd, addr, addrLen) == 0) {
+        return 0;
+    }
+    if (errno != EINPROGRESS) {
+        return -1;
+    }
+    
+    struct pollfd pfd = { fd, POLLOUT, 0 };
+    if (host_fiber_wait_io(&pfd, 1, HOST_FIBER_FOREVER) < 0) {
+        return -1;
+    }
+    int error = 0;
+    socklen_t errorLen = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &errorLen) != 0) {
+        return -1;
+    }
+    if (error) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+ssize_t read(int fd, void *buf, size_t len)
+{
+    for (;;) {
+        ssize_t n = syscall(SYS_read, fd, buf, len);
+        if (n >= 0 || !current_task || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            return n;
+        }
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (host_fiber_wait_io(&pfd, 1, HOST_FIBER_FOREVER) < 0) {
+            return -1;
+        }
+    }
+}
+
+ssize_t write(int fd, const void *buf, size_t len)
+{
+    for (;;) {
+        ssize_t n = syscall(SYS_write, fd, buf, len);
+        if (n >= 0 || !current_task || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            return n;
+        }
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        if (host_fiber_wait_io(&pfd, 1, HOST_FIBER_FOREVER) < 0) {
+            return -1;
+        }
+    }
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeoutMs)
+{
+    if (!current_task) {
+        struct timespec timeout = { timeoutMs / 1000, (timeoutMs % 1000) * 1000000 };
+        return ppoll(fds, nfds, timeoutMs >= 0 ? &timeout : NULL, NULL);
+    }
+    
+    struct timespec now = { 0, 0 };
+    int n = ppoll(fds, nfds, &now, NULL);
+    if (n != 0 || timeoutMs == 0) {
+        return n;
+    }
+    
+    int64_t deadline = timeoutMs < 0 ? HOST_FIBER_FOREVER : host_fiber_now_us() + (int64_t)timeoutMs * 1000;
+    int result = host_fiber_wait_io(fds, nfds, deadline);
+    if (result <= 0) {
+        return result;
+    }
+    n = 0;
+    for (nfds_t i = 0; i < nfds; i++) {
+        n += fds[i].revents != 0;
+    }
+    return n;
+}
+
+int select(int nfds, fd_set *readFds, fd_set *writeFds, fd_set *exceptFds, struct timeval *timeout)
+{
+    struct timespec ts;
+    if (timeout) {
+        ts.tv_sec = timeout->tv_sec;
+        ts.tv_nsec = timeout->tv_usec * 1000;
+    }
+    if (!current_task) {
+        return pselect(nfds, readFds, writeFds, exceptFds, timeout ? &ts : NULL, NULL);
+    }
+    
+    // Translated to poll, which waits in the event loop.
+    struct pollfd fds[16];
+    int n = 0;
+    for (int fd = 0; fd < nfds; fd++) {
+        short events = (readFds && FD_ISSET(fd, readFds) ? POLLIN : 0)
+                     | (writeFds && FD_ISSET(fd, writeFds) ? POLLOUT : 0)
+                     | (exceptFds && FD_ISSET(fd, exceptFds) ? POLLPRI : 0);
+        if (!events) {
+            continue;
+        }
+        if (n == sizeof(fds) / sizeof(fds[0])) {
+            errno = EINVAL;
+            return -1;
+        }
+        fds[n].fd = fd;
+        fds[n].events = events;
+        fds[n].revents = 0;
+        n++;
+    }
+    
+    int timeoutMs = timeout ? (int)(timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000) : -1;
+    int result = poll(fds, n, timeoutMs);
+    if (result < 0) {
+        return result;
+    }
+    
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        short revents = fds[i].revents;
+        if (readFds && FD_ISSET(fds[i].fd, readFds)) {
+            if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                count++;
+            } else {
+                FD_CLR(fds[i].fd, readFds);
+            }
+        }
+        if (writeFds && FD_ISSET(fds[i].fd, writeFds)) {
+            if (revents & (POLLOUT | POLLHUP | POLLERR)) {
+                count++;
+            } else {
+                FD_CLR(fds[i].fd, writeFds);
+            }
+        }
+        if (exceptFds && FD_ISSET(fds[i].fd, exceptFds)) {
+            if (revents & POLLPRI) {
+                count++;
+            } else {
+                FD_CLR(fds[i].fd, exceptFds);
+            }
+        }
+    }
+    return count;
+}
@@ -0,0 +1,768 @@
+//
+//  host_flash.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  This module emulates a 4 MB flash with the partition table of
+//  esp_partition.h, the OTA operations on it and the NVS key-value store.
+//  Writes clear bits like NOR flash does, so writing a region which hasn't
+//  been erased corrupts it as it would on the device.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_partition.h"
+#include "esp_ota_ops.h"
+#include "esp_spi_flash.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#include "host.h"
+
+
+#define TAG "host_flash"
+
+#define HOST_FLASH_SIZE (4 * 1024 * 1024)
+#define HOST_FLASH_BLOCK_SIZE 0x10000
+
+// Typical timing of the flash of an ESP32 module.
+#define HOST_FLASH_SECTOR_ERASE_US 20000
+#define HOST_FLASH_BLOCK_ERASE_US 120000
+#define HOST_FLASH_WRITE_NS_PER_BYTE 1500
+
+#define HOST_IMAGE_MAGIC 0xe9
+
+#define HOST_NVS_MAX_NAMESPACES 16
+#define HOST_NVS_MAX_NAME_LEN 15
+
+typedef enum {
+    HOST_NVS_TYPE_U8,
+    HOST_NVS_TYPE_I32,
+    HOST_NVS_TYPE_U32,
+    HOST_NVS_TYPE_BLOB,
+} host_nvs_type_t;
+
+typedef struct host_nvs_entry_ {
+    int ns;
+    char key[HOST_NVS_MAX_NAME_LEN + 1];
+    host_nvs_type_t type;
+    size_t len;
+    uint8_t *value;
+    struct host_nvs_entry_ *next;
+} host_nvs_entry_t;
+
+struct host_partition_iterator_ {
+    int index;
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    const char *label;
+};
+
+static const esp_partition_t partitions[] = {
+    { ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_NVS, 0x009000, 0x004000, "nvs", 0 },
+    { ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_OTA, 0x00d000, 0x002000, "otadata", 0 },
+    { ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_PHY, 0x00f000, 0x001000, "phy_init", 0 },
+    { ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_FACTORY, 0x010000, 0x100000, "factory", 0 },
+    { ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, 0x110000, 0x100000, "ota_0", 0 },
+    { ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, 0x210000, 0x100000, "ota_1", 0 },
+    { ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, 0x310000, 0x070000, "storage_a", 0 },
+    { ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, 0x380000, 0x070000, "storage_b", 0 },
+};
+#define HOST_NOF_PARTITIONS (sizeof(partitions) / sizeof(partitions[0]))
+#define HOST_RUNNING_PARTITION (&partitions[3])
+
+static pthread_mutex_t flash_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t *flash;
+static int is_flash_initialised;
+static int is_timing_enabled;
+static host_flash_stats_t flash_stats;
+static const esp_partition_t *boot_partition;
+
+// The template of the copy-on-write flash (see host_flash_freeze) and which of its sectors are erased.
+static int template_fd = -1;
+static uint8_t *template_erased_sectors;
+
+// The OTA session (one at a time, like the updater uses it).
+static esp_ota_handle_t ota_handle;
+static const esp_partition_t *ota_partition;
+static uint32_t ota_bytes_written;
+
+static pthread_mutex_t nvs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char nvs_namespaces[HOST_NVS_MAX_NAMESPACES][HOST_NVS_MAX_NAME_LEN + 1];
+static int nvs_nof_namespaces;
+static host_nvs_entry_t *nvs_entries;
+
+
+static void host_flash_init_locked();
+static void host_flash_busy(uint64_t us);
+static int host_flash_clone_locked();
+static void host_flash_erase_copy(uint32_t address, uint32_t size);
+static int host_flash_partition_matches(const esp_partition_t *partition, esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label);
+static esp_err_t host_nvs_check_handle(nvs_handle handle, const char *key, int forWriting);
+static host_nvs_entry_t *host_nvs_find(nvs_handle handle, const char *key);
+static esp_err_t host_nvs_set(nvs_handle handle, const char *key, host_nvs_type_t type, const void *value, size_t len);
+static esp_err_t host_nvs_get(nvs_handle handle, const char *key, host_nvs_type_t type, void *outValue, size_t *len);
+
+
+void host_flash_reset()
+{
+    pthread_mutex_lock(&flash_mutex);
+    host_flash_init_locked();
+    pthread_mutex_unlock(&flash_mutex);
+}
+
+void host_flash_set_timing(int enabled)
+{
+    is_timing_enabled = enabled;
+}
+
+void host_flash_get_stats(host_flash_stats_t *stats)
+{
+    pthread_mutex_lock(&flash_mutex);
+    *stats = flash_stats;
+    pthread_mutex_unlock(&flash_mutex);
+}
+
+const uint8_t *host_flash_get_contents(uint32_t address)
+{
+    pthread_mutex_lock(&flash_mutex);
+    host_flash_init_locked();
+    pthread_mutex_unlock(&flash_mutex);
+    return address < HOST_FLASH_SIZE ? &flash[address] : NULL;
+}
+
+int host_flash_freeze()
+{
+    // The copies are private mappings of the template, page by page.
+    if (sysconf(_SC_PAGESIZE) != SPI_FLASH_SEC_SIZE) {
+        return -1;
+    }
+    
+    pthread_mutex_lock(&flash_mutex);
+    host_flash_init_locked();
+    int result = -1;
+    int fd = memfd_create("host_flash", MFD_CLOEXEC);
+    uint8_t *erasedSectors = malloc(HOST_FLASH_SIZE / SPI_FLASH_SEC_SIZE);
+    if (fd >= 0 && erasedSectors && ftruncate(fd, HOST_FLASH_SIZE) == 0 && pwrite(fd, flash, HOST_FLASH_SIZE, 0) == HOST_FLASH_SIZE) {
+        for (uint32_t sector = 0; sector < HOST_FLASH_SIZE / SPI_FLASH_SEC_SIZE; sector++) {
+            const uint8_t *bytes = &flash[sector * SPI_FLASH_SEC_SIZE];
+            uint32_t i = 0;
+            while (i < SPI_FLASH_SEC_SIZE && bytes[i] == 0xff) {
+                i++;
+            }
+            erasedSectors[sector] = i == SPI_FLASH_SEC_SIZE;
+        }
+        uint8_t *initialFlash = flash;
+        template_fd = fd;
+        template_erased_sectors = erasedSectors;
+        result = host_flash_clone_locked();
+        if (result == 0) {
+            munmap(initialFlash, HOST_FLASH_SIZE);
+        } else {
+            flash = initialFlash;
+            template_fd = -1;
+            template_erased_sectors = NULL;
+        }
+    }
+    if (result != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(erasedSectors);
+    }
+    pthread_mutex_unlock(&flash_mutex);
+    return result;
+}
+
+int host_flash_clone()
+{
+    pthread_mutex_lock(&flash_mutex);
+    int result = template_fd >= 0 ? host_flash_clone_locked() : -1;
+    pthread_mutex_unlock(&flash_mutex);
+    return result;
+}
+
+esp_partition_iterator_t esp_partition_find(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+    struct host_partition_iterator_ it = { -1, type, subtype, label };
+    return esp_partition_next(&it) ? memcpy(malloc(sizeof(it)), &it, sizeof(it)) : NULL;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+    for (int i = 0; i < HOST_NOF_PARTITIONS; i++) {
+        if (host_flash_partition_matches(&partitions[i], type, subtype, label)) {
+            return &partitions[i];
+        }
+    }
+    return NULL;
+}
+
+const esp_partition_t *esp_partition_get(esp_partition_iterator_t iterator)
+{
+    return &partitions[iterator->index];
+}
+
+esp_partition_iterator_t esp_partition_next(esp_partition_iterator_t iterator)
+{
+    // Like ESP-IDF, the iterator is released at the end.
+    for (int i = iterator->index + 1; i < HOST_NOF_PARTITIONS; i++) {
+        if (host_flash_partition_matches(&partitions[i], iterator->type, iterator->subtype, iterator->label)) {
+            iterator->index = i;
+            return iterator;
+        }
+    }
+    if (iterator->index >= 0) {
+        free(iterator);
+    }
+    return NULL;
+}
+
+void esp_partition_iterator_release(esp_partition_iterator_t iterator)
+{
+    free(iterator);
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t srcOffset, void *dst, size_t size)
+{
+    if (srcOffset > partition->size || size > partition->size - srcOffset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    pthread_mutex_lock(&flash_mutex);
+    host_flash_init_locked();
+    memcpy(dst, &flash[partition->address + srcOffset], size);
+    pthread_mutex_unlock(&flash_mutex);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dstOffset, const void *src, size_t size)
+{
+    if (dstOffset > partition->size || size > partition->size - dstOffset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    
+    pthread_mutex_lock(&flash_mutex);
+    host_flash_init_locked();
+    uint8_t *dst = &flash[partition->address + dstOffset];
+    for (size_t i = 0; i < size; i++) {
+        dst[i] &= ((const uint8_t *)src)[i];
+    }
+    flash_stats.bytes_written += size;
+    flash_stats.nof_writes++;
+    pthread_mutex_unlock(&flash_mutex);
+    
+    host_flash_busy((uint64_t)size * HOST_FLASH_WRITE_NS_PER_BYTE / 1000);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, uint32_t startAddress, uint32_t size)
+{
+    if (startAddress % SPI_FLASH_SEC_SIZE || size % SPI_FLASH_SEC_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (startAddress > partition->size || size > partition->size - startAddress) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    
+    pthread_mutex_lock(&flash_mutex);
+    host_flash_init_locked();
+    if (template_fd >= 0) {
+        host_flash_erase_copy(partition->address + startAddress, size);
+    } else {
+        memset(&flash[partition->address + startAddress], 0xff, size);
+    }
+    flash_stats.bytes_erased += size;
+    flash_stats.nof_erases++;
+    pthread_mutex_unlock(&flash_mutex);
+    
+    // Like spi_flash_erase_range, aligned 64 KB blocks are erased with one command.
+    uint64_t us = 0;
+    uint32_t address = partition->address + startAddress;
+    uint32_t end = address + size;
+    while (address < end) {
+        if (address % HOST_FLASH_BLOCK_SIZE == 0 && end - address >= HOST_FLASH_BLOCK_SIZE) {
+            us += HOST_FLASH_BLOCK_ERASE_US;
+            address += HOST_FLASH_BLOCK_SIZE;
+        } else {
+            us += HOST_FLASH_SECTOR_ERASE_US;
+            address += SPI_FLASH_SEC_SIZE;
+        }
+    }
+    host_flash_busy(us);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, uint32_t offset, uint32_t size,
+                             spi_flash_mmap_memory_t memory, const void **outPtr, spi_flash_mmap_handle_t *outHandle)
+{
+    if (offset > partition->size || size > partition->size - offset) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&flash_mutex);
+    host_flash_init_locked();
+    pthread_mutex_unlock(&flash_mutex);
+    
+    *outPtr = &flash[partition->address + offset];
+    *outHandle = 1;
+    return ESP_OK;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle)
+{
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t imageSize, esp_ota_handle_t *outHandle)
+{
+    if (!partition || partition->type != ESP_PARTITION_TYPE_APP || partition == HOST_RUNNING_PARTITION) {
+        return ESP_ERR_OTA_PARTITION_CONFLICT;
+    }
+    
+    // Without an image size, ESP-IDF erases the whole partition.
+    uint32_t eraseSize = partition->size;
+    if (imageSize != 0 && imageSize != OTA_SIZE_UNKNOWN) {
+        eraseSize = (imageSize + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+    }
+    esp_err_t result = esp_partition_erase_range(partition, 0, eraseSize);
+    if (result != ESP_OK) {
+        return result;
+    }
+    
+    pthread_mutex_lock(&flash_mutex);
+    ota_partition = partition;
+    ota_bytes_written = 0;
+    *outHandle = ++ota_handle;
+    pthread_mutex_unlock(&flash_mutex);
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size)
+{
+    pthread_mutex_lock(&flash_mutex);
+    const esp_partition_t *partition = handle == ota_handle ? ota_partition : NULL;
+    uint32_t offset = ota_bytes_written;
+    pthread_mutex_unlock(&flash_mutex);
+    
+    if (!partition) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (offset == 0 && size > 0 && ((const uint8_t *)data)[0] != HOST_IMAGE_MAGIC) {
+        ESP_LOGE(TAG, "esp_ota_write: invalid image magic 0x%02x", ((const uint8_t *)data)[0]);
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    esp_err_t result = esp_partition_write(partition, offset, data, size);
+    if (result == ESP_OK) {
+        pthread_mutex_lock(&flash_mutex);
+        ota_bytes_written += size;
+        pthread_mutex_unlock(&flash_mutex);
+    }
+    return result;
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle)
+{
+    pthread_mutex_lock(&flash_mutex);
+    const esp_partition_t *partition = handle == ota_handle ? ota_partition : NULL;
+    uint32_t written = ota_bytes_written;
+    ota_partition = NULL;
+    pthread_mutex_unlock(&flash_mutex);
+    
+    if (!partition) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (written == 0 || flash[partition->address] != HOST_IMAGE_MAGIC) {
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+    if (!partition || partition->type != ESP_PARTITION_TYPE_APP) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&flash_mutex);
+    host_flash_init_locked();
+    esp_err_t result = flash[partition->address] == HOST_IMAGE_MAGIC ? ESP_OK : ESP_ERR_OTA_VALIDATE_FAILED;
+    if (result == ESP_OK) {
+        boot_partition = partition;
+    }
+    pthread_mutex_unlock(&flash_mutex);
+    return result;
+}
+
+const esp_partition_t *esp_ota_get_boot_partition()
+{
+    pthread_mutex_lock(&flash_mutex);
+    host_flash_init_locked();
+    const esp_partition_t *partition = boot_partition;
+    pthread_mutex_unlock(&flash_mutex);
+    return partition;
+}
+
+const esp_partition_t *esp_ota_get_running_partition()
+{
+    return HOST_RUNNING_PARTITION;
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *startFrom)
+{
+    // The next OTA slot after the given (or running) partition, wrapping around.
+    const esp_partition_t *from = startFrom ? startFrom : HOST_RUNNING_PARTITION;
+    const esp_partition_t *first = NULL;
+    const esp_partition_t *next = NULL;
+    for (int i = 0; i < HOST_NOF_PARTITIONS; i++) {
+        const esp_partition_t *p = &partitions[i];
+        if (p->type != ESP_PARTITION_TYPE_APP || p->subtype < ESP_PARTITION_SUBTYPE_APP_OTA_MIN || p->subtype >= ESP_PARTITION_SUBTYPE_APP_OTA_MAX) {
+            continue;
+        }
+        if (!first) {
+            first = p;
+        }
+        if (!next && p->address > from->address) {
+            next = p;
+        }
+    }
+    return next ? next : first;
+}
+
+static void host_flash_init_locked()
+{
+    if (is_flash_initialised) {
+        return;
+    }
+    
+    // Not a static buffer, so that the flash of a device can be replaced by a copy (see host_flash_clone).
+    if (!flash) {
+        flash = mmap(NULL, HOST_FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (flash == MAP_FAILED) {
+            ESP_LOGE(TAG, "host_flash_init_locked: failed to map the flash");
+            abort();
+        }
+    }
+    
+    // The running factory image: a header with the image magic and a fixed pattern.
+    memset(flash, 0xff, HOST_FLASH_SIZE);
+    const esp_partition_t *factory = HOST_RUNNING_PARTITION;
+    for (uint32_t i = 0; i < 0x40000; i++) {
+        flash[factory->address + i] = (uint8_t)(i * 7 + 3);
+    }
+    flash[factory->address] = HOST_IMAGE_MAGIC;
+    
+    memset(&flash_stats, 0, sizeof(flash_stats));
+    boot_partition = factory;
+    ota_partition = NULL;
+    is_flash_initialised = 1;
+}
+
+static int host_flash_clone_locked()
+{
+    uint8_t *copy = mmap(NULL, HOST_FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, template_fd, 0);
+    if (copy == MAP_FAILED) {
+        ESP_LOGE(TAG, "host_flash_clone: failed to map a copy of the flash (%d)", errno);
+        return -1;
+    }
+    flash = copy;
+    return 0;
+}
+
+// Sectors which are erased in the template are dropped from the copy, which
+// reverts them to the template, instead of writing 0xff into private pages.
+static void host_flash_erase_copy(uint32_t address, uint32_t size)
+{
+    uint32_t end = address + size;
+    while (address < end) {
+        uint32_t runEnd = address;
+        int isErased = template_erased_sectors[address / SPI_FLASH_SEC_SIZE];
+        while (runEnd < end && template_erased_sectors[runEnd / SPI_FLASH_SEC_SIZE] == isErased) {
+            runEnd += SPI_FLASH_SEC_SIZE;
+        }
+        if (isErased) {
+            madvise(&flash[address], runEnd - address, MADV_DONTNEED);
+        } else {
+            memset(&flash[address], 0xff, runEnd - address);
+        }
+        address = runEnd;
+    }
+}
+
+static void host_flash_busy(uint64_t us)
+{
+    pthread_mutex_lock(&flash_mutex);
+    flash_stats.busy_us += us;
+    pthread_mutex_unlock(&flash_mutex);
+    
+    if (is_timing_enabled && us > 0) {
+        struct timespec duration = { us / 1000000, (us % 1000000) * 1000 };
+        nanosleep(&duration, NULL);
+    }
+}
+
+static int host_flash_partition_matches(const esp_partition_t *partition, esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+    return partition->type == type
+        && (subtype == ESP_PARTITION_SUBTYPE_ANY || partition->subtype == subtype)
+        && (!label || strcmp(partition->label, label) == 0);
+}
+
+
+esp_err_t nvs_flash_init()
+{
+    return ESP_OK;
+}
+
+void host_nvs_reset()
+{
+    pthread_mutex_lock(&nvs_mutex);
+    while (nvs_entries) {
+        host_nvs_entry_t *entry = nvs_entries;
+        nvs_entries = entry->next;
+        free(entry->value);
+        free(entry);
+    }
+    nvs_nof_namespaces = 0;
+    pthread_mutex_unlock(&nvs_mutex);
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode openMode, nvs_handle *outHandle)
+{
+    if (strlen(name) > HOST_NVS_MAX_NAME_LEN) {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+    
+    // Handles are the index of the namespace (plus one), with the mode in bit 31.
+    pthread_mutex_lock(&nvs_mutex);
+    int ns;
+    for (ns = 0; ns < nvs_nof_namespaces; ns++) {
+        if (strcmp(nvs_namespaces[ns], name) == 0) {
+            break;
+        }
+    }
+    esp_err_t result = ESP_OK;
+    if (ns == nvs_nof_namespaces) {
+        if (openMode == NVS_READONLY) {
+            result = ESP_ERR_NVS_NOT_FOUND;
+        } else if (nvs_nof_namespaces == HOST_NVS_MAX_NAMESPACES) {
+            result = ESP_ERR_NO_MEM;
+        } else {
+            strcpy(nvs_namespaces[nvs_nof_namespaces++], name);
+        }
+    }
+    pthread_mutex_unlock(&nvs_mutex);
+    
+    if (result == ESP_OK) {
+        *outHandle = (ns + 1) | (openMode == NVS_READONLY ? 0x80000000 : 0);
+    }
+    return result;
+}
+
+void nvs_close(nvs_handle handle)
+{
+}
+
+esp_err_t nvs_commit(nvs_handle handle)
+{
+    return host_nvs_check_handle(handle, NULL, 0);
+}
+
+esp_err_t nvs_erase_key(nvs_handle handle, const char *key)
+{
+    esp_err_t result = host_nvs_check_handle(handle, key, 1);
+    if (result != ESP_OK) {
+        return result;
+    }
+    
+    pthread_mutex_lock(&nvs_mutex);
+    result = ESP_ERR_NVS_NOT_FOUND;
+    for (host_nvs_entry_t **link = &nvs_entries; *link; link = &(*link)->next) {
+        host_nvs_entry_t *entry = *link;
+        if (entry->ns == (handle & 0xffff) - 1 && strcmp(entry->key, key) == 0) {
+            *link = entry->next;
+            free(entry->value);
+            free(entry);
+            result = ESP_OK;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&nvs_mutex);
+    return result;
+}
+
+esp_err_t nvs_erase_all(nvs_handle handle)
+{
+    esp_err_t result = host_nvs_check_handle(handle, NULL, 1);
+    if (result != ESP_OK) {
+        return result;
+    }
+    
+    pthread_mutex_lock(&nvs_mutex);
+    host_nvs_entry_t **link = &nvs_entries;
+    while (*link) {
+        host_nvs_entry_t *entry = *link;
+        if (entry->ns == (handle & 0xffff) - 1) {
+            *link = entry->next;
+            free(entry->value);
+            free(entry);
+        } else {
+            link = &entry->next;
+        }
+    }
+    pthread_mutex_unlock(&nvs_mutex);
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length)
+{
+    return host_nvs_set(handle, key, HOST_NVS_TYPE_BLOB, value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *outValue, size_t *length)
+{
+    return host_nvs_get(handle, key, HOST_NVS_TYPE_BLOB, outValue, length);
+}
+
+esp_err_t nvs_set_i32(nvs_handle handle, const char *key, int32_t value)
+{
+    return host_nvs_set(handle, key, HOST_NVS_TYPE_I32, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_i32(nvs_handle handle, const char *key, int32_t *outValue)
+{
+    size_t len = sizeof(*outValue);
+    return host_nvs_get(handle, key, HOST_NVS_TYPE_I32, outValue, &len);
+}
+
+esp_err_t nvs_set_u32(nvs_handle handle, const char *key, uint32_t value)
+{
+    return host_nvs_set(handle, key, HOST_NVS_TYPE_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle handle, const char *key, uint32_t *outValue)
+{
+    size_t len = sizeof(*outValue);
+    return host_nvs_get(handle, key, HOST_NVS_TYPE_U32, outValue, &len);
+}
+
+esp_err_t nvs_set_u8(nvs_handle handle, const char *key, uint8_t value)
+{
+    return host_nvs_set(handle, key, HOST_NVS_TYPE_U8, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u8(nvs_handle handle, const char *key, uint8_t *outValue)
+{
+    size_t len = sizeof(*outValue);
+    return host_nvs_get(handle, key, HOST_NVS_TYPE_U8, outValue, &len);
+}
+
+static esp_err_t host_nvs_check_handle(nvs_handle handle, const char *key, int forWriting)
+{
+    int ns = (handle & 0xffff) - 1;
+    if (ns < 0 || ns >= nvs_nof_namespaces) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (forWriting && (handle & 0x80000000)) {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+    if (key && strlen(key) > HOST_NVS_MAX_NAME_LEN) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    return ESP_OK;
+}
+
+static host_nvs_entry_t *host_nvs_find(nvs_handle handle, const char *key)
+{
+    for (host_nvs_entry_t *entry = nvs_entries; entry; entry = entry->next) {
+        if (entry->ns == (handle & 0xffff) - 1 && strcmp(entry->key, key) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static esp_err_t host_nvs_set(nvs_handle handle, const char *key, host_nvs_type_t type, const void *value, size_t len)
+{
+    esp_err_t result = host_nvs_check_handle(handle, key, 1);
+    if (result != ESP_OK) {
+        return result;
+    }
+    
+    uint8_t *copy = malloc(len ? len : 1);
+    if (!copy) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(copy, value, len);
+    
+    pthread_mutex_lock(&nvs_mutex);
+    host_nvs_entry_t *entry = host_nvs_find(handle, key);
+    if (!entry) {
+        entry = calloc(1, sizeof(host_nvs_entry_t));
+        if (!entry) {
+            pthread_mutex_unlock(&nvs_mutex);
+            free(copy);
+            return ESP_ERR_NO_MEM;
+        }
+        entry->ns = (handle & 0xffff) - 1;
+        strcpy(entry->key, key);
+        entry->next = nvs_entries;
+        nvs_entries = entry;
+    }
+    free(entry->value);
+    entry->type = type;
+    entry->value = copy;
+    entry->len = len;
+    pthread_mutex_unlock(&nvs_mutex);
+    return ESP_OK;
+}
+
+static esp_err_t host_nvs_get(nvs_handle handle, const char *key, host_nvs_type_t type, void *outValue, size_t *len)
+{
+    esp_err_t result = host_nvs_check_handle(handle, key, 0);
+    if (result != ESP_OK) {
+        return result;
+    }
+    
+    pthread_mutex_lock(&nvs_mutex);
+    host_nvs_entry_t *entry = host_nvs_find(handle, key);
+    if (!entry || entry->type != type) {
+        result = ESP_ERR_NVS_NOT_FOUND;
+    } else if (type == HOST_NVS_TYPE_BLOB && !outValue) {
+        *len = entry->len;
+    } else if (*len < entry->len) {
+        result = ESP_ERR_NVS_INVALID_LENGTH;
+    } else {
+        memcpy(outValue, entry->value, entry->len);
+        *len = entry->len;
+    }
+    pthread_mutex_unlock(&nvs_mutex);
+    return result;
+}
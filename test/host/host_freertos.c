@@ -0,0 +1,584 @@
+//
+//  host_freertos.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  This module implements the FreeRTOS functions used by the updater on
+//  POSIX threads. Ticks are derived from the monotonic clock, tasks get a
+//  stack which is painted to measure its high-water mark, and software
+//  timers are run by a single thread, like the timer service task.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/event_groups.h"
+#include "freertos/timers.h"
+#include "esp_log.h"
+
+#include "host.h"
+
+
+#define TAG "host_freertos"
+
+// Stacks on the host need more space than on the ESP32 (64-bit pointers,
+// glibc), so the requested size is multiplied, with a minimum. The high-water
+// mark is still reported relative to the requested size.
+#define HOST_STACK_FACTOR 4
+#define HOST_STACK_MIN_SIZE (256 * 1024)
+#define HOST_STACK_PAINT 0xa5
+
+// Accounts task stacks on the emulated heap (see host_heap.c).
+void host_heap_account(long delta);
+
+
+struct host_task_ {
+    TaskFunction_t function;
+    void *parameter;
+    pthread_t thread;
+    uint8_t *stack;
+    size_t stack_size;
+    uint32_t requested_stack_size;
+};
+
+struct host_queue_ {
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    uint8_t *items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+struct host_event_group_ {
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    EventBits_t bits;
+};
+
+struct host_timer_ {
+    TimerCallbackFunction_t callback;
+    void *timer_id;
+    TickType_t period;
+    int auto_reload;
+    int is_active;
+    int is_deleted;
+    int64_t expiry_us;
+    struct host_timer_ *next;
+};
+
+static pthread_once_t host_freertos_once = PTHREAD_ONCE_INIT;
+static struct timespec start_time;
+static pthread_key_t current_task_key;
+
+static pthread_mutex_t timer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_changed;
+static struct host_timer_ *timer_list;
+
+
+static void host_freertos_init_once();
+static int64_t host_freertos_now_us();
+static void host_freertos_deadline(TickType_t ticks, struct timespec *deadline);
+static void host_freertos_init_cond(pthread_cond_t *cond);
+static void *host_freertos_task_main(void *arg);
+static void *host_freertos_timer_service(void *arg);
+static BaseType_t host_freertos_queue_send(QueueHandle_t queue, const void *item, TickType_t ticksToWait, int toFront);
+static BaseType_t host_freertos_queue_receive(QueueHandle_t queue, void *item, TickType_t ticksToWait, int remove);
+
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stackDepth,
+                                   void *parameter, UBaseType_t priority, TaskHandle_t *handle, BaseType_t coreId)
+{
+    pthread_once(&host_freertos_once, host_freertos_init_once);
+    
+    struct host_task_ *task = calloc(1, sizeof(struct host_task_));
+    if (!task) {
+        return pdFAIL;
+    }
+    
+    task->function = function;
+    task->parameter = parameter;
+    task->requested_stack_size = stackDepth;
+    task->stack_size = stackDepth * HOST_STACK_FACTOR;
+    if (task->stack_size < HOST_STACK_MIN_SIZE) {
+        task->stack_size = HOST_STACK_MIN_SIZE;
+    }
+    
+    // The stack isn't allocated with malloc, so that only the requested size is accounted.
+    task->stack = mmap(NULL, task->stack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (task->stack == MAP_FAILED) {
+        free(task);
+        return pdFAIL;
+    }
+    memset(task->stack, HOST_STACK_PAINT, task->stack_size);
+    host_heap_account(stackDepth);
+    
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, task->stack, task->stack_size);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int result = pthread_create(&task->thread, &attr, host_freertos_task_main, task);
+    pthread_attr_destroy(&attr);
+    if (result != 0) {
+        ESP_LOGE(TAG, "xTaskCreate: failed to create task '%s' (%d)", name, result);
+        host_heap_account(-(long)stackDepth);
+        munmap(task->stack, task->stack_size);
+        free(task);
+        return pdFAIL;
+    }
+    
+    if (handle) {
+        *handle = task;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stackDepth,
+                       void *parameter, UBaseType_t priority, TaskHandle_t *handle)
+{
+    return xTaskCreatePinnedToCore(function, name, stackDepth, parameter, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    // Only tasks deleting themselves are supported. The stack stays mapped
+    // because the thread is still running on it.
+    struct host_task_ *current = pthread_getspecific(current_task_key);
+    if (task && task != current) {
+        ESP_LOGE(TAG, "vTaskDelete: deleting other tasks isn't supported");
+        abort();
+    }
+    if (current) {
+        host_heap_account(-(long)current->requested_stack_size);
+    }
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if (ticks == 0) {
+        sched_yield();
+        return;
+    }
+    struct timespec deadline;
+    host_freertos_deadline(ticks, &deadline);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+    }
+}
+
+TickType_t xTaskGetTickCount()
+{
+    pthread_once(&host_freertos_once, host_freertos_init_once);
+    return (TickType_t)(host_freertos_now_us() / (1000 * portTICK_PERIOD_MS));
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    if (!task) {
+        task = pthread_getspecific(current_task_key);
+        if (!task) {
+            return 0;
+        }
+    }
+    
+    // The stack grows downwards: count the painted bytes from the bottom.
+    size_t unused = 0;
+    while (unused < task->stack_size && task->stack[unused] == HOST_STACK_PAINT) {
+        unused++;
+    }
+    size_t used = task->stack_size - unused;
+    return used < task->requested_stack_size ? task->requested_stack_size - used : 0;
+}
+
+static void *host_freertos_task_main(void *arg)
+{
+    struct host_task_ *task = arg;
+    pthread_setspecific(current_task_key, task);
+    task->function(task->parameter);
+    
+    // FreeRTOS tasks must not return.
+    ESP_LOGE(TAG, "task returned from its function");
+    abort();
+    return NULL;
+}
+
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    pthread_once(&host_freertos_once, host_freertos_init_once);
+    
+    struct host_queue_ *queue = calloc(1, sizeof(struct host_queue_));
+    if (!queue) {
+        return NULL;
+    }
+    queue->items = malloc(length * itemSize);
+    if (!queue->items) {
+        free(queue);
+        return NULL;
+    }
+    queue->length = length;
+    queue->item_size = itemSize;
+    pthread_mutex_init(&queue->mutex, NULL);
+    host_freertos_init_cond(&queue->changed);
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    pthread_cond_destroy(&queue->changed);
+    pthread_mutex_destroy(&queue->mutex);
+    free(queue->items);
+    free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait)
+{
+    return host_freertos_queue_send(queue, item, ticksToWait, 0);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticksToWait)
+{
+    return host_freertos_queue_send(queue, item, ticksToWait, 1);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticksToWait)
+{
+    return host_freertos_queue_receive(queue, item, ticksToWait, 1);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t ticksToWait)
+{
+    return host_freertos_queue_receive(queue, item, ticksToWait, 0);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->mutex);
+    return count;
+}
+
+static BaseType_t host_freertos_queue_send(QueueHandle_t queue, const void *item, TickType_t ticksToWait, int toFront)
+{
+    struct timespec deadline;
+    host_freertos_deadline(ticksToWait, &deadline);
+    
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == queue->length) {
+        if (ticksToWait == 0
+            || (ticksToWait != portMAX_DELAY && pthread_cond_timedwait(&queue->changed, &queue->mutex, &deadline) == ETIMEDOUT)) {
+            pthread_mutex_unlock(&queue->mutex);
+            return pdFALSE;
+        }
+        if (ticksToWait == portMAX_DELAY) {
+            pthread_cond_wait(&queue->changed, &queue->mutex);
+        }
+    }
+    
+    UBaseType_t index;
+    if (toFront) {
+        queue->head = (queue->head + queue->length - 1) % queue->length;
+        index = queue->head;
+    } else {
+        index = (queue->head + queue->count) % queue->length;
+    }
+    memcpy(queue->items + index * queue->item_size, item, queue->item_size);
+    queue->count++;
+    
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdTRUE;
+}
+
+static BaseType_t host_freertos_queue_receive(QueueHandle_t queue, void *item, TickType_t ticksToWait, int remove)
+{
+    struct timespec deadline;
+    host_freertos_deadline(ticksToWait, &deadline);
+    
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0) {
+        if (ticksToWait == 0
+            || (ticksToWait != portMAX_DELAY && pthread_cond_timedwait(&queue->changed, &queue->mutex, &deadline) == ETIMEDOUT)) {
+            pthread_mutex_unlock(&queue->mutex);
+            return pdFALSE;
+        }
+        if (ticksToWait == portMAX_DELAY) {
+            pthread_cond_wait(&queue->changed, &queue->mutex);
+        }
+    }
+    
+    memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+    if (remove) {
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        pthread_cond_broadcast(&queue->changed);
+    }
+    
+    pthread_mutex_unlock(&queue->mutex);
+    return pdTRUE;
+}
+
+
+EventGroupHandle_t xEventGroupCreate()
+{
+    pthread_once(&host_freertos_once, host_freertos_init_once);
+    
+    struct host_event_group_ *group = calloc(1, sizeof(struct host_event_group_));
+    if (!group) {
+        return NULL;
+    }
+    pthread_mutex_init(&group->mutex, NULL);
+    host_freertos_init_cond(&group->changed);
+    return group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&group->mutex);
+    group->bits |= bits;
+    EventBits_t result = group->bits;
+    pthread_cond_broadcast(&group->changed);
+    pthread_mutex_unlock(&group->mutex);
+    return result;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&group->mutex);
+    EventBits_t result = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock(&group->mutex);
+    return result;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    pthread_mutex_lock(&group->mutex);
+    EventBits_t result = group->bits;
+    pthread_mutex_unlock(&group->mutex);
+    return result;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clearOnExit,
+                                BaseType_t waitForAllBits, TickType_t ticksToWait)
+{
+    struct timespec deadline;
+    host_freertos_deadline(ticksToWait, &deadline);
+    
+    pthread_mutex_lock(&group->mutex);
+    for (;;) {
+        EventBits_t matching = group->bits & bits;
+        if (waitForAllBits ? matching == bits : matching != 0) {
+            break;
+        }
+        if (ticksToWait == 0) {
+            break;
+        }
+        if (ticksToWait == portMAX_DELAY) {
+            pthread_cond_wait(&group->changed, &group->mutex);
+        } else if (pthread_cond_timedwait(&group->changed, &group->mutex, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    
+    // As in FreeRTOS, the bits before clearing are returned (also on timeout).
+    EventBits_t result = group->bits;
+    EventBits_t matching = result & bits;
+    if (clearOnExit && (waitForAllBits ? matching == bits : matching != 0)) {
+        group->bits &= ~bits;
+    }
+    pthread_mutex_unlock(&group->mutex);
+    return result;
+}
+
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t autoReload,
+                           void *timerId, TimerCallbackFunction_t callback)
+{
+    pthread_once(&host_freertos_once, host_freertos_init_once);
+    
+    struct host_timer_ *timer = calloc(1, sizeof(struct host_timer_));
+    if (!timer) {
+        return NULL;
+    }
+    timer->callback = callback;
+    timer->timer_id = timerId;
+    timer->period = period;
+    timer->auto_reload = autoReload;
+    
+    pthread_mutex_lock(&timer_mutex);
+    timer->next = timer_list;
+    timer_list = timer;
+    pthread_mutex_unlock(&timer_mutex);
+    return timer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticksToWait)
+{
+    return xTimerReset(timer, ticksToWait);
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticksToWait)
+{
+    pthread_mutex_lock(&timer_mutex);
+    timer->is_active = 0;
+    pthread_cond_broadcast(&timer_changed);
+    pthread_mutex_unlock(&timer_mutex);
+    return pdPASS;
+}
+
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t ticksToWait)
+{
+    pthread_mutex_lock(&timer_mutex);
+    timer->is_active = 1;
+    timer->expiry_us = host_freertos_now_us() + (int64_t)timer->period * portTICK_PERIOD_MS * 1000;
+    pthread_cond_broadcast(&timer_changed);
+    pthread_mutex_unlock(&timer_mutex);
+    return pdPASS;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticksToWait)
+{
+    // Like in FreeRTOS, changing the period also starts a dormant timer.
+    pthread_mutex_lock(&timer_mutex);
+    timer->period = period;
+    pthread_mutex_unlock(&timer_mutex);
+    return xTimerReset(timer, ticksToWait);
+}
+
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t ticksToWait)
+{
+    // The timer service thread releases it.
+    pthread_mutex_lock(&timer_mutex);
+    timer->is_active = 0;
+    timer->is_deleted = 1;
+    pthread_cond_broadcast(&timer_changed);
+    pthread_mutex_unlock(&timer_mutex);
+    return pdPASS;
+}
+
+static void *host_freertos_timer_service(void *arg)
+{
+    pthread_mutex_lock(&timer_mutex);
+    for (;;) {
+        
+        // Release deleted timers and find the next one to expire.
+        struct host_timer_ *next = NULL;
+        struct host_timer_ **link = &timer_list;
+        while (*link) {
+            struct host_timer_ *timer = *link;
+            if (timer->is_deleted) {
+                *link = timer->next;
+                free(timer);
+                continue;
+            }
+            if (timer->is_active && (!next || timer->expiry_us < next->expiry_us)) {
+                next = timer;
+            }
+            link = &timer->next;
+        }
+        
+        if (!next) {
+            pthread_cond_wait(&timer_changed, &timer_mutex);
+            continue;
+        }
+        
+        int64_t now = host_freertos_now_us();
+        if (next->expiry_us > now) {
+            int64_t expiry = next->expiry_us - now;
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += expiry / 1000000;
+            deadline.tv_nsec += (expiry % 1000000) * 1000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&timer_changed, &timer_mutex, &deadline);
+            continue;
+        }
+        
+        if (next->auto_reload) {
+            next->expiry_us += (int64_t)next->period * portTICK_PERIOD_MS * 1000;
+        } else {
+            next->is_active = 0;
+        }
+        
+        // The callback may call the timer functions.
+        pthread_mutex_unlock(&timer_mutex);
+        next->callback(next);
+        pthread_mutex_lock(&timer_mutex);
+    }
+    return NULL;
+}
+
+
+static void host_freertos_init_once()
+{
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    pthread_key_create(&current_task_key, NULL);
+    host_freertos_init_cond(&timer_changed);
+    
+    pthread_t thread;
+    pthread_create(&thread, NULL, host_freertos_timer_service, NULL);
+    pthread_detach(thread);
+}
+
+static int64_t host_freertos_now_us()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)(now.tv_sec - start_time.tv_sec) * 1000000 + (now.tv_nsec - start_time.tv_nsec) / 1000;
+}
+
+static void host_freertos_deadline(TickType_t ticks, struct timespec *deadline)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    if (ticks == portMAX_DELAY) {
+        return;
+    }
+    uint64_t ms = (uint64_t)ticks * portTICK_PERIOD_MS;
+    deadline->tv_sec += ms / 1000;
+    deadline->tv_nsec += (ms % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+}
+
+static void host_freertos_init_cond(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
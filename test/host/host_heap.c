@@ -0,0 +1,187 @@
+//
+//  host_heap.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  This module measures the heap use of the updater on the host: malloc and
+//  friends are interposed and count the allocated bytes, which are reported
+//  against an emulated internal RAM by the ESP-IDF heap functions. mbedTLS
+//  allocates through the same functions, so its buffers are included.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <errno.h>
+#include <malloc.h>
+
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+
+#include "host.h"
+
+
+#define HOST_HEAP_DEFAULT_SIZE (300 * 1024)
+
+// The glibc allocator, called by the interposed functions.
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+
+void host_heap_account(long delta);
+
+static long heap_used;
+static long heap_peak;
+static size_t heap_size;
+
+
+// The sanitizers of the fuzz targets replace the allocator, so there only the
+// task stacks are accounted.
+#ifndef HOST_HEAP_NO_INTERPOSE
+
+void *malloc(size_t size)
+{
+    void *ptr = __libc_malloc(size);
+    if (ptr) {
+        host_heap_account(malloc_usable_size(ptr));
+    }
+    return ptr;
+}
+
+void *calloc(size_t n, size_t size)
+{
+    void *ptr = __libc_calloc(n, size);
+    if (ptr) {
+        host_heap_account(malloc_usable_size(ptr));
+    }
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    size_t oldSize = ptr ? malloc_usable_size(ptr) : 0;
+    void *newPtr = __libc_realloc(ptr, size);
+    if (newPtr) {
+        host_heap_account((long)malloc_usable_size(newPtr) - (long)oldSize);
+    } else if (size == 0) {
+        host_heap_account(-(long)oldSize);
+    }
+    return newPtr;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    void *ptr = __libc_memalign(alignment, size);
+    if (ptr) {
+        host_heap_account(malloc_usable_size(ptr));
+    }
+    return ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **outPtr, size_t alignment, size_t size)
+{
+    void *ptr = memalign(alignment, size);
+    if (!ptr) {
+        return ENOMEM;
+    }
+    *outPtr = ptr;
+    return 0;
+}
+
+void free(void *ptr)
+{
+    if (ptr) {
+        host_heap_account(-(long)malloc_usable_size(ptr));
+        __libc_free(ptr);
+    }
+}
+
+#endif // HOST_HEAP_NO_INTERPOSE
+
+void host_heap_account(long delta)
+{
+    long used = __atomic_add_fetch(&heap_used, delta, __ATOMIC_RELAXED);
+    long peak = __atomic_load_n(&heap_peak, __ATOMIC_RELAXED);
+    while (used > peak && !__atomic_compare_exchange_n(&heap_peak, &peak, used, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void host_heap_set_size(size_t size)
+{
+    heap_size = size;
+}
+
+size_t host_heap_get_used()
+{
+    long used = __atomic_load_n(&heap_used, __ATOMIC_RELAXED);
+    return used > 0 ? used : 0;
+}
+
+size_t host_heap_get_peak()
+{
+    long peak = __atomic_load_n(&heap_peak, __ATOMIC_RELAXED);
+    return peak > 0 ? peak : 0;
+}
+
+void host_heap_reset_peak()
+{
+    __atomic_store_n(&heap_peak, __atomic_load_n(&heap_used, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+uint32_t esp_get_free_heap_size()
+{
+    if (heap_size == 0) {
+        const char *env = getenv("HOST_HEAP_SIZE");
+        heap_size = env ? strtoul(env, NULL, 0) : HOST_HEAP_DEFAULT_SIZE;
+    }
+    size_t used = host_heap_get_used();
+    return used < heap_size ? heap_size - used : 0;
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    // There is no external RAM.
+    if (caps & MALLOC_CAP_SPIRAM) {
+        return NULL;
+    }
+    if (size > esp_get_free_heap_size()) {
+        return NULL;
+    }
+    return malloc(size);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    return (caps & MALLOC_CAP_SPIRAM) ? 0 : esp_get_free_heap_size();
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    return heap_caps_get_free_size(caps);
+}
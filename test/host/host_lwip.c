@@ -0,0 +1,51 @@
+//
+//  host_lwip.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  This module gives the TCP sockets of the host the buffer sizes of lwIP on
+//  the device (CONFIG_TCP_WND_DEFAULT and CONFIG_TCP_SND_BUF_DEFAULT). The
+//  small receive window makes a server stall while the device is busy, e.g.
+//  writing the flash, as it does with a real device. Sockets created by
+//  mbedTLS are included, because socket() is replaced for the whole process.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "freertos/FreeRTOS.h"
+#include "lwip/sockets.h"
+
+
+int socket(int domain, int type, int protocol)
+{
+    int fd = syscall(SYS_socket, domain, type, protocol);
+    if (fd >= 0 && (type & 0xff) == SOCK_STREAM) {
+        int rcvBuf = CONFIG_TCP_WND_DEFAULT;
+        int sndBuf = CONFIG_TCP_SND_BUF_DEFAULT;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvBuf, sizeof(rcvBuf));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndBuf, sizeof(sndBuf));
+    }
+    return fd;
+}
@@ -0,0 +1,109 @@
+//
+//  host_wifi_sta.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  This module replaces wifi_sta.c on the host: the connection to the
+//  network is a flag which the test sets (see host.h).
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <pthread.h>
+
+#include "esp_err.h"
+#include "esp_event_loop.h"
+#include "lwip/sockets.h"
+#include "lwip/dns.h"
+
+#include "wifi_sta.h"
+#include "host.h"
+
+
+static pthread_once_t wifi_sta_once = PTHREAD_ONCE_INIT;
+static EventGroupHandle_t wifi_sta_event_group;
+static uint32_t dns_server = 0x0100007f; // 127.0.0.1
+
+
+static void wifi_sta_init_once()
+{
+    wifi_sta_event_group = xEventGroupCreate();
+}
+
+esp_err_t wifi_sta_init(wifi_sta_init_struct_t *param)
+{
+    host_wifi_sta_set_connected(1);
+    host_wifi_sta_set_dns_ready(1);
+    return ESP_OK;
+}
+
+esp_err_t wifi_sta_handle_event(void *ctx, system_event_t *event, int *handled)
+{
+    *handled = 0;
+    return ESP_OK;
+}
+
+int wifi_sta_is_connected()
+{
+    return (xEventGroupGetBits(wifi_sta_get_event_group()) & WIFI_STA_EVENT_GROUP_CONNECTED_FLAG) != 0;
+}
+
+int wifi_sta_is_dns_ready()
+{
+    EventBits_t bits = xEventGroupGetBits(wifi_sta_get_event_group());
+    return (bits & WIFI_STA_EVENT_GROUP_CONNECTED_FLAG) && (bits & WIFI_STA_EVENT_GROUP_DNS_READY_FLAG);
+}
+
+EventGroupHandle_t wifi_sta_get_event_group()
+{
+    pthread_once(&wifi_sta_once, wifi_sta_init_once);
+    return wifi_sta_event_group;
+}
+
+void host_wifi_sta_set_connected(int connected)
+{
+    if (connected) {
+        xEventGroupSetBits(wifi_sta_get_event_group(), WIFI_STA_EVENT_GROUP_CONNECTED_FLAG);
+    } else {
+        xEventGroupClearBits(wifi_sta_get_event_group(), WIFI_STA_EVENT_GROUP_CONNECTED_FLAG);
+    }
+}
+
+void host_wifi_sta_set_dns_ready(int dnsReady)
+{
+    if (dnsReady) {
+        xEventGroupSetBits(wifi_sta_get_event_group(), WIFI_STA_EVENT_GROUP_DNS_READY_FLAG);
+    } else {
+        xEventGroupClearBits(wifi_sta_get_event_group(), WIFI_STA_EVENT_GROUP_DNS_READY_FLAG);
+    }
+}
+
+void host_wifi_sta_set_dns_server(uint32_t address)
+{
+    dns_server = address;
+}
+
+ip_addr_t dns_getserver(uint8_t numdns)
+{
+    ip_addr_t server = { { numdns == 0 ? dns_server : 0 }, 0 };
+    return server;
+}
@@ -0,0 +1,52 @@
+//
+//  esp_heap_caps.h
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  Host build: the heap is the process heap, accounted against an
+//  emulated internal RAM of HOST_HEAP_SIZE bytes (see host_heap.c).
+//  There is no external RAM: MALLOC_CAP_SPIRAM allocations fail.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __HOST_ESP_HEAP_CAPS__
+#define __HOST_ESP_HEAP_CAPS__ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define MALLOC_CAP_EXEC             (1 << 0)
+#define MALLOC_CAP_32BIT            (1 << 1)
+#define MALLOC_CAP_8BIT             (1 << 2)
+#define MALLOC_CAP_DMA              (1 << 3)
+#define MALLOC_CAP_SPIRAM           (1 << 10)
+#define MALLOC_CAP_INTERNAL         (1 << 11)
+#define MALLOC_CAP_DEFAULT          (1 << 12)
+
+void *heap_caps_malloc(size_t size, uint32_t caps);
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
+
+
+#endif // __HOST_ESP_HEAP_CAPS__
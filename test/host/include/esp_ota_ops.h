@@ -0,0 +1,53 @@
+//
+//  esp_ota_ops.h
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  Host build: OTA operations on the emulated flash (see host_flash.c).
+//  An image is valid if it starts with the ESP image magic byte 0xe9.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __HOST_ESP_OTA_OPS__
+#define __HOST_ESP_OTA_OPS__ 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+
+#define OTA_SIZE_UNKNOWN 0xffffffff
+
+typedef uint32_t esp_ota_handle_t;
+
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t imageSize, esp_ota_handle_t *outHandle);
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size);
+esp_err_t esp_ota_end(esp_ota_handle_t handle);
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition);
+const esp_partition_t *esp_ota_get_boot_partition();
+const esp_partition_t *esp_ota_get_running_partition();
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *startFrom);
+
+
+#endif // __HOST_ESP_OTA_OPS__
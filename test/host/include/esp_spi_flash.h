@@ -0,0 +1,50 @@
+//
+//  esp_spi_flash.h
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  Host build: the flash is an array in memory (see host_flash.c).
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __HOST_ESP_SPI_FLASH__
+#define __HOST_ESP_SPI_FLASH__ 1
+
+#include <stdint.h>
+#include "esp_err.h"
+
+
+#define SPI_FLASH_SEC_SIZE 4096
+#define SPI_FLASH_MMU_PAGE_SIZE 0x10000
+
+typedef enum {
+    SPI_FLASH_MMAP_DATA,
+    SPI_FLASH_MMAP_INST,
+} spi_flash_mmap_memory_t;
+
+typedef uint32_t spi_flash_mmap_handle_t;
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle);
+
+
+#endif // __HOST_ESP_SPI_FLASH__
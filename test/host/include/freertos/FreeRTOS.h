@@ -0,0 +1,66 @@
+//
+//  FreeRTOS.h
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  Host build: the subset of the FreeRTOS API used by the updater,
+//  implemented on POSIX threads (see host_freertos.c). The tick rate is
+//  the one of the project (CONFIG_FREERTOS_HZ in sdkconfig.h, which the
+//  Makefile generates from the sdkconfig file).
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __HOST_FREERTOS__
+#define __HOST_FREERTOS__ 1
+
+// Like the ESP-IDF headers, this makes the C library basics available.
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define configTICK_RATE_HZ CONFIG_FREERTOS_HZ
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define portTICK_RATE_MS portTICK_PERIOD_MS
+#define portMAX_DELAY ((TickType_t)0xffffffffu)
+#define pdMS_TO_TICKS(ms) ((TickType_t)((TickType_t)(ms) * (TickType_t)configTICK_RATE_HZ / (TickType_t)1000))
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL 0
+#define pdPASS 1
+
+#define tskNO_AFFINITY 0x7fffffff
+#define tskIDLE_PRIORITY 0
+
+
+#endif // __HOST_FREERTOS__
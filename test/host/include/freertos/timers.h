@@ -0,0 +1,49 @@
+//
+//  timers.h
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  Host build: software timers, run by a single timer thread like the
+//  FreeRTOS timer service task (see host_freertos.c).
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __HOST_FREERTOS_TIMERS__
+#define __HOST_FREERTOS_TIMERS__ 1
+
+#include "freertos/FreeRTOS.h"
+
+
+typedef struct host_timer_ *TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t autoReload,
+                           void *timerId, TimerCallbackFunction_t callback);
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticksToWait);
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticksToWait);
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t ticksToWait);
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticksToWait);
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t ticksToWait);
+
+
+#endif // __HOST_FREERTOS_TIMERS__
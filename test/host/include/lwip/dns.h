@@ -0,0 +1,51 @@
+//
+//  dns.h
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  Host build: the DNS server configured by DHCP (see host_wifi_sta.c).
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __HOST_LWIP_DNS__
+#define __HOST_LWIP_DNS__ 1
+
+#include <stdint.h>
+
+
+typedef struct {
+    uint32_t addr;
+} ip4_addr_t;
+
+typedef struct {
+    ip4_addr_t u_addr;
+    uint8_t type;
+} ip_addr_t;
+
+#define ip_2_ip4(ipaddr) (&((ipaddr)->u_addr))
+#define ip4_addr_get_u32(src_ipaddr) ((src_ipaddr)->addr)
+
+ip_addr_t dns_getserver(uint8_t numdns);
+
+
+#endif // __HOST_LWIP_DNS__
@@ -0,0 +1,62 @@
+//
+//  nvs.h
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  Host build: non-volatile storage in memory (see host_flash.c). The
+//  contents survive nvs_close but not the end of the process.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __HOST_NVS__
+#define __HOST_NVS__ 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+
+typedef uint32_t nvs_handle;
+
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE
+} nvs_open_mode;
+
+esp_err_t nvs_open(const char *name, nvs_open_mode openMode, nvs_handle *outHandle);
+void nvs_close(nvs_handle handle);
+esp_err_t nvs_commit(nvs_handle handle);
+esp_err_t nvs_erase_key(nvs_handle handle, const char *key);
+esp_err_t nvs_erase_all(nvs_handle handle);
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length);
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *outValue, size_t *length);
+esp_err_t nvs_set_i32(nvs_handle handle, const char *key, int32_t value);
+esp_err_t nvs_get_i32(nvs_handle handle, const char *key, int32_t *outValue);
+esp_err_t nvs_set_u32(nvs_handle handle, const char *key, uint32_t value);
+esp_err_t nvs_get_u32(nvs_handle handle, const char *key, uint32_t *outValue);
+esp_err_t nvs_set_u8(nvs_handle handle, const char *key, uint8_t value);
+esp_err_t nvs_get_u8(nvs_handle handle, const char *key, uint8_t *outValue);
+
+
+#endif // __HOST_NVS__
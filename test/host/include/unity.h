@@ -0,0 +1,115 @@
+//
+//  unity.h
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  Host build: the subset of Unity used by the component's tests (see
+//  main/test). TEST_CASE registers the test like the ESP-IDF unit test app;
+//  test_main.c runs the registered tests, each in its own process.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __HOST_UNITY__
+#define __HOST_UNITY__ 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+
+typedef struct unity_test_ {
+    const char *name;
+    const char *desc;
+    void (*fn)(void);
+    const char *file;
+    int line;
+    struct unity_test_ *next;
+} unity_test_t;
+
+void unity_register_test(unity_test_t *test);
+
+// Reports the failure and ends the test.
+void unity_fail(const char *file, int line, const char *format, ...) __attribute__((noreturn, format(printf, 3, 4)));
+
+#define UNITY_JOIN_(a, b) a##b
+#define UNITY_JOIN(a, b) UNITY_JOIN_(a, b)
+#define UNITY_UID(prefix) UNITY_JOIN(prefix, __LINE__)
+
+#define TEST_CASE(name_, desc_) \
+    static void UNITY_UID(test_fn_)(void); \
+    __attribute__((constructor)) static void UNITY_UID(test_reg_)(void) \
+    { \
+        static unity_test_t test = { name_, desc_, UNITY_UID(test_fn_), __FILE__, __LINE__, NULL }; \
+        unity_register_test(&test); \
+    } \
+    static void UNITY_UID(test_fn_)(void)
+
+#define TEST_FAIL_MESSAGE(message) unity_fail(__FILE__, __LINE__, "%s", message)
+
+#define TEST_ASSERT_MESSAGE(condition, message) do { \
+        if (!(condition)) unity_fail(__FILE__, __LINE__, "%s", message); \
+    } while (0)
+
+#define TEST_ASSERT(condition) TEST_ASSERT_MESSAGE(condition, "expression '" #condition "' is false")
+#define TEST_ASSERT_TRUE(condition) TEST_ASSERT(condition)
+#define TEST_ASSERT_FALSE(condition) TEST_ASSERT_MESSAGE(!(condition), "expression '" #condition "' is true")
+#define TEST_ASSERT_NULL(pointer) TEST_ASSERT_MESSAGE((pointer) == NULL, "'" #pointer "' is not NULL")
+#define TEST_ASSERT_NOT_NULL(pointer) TEST_ASSERT_MESSAGE((pointer) != NULL, "'" #pointer "' is NULL")
+
+#define TEST_ASSERT_EQUAL_INT(expected, actual) do { \
+        long long e_ = (long long)(expected), a_ = (long long)(actual); \
+        if (e_ != a_) unity_fail(__FILE__, __LINE__, "expected %lld, was %lld (%s)", e_, a_, #actual); \
+    } while (0)
+
+#define TEST_ASSERT_EQUAL(expected, actual) TEST_ASSERT_EQUAL_INT(expected, actual)
+#define TEST_ASSERT_EQUAL_UINT32(expected, actual) TEST_ASSERT_EQUAL_INT(expected, actual)
+#define TEST_ASSERT_EQUAL_HEX(expected, actual) TEST_ASSERT_EQUAL_INT(expected, actual)
+
+#define TEST_ASSERT_INT_WITHIN(delta, expected, actual) do { \
+        long long d_ = (long long)(delta), e_ = (long long)(expected), a_ = (long long)(actual); \
+        if (a_ < e_ - d_ || a_ > e_ + d_) \
+            unity_fail(__FILE__, __LINE__, "expected %lld +/- %lld, was %lld (%s)", e_, d_, a_, #actual); \
+    } while (0)
+
+#define TEST_ASSERT_GREATER_THAN(threshold, actual) do { \
+        long long t_ = (long long)(threshold), a_ = (long long)(actual); \
+        if (!(a_ > t_)) unity_fail(__FILE__, __LINE__, "expected > %lld, was %lld (%s)", t_, a_, #actual); \
+    } while (0)
+
+#define TEST_ASSERT_LESS_THAN(threshold, actual) do { \
+        long long t_ = (long long)(threshold), a_ = (long long)(actual); \
+        if (!(a_ < t_)) unity_fail(__FILE__, __LINE__, "expected < %lld, was %lld (%s)", t_, a_, #actual); \
+    } while (0)
+
+#define TEST_ASSERT_EQUAL_STRING(expected, actual) do { \
+        const char *e_ = (expected), *a_ = (actual); \
+        if (strcmp(e_, a_) != 0) unity_fail(__FILE__, __LINE__, "expected \"%s\", was \"%s\"", e_, a_); \
+    } while (0)
+
+#define TEST_ASSERT_EQUAL_MEMORY(expected, actual, len) do { \
+        if (memcmp((expected), (actual), (len)) != 0) \
+            unity_fail(__FILE__, __LINE__, "memory differs (%s, %u bytes)", #actual, (unsigned)(len)); \
+    } while (0)
+
+
+#endif // __HOST_UNITY__
@@ -0,0 +1,263 @@
+//
+//  parse_bench.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  Measures the throughput of the parsers on the host, without sockets and
+//  cryptography: responses are replayed through https_send_request with the
+//  mem_transport module, and the metadata is decoded from memory. Reports
+//  MB/s and CPU cycles (time stamp counter) per response header block and
+//  per metadata file, so that parser changes can be compared; run the fuzz
+//  targets on the same change for robustness.
+//
+//  Usage: parse_bench [-n <iterations>]
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+#include "https_client.h"
+#include "https_transport.h"
+#include "mem_transport.h"
+#include "iap_metadata.h"
+#include "iap_cbor.h"
+
+
+#define BENCH_DEFAULT_ITERATIONS 100000
+#define BENCH_BODY_SIZE (1024 * 1024)
+
+// A metadata response as sent by a typical web server.
+static const char *metadata_response =
+    "HTTP/1.1 200 OK\r\n"
+    "Date: Sun, 18 Oct 2026 10:00:00 GMT\r\n"
+    "Server: Apache/2.4.62 (Debian)\r\n"
+    "Last-Modified: Sat, 17 Oct 2026 08:12:00 GMT\r\n"
+    "ETag: \"10b-5f8a2c3e4d1c0\"\r\n"
+    "Accept-Ranges: bytes\r\n"
+    "Cache-Control: max-age=3600\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 197\r\n"
+    "Keep-Alive: timeout=5, max=100\r\n"
+    "Connection: Keep-Alive\r\n"
+    "\r\n"
+    "VERSION=2\n"
+    "FILE=/fw.bin\n"
+    "INTERVAL=3600\n"
+    "SIZE=2048\n"
+    "SHA256=9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08\n"
+    "MIN_VERSION=1\n"
+    "ROLLOUT=50\n"
+    "SALT=release-2\n"
+    "[storage]\n"
+    "VERSION=3\n"
+    "PARTITION=storage\n";
+
+static char response_buffer[4096];
+
+
+static uint64_t bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static uint64_t bench_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static http_continue_receiving_t bench_body_callback(http_request_t *request, size_t bytesReceived)
+{
+    return HTTP_CONTINUE_RECEIVING;
+}
+
+static void bench_error_callback(http_request_t *request, http_err_t error, int additionalInfo)
+{
+    fprintf(stderr, "parse_bench: unexpected error 0x%x\n", error);
+    exit(1);
+}
+
+static void bench_report(const char *name, uint64_t ns, uint64_t cycles, size_t bytes, int count, const char *unit)
+{
+    printf("%-32s %9.1f MB/s %10.0f cycles/%s\n", name, bytes / (ns / 1e9) / 1e6, (double)cycles / count, unit);
+}
+
+static int bench_count_header_lines(const char *response)
+{
+    // Without the status line and the empty line at the end.
+    int nofLines = -1;
+    for (const char *p = response; strncmp(p, "\r\n", 2); p = strstr(p, "\r\n") + 2) {
+        nofLines++;
+    }
+    return nofLines;
+}
+
+// Replays the response 'count' times, each on a new connection, reading at most readSize bytes at a time.
+static void bench_responses(const char *name, const char *data, size_t len, int count, size_t readSize, size_t responseBufferLen, const char *unit)
+{
+    mem_transport_response_t response = { data, len, NULL, 0 };
+    mem_transport_init_struct_t params = { &response, 1, readSize, 0 };
+    struct mem_transport_context_ *ctx = mem_transport_create_context(&params);
+    https_transport_t transport;
+    mem_transport_init_transport(ctx, &transport);
+    
+    http_request_t request;
+    memset(&request, 0, sizeof(request));
+    request.verb = HTTP_GET;
+    request.host = "localhost";
+    request.path = "/meta.txt";
+    request.response_buffer = response_buffer;
+    request.response_buffer_len = responseBufferLen;
+    request.error_callback = bench_error_callback;
+    request.body_callback = bench_body_callback;
+    request.response_mode = HTTP_STREAM_BODY;
+    
+    uint64_t startNs = bench_ns();
+    uint64_t startCycles = bench_cycles();
+    for (int i = 0; i < count; i++) {
+        transport.connect(transport.context);
+        if (https_send_request(&transport, &request) != HTTP_SUCCESS) {
+            fprintf(stderr, "parse_bench: %s failed\n", name);
+            exit(1);
+        }
+    }
+    uint64_t cycles = bench_cycles() - startCycles;
+    uint64_t ns = bench_ns() - startNs;
+    
+    bench_report(name, ns, cycles, len * count, count, unit);
+    if (strcmp(unit, "response") == 0) {
+        printf("%-32s %14s %10.0f cycles/header line\n", "", "", (double)cycles / count / bench_count_header_lines(data));
+    }
+    mem_transport_free_context(ctx);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = BENCH_DEFAULT_ITERATIONS;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n') {
+            iterations = atoi(optarg);
+        } else {
+            fprintf(stderr, "usage: %s [-n <iterations>]\n", argv[0]);
+            return 2;
+        }
+    }
+    esp_log_level_set("*", ESP_LOG_NONE);
+    
+    const char *metadata = strstr(metadata_response, "\r\n\r\n") + 4;
+    size_t metadataLen = strlen(metadata);
+    printf("metadata response: %u bytes, %d header lines, %u bytes of metadata; %d iterations\n\n",
+           (unsigned)strlen(metadata_response), bench_count_header_lines(metadata_response), (unsigned)metadataLen, iterations);
+    
+    // The response in one read, as with large TLS records, and in small TCP segments.
+    bench_responses("metadata response, 1 read", metadata_response, strlen(metadata_response), iterations, 0, 512, "response");
+    bench_responses("metadata response, 64 B reads", metadata_response, strlen(metadata_response), iterations, 64, 512, "response");
+    
+    // Streaming a large body, with the 4 KB buffer of the firmware request.
+    char *firmwareResponse = malloc(BENCH_BODY_SIZE + 128);
+    int headerLen = sprintf(firmwareResponse, "HTTP/1.1 200 OK\r\nContent-Length: %u\r\n\r\n", BENCH_BODY_SIZE);
+    memset(firmwareResponse + headerLen, 0x5a, BENCH_BODY_SIZE);
+    int bodyIterations = iterations / 1000 > 10 ? iterations / 1000 : 10;
+    bench_responses("1 MB body, 1436 B reads", firmwareResponse, headerLen + BENCH_BODY_SIZE, bodyIterations, CONFIG_TCP_MSS, 4096, "MB");
+    bench_responses("1 MB body, 4 KB reads", firmwareResponse, headerLen + BENCH_BODY_SIZE, bodyIterations, 0, 4096, "MB");
+    free(firmwareResponse);
+    
+    // The header value parsers on the header block.
+    char headers[1024];
+    memcpy(headers, metadata_response, metadata - metadata_response);
+    headers[metadata - metadata_response] = 0x00;
+    uint64_t startNs = bench_ns();
+    uint64_t startCycles = bench_cycles();
+    for (int i = 0; i < iterations; i++) {
+        int value;
+        if (http_parse_key_value_int(headers, "Content-Length: ", &value) || value != metadataLen) {
+            fprintf(stderr, "parse_bench: http_parse_key_value_int failed\n");
+            return 1;
+        }
+    }
+    bench_report("http_parse_key_value_int", bench_ns() - startNs, bench_cycles() - startCycles,
+                 strlen(headers) * (size_t)iterations, iterations, "call");
+    
+    // The metadata parsers.
+    iap_metadata_t md;
+    startNs = bench_ns();
+    startCycles = bench_cycles();
+    for (int i = 0; i < iterations; i++) {
+        iap_metadata_parser_t parser;
+        iap_metadata_parser_init(&parser, &md);
+        iap_metadata_parser_feed(&parser, metadata, metadataLen);
+        if (iap_metadata_parser_finish(&parser) != IAP_METADATA_OK) {
+            fprintf(stderr, "parse_bench: iap_metadata_parser_feed failed\n");
+            return 1;
+        }
+    }
+    bench_report("iap_metadata_parser_feed", bench_ns() - startNs, bench_cycles() - startCycles,
+                 metadataLen * (size_t)iterations, iterations, "file");
+    
+    uint8_t cbor[128];
+    uint8_t *p = cbor;
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_MAP, 5);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 1);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 2);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 2);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_TSTR, 7);
+    memcpy(p, "/fw.bin", 7);
+    p += 7;
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 3);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 3600);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 4);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 2048);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 5);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_BSTR, 32);
+    memset(p, 0xab, 32);
+    p += 32;
+    size_t cborLen = p - cbor;
+    startNs = bench_ns();
+    startCycles = bench_cycles();
+    for (int i = 0; i < iterations; i++) {
+        if (iap_metadata_decode_cbor(cbor, cborLen, NULL, &md) != IAP_METADATA_OK) {
+            fprintf(stderr, "parse_bench: iap_metadata_decode_cbor failed\n");
+            return 1;
+        }
+    }
+    bench_report("iap_metadata_decode_cbor", bench_ns() - startNs, bench_cycles() - startCycles,
+                 cborLen * (size_t)iterations, iterations, "file");
+    
+    return 0;
+}
@@ -0,0 +1,296 @@
+//
+//  record_corpus.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  Records the seed corpus of the fuzz targets: typical exchanges with the
+//  test server (metadata in text and CBOR format, a complete image on a
+//  kept-alive connection, a Range request, an unknown path and a closed
+//  connection) are sent with https_send_request over TLS, and the streams
+//  received through the rec_transport module are written in the input
+//  formats of the targets (see fuzz_*.c).
+//
+//  Usage: record_corpus <corpus directory>
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+#include "https_client.h"
+#include "https_transport.h"
+#include "mem_transport.h"
+#include "rec_transport.h"
+#include "wifi_tls.h"
+#include "iap_cbor.h"
+#include "host.h"
+#include "test_server.h"
+
+
+#define TAG "record"
+
+#define RECORD_IMAGE_SIZE 2048
+#define RECORD_BUFFER_SIZE 65536
+#define RECORD_MAX_NOF_CHUNKS 1024
+
+// Flags of the fuzz_https_client target.
+#define RECORD_FLAG_WAIT_FOR_COMPLETE_BODY (1 << 0)
+#define RECORD_FLAG_KEEP_ALIVE             (1 << 1)
+
+typedef struct {
+    const char *name;
+    
+    // Requests sent on one connection.
+    const char *paths[2];
+    const char *additional_headers;
+    uint8_t flags;
+    
+    size_t max_record_size;
+    int is_metadata;
+} record_exchange_t;
+
+static const record_exchange_t exchanges[] = {
+    { "meta-text", { "/meta.txt" }, NULL, 0, 0, 1 },
+    { "meta-fw-keep-alive", { "/meta.txt", "/fw.bin" }, NULL, RECORD_FLAG_KEEP_ALIVE, 0, 0 },
+    { "fw-range", { "/fw.bin" }, "Range: bytes=1024-\r\n", 0, 256, 0 },
+    { "not-found", { "/missing.bin" }, NULL, 0, 0, 0 },
+    { "fw-connection-close", { "/fw.bin" }, "Connection: close\r\n", 0, 0, 0 },
+    { "meta-cbor", { "/meta.cbor" }, NULL, RECORD_FLAG_WAIT_FOR_COMPLETE_BODY, 0, 1 },
+};
+
+static const char *metadata_text =
+    "VERSION=2\n"
+    "FILE=/fw.bin\n"
+    "INTERVAL=3600\n"
+    "SIZE=2048\n"
+    "SHA256=9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08\n"
+    "MIN_VERSION=1\n"
+    "ROLLOUT=50\n"
+    "SALT=release-2\n"
+    "[storage]\n"
+    "VERSION=3\n"
+    "FILE=/storage.bin\n"
+    "PARTITION=storage\n";
+
+static uint8_t image[RECORD_IMAGE_SIZE];
+static uint8_t metadata_cbor[256];
+static size_t metadata_cbor_len;
+
+
+static http_continue_receiving_t record_body_callback(http_request_t *request, size_t bytesReceived)
+{
+    return HTTP_CONTINUE_RECEIVING;
+}
+
+static void record_error_callback(http_request_t *request, http_err_t error, int additionalInfo)
+{
+}
+
+static void record_write_file(const char *dir, const char *target, const char *name,
+                              const uint8_t *prefix, size_t prefixLen, const char *data, size_t len)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, target);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/%s/%s", dir, target, name);
+    
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        ESP_LOGE(TAG, "can't write %s", path);
+        return;
+    }
+    fwrite(prefix, 1, prefixLen, f);
+    fwrite(data, 1, len, f);
+    fclose(f);
+    printf("%s: %u bytes\n", path, (unsigned)(prefixLen + len));
+}
+
+static size_t record_cbor_text(uint8_t *p, int major, const char *str)
+{
+    size_t n = iap_cbor_encode_head(p, major, strlen(str));
+    memcpy(p + n, str, strlen(str));
+    return n + strlen(str);
+}
+
+// The text metadata above in CBOR format (see iap_metadata.h).
+static void record_init_metadata_cbor(void)
+{
+    uint8_t *p = metadata_cbor;
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_MAP, 9);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 1);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 2);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 2);
+    p += record_cbor_text(p, IAP_CBOR_MAJOR_TSTR, "/fw.bin");
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 3);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 3600);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 4);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, RECORD_IMAGE_SIZE);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 5);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_BSTR, 32);
+    for (int i = 0; i < 32; i++) {
+        *p++ = i;
+    }
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 8);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 1);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 9);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 50);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 12);
+    p += record_cbor_text(p, IAP_CBOR_MAJOR_TSTR, "release-2");
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 10);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_ARRAY, 1);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_MAP, 4);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 0);
+    p += record_cbor_text(p, IAP_CBOR_MAJOR_TSTR, "storage");
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 1);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 3);
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 2);
+    p += record_cbor_text(p, IAP_CBOR_MAJOR_TSTR, "/storage.bin");
+    p += iap_cbor_encode_head(p, IAP_CBOR_MAJOR_UINT, 11);
+    p += record_cbor_text(p, IAP_CBOR_MAJOR_TSTR, "storage");
+    metadata_cbor_len = p - metadata_cbor;
+}
+
+static int record_exchange(const record_exchange_t *exchange, const char *dir)
+{
+    // The CBOR metadata is binary, the test server serves it like an image.
+    int isCbor = strcmp(exchange->paths[0], "/meta.cbor") == 0;
+    test_server_config_t serverConfig = {
+        .max_record_size = exchange->max_record_size,
+        .metadata_path = "/meta.txt",
+        .metadata = metadata_text,
+        .image_path = isCbor ? "/meta.cbor" : "/fw.bin",
+        .image = isCbor ? metadata_cbor : image,
+        .image_size = isCbor ? metadata_cbor_len : sizeof(image),
+    };
+    uint16_t port;
+    if (test_server_start(&serverConfig, &port) != 0) {
+        ESP_LOGE(TAG, "failed to start the test server");
+        return -1;
+    }
+    char portString[8];
+    sprintf(portString, "%u", port);
+    
+    wifi_tls_init_struct_t tlsInitStruct = {
+        .server_host_name = "localhost",
+        .server_port = portString,
+        .server_root_ca_public_key_pem = test_server_cert_pem,
+        .peer_public_key_pem = test_server_cert_pem,
+    };
+    struct wifi_tls_context_ *tlsContext = wifi_tls_create_context(&tlsInitStruct);
+    https_transport_t tlsTransport;
+    wifi_tls_init_transport(tlsContext, &tlsTransport);
+    
+    static char dataBuffer[RECORD_BUFFER_SIZE];
+    static uint32_t chunkLengths[RECORD_MAX_NOF_CHUNKS];
+    memset(dataBuffer, 0, sizeof(dataBuffer));
+    rec_transport_init_struct_t recInitStruct = {
+        .transport = &tlsTransport,
+        .data_buffer = dataBuffer,
+        .data_buffer_size = sizeof(dataBuffer),
+        .chunk_lengths = chunkLengths,
+        .max_nof_chunks = RECORD_MAX_NOF_CHUNKS,
+    };
+    struct rec_transport_context_ *recContext = rec_transport_create_context(&recInitStruct);
+    https_transport_t transport;
+    rec_transport_init_transport(recContext, &transport);
+    
+    static char responseBuffer[4096];
+    http_request_t request;
+    memset(&request, 0, sizeof(request));
+    request.verb = HTTP_GET;
+    request.host = "localhost";
+    request.additional_headers = exchange->additional_headers;
+    request.response_buffer = responseBuffer;
+    request.response_buffer_len = sizeof(responseBuffer);
+    request.error_callback = record_error_callback;
+    request.body_callback = record_body_callback;
+    request.response_mode = HTTP_STREAM_BODY;
+    
+    int result = transport.connect(transport.context);
+    for (int i = 0; !result && i < 2 && exchange->paths[i]; i++) {
+        request.path = exchange->paths[i];
+        request.keep_alive = (exchange->flags & RECORD_FLAG_KEEP_ALIVE) != 0;
+        https_send_request(&transport, &request);
+    }
+    
+    mem_transport_response_t recording;
+    if (result || !rec_transport_get_recording(recContext, &recording) || recording.len == 0) {
+        ESP_LOGE(TAG, "%s: nothing recorded", exchange->name);
+        result = -1;
+    } else {
+        uint8_t prefix[2] = { exchange->flags, 0 };
+        record_write_file(dir, "https_client", exchange->name, prefix, 2, recording.data, recording.len);
+        
+        // The header block of the (first) response, and the metadata itself.
+        const char *endOfHeaders = strstr(recording.data, "\r\n\r\n");
+        if (endOfHeaders) {
+            size_t headersLen = endOfHeaders - recording.data + 4;
+            record_write_file(dir, "http_parse", exchange->name, NULL, 0, recording.data, headersLen);
+            if (exchange->is_metadata) {
+                uint8_t split = 16;
+                record_write_file(dir, "metadata", exchange->name, &split, 1, endOfHeaders + 4, recording.len - headersLen);
+                if (!isCbor) {
+                    record_write_file(dir, "http_parse", "meta-text-body", NULL, 0, endOfHeaders + 4, recording.len - headersLen);
+                }
+            }
+        }
+    }
+    
+    transport.close(transport.context);
+    rec_transport_free_context(recContext);
+    wifi_tls_free_context(tlsContext);
+    test_server_stop();
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <corpus directory>\n", argv[0]);
+        return 2;
+    }
+    mkdir(argv[1], 0755);
+    
+    for (int i = 0; i < sizeof(image); i++) {
+        image[i] = i * 7;
+    }
+    image[0] = 0xe9;
+    record_init_metadata_cbor();
+    
+    host_wifi_sta_set_connected(1);
+    host_wifi_sta_set_dns_ready(1);
+    
+    // Some of the exchanges are errors on purpose.
+    esp_log_level_set("*", ESP_LOG_NONE);
+    
+    int result = 0;
+    for (int i = 0; i < sizeof(exchanges) / sizeof(exchanges[0]); i++) {
+        result |= record_exchange(&exchanges[i], argv[1]);
+    }
+    return result ? 1 : 0;
+}
@@ -0,0 +1,112 @@
+//
+//  test_main.c
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  Runs the component's tests (main/test) on the host. Each test runs in a
+//  new process, i.e. with a fresh flash, NVS and updater, like after the
+//  reset between tests on the device.
+//
+//  Usage: test_runner [<name or [tag]> ...]
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "unity.h"
+#include "host.h"
+
+
+static unity_test_t *tests;
+static unity_test_t **last_test = &tests;
+
+
+void unity_register_test(unity_test_t *test)
+{
+    // Keep the order of the source files.
+    *last_test = test;
+    last_test = &test->next;
+}
+
+void unity_fail(const char *file, int line, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "%s:%d: FAIL: ", file, line);
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    fflush(stderr);
+    _exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int nofTests = 0;
+    int nofFailures = 0;
+    
+    // Flash writes and erases take as long as on the device (e.g. for the duty cycle).
+    host_flash_set_timing(1);
+    
+    for (unity_test_t *test = tests; test; test = test->next) {
+        int selected = argc == 1;
+        for (int i = 1; i < argc; i++) {
+            selected |= strcmp(argv[i], test->name) == 0 || strstr(test->desc, argv[i]) != NULL;
+        }
+        if (!selected) {
+            continue;
+        }
+        
+        printf("%s \"%s\" ... ", test->desc, test->name);
+        fflush(stdout);
+        
+        pid_t pid = fork();
+        if (pid == 0) {
+            test->fn();
+            fflush(stdout);
+            _exit(0);
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        
+        nofTests++;
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            printf("PASS\n");
+        } else {
+            nofFailures++;
+            if (WIFSIGNALED(status)) {
+                printf("FAIL (signal %d)\n", WTERMSIG(status));
+            } else {
+                printf("FAIL\n");
+            }
+        }
+    }
+    
+    printf("\n%d Tests %d Failures\n", nofTests, nofFailures);
+    return nofFailures ? 1 : 0;
+}
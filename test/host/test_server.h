@@ -0,0 +1,96 @@
+//
+//  test_server.h
+//  esp32-ota-https
+//
+//  Updating the firmware over the air.
+//
+//  This module provides an HTTPS update server for tests on the host. It
+//  runs in a child process and serves the metadata and the firmware image
+//  (with support for Range requests) through a link which can be shaped:
+//  bandwidth, round-trip time, segment loss and the TLS record size.
+//
+//  Created by Andreas Schweizer on 18.10.2026.
+//  Copyright © 2026 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+// software and associated documentation files (the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights to use, copy, modify, 
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to 
+// permit persons to whom the Software is furnished to do so, subject to the following 
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies 
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A 
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF 
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __TEST_SERVER__
+#define __TEST_SERVER__ 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+// Self-signed certificate of the server (CN=localhost, P-256), to be used
+// as the root CA and the pinned peer certificate by the client.
+extern const char *test_server_cert_pem;
+
+typedef struct test_server_config_ {
+    
+    // Shaping of the link from the server to the client: bandwidth in bytes/s
+    // (0 = unlimited), round-trip time in milliseconds, and the probability that a
+    // TCP segment (CONFIG_TCP_MSS bytes) is lost, in per mille. A lost segment and all segments
+    // after it arrive 'retransmit_timeout_ms' later (0 selects 200 ms).
+    uint32_t bandwidth_bytes_per_s;
+    uint32_t rtt_ms;
+    uint32_t loss_per_mille;
+    uint32_t retransmit_timeout_ms;
+    
+    // Maximum size of the TLS records of the response body, 0 selects 16384 bytes.
+    uint32_t max_record_size;
+    
+    // Metadata file and firmware image, served with GET on these paths.
+    const char *metadata_path;
+    const char *metadata;
+    const char *image_path;
+    const uint8_t *image;
+    size_t image_size;
+    
+} test_server_config_t;
+
+// Counters of the server, updated while it runs and kept after test_server_stop.
+typedef struct test_server_stats_ {
+    uint32_t nof_connections;
+    uint32_t nof_handshakes;
+    uint32_t nof_requests;
+    uint32_t nof_image_requests;
+    uint32_t nof_range_requests;
+    uint32_t nof_segments_lost;
+    uint64_t nof_body_bytes;
+} test_server_stats_t;
+
+
+// Starts the server on a free port of the loopback interface (written to 'port').
+// The configuration and the contents are copied by the child process.
+// Returns 0 on success. Call this before creating any threads.
+int test_server_start(const test_server_config_t *config, uint16_t *port);
+
+// Stops the server.
+void test_server_stop();
+
+void test_server_get_stats(test_server_stats_t *stats);
+
+// Replaces the metadata served by the running server, e.g. to roll out a new
+// version. Returns 0 on success, -1 if the server isn't running or the text
+// is longer than TEST_SERVER_MAX_METADATA_LEN.
+#define TEST_SERVER_MAX_METADATA_LEN 4096
+int test_server_set_metadata(const char *metadata);
+
+
+#endif // __TEST_SERVER__